@@ -60,6 +60,7 @@
 
 #if defined(_MSC_VER)
 #define inline _inline
+#include <intrin.h>
 #endif
 
 /***************************************************************************
@@ -134,6 +135,8 @@ void blackrock_init(struct BlackRock* br, uint64_t range, uint64_t seed, unsigne
 
     while (br->a * br->b <= range) br->b++;
 
+    br->a_recip = br->a ? UINT64_MAX / br->a : 0;
+    br->b_recip = br->b ? UINT64_MAX / br->b : 0;
     br->rounds = rounds;
     br->seed = seed;
     br->range = range;
@@ -161,6 +164,39 @@ static inline uint64_t READ(uint64_t r, uint64_t R, uint64_t seed)
     return R;
 }
 
+/***************************************************************************
+ * Divide by 'd' by multiplying by its precomputed reciprocal instead,
+ * since a 64-bit divide is the slowest instruction in the cipher. The
+ * reciprocal is rounded down, so the estimated quotient is at most one
+ * too small, which we fix up. The result is exactly the same as using
+ * the '/' and '%' operators.
+ ***************************************************************************/
+static inline uint64_t DIVMOD(uint64_t n, uint64_t d, uint64_t recip, uint64_t* mod)
+{
+#if defined(__SIZEOF_INT128__) || (defined(_MSC_VER) && defined(_M_X64))
+    uint64_t q;
+    uint64_t r;
+
+#if defined(__SIZEOF_INT128__)
+    q = (uint64_t) (((unsigned __int128) n * recip) >> 64);
+#else
+    q = __umulh(n, recip);
+#endif
+    r = n - q * d;
+    if (r >= d)
+    {
+        r -= d;
+        q++;
+    }
+    *mod = r;
+    return q;
+#else
+    (void) recip;
+    *mod = n % d;
+    return n / d;
+#endif
+}
+
 /***************************************************************************
  *
  * NOTE:
@@ -169,24 +205,27 @@ static inline uint64_t READ(uint64_t r, uint64_t R, uint64_t seed)
  *      http://www.cs.ucdavis.edu/~rogaway/papers/subset.pdf
  * Read that paper in order to understand this code.
  ***************************************************************************/
-static inline uint64_t ENCRYPT(unsigned r, uint64_t a, uint64_t b, uint64_t m, uint64_t seed)
+static inline uint64_t ENCRYPT(const struct BlackRock* br, uint64_t m)
 {
+    unsigned r = br->rounds;
+    uint64_t a = br->a;
+    uint64_t b = br->b;
+    uint64_t seed = br->seed;
     uint64_t L, R;
     unsigned j;
     uint64_t tmp;
 
-    L = m % a;
-    R = m / a;
+    R = DIVMOD(m, a, br->a_recip, &L);
 
     for (j = 1; j <= r; j++)
     {
         if (j & 1)
         {
-            tmp = (L + READ(j, R, seed)) % a;
+            DIVMOD(L + READ(j, R, seed), a, br->a_recip, &tmp);
         }
         else
         {
-            tmp = (L + READ(j, R, seed)) % b;
+            DIVMOD(L + READ(j, R, seed), b, br->b_recip, &tmp);
         }
         L = R;
         R = tmp;
@@ -201,6 +240,42 @@ static inline uint64_t ENCRYPT(unsigned r, uint64_t a, uint64_t b, uint64_t m, u
     }
 }
 
+/***************************************************************************
+ * ENCRYPT() for 8 values at once. The rounds for each are independent,
+ * so interleaving them lets the CPU overlap their latencies.
+ ***************************************************************************/
+static void ENCRYPT_x8(const struct BlackRock* br, const uint64_t* m, uint64_t* c)
+{
+    unsigned r = br->rounds;
+    uint64_t a = br->a;
+    uint64_t b = br->b;
+    uint64_t L[8], R[8];
+    unsigned i, j;
+
+    for (i = 0; i < 8; i++) R[i] = DIVMOD(m[i], a, br->a_recip, &L[i]);
+
+    for (j = 1; j <= r; j++)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            uint64_t tmp;
+            if (j & 1)
+                DIVMOD(L[i] + READ(j, R[i], br->seed), a, br->a_recip, &tmp);
+            else
+                DIVMOD(L[i] + READ(j, R[i], br->seed), b, br->b_recip, &tmp);
+            L[i] = R[i];
+            R[i] = tmp;
+        }
+    }
+    for (i = 0; i < 8; i++)
+    {
+        if (r & 1)
+            c[i] = a * L[i] + R[i];
+        else
+            c[i] = a * R[i] + L[i];
+    }
+}
+
 /***************************************************************************
  ***************************************************************************/
 static inline uint64_t UNENCRYPT(unsigned r, uint64_t a, uint64_t b, uint64_t m, uint64_t seed)
@@ -266,12 +341,27 @@ uint64_t blackrock_shuffle(const struct BlackRock* br, uint64_t m)
 {
     uint64_t c;
 
-    c = ENCRYPT(br->rounds, br->a, br->b, m, br->seed);
-    while (c >= br->range) c = ENCRYPT(br->rounds, br->a, br->b, c, br->seed);
+    c = ENCRYPT(br, m);
+    while (c >= br->range) c = ENCRYPT(br, c);
 
     return c;
 }
 
+/***************************************************************************
+ * The occasional value that lands outside the range gets cycled back in
+ * one at a time, which is rare enough not to be worth vectorizing.
+ ***************************************************************************/
+void blackrock_shuffle_x8(const struct BlackRock* br, const uint64_t* m, uint64_t* c)
+{
+    unsigned i;
+
+    ENCRYPT_x8(br, m, c);
+    for (i = 0; i < 8; i++)
+    {
+        while (c[i] >= br->range) c[i] = ENCRYPT(br, c[i]);
+    }
+}
+
 /***************************************************************************
  ***************************************************************************/
 uint64_t blackrock_unshuffle(const struct BlackRock* br, uint64_t m)
@@ -285,7 +375,8 @@ uint64_t blackrock_unshuffle(const struct BlackRock* br, uint64_t m)
 }
 
 /***************************************************************************
- * This function called only during selftest/regression-test.
+ * This function called only during selftest/regression-test. The 8-way
+ * shuffle is used for most of the range, and must match the normal one.
  ***************************************************************************/
 static unsigned blackrock_verify(struct BlackRock* br, uint64_t max)
 {
@@ -302,6 +393,22 @@ static unsigned blackrock_verify(struct BlackRock* br, uint64_t max)
     for (i = 0; i < range; i++)
     {
         uint64_t x = blackrock_shuffle(br, i);
+
+        if (i % 8 == 0 && i + 8 <= range)
+        {
+            uint64_t index[8];
+            uint64_t result[8];
+            unsigned j;
+
+            for (j = 0; j < 8; j++) index[j] = i + j;
+            blackrock_shuffle_x8(br, index, result);
+            for (j = 0; j < 8; j++)
+            {
+                if (result[j] != blackrock_shuffle(br, i + j))
+                    is_success = 0;
+            }
+            x = result[0];
+        }
         if (x < max)
             list[x]++;
     }
@@ -357,6 +464,30 @@ void blackrock_benchmark(unsigned rounds)
         printf("iterations/second = %5.3f-million\n", rate);
     }
 
+    /*
+     * Time the 8-way version
+     */
+    result = 0;
+    start = pixie_nanotime();
+    for (i = 0; i < ITERATIONS; i += 8)
+    {
+        uint64_t index[8] = {i, i + 1, i + 2, i + 3, i + 4, i + 5, i + 6, i + 7};
+        uint64_t x[8];
+
+        blackrock_shuffle_x8(&br, index, x);
+        result += x[0] + x[7];
+    }
+    stop = pixie_nanotime();
+    if (result)
+    {
+        double elapsed = ((double) (stop - start)) / (1000000000.0);
+        double rate = ITERATIONS / elapsed;
+
+        rate /= 1000000.0;
+
+        printf("x8 iterations/second = %5.3f-million\n", rate);
+    }
+
     printf("\n");
 }
 
@@ -389,6 +520,33 @@ int blackrock_selftest(void)
         }
     }
 
+    /* The 8-way shuffle must be bit-identical to the normal one, including
+     * for tiny ranges and odd numbers of rounds */
+    for (range = 1; range < 100; range += 7)
+    {
+        struct BlackRock br;
+        unsigned rounds;
+
+        for (rounds = 1; rounds <= 14; rounds += 3)
+        {
+            uint64_t index[8];
+            uint64_t result[8];
+            unsigned j;
+
+            blackrock_init(&br, range, range * 0x12345ULL, rounds);
+            for (j = 0; j < 8; j++) index[j] = (j * 13) % range;
+            blackrock_shuffle_x8(&br, index, result);
+            for (j = 0; j < 8; j++)
+            {
+                if (result[j] != blackrock_shuffle(&br, index[j]))
+                {
+                    fprintf(stderr, "BLACKROCK: 8-way shuffle mismatch\n");
+                    return 1; /*fail*/
+                }
+            }
+        }
+    }
+
     range = 3015 * 3;
 
     for (i = 0; i < 5; i++)
@@ -152,6 +152,81 @@ uint64_t siphash24(const void* in, size_t inlen, const uint64_t key[2])
     return result;
 }
 
+void siphash24_init(struct siphash24_state* state, const uint64_t key[2])
+{
+    state->v[0] = 0x736f6d6570736575ULL ^ key[0];
+    state->v[1] = 0x646f72616e646f6dULL ^ key[1];
+    state->v[2] = 0x6c7967656e657261ULL ^ key[0];
+    state->v[3] = 0x7465646279746573ULL ^ key[1];
+    state->tail = 0;
+    state->length = 0;
+}
+
+void siphash24_update(struct siphash24_state* state, const void* in, size_t inlen)
+{
+    const u8* p = (const u8*) in;
+    const u8* end = p + inlen;
+    u64 v0 = state->v[0];
+    u64 v1 = state->v[1];
+    u64 v2 = state->v[2];
+    u64 v3 = state->v[3];
+    u64 m;
+    unsigned used = (unsigned) (state->length & 7);
+
+    state->length += inlen;
+
+    /* Finish the word left over from last time */
+    if (used)
+    {
+        for (; used < 8 && p != end; used++, p++) state->tail |= ((u64) *p) << (8 * used);
+        if (used < 8)
+            goto save;
+        m = state->tail;
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+        state->tail = 0;
+    }
+
+    for (; end - p >= 8; p += 8)
+    {
+        m = U8TO64_LE(p);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    for (m = 0; p != end; p++, m += 8) state->tail |= ((u64) *p) << m;
+
+save:
+    state->v[0] = v0;
+    state->v[1] = v1;
+    state->v[2] = v2;
+    state->v[3] = v3;
+}
+
+uint64_t siphash24_final(const struct siphash24_state* state)
+{
+    u64 v0 = state->v[0];
+    u64 v1 = state->v[1];
+    u64 v2 = state->v[2];
+    u64 v3 = state->v[3];
+    u64 b = state->length << 56 | state->tail;
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
 /*
    SipHash-2-4 output with
    k = 00 01 02 ...
@@ -828,9 +903,48 @@ static int test_vectors()
     return ok;
 }
 
+/* The same vectors, hashed a few bytes at a time */
+static int test_vectors_incremental()
+{
+    static const size_t steps[] = {1, 3, 7, 8, 9, 64};
+    uint64_t key[2];
+    u8 in[MAXLEN];
+    size_t s;
+    int i;
+    int ok = 1;
+
+    key[0] = U8TO64_LE((const u8*) "\x00\x01\x02\x03\x04\x05\x06\x07");
+    key[1] = U8TO64_LE((const u8*) "\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f");
+
+    for (i = 0; i < MAXLEN; ++i) in[i] = (u8) i;
+
+    for (s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+    {
+        for (i = 0; i < MAXLEN; ++i)
+        {
+            struct siphash24_state state;
+            size_t offset;
+
+            siphash24_init(&state, key);
+            for (offset = 0; offset < (size_t) i; offset += steps[s])
+            {
+                size_t n = (size_t) i - offset < steps[s] ? (size_t) i - offset : steps[s];
+                siphash24_update(&state, in + offset, n);
+            }
+            if (siphash24_final(&state) != U8TO64_LE(vectors[i]))
+            {
+                printf("incremental test vector failed for %d bytes\n", i);
+                ok = 0;
+            }
+        }
+    }
+
+    return ok;
+}
+
 int siphash24_selftest(void)
 {
-    if (test_vectors())
+    if (test_vectors() && test_vectors_incremental())
         return 0;
     else
         return 1;
@@ -1,9 +1,31 @@
 #ifndef CRYPTO_SIPHASH24_H
 #define CRYPTO_SIPHASH24_H
+#include <stddef.h>
 #include <stdint.h>
 
 uint64_t siphash24(const void* in, size_t inlen, const uint64_t key[2]);
 
+/**
+ * For hashing something that arrives a piece at a time, like a banner
+ * spread across several packets, without buffering it. The result is the
+ * same as 'siphash24()' of all the pieces put together.
+ */
+struct siphash24_state
+{
+    uint64_t v[4];
+
+    /** The bytes since the last whole word */
+    uint64_t tail;
+
+    uint64_t length;
+};
+
+void siphash24_init(struct siphash24_state* state, const uint64_t key[2]);
+
+void siphash24_update(struct siphash24_state* state, const void* in, size_t inlen);
+
+uint64_t siphash24_final(const struct siphash24_state* state);
+
 /**
  * Regression-test this module.
  * @return
@@ -7,11 +7,19 @@
     send a packet, we need to resend it in the future in case we don't
     get a response.
 
-    This design creates a large "ring" of timeouts, and then cycles
-    again and again through the ring. This is a fairly high granularity,
-    just has hundreds, thousands, or 10 thousand entries per second.
-    (I keep adjusting the granularity up and down). Not that at any
-    slot in the ring, there may be entries from the far future.
+    This design is a hierarchical timing wheel. The first level is a ring
+    of slots, each 1/64 of a second wide, covering the next few seconds
+    or minutes. Each level above that is a coarser ring,
+    each of whose slots covers a whole turn of the level below. As time
+    moves forward, a slot in a higher level gets "cascaded" down to the
+    finer levels once its time comes close. Thus, turning the wheel costs
+    only the number of entries that expire, plus a cascade now and then,
+    instead of walking a million slots and skipping over far-future
+    entries that happen to share a slot with expired ones.
+
+    The number of first-level slots is sized to the number of TCBs, so
+    that a big scan with long timeouts puts nearly everything directly
+    into the first level, and never cascades.
 
     NOTE: a big feature of this system is that the structure that tracks
     the timeout is actually held within the TCB structure. In other
@@ -31,46 +39,59 @@
 #include <string.h>
 #include <time.h>
 
-/***************************************************************************
- * The timeout system is a circular ring. We move an index around the
- * ring. At each slot in the ring is a linked-list of all entries at
- * that time index. Because the ring can wrap, not everything at a given
- * entry will be the same timestamp. Therefore, when doing the timeout
- * logic at a slot, we have to doublecheck the actual timestamp, and skip
- * those things that are further in the future.
- ***************************************************************************/
+/**
+ * Each first-level slot is this many ticks wide, 1/64 of a second. An
+ * entry never fires early, but may fire up to this much late.
+ */
+#define TIMEOUT_SLOT_SHIFT 8
+#define TIMEOUT_SLOT_TICKS (1ULL << TIMEOUT_SLOT_SHIFT)
+
+/**
+ * The first level has between 256 slots (4 seconds) and 64k slots (17
+ * minutes) depending upon the number of TCBs. The levels above it have
+ * 64 slots each, so that even the smallest wheel covers twelve days.
+ */
+#define TIMEOUT_LEVELS 4
+#define TIMEOUT_LEVEL_BITS 6
+#define TIMEOUT_FIRST_BITS_MIN 8
+#define TIMEOUT_FIRST_BITS_MAX 16
+
 struct Timeouts
 {
     /**
-     * This index is a monotonically increasing number, modulus the mask.
-     * Every time we check timeouts, we simply move it forward in time.
+     * The next first-level slot to expire, counted in slots since the
+     * epoch. Everything before this has already been expired.
      */
-    uint64_t current_index;
+    uint64_t current;
 
     /**
-     * Counts the number of outstanding timeouts. Adding a timeout increments
-     * this number, and removing a timeout decrements this number. The
-     * program shouldn't exit until this number is zero.
+     * The index into a level is the slot number shifted right by that
+     * level's shift, then masked by its number of slots minus one.
      */
-    uint64_t outstanding_count;
+    unsigned shift[TIMEOUT_LEVELS];
+    unsigned mask[TIMEOUT_LEVELS];
 
     /**
-     * The number of slots is a power-of-2, so the mask is just this
-     * number minus 1
+     * The total number of first-level slots covered by the wheel. Entries
+     * further in the future are parked at the far end, and re-inserted
+     * when they get there.
      */
-    unsigned mask;
+    uint64_t span;
 
     /**
-     * The ring of entries.
+     * A linked-list of entries for each slot in each level.
      */
-    struct TimeoutEntry* slots[1024 * 1024];
+    struct TimeoutEntry** slots[TIMEOUT_LEVELS];
 };
 
 /***************************************************************************
  ***************************************************************************/
-struct Timeouts* timeouts_create(uint64_t timestamp)
+struct Timeouts* timeouts_create(uint64_t timestamp, size_t entry_count)
 {
     struct Timeouts* timeouts;
+    unsigned bits;
+    unsigned shift;
+    unsigned i;
 
     /*
      * Allocate memory and initialize it to zero
@@ -78,92 +99,298 @@ struct Timeouts* timeouts_create(uint64_t timestamp)
     timeouts = CALLOC(1, sizeof(*timeouts));
 
     /*
-     * We just mask off the low order bits to determine wrap. I'm using
-     * a variable here because one of these days I'm going to make
-     * the size of the ring dynamically adjustable depending upon
-     * the speed of the scan.
+     * One first-level slot for every 256 TCBs
      */
-    timeouts->mask = sizeof(timeouts->slots) / sizeof(timeouts->slots[0]) - 1;
+    bits = TIMEOUT_FIRST_BITS_MIN;
+    while (bits < TIMEOUT_FIRST_BITS_MAX && (entry_count >> (bits + 8)) != 0) bits++;
+
+    shift = 0;
+    for (i = 0; i < TIMEOUT_LEVELS; i++)
+    {
+        timeouts->shift[i] = shift;
+        timeouts->mask[i] = (1U << bits) - 1;
+        timeouts->slots[i] = CALLOC(1ULL << bits, sizeof(timeouts->slots[i][0]));
+        shift += bits;
+        bits = TIMEOUT_LEVEL_BITS;
+    }
+    timeouts->span = 1ULL << shift;
 
     /*
      * Set the index to the current time. Note that this timestamp is
      * the 'time_t' value multiplied by the number of ticks-per-second,
-     * where 'ticks' is something I've defined for scanning. Right now
-     * I hard-code in the size of the ticks, but eventually they'll be
-     * dynamically resized depending upon the speed of the scan.
+     * where 'ticks' is something I've defined for scanning.
      */
-    timeouts->current_index = timestamp;
+    timeouts->current = timestamp >> TIMEOUT_SLOT_SHIFT;
 
     return timeouts;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void timeouts_destroy(struct Timeouts* timeouts)
+{
+    unsigned i;
+
+    if (timeouts == NULL)
+        return;
+    for (i = 0; i < TIMEOUT_LEVELS; i++) free(timeouts->slots[i]);
+    free(timeouts);
+}
+
+/***************************************************************************
+ * Link the entry into the slot for its timestamp, in the finest level
+ * that reaches that far ahead of the current slot.
+ ***************************************************************************/
+static void timeouts_place(struct Timeouts* timeouts, struct TimeoutEntry* entry)
+{
+    struct TimeoutEntry** slot;
+    uint64_t expires;
+    uint64_t delta;
+    unsigned level;
+
+    /* Round up, so that we never expire an entry early. Anything in the
+     * past goes into the current slot, to be expired on the next turn */
+    expires = (entry->timestamp + TIMEOUT_SLOT_TICKS - 1) >> TIMEOUT_SLOT_SHIFT;
+    if (expires < timeouts->current)
+        expires = timeouts->current;
+    delta = expires - timeouts->current;
+    if (delta >= timeouts->span)
+        expires = timeouts->current + timeouts->span - 1;
+
+    for (level = 0; level < TIMEOUT_LEVELS - 1; level++)
+    {
+        if (delta < (1ULL << timeouts->shift[level + 1]))
+            break;
+    }
+
+    slot = &timeouts->slots[level][(expires >> timeouts->shift[level]) & timeouts->mask[level]];
+    entry->next = *slot;
+    entry->prev = slot;
+    if (entry->next)
+        entry->next->prev = &entry->next;
+    *slot = entry;
+}
+
 /***************************************************************************
  * This inserts the timeout entry into the appropriate place in the
- * timeout ring.
+ * timeout wheel.
  ***************************************************************************/
 void timeouts_add(struct Timeouts* timeouts, struct TimeoutEntry* entry, size_t offset,
                   uint64_t timestamp)
 {
-    unsigned index;
-
     /* Unlink from wherever the entry came from */
-    if (entry->timestamp)
-        timeouts->outstanding_count--;
     timeout_unlink(entry);
 
-    if (entry->prev)
-    {
-        LOG(1, "***CHANGE %d-seconds\n", (int) ((timestamp - entry->timestamp) / TICKS_PER_SECOND));
-    }
-
     /* Initialize the new entry */
     entry->timestamp = timestamp;
     entry->offset = (unsigned) offset;
 
     /* Link it into it's new location */
-    index = timestamp & timeouts->mask;
-    entry->next = timeouts->slots[index];
-    timeouts->slots[index] = entry;
-    entry->prev = &timeouts->slots[index];
+    timeouts_place(timeouts, entry);
+}
+
+/***************************************************************************
+ * Take the first entry off a slot's list. Unlike 'timeout_unlink()', this
+ * keeps the timestamp, because we are about to put it somewhere else.
+ ***************************************************************************/
+static struct TimeoutEntry* timeouts_pop(struct TimeoutEntry** slot)
+{
+    struct TimeoutEntry* entry = *slot;
+
+    if (entry == NULL)
+        return NULL;
+    *slot = entry->next;
     if (entry->next)
-        entry->next->prev = &entry->next;
+        entry->next->prev = slot;
+    return entry;
+}
 
-    timeouts->outstanding_count++;
+/***************************************************************************
+ * Re-insert everything in a slot of a higher level. It all lands in
+ * the finer levels, now that its time is close.
+ ***************************************************************************/
+static void timeouts_cascade(struct Timeouts* timeouts, struct TimeoutEntry** slot)
+{
+    struct TimeoutEntry* entry;
+
+    while ((entry = timeouts_pop(slot)) != NULL) timeouts_place(timeouts, entry);
 }
 
 /***************************************************************************
- * Remove the next event that it older than the specified timestamp
+ * Turn the wheel forward to the current time, one first-level slot at a
+ * time, moving expired entries onto the caller's list.
  ***************************************************************************/
-void* timeouts_remove(struct Timeouts* timeouts, uint64_t timestamp)
+size_t timeouts_expire(struct Timeouts* timeouts, uint64_t timestamp,
+                       struct TimeoutEntry** expired)
 {
-    struct TimeoutEntry* entry = NULL;
+    uint64_t target = timestamp >> TIMEOUT_SLOT_SHIFT;
+    struct TimeoutEntry** tail = expired;
+    size_t count = 0;
+
+    /* The common case: called again within the same 1/64 of a second */
+    if (timeouts->current > target)
+        return 0;
 
-    /* Search until we find one */
-    while (timeouts->current_index <= timestamp)
+    /* Append to the end, so entries come out in roughly the order they
+     * expired */
+    while (*tail) tail = &(*tail)->next;
+
+    while (timeouts->current <= target)
     {
-        /* Start at the current slot */
-        entry = timeouts->slots[timeouts->current_index & timeouts->mask];
+        uint64_t t = timeouts->current;
+        struct TimeoutEntry** slot;
+        struct TimeoutEntry* entry;
 
-        /* enumerate through the linked list until we find a used slot */
-        while (entry && entry->timestamp > timestamp) entry = entry->next;
-        if (entry)
-            break;
+        /*
+         * When the first level wraps around, bring down the next slot of
+         * the second level, and so on up if that wraps, too
+         */
+        if ((t & timeouts->mask[0]) == 0)
+        {
+            unsigned level;
+            for (level = 1; level < TIMEOUT_LEVELS; level++)
+            {
+                unsigned index = (t >> timeouts->shift[level]) & timeouts->mask[level];
+                timeouts_cascade(timeouts, &timeouts->slots[level][index]);
+                if (index != 0)
+                    break;
+            }
+        }
+
+        /*
+         * Everything in this slot has expired, except entries that were
+         * parked here from beyond the end of the wheel
+         */
+        slot = &timeouts->slots[0][t & timeouts->mask[0]];
+        timeouts->current = t + 1;
+        while ((entry = timeouts_pop(slot)) != NULL)
+        {
+            if (entry->timestamp > timestamp)
+            {
+                timeouts_place(timeouts, entry);
+                continue;
+            }
 
-        /* found nothing at this slot, so move to next slot */
-        timeouts->current_index++;
+            entry->next = NULL;
+            entry->prev = tail;
+            *tail = entry;
+            tail = &entry->next;
+            count++;
+        }
     }
 
-    if (entry == NULL)
+    return count;
+}
+
+/***************************************************************************
+ * Add entries at random times, including the past and beyond the end of
+ * the wheel, then turn the wheel in uneven steps. Check that nothing
+ * expires early or late, and that entries can be unlinked or moved while
+ * they are on the expired list.
+ ***************************************************************************/
+#define SELFTEST_COUNT 20000
+int timeouts_selftest(void)
+{
+    struct Timeouts* timeouts;
+    struct TimeoutEntry* entries;
+    uint64_t start = TICKS_FROM_SECS(1700000000ULL);
+    uint64_t now = start;
+    uint64_t seed = 1;
+    size_t expired_count = 0;
+    size_t removed_count = 0;
+    size_t i;
+    int line = 0;
+
+    timeouts = timeouts_create(start, 1024);
+    entries = CALLOC(SELFTEST_COUNT, sizeof(entries[0]));
+
+    for (i = 0; i < SELFTEST_COUNT; i++)
     {
-        /* we've caught up to the current time, and there's nothing
-         * left to timeout, so return NULL */
-        return NULL;
+        uint64_t when;
+
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        switch ((seed >> 60) & 3)
+        {
+        case 0: /* within the first level */
+            when = start + (seed >> 20) % TICKS_FROM_SECS(3);
+            break;
+        case 1: /* up to a minute */
+            when = start + (seed >> 20) % TICKS_FROM_SECS(60);
+            break;
+        case 2: /* already in the past */
+            when = start - (seed >> 20) % TICKS_FROM_SECS(10);
+            break;
+        default: /* up to 20 days, past the end of the wheel */
+            when = start + (seed >> 20) % TICKS_FROM_SECS(20 * 24 * 3600);
+            break;
+        }
+        timeout_init(&entries[i]);
+        timeouts_add(timeouts, &entries[i], 0, when);
     }
 
-    /* unlink this entry from the timeout system */
-    timeouts--;
-    timeout_unlink(entry);
+    while (expired_count + removed_count < SELFTEST_COUNT)
+    {
+        struct TimeoutEntry* expired = NULL;
+        struct TimeoutEntry* entry;
+
+        /* Mostly small steps, with the occasional big jump */
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        if ((seed >> 60) == 0)
+            now += TICKS_FROM_SECS(6 * 3600);
+        else
+            now += (seed >> 40) % TICKS_FROM_SECS(2);
+
+        timeouts_expire(timeouts, now, &expired);
+        while ((entry = expired) != NULL)
+        {
+            if (entry->timestamp > now)
+            {
+                line = __LINE__;
+                goto fail;
+            }
+
+            /* Sometimes the entry we're processing deletes another one that
+             * also expired, or reschedules itself */
+            if (entry->next && (entry - entries) % 7 == 0)
+            {
+                timeout_unlink(entry->next);
+                removed_count++;
+            }
+            if ((entry - entries) % 5 == 0 && entry->timestamp != 1)
+            {
+                timeouts_add(timeouts, entry, 0, 1);
+                continue;
+            }
+
+            timeout_unlink(entry);
+            expired_count++;
+        }
+
+        /* Nothing still in the wheel should be overdue by more than a slot */
+        for (i = 0; i < SELFTEST_COUNT; i++)
+        {
+            if (timeout_is_unlinked(&entries[i]) || entries[i].timestamp == 1)
+                continue;
+            if (entries[i].timestamp + 2 * TIMEOUT_SLOT_TICKS <= now)
+            {
+                line = __LINE__;
+                goto fail;
+            }
+        }
+
+        if (now > start + TICKS_FROM_SECS(30 * 24 * 3600))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+    }
 
-    /* return a pointer to the structure holding this entry */
-    return ((char*) entry) - entry->offset;
+    free(entries);
+    timeouts_destroy(timeouts);
+    return 0;
+fail:
+    fprintf(stderr, "[-] timeouts: selftest failed, line=%d\n", line);
+    free(entries);
+    timeouts_destroy(timeouts);
+    return 1;
 }
@@ -38,7 +38,7 @@ struct TimeoutEntry
  ***************************************************************************/
 static inline bool timeout_is_unlinked(const struct TimeoutEntry* entry)
 {
-    if (entry->prev == 0 || entry->next == 0)
+    if (entry->prev == 0)
         return true;
     else
         return false;
@@ -48,7 +48,7 @@ static inline bool timeout_is_unlinked(const struct TimeoutEntry* entry)
  ***************************************************************************/
 static inline void timeout_unlink(struct TimeoutEntry* entry)
 {
-    if (entry->prev == 0 && entry->next == 0)
+    if (entry->prev == 0)
         return;
     *(entry->prev) = entry->next;
     if (entry->next)
@@ -66,23 +66,40 @@ static inline void timeout_init(struct TimeoutEntry* entry)
     entry->prev = 0;
 }
 
+/***************************************************************************
+ * Given an entry, find the object that contains it.
+ ***************************************************************************/
+static inline void* timeout_object(const struct TimeoutEntry* entry)
+{
+    return ((char*) entry) - entry->offset;
+}
+
 /**
  * Create a timeout subsystem.
  * @param timestamp_now
  *      The current timestamp indicating "now" when the thing starts.
  *      This should be 'time(0) * TICKS_PER_SECOND'.
+ * @param entry_count
+ *      Roughly how many entries will be outstanding at once, such as
+ *      the size of the TCB table. This sizes the wheel, and isn't a limit.
  */
-struct Timeouts* timeouts_create(uint64_t timestamp_now);
+struct Timeouts* timeouts_create(uint64_t timestamp_now, size_t entry_count);
+
+/**
+ * Free the wheel. Entries still in it aren't touched, since they belong
+ * to other structures.
+ */
+void timeouts_destroy(struct Timeouts* timeouts);
 
 /**
  * Insert the timeout 'entry' into the future location in the timeout
- * ring, as determined by the timestamp.
+ * wheel, as determined by the timestamp.
  * @param timeouts
- *      A ring of timeouts, with each slot corresponding to a specific
+ *      A wheel of timeouts, with each slot corresponding to a specific
  *      time in the future.
  * @param entry
- *      The entry that we are going to insert into the ring. If it's
- *      already in the ring, it'll be removed from the old location
+ *      The entry that we are going to insert into the wheel. If it's
+ *      already in the wheel, it'll be removed from the old location
  *      first before inserting into the new location.
  * @param offset
  *      The 'entry' field above is part of an existing structure. This
@@ -97,21 +114,37 @@ void timeouts_add(struct Timeouts* timeouts, struct TimeoutEntry* entry, size_t
                   uint64_t timestamp_expires);
 
 /**
- * Remove an object from the timestamp system that is older than than
- * the specified timestamp. This function must be called repeatedly
- * until it returns NULL to remove all the objects that are older
- * than the given timestamp.
+ * Move every entry that has expired by 'timestamp_now' onto the 'expired'
+ * list, so the caller can process them all in one pass. This costs
+ * nothing when no time has passed since the last call.
+ *
+ * The entries are linked in the same way they were in the wheel, so the
+ * caller can 'timeout_unlink()' or 'timeouts_add()' any of them while
+ * walking the list, including ones it hasn't reached yet. Typically:
+ *
+ *      struct TimeoutEntry* expired = NULL;
+ *      timeouts_expire(timeouts, now, &expired);
+ *      while ((entry = expired) != NULL) {
+ *          timeout_unlink(entry);
+ *          ...process timeout_object(entry)...
+ *      }
+ *
  * @param timeouts
- *      A ring of timeouts. We'll walk the ring until we've caught
- *      up with the current time.
+ *      The wheel of timeouts. We'll turn it until we've caught up with
+ *      the current time.
  * @param timestamp_now
- *      Usually, this timestmap will be "now", the current time,
+ *      Usually, this timestamp will be "now", the current time,
  *      and anything older than this will be aged out.
+ * @param expired
+ *      The head of a list, usually empty, to which expired entries
+ *      are added.
  * @return
- *      an object older than the specified timestamp, or NULL
- *      if there are no more objects to be found
+ *      the number of entries added to the list
  */
-void* timeouts_remove(struct Timeouts* timeouts, uint64_t timestamp_now);
+size_t timeouts_expire(struct Timeouts* timeouts, uint64_t timestamp_now,
+                       struct TimeoutEntry** expired);
+
+int timeouts_selftest(void);
 
 /*
  * This macros convert a normal "timeval" structure into the timestamp
@@ -120,7 +153,7 @@ void* timeouts_remove(struct Timeouts* timeouts, uint64_t timestamp_now);
  */
 #define TICKS_PER_SECOND (16384ULL)
 #define TICKS_FROM_SECS(secs) ((secs) * 16384ULL)
-#define TICKS_FROM_USECS(usecs) ((usecs) / 16384ULL)
+#define TICKS_FROM_USECS(usecs) ((usecs) * 16384ULL / 1000000ULL)
 #define TICKS_FROM_TV(secs, usecs) (TICKS_FROM_SECS(secs) + TICKS_FROM_USECS(usecs))
 
 #endif
@@ -11,6 +11,8 @@
 #include "masscan.h"
 #include "massip-addr.h"
 #include "output.h"
+#include "out-record.h"
+#include "proto-minecraft.h"
 #include "util-logger.h"
 #include "util-malloc.h"
 #include "util-safefunc.h"
@@ -297,6 +299,58 @@ static void parse_banner6(struct Output* out, unsigned char* buf, size_t length,
                          buf + offset, (unsigned) (length - offset));
 }
 
+/***************************************************************************
+ * Parse the compact record of a Minecraft server's status fields, and
+ * report them as a "minecraft.status" banner for the output to format.
+ ***************************************************************************/
+static void parse_minecraft(struct Output* out, const unsigned char* buf, size_t length,
+                            const struct MassIP* filter, const struct RangeList* btypes)
+{
+    struct MasscanRecord record;
+    struct MinecraftStatus status;
+    char banner[MINECRAFT_STATUS_LENGTH];
+    size_t offset = 0;
+
+    record.timestamp = _get_integer(buf, length, &offset);
+    record.ip_proto = _get_byte(buf, length, &offset);
+    record.port = _get_short(buf, length, &offset);
+    record.ttl = _get_byte(buf, length, &offset);
+    record.ip.version = _get_byte(buf, length, &offset);
+    if (record.ip.version == 6)
+    {
+        record.ip.ipv6.hi = _get_long(buf, length, &offset);
+        record.ip.ipv6.lo = _get_long(buf, length, &offset);
+    }
+    else
+        record.ip.ipv4 = _get_integer(buf, length, &offset);
+    status.protocol = (int) _get_integer(buf, length, &offset);
+    status.players_max = (int) _get_integer(buf, length, &offset);
+    status.players_online = (int) _get_integer(buf, length, &offset);
+    status.version_name_length = _get_byte(buf, length, &offset);
+    status.version_name = (const char*) buf + offset;
+    offset += status.version_name_length;
+    status.description_length = _get_short(buf, length, &offset);
+    status.description = (const char*) buf + offset;
+    offset += status.description_length;
+    status.favicon_length = _get_integer(buf, length, &offset);
+    status.favicon_hash = _get_long(buf, length, &offset);
+    if (offset > length)
+    {
+        fprintf(stderr, "[-] corrupt record\n");
+        return;
+    }
+
+    if (out->when_scan_started == 0)
+        out->when_scan_started = record.timestamp;
+
+    if (!readscan_filter_pass(record.ip, record.port, PROTO_MINECRAFT_STATUS, filter, btypes))
+        return;
+
+    output_report_banner(out, record.timestamp, record.ip, record.ip_proto, record.port,
+                         PROTO_MINECRAFT_STATUS, record.ttl, (const unsigned char*) banner,
+                         (unsigned) minecraft_status_format(&status, banner));
+}
+
 /***************************************************************************
  * [OBSOLETE]
  *  This parses an old version of the banner record. I've still got files
@@ -570,6 +624,9 @@ static uint64_t _binaryfile_parse(struct Output* out, const char* filename, stru
             case 13: /* Banner6 */
                 parse_banner6(out, buf, bytes_read, filter, btypes);
                 break;
+            case Out_Minecraft:
+                parse_minecraft(out, buf, bytes_read, filter, btypes);
+                break;
             case 'm': /* FILEHEADER */
                 // goto end;
                 break;
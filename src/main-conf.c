@@ -200,8 +200,13 @@ static void print_nmap_help(void)
         "    Ex: -p22; -p1-65535; -p 111,137,80,139,8080\n"
         "TIMING AND PERFORMANCE:\n"
         "  --max-rate <number>: Send packets no faster than <number> per second\n"
+        "  --rate auto[:<min>-<max>]: Send as fast as the network allows, adjusting\n"
+        "    the rate between <min> and <max> packets per second\n"
+        "  --pacing <none|spin|txtime>: Space packets evenly instead of in bursts\n"
         "  --connection-timeout <number>: time in seconds a TCP connection will\n"
         "    timeout while waiting for banner data from a port.\n"
+        "  --dedup-exact: Remember every response for the whole scan, so that\n"
+        "    duplicates are never reported, using a bit for every target\n"
         "FIREWALL/IDS EVASION AND SPOOFING:\n"
         "  -S/--source-ip <IP_Address>: Spoof source address\n"
         "  -e <iface>: Use specified interface\n"
@@ -1075,6 +1080,21 @@ static int isInteger(const char* value)
     return 1;
 }
 
+/***************************************************************************
+ * Remember an include/exclude file that went into the targets, so that
+ * "--save-targets" can record it, and a later "--load-targets" can tell
+ * if it's changed since.
+ ***************************************************************************/
+static void masscan_add_target_source(struct Masscan* masscan, const char* filename)
+{
+    unsigned n = masscan->target_image.source_count;
+
+    masscan->target_image.sources =
+        REALLOCARRAY(masscan->target_image.sources, n + 1, sizeof(char*));
+    masscan->target_image.sources[n] = STRDUP(filename);
+    masscan->target_image.source_count = n + 1;
+}
+
 /***************************************************************************
  ***************************************************************************/
 typedef int (*SET_PARAMETER)(struct Masscan* masscan, const char* name, const char* value);
@@ -1194,6 +1214,93 @@ static int SET_capture(struct Masscan* masscan, const char* name, const char* va
     return CONF_OK;
 }
 
+static int SET_cpu_map(struct Masscan* masscan, const char* name, const char* value)
+{
+    unsigned count = 0;
+
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->cpu_map.is_none)
+            fprintf(masscan->echo, "cpu-map = none\n");
+        else if (masscan->cpu_map.count)
+        {
+            unsigned i;
+            fprintf(masscan->echo, "cpu-map = ");
+            for (i = 0; i < masscan->cpu_map.count; i++)
+                fprintf(masscan->echo, "%s%u", i ? "," : "", masscan->cpu_map.list[i]);
+            fprintf(masscan->echo, "\n");
+        }
+        else if (masscan->echo_all)
+            fprintf(masscan->echo, "cpu-map = auto\n");
+        return 0;
+    }
+
+    masscan->cpu_map.is_none = 0;
+    masscan->cpu_map.count = 0;
+    if (EQUALS("none", value))
+    {
+        masscan->cpu_map.is_none = 1;
+        return CONF_OK;
+    }
+    if (EQUALS("auto", value))
+        return CONF_OK;
+
+    /* A list of processors and ranges, like "2,4,6-9" */
+    while (*value)
+    {
+        char* end;
+        unsigned long first;
+        unsigned long last;
+
+        first = strtoul(value, &end, 10);
+        if (end == value)
+            goto fail;
+        last = first;
+        value = end;
+        if (*value == '-')
+        {
+            value++;
+            last = strtoul(value, &end, 10);
+            if (end == value || last < first)
+                goto fail;
+            value = end;
+        }
+        for (; first <= last; first++)
+        {
+            if (count >= sizeof(masscan->cpu_map.list) / sizeof(masscan->cpu_map.list[0]))
+                goto fail;
+            masscan->cpu_map.list[count++] = (unsigned) first;
+        }
+        if (*value == ',')
+            value++;
+        else if (*value)
+            goto fail;
+    }
+    if (count == 0)
+        goto fail;
+    masscan->cpu_map.count = count;
+    return CONF_OK;
+fail:
+    fprintf(stderr, "FAIL: cpu-map: expected list of processors like \"0,2,4-7\", "
+                    "\"auto\", or \"none\"\n");
+    return CONF_ERR;
+}
+
+static int SET_dedup_exact(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->is_dedup_exact || masscan->echo_all)
+            fprintf(masscan->echo, "dedup-exact = %s\n",
+                    masscan->is_dedup_exact ? "true" : "false");
+        return 0;
+    }
+    masscan->is_dedup_exact = parseBoolean(value);
+    return CONF_OK;
+}
+
 static int SET_hello(struct Masscan* masscan, const char* name, const char* value)
 {
     UNUSEDPARM(name);
@@ -1313,6 +1420,39 @@ static int SET_hello_string(struct Masscan* masscan, const char* name, const cha
     return CONF_OK;
 }
 
+static int SET_hello_set(struct Masscan* masscan, const char* name, const char* value)
+{
+    struct TcpCfgHelloSet* set;
+    struct TcpCfgHelloSet** next;
+
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        for (set = masscan->payloads.hello_sets; set; set = set->next)
+        {
+            fprintf(masscan->echo, "hello-set = %s\n", set->value);
+        }
+        return 0;
+    }
+
+    if (!banner1_hello_set(NULL, value))
+    {
+        fprintf(stderr, "FAIL: %s: expected a probe and ports, like \"minecraft:25500-25600\"\n",
+                value);
+        return CONF_ERR;
+    }
+
+    set = MALLOC(sizeof(*set));
+    set->value = STRDUP(value);
+    set->next = NULL;
+
+    /* Later ones override earlier ones, so keep them in order */
+    next = &masscan->payloads.hello_sets;
+    while (*next) next = &(*next)->next;
+    *next = set;
+    return CONF_OK;
+}
+
 static int SET_hello_timeout(struct Masscan* masscan, const char* name, const char* value)
 {
     UNUSEDPARM(name);
@@ -1958,15 +2098,111 @@ static int SET_randomize_hosts(struct Masscan* masscan, const char* name, const
     return CONF_OK;
 }
 
-static int SET_rate(struct Masscan* masscan, const char* name, const char* value)
+/***************************************************************************
+ ***************************************************************************/
+static int SET_pacing(struct Masscan* masscan, const char* name, const char* value)
+{
+    static const char* modes[] = {"none", "spin", "txtime", 0};
+    unsigned i;
+
+    if (masscan->echo)
+    {
+        if (masscan->pacing || masscan->echo_all)
+            fprintf(masscan->echo, "pacing = %s\n", modes[masscan->pacing]);
+        return 0;
+    }
+
+    for (i = 0; modes[i]; i++)
+    {
+        if (EQUALS(modes[i], value))
+        {
+            masscan->pacing = i;
+            return CONF_OK;
+        }
+    }
+    fprintf(stderr, "CONF: unknown pacing, expected none, spin, or txtime: %s=%s\n", name, value);
+    return CONF_ERR;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int SET_benchmark_pcap(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+        return 0;
+    safe_strcpy(masscan->benchmark_pcap, sizeof(masscan->benchmark_pcap), value);
+    masscan->op = Operation_Benchmark;
+    return CONF_OK;
+}
+
+/***************************************************************************
+ * Parses a rate like "10000" or "0.5", in packets/second.
+ ***************************************************************************/
+static int parse_rate(const char* value, size_t length, double* r_rate)
 {
     double rate = 0.0;
     double point = 10.0;
-    unsigned i;
+    size_t i;
+
+    if (length == 0)
+        return -1;
+
+    for (i = 0; i < length && value[i] != '.'; i++)
+    {
+        char c = value[i];
+        if (c < '0' || '9' < c)
+            return -1;
+        rate = rate * 10.0 + (c - '0');
+    }
+
+    if (i < length && value[i] == '.')
+    {
+        for (i++; i < length; i++)
+        {
+            char c = value[i];
+            if (c < '0' || '9' < c)
+                return -1;
+            rate += (c - '0') / point;
+            point *= 10.0;
+        }
+    }
+
+    *r_rate = rate;
+    return 0;
+}
+
+/***************************************************************************
+ * Echoes a rate so that parse_rate() reads it back the same, which rules
+ * out "%g" and its exponents: as an integer unless it has a fraction.
+ ***************************************************************************/
+static void echo_rate(FILE* fp, double rate)
+{
+    if (rate != (double) (unsigned long long) rate)
+        fprintf(fp, "%f", rate);
+    else
+        fprintf(fp, "%.0f", rate);
+}
+
+/***************************************************************************
+ * Either a fixed rate, or "auto" or "auto:<min>-<max>" for the adaptive
+ * rate controller.
+ ***************************************************************************/
+static int SET_rate(struct Masscan* masscan, const char* name, const char* value)
+{
+    double rate = 0.0;
 
     if (masscan->echo)
     {
-        if ((unsigned) (masscan->max_rate * 100000) % 100000)
+        if (masscan->rate_auto.is_enabled)
+        {
+            fprintf(masscan->echo, "rate = auto:");
+            echo_rate(masscan->echo, masscan->rate_auto.min_rate);
+            fprintf(masscan->echo, "-");
+            echo_rate(masscan->echo, masscan->max_rate);
+            fprintf(masscan->echo, "\n");
+        }
+        else if ((unsigned) (masscan->max_rate * 100000) % 100000)
         {
             /* print as floating point number, which is rare */
             fprintf(masscan->echo, "rate = %f\n", masscan->max_rate);
@@ -1980,34 +2216,46 @@ static int SET_rate(struct Masscan* masscan, const char* name, const char* value
         return 0;
     }
 
-    for (i = 0; value[i] && value[i] != '.'; i++)
+    if (strncmp(value, "auto", 4) == 0)
     {
-        char c = value[i];
-        if (c < '0' || '9' < c)
+        double min_rate = 100.0;
+        double max_rate = 1000000.0;
+
+        if (value[4] == ':')
+        {
+            const char* dash = strchr(value + 5, '-');
+
+            if (dash == NULL || parse_rate(value + 5, dash - (value + 5), &min_rate) != 0 ||
+                parse_rate(dash + 1, strlen(dash + 1), &max_rate) != 0)
+            {
+                fprintf(stderr, "CONF: bad auto rate, expected auto:<min>-<max>: %s=%s\n", name,
+                        value);
+                return CONF_ERR;
+            }
+        }
+        else if (value[4] != '\0')
         {
             fprintf(stderr, "CONF: non-digit in rate spec: %s=%s\n", name, value);
             return CONF_ERR;
         }
-        rate = rate * 10.0 + (c - '0');
+        if (min_rate <= 0.0 || max_rate < min_rate)
+        {
+            fprintf(stderr, "CONF: auto rate needs 0 < min <= max: %s=%s\n", name, value);
+            return CONF_ERR;
+        }
+        masscan->rate_auto.is_enabled = 1;
+        masscan->rate_auto.min_rate = min_rate;
+        masscan->max_rate = max_rate;
+        return CONF_OK;
     }
 
-    if (value[i] == '.')
+    if (parse_rate(value, strlen(value), &rate) != 0)
     {
-        i++;
-        while (value[i])
-        {
-            char c = value[i];
-            if (c < '0' || '9' < c)
-            {
-                fprintf(stderr, "CONF: non-digit in rate spec: %s=%s\n", name, value);
-                return CONF_ERR;
-            }
-            rate += (c - '0') / point;
-            point *= 10.0;
-            value++;
-        }
+        fprintf(stderr, "CONF: non-digit in rate spec: %s=%s\n", name, value);
+        return CONF_ERR;
     }
 
+    masscan->rate_auto.is_enabled = 0;
     masscan->max_rate = rate;
     return CONF_OK;
 }
@@ -2221,6 +2469,105 @@ static int SET_output_stylesheet(struct Masscan* masscan, const char* name, cons
     return CONF_OK;
 }
 
+static int SET_rx_threads(struct Masscan* masscan, const char* name, const char* value)
+{
+    uint64_t x;
+
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->rx_thread_count > 1 || masscan->echo_all)
+            fprintf(masscan->echo, "rx-threads = %u\n", masscan->rx_thread_count);
+        return 0;
+    }
+    x = strtoul(value, 0, 0);
+    if (x < 1 || x > 64)
+    {
+        fprintf(stderr, "FAIL: rx-threads=<n>: expected number from 1 to 64\n");
+        return CONF_ERR;
+    }
+    masscan->rx_thread_count = (unsigned) x;
+    return CONF_OK;
+}
+
+static int SET_rx_ring(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->is_rxring || masscan->echo_all)
+            fprintf(masscan->echo, "rx-ring = %s\n", masscan->is_rxring ? "true" : "false");
+        return 0;
+    }
+    masscan->is_rxring = parseBoolean(value);
+    return CONF_OK;
+}
+
+static int SET_tx_ring(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->is_txring || masscan->echo_all)
+            fprintf(masscan->echo, "tx-ring = %s\n", masscan->is_txring ? "true" : "false");
+        return 0;
+    }
+    masscan->is_txring = parseBoolean(value);
+    return CONF_OK;
+}
+
+static int SET_tx_threads(struct Masscan* masscan, const char* name, const char* value)
+{
+    uint64_t x;
+
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->tx_thread_count > 1 || masscan->echo_all)
+            fprintf(masscan->echo, "tx-threads = %u\n", masscan->tx_thread_count);
+        return 0;
+    }
+    x = strtoul(value, 0, 0);
+    if (x < 1 || x > 64)
+    {
+        fprintf(stderr, "FAIL: tx-threads=<n>: expected number from 1 to 64\n");
+        return CONF_ERR;
+    }
+    masscan->tx_thread_count = (unsigned) x;
+    return CONF_OK;
+}
+
+/* Reads the final targets from a file written by "--save-targets", instead
+ * of parsing and applying include/exclude files again */
+static int SET_load_targets(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+    {
+        if (masscan->target_image.load_filename[0])
+            fprintf(masscan->echo, "load-targets = %s\n", masscan->target_image.load_filename);
+        return 0;
+    }
+    safe_strcpy(masscan->target_image.load_filename,
+                sizeof(masscan->target_image.load_filename), value);
+    if (masscan->op == 0)
+        masscan->op = Operation_Scan;
+    return CONF_OK;
+}
+
+/* Writes the final targets to a file, then exits. This is an operation
+ * like "--echo", so it's never echoed itself */
+static int SET_save_targets(struct Masscan* masscan, const char* name, const char* value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo)
+        return 0;
+    safe_strcpy(masscan->target_image.save_filename,
+                sizeof(masscan->target_image.save_filename), value);
+    masscan->op = Operation_SaveTargets;
+    return CONF_OK;
+}
+
 static int SET_topports(struct Masscan* masscan, const char* name, const char* value)
 {
     unsigned default_value = 20;
@@ -2544,12 +2891,15 @@ struct ConfigParameter config_parameters[] = {
     {"arpscan", SET_arpscan, F_BOOL, {"arp", 0}},
     {"randomize-hosts", SET_randomize_hosts, F_BOOL, {0}},
     {"rate", SET_rate, 0, {"max-rate", 0}},
+    {"pacing", SET_pacing, 0, {0}},
+    {"benchmark-pcap", SET_benchmark_pcap, 0, {0}},
     {"shard", SET_shard, 0, {"shards", 0}},
     {"banners", SET_banners, F_BOOL, {"banner", 0}},       /* --banners */
     {"rawudp", SET_banners_rawudp, F_BOOL, {"rawudp", 0}}, /* --rawudp */
     {"nobanners", SET_nobanners, F_BOOL, {"nobanner", 0}},
     {"retries", SET_retries, 0, {"retry", "max-retries", "max-retry", 0}},
     {"noreset", SET_noreset, F_BOOL, {0}},
+    {"dedup-exact", SET_dedup_exact, F_BOOL, {"exact-dedup", 0}},
     {"nmap-payloads", SET_nmap_payloads, 0, {"nmap-payload", 0}},
     {"nmap-service-probes", SET_nmap_service_probes, 0, {"nmap-service-probe", 0}},
     {"offline", SET_offline, F_BOOL, {"notransmit", "nosend", "dry-run", 0}},
@@ -2558,6 +2908,7 @@ struct ConfigParameter config_parameters[] = {
     {"hello", SET_hello, 0, {0}},
     {"hello-file", SET_hello_file, 0, {"hello-filename", 0}},
     {"hello-string", SET_hello_string, 0, {0}},
+    {"hello-set", SET_hello_set, 0, {0}},
     {"hello-timeout", SET_hello_timeout, 0, {0}},
     {"http-cookie", SET_http_cookie, 0, {0}},
     {"http-header", SET_http_header, 0, {"http-field", 0}},
@@ -2591,6 +2942,13 @@ struct ConfigParameter config_parameters[] = {
     {"tcp-tsecho", SET_tcp_tsecho, F_NUMABLE, {0}},
     {"tcp-sackok", SET_tcp_sackok, F_BOOL, {0}},
     {"top-ports", SET_topports, F_NUMABLE, {"top-port", 0}},
+    {"tx-ring", SET_tx_ring, F_BOOL, {"txring", 0}},
+    {"rx-ring", SET_rx_ring, F_BOOL, {"rxring", 0}},
+    {"tx-threads", SET_tx_threads, 0, {"tx-thread", 0}},
+    {"rx-threads", SET_rx_threads, 0, {"rx-thread", 0}},
+    {"cpu-map", SET_cpu_map, 0, {"cpumap", 0}},
+    {"load-targets", SET_load_targets, 0, {"load-target", 0}},
+    {"save-targets", SET_save_targets, 0, {"save-target", 0}},
 
     {"debug-tcp", SET_debug_tcp, F_BOOL, {"tcp-debug", 0}},
     {0}};
@@ -3031,6 +3389,7 @@ void masscan_set_parameter(struct Masscan* masscan, const char* name, const char
             LOG(0, "[-] FAIL: error reading from exclude file\n");
             exit(1);
         }
+        masscan_add_target_source(masscan, filename);
 
         /* Detect if this file has made any change, otherwise don't print
          * a message */
@@ -3073,6 +3432,7 @@ void masscan_set_parameter(struct Masscan* masscan, const char* name, const char
             LOG(0, "[-] FAIL: error reading from include file\n");
             exit(1);
         }
+        masscan_add_target_source(masscan, filename);
         if (masscan->op == 0)
             masscan->op = Operation_Scan;
     }
@@ -4169,6 +4529,11 @@ void masscan_echo(struct Masscan* masscan, FILE* fp, unsigned is_echo_all)
     }
     fprintf(fp, "\n");
 
+    /* The ranges came from "load-targets", which was echoed above, and
+     * can't be combined with ranges */
+    if (masscan->target_image.load_filename[0])
+        return;
+
     /*
      * IPv4 address targets
      */
@@ -20,265 +20,342 @@
 
     We call this "deduplication" as it's simply removing duplicate
     responses.
+
+    With "--dedup-exact", we DO remember every response, but cheaply.
+    Every target (IP address + port) has an index into the scan's range,
+    which we can calculate from the response. That means a single bit per
+    target is enough to remember it, in a bitmap that's shared by all the
+    receive threads. Scanning the entire Internet on one port is 512
+    megabytes, most of which the operating system never has to provide,
+    since the pages are only touched when a response comes back.
 */
 #include "main-dedup.h"
+#include "massip.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
 #include "syn-cookie.h"
+#include "util-logger.h"
 #include "util-malloc.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
 /**
- * This is the number of entries in our table. More entries does a better job at
- * the cost of using more memory.
+ * The table is an array of buckets, each one a cache-line holding the
+ * fingerprints of the 16 most recent responses that hashed to it, so that
+ * a lookup is a single cache miss, and comparing against all of them is
+ * a few SIMD instructions.
  */
-#define DEDUP_ENTRIES 65536
-
-struct DedupEntry_IPv4
-{
-    unsigned ip_them;
-    unsigned port_them;
-    unsigned ip_me;
-    unsigned port_me;
-};
+#define DEDUP_SLOTS 16
 
-struct DedupEntry_IPv6
-{
-    ipv6address ip_them;
-    ipv6address ip_me;
-    unsigned short port_them;
-    unsigned short port_me;
-};
+/**
+ * The table size limits, in entries, for when it's sized from the rate.
+ * The minimum is a quarter megabyte, plenty for slow scans.
+ */
+#define DEDUP_ENTRIES_MIN 65536
+#define DEDUP_ENTRIES_MAX (1 << 24)
 
 /**
- * This is simply the array of entries. We have two arrays, one for IPv4
- * and another for IPv6.
+ * How long, in seconds, duplicates keep arriving after the first
+ * response, beyond the retries: the slow responders.
  */
-struct DedupTable
+#define DEDUP_RTT 1.0
+
+struct DedupBucket
 {
-    struct DedupEntry_IPv4 entries[DEDUP_ENTRIES][4];
-    struct DedupEntry_IPv6 entries6[DEDUP_ENTRIES][4];
+    uint32_t fingerprints[DEDUP_SLOTS];
 };
 
 /**
- * We use the FNv1a hash algorithm, which starts with this seed value.
+ * The largest bitmap we'll map, 32 gigabytes of address space, enough for
+ * 2^38 targets. Bigger scans fall back to the hashtable.
  */
-const unsigned fnv1a_seed = 0x811C9DC5; /* 2166136261 */
+#define DEDUP_BITMAP_MAX (1ULL << 38)
 
 /**
- * Hash one byte, the other hash functions of multiple bytes call this function.
- * @param hash
- *      The current hash value that we keep updating as we repeatedly
- *      call this function, or the `fnv1a_seed   value on the first call to
- *      this function.
+ * One bit for every target in the scan, shared between threads
  */
-static inline unsigned fnv1a(unsigned char c, unsigned hash)
+struct DedupBitmap
 {
-    const unsigned prime = 0x01000193; /* 16777619 */
-    return (c ^ hash) * prime;
-}
+    volatile uint64_t* bits;
+    size_t size;
+    uint64_t range;
+    const struct MassIP* targets;
+    unsigned is_mapped : 1;
+};
 
-static unsigned fnv1a_string(const void* v_buf, size_t length, unsigned hash)
+/**
+ * The table of recent responses, for both IPv4 and IPv6.
+ */
+struct DedupTable
 {
-    const unsigned char* buf = (const unsigned char*) v_buf;
-    size_t i;
-    for (i = 0; i < length; i++) hash = fnv1a(buf[i], hash);
-    return hash;
-}
+    struct DedupBucket* buckets;
+    void* allocation;
 
-static inline unsigned fnv1a_short(unsigned data, unsigned hash)
+    /** The hash's top bits select the bucket, the next 32 bits are
+     * the fingerprint */
+    unsigned bucket_shift;
+
+    /** Random keys for the hash, so that it can't be predicted */
+    uint64_t keys[6];
+
+    /** With --dedup-exact, responses from our targets are looked up
+     * here instead */
+    struct DedupBitmap* bitmap;
+};
+
+/***************************************************************************
+ * Used to expand the entropy into the hash keys.
+ ***************************************************************************/
+static uint64_t splitmix64(uint64_t* state)
 {
-    hash = fnv1a((data >> 0) & 0xFF, hash);
-    hash = fnv1a((data >> 8) & 0xFF, hash);
-    return hash;
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
 }
-static inline unsigned fnv1a_longlong(unsigned long long data, unsigned hash)
+
+/***************************************************************************
+ ***************************************************************************/
+size_t dedup_entries_for_rate(double rate, unsigned retries)
 {
-    return fnv1a_string(&data, 8, hash);
+    double entries = rate * (retries + DEDUP_RTT);
+
+    if (entries > DEDUP_ENTRIES_MAX)
+        return DEDUP_ENTRIES_MAX;
+    return (size_t) entries;
 }
 
 /**
- * Create a new table, which means simply allocating the object
- * and setting it to zero.
+ * Create a new table, with at least the given number of entries rounded
+ * up to a power-of-two number of buckets.
  */
-struct DedupTable* dedup_create(void)
+struct DedupTable* dedup_create(size_t entries, uint64_t entropy)
 {
     struct DedupTable* dedup;
+    size_t bucket_count = 1;
+    unsigned bits = 0;
+    unsigned i;
+
+    if (entries < DEDUP_ENTRIES_MIN)
+        entries = DEDUP_ENTRIES_MIN;
+    if (entries > DEDUP_ENTRIES_MAX)
+        entries = DEDUP_ENTRIES_MAX;
+    while (bucket_count * DEDUP_SLOTS < entries)
+    {
+        bucket_count *= 2;
+        bits++;
+    }
 
     dedup = CALLOC(1, sizeof(*dedup));
+    dedup->bucket_shift = 64 - bits;
+
+    /* Align the buckets to cache-lines */
+    dedup->allocation = CALLOC(bucket_count + 1, sizeof(struct DedupBucket));
+    dedup->buckets = (struct DedupBucket*) (((size_t) dedup->allocation + 63) & ~(size_t) 63);
+
+    for (i = 0; i < sizeof(dedup->keys) / sizeof(dedup->keys[0]); i++)
+        dedup->keys[i] = splitmix64(&entropy) | 1;
 
     return dedup;
 }
 
 /**
- * There's nothing special we need to do to free the structure
- * since it's all contained in the single allocation.
+ * Free the buckets and the table.
  */
 void dedup_destroy(struct DedupTable* dedup)
 {
+    if (dedup == NULL)
+        return;
+    free(dedup->allocation);
     free(dedup);
 }
 
-/**
- * Create a hash of the IPv6 socket. This doesn't have to be
- * cryptographically secure, so we are going to use the FNv1a algorithm.
- */
-static inline unsigned dedup_hash_ipv6(ipaddress ip_them, unsigned port_them, ipaddress ip_me,
-                                       unsigned port_me)
+/***************************************************************************
+ ***************************************************************************/
+struct DedupBitmap* dedup_bitmap_create(const struct MassIP* targets)
 {
-    unsigned hash = fnv1a_seed;
-    hash = fnv1a_longlong(ip_them.ipv6.hi, hash);
-    hash = fnv1a_longlong(ip_them.ipv6.lo, hash);
-    hash = fnv1a_short(port_them, hash);
-    hash = fnv1a_longlong(ip_me.ipv6.hi, hash);
-    hash = fnv1a_longlong(ip_me.ipv6.lo, hash);
-    hash = fnv1a_short(port_me, hash);
-    return hash;
+    struct DedupBitmap* bitmap;
+    massint128_t range = massip_range((struct MassIP*) targets);
+    size_t size;
+
+    if (range.hi || range.lo > DEDUP_BITMAP_MAX || range.lo / 8 > (size_t) ~0)
+    {
+        LOG(0, "[-] dedup-exact: too many targets, remembering recent responses instead\n");
+        return NULL;
+    }
+    size = (size_t) ((range.lo + 63) / 64) * sizeof(uint64_t);
+    if (size == 0)
+        size = sizeof(uint64_t);
+
+    bitmap = CALLOC(1, sizeof(*bitmap));
+    bitmap->size = size;
+    bitmap->range = range.lo;
+    bitmap->targets = targets;
+
+    /* Map the bitmap so that pages are zero-filled when first touched.
+     * Elsewhere the address space is only reserved, but Windows commits
+     * the whole bitmap up front, charging it against the commit limit
+     * even though physical pages still arrive on demand. */
+#if defined(WIN32)
+    bitmap->bits = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    bitmap->bits = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE,
+                        -1, 0);
+    if (bitmap->bits == MAP_FAILED)
+        bitmap->bits = NULL;
+#endif
+    if (bitmap->bits)
+        bitmap->is_mapped = 1;
+    else
+        bitmap->bits = calloc(1, size);
+    if (bitmap->bits == NULL)
+    {
+        LOG(0, "[-] dedup-exact: out of memory for %llu targets\n", (unsigned long long) range.lo);
+        free(bitmap);
+        return NULL;
+    }
+
+    LOG(1, "[+] dedup-exact: %llu-kilobyte bitmap\n", (unsigned long long) (size / 1024));
+    return bitmap;
 }
 
-/**
- * If two IPv6 addresses are equal.
- */
-static inline int is_equal6(ipv6address lhs, ipv6address rhs)
+/***************************************************************************
+ ***************************************************************************/
+void dedup_bitmap_destroy(struct DedupBitmap* bitmap)
 {
-    return lhs.hi == rhs.hi && lhs.lo == rhs.lo;
+    if (bitmap == NULL)
+        return;
+    if (!bitmap->is_mapped)
+        free((void*) bitmap->bits);
+#if defined(WIN32)
+    else
+        VirtualFree((void*) bitmap->bits, 0, MEM_RELEASE);
+#else
+    else
+        munmap((void*) bitmap->bits, bitmap->size);
+#endif
+    free(bitmap);
 }
 
-/**
- * Swap two addresses in the table. This uses the classic XOR trick
- * rather than using a swap variable.
- */
-static inline void swap6(struct DedupEntry_IPv6* lhs, struct DedupEntry_IPv6* rhs)
+/***************************************************************************
+ ***************************************************************************/
+void dedup_set_bitmap(struct DedupTable* dedup, struct DedupBitmap* bitmap)
 {
-    lhs->ip_them.hi ^= rhs->ip_them.hi;
-    lhs->ip_them.lo ^= rhs->ip_them.lo;
-    lhs->port_them ^= rhs->port_them;
-    lhs->ip_me.hi ^= rhs->ip_me.hi;
-    lhs->ip_me.lo ^= rhs->ip_me.lo;
-    lhs->port_me ^= rhs->port_me;
-
-    rhs->ip_them.hi ^= lhs->ip_them.hi;
-    rhs->ip_them.lo ^= lhs->ip_them.lo;
-    rhs->port_them ^= lhs->port_them;
-    rhs->ip_me.hi ^= lhs->ip_me.hi;
-    rhs->ip_me.lo ^= lhs->ip_me.lo;
-    rhs->port_me ^= lhs->port_me;
-
-    lhs->ip_them.hi ^= rhs->ip_them.hi;
-    lhs->ip_them.lo ^= rhs->ip_them.lo;
-    lhs->port_them ^= rhs->port_them;
-    lhs->ip_me.hi ^= rhs->ip_me.hi;
-    lhs->ip_me.lo ^= rhs->ip_me.lo;
-    lhs->port_me ^= rhs->port_me;
+    dedup->bitmap = bitmap;
 }
 
-/**
- * This implements the same algorithm as for IPv4 addresses, but for
- * IPv6 addresses instead.
- */
-static unsigned dedup_is_duplicate_ipv6(struct DedupTable* dedup, ipaddress ip_them,
-                                        unsigned port_them, ipaddress ip_me, unsigned port_me)
+/***************************************************************************
+ * Atomically set the bit for this target, returning whether it was
+ * already set, meaning another thread (or this one) has already seen it.
+ * Checking first means the common case of a repeat doesn't need a
+ * locked instruction.
+ ***************************************************************************/
+static inline unsigned dedup_bitmap_test_and_set(struct DedupBitmap* bitmap, uint64_t index)
 {
-    unsigned hash;
-    struct DedupEntry_IPv6* bucket;
-    unsigned i;
-
-    /* THREAT: probably need to secure this hash, though the syn-cookies
-     * provides some protection */
-    hash = dedup_hash_ipv6(ip_them, port_them, ip_me, port_me);
-    hash &= DEDUP_ENTRIES - 1;
-
-    /* Search in this bucket */
-    bucket = dedup->entries6[hash];
+    volatile uint64_t* word = &bitmap->bits[index / 64];
+    uint64_t mask = 1ULL << (index % 64);
 
-    /* If we find the entry in our table, move it to the front, so
-     * that it won't be aged out as quickly. We keep prepending new
-     * addresses to front, aging older addresses that haven't been
-     * seen in a while. */
-    for (i = 0; i < 4; i++)
-    {
-        if (is_equal6(bucket[i].ip_them, ip_them.ipv6) && bucket[i].port_them == port_them &&
-            is_equal6(bucket[i].ip_me, ip_me.ipv6) && bucket[i].port_me == port_me)
-        {
-            /* move to end of list so constant repeats get ignored */
-            if (i > 0)
-            {
-                swap6(&bucket[0], &bucket[i]);
-            }
-            return 1;
-        }
-    }
+    if (*word & mask)
+        return 1;
+    return (pixie_locked_fetch_or64(word, mask) & mask) != 0;
+}
 
-    /* We didn't find it, so add it to our list. This will push
-     * older entries at this bucket off the list */
-    memmove(bucket, bucket + 1, 3 * sizeof(*bucket));
-    bucket[0].ip_them.hi = ip_them.ipv6.hi;
-    bucket[0].ip_them.lo = ip_them.ipv6.lo;
-    bucket[0].port_them = (unsigned short) port_them;
-    bucket[0].ip_me.hi = ip_me.ipv6.hi;
-    bucket[0].ip_me.lo = ip_me.ipv6.lo;
-    bucket[0].port_me = (unsigned short) port_me;
+/***************************************************************************
+ * Hash the socket with multiply-shift. Each pair of words is offset by
+ * random keys and multiplied, then the sum is multiplied once more so
+ * that the top bits, which we use, depend on every bit of the input.
+ ***************************************************************************/
+static inline uint64_t dedup_hash(const struct DedupTable* dedup, uint64_t a, uint64_t b,
+                                  uint64_t c, uint64_t d, uint64_t e)
+{
+    const uint64_t* k = dedup->keys;
+    uint64_t hash;
 
-    return 0;
+    hash = (a + k[0]) * (b + k[1]) + (c + k[2]) * (d + k[3]) + (e + k[4]);
+    hash ^= hash >> 32;
+    return hash * k[5];
 }
 
 /***************************************************************************
+ * Whether any of the fingerprints in the bucket match, all 16 compared
+ * at once.
  ***************************************************************************/
-static unsigned dedup_is_duplicate_ipv4(struct DedupTable* dedup, ipaddress ip_them,
-                                        unsigned port_them, ipaddress ip_me, unsigned port_me)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+static inline unsigned bucket_contains(const struct DedupBucket* bucket, uint32_t fingerprint)
+{
+    const __m128i* row = (const __m128i*) bucket->fingerprints;
+    __m128i key = _mm_set1_epi32((int) fingerprint);
+    __m128i match;
+
+    match = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi32(_mm_load_si128(&row[0]), key),
+                     _mm_cmpeq_epi32(_mm_load_si128(&row[1]), key)),
+        _mm_or_si128(_mm_cmpeq_epi32(_mm_load_si128(&row[2]), key),
+                     _mm_cmpeq_epi32(_mm_load_si128(&row[3]), key)));
+    return _mm_movemask_epi8(match) != 0;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+static inline unsigned bucket_contains(const struct DedupBucket* bucket, uint32_t fingerprint)
 {
-    unsigned hash;
-    struct DedupEntry_IPv4* bucket;
+    const uint32_t* row = bucket->fingerprints;
+    uint32x4_t key = vdupq_n_u32(fingerprint);
+    uint32x4_t match;
+    uint64x2_t match64;
+
+    match = vorrq_u32(vorrq_u32(vceqq_u32(vld1q_u32(row + 0), key),
+                                vceqq_u32(vld1q_u32(row + 4), key)),
+                      vorrq_u32(vceqq_u32(vld1q_u32(row + 8), key),
+                                vceqq_u32(vld1q_u32(row + 12), key)));
+    match64 = vreinterpretq_u64_u32(match);
+    return (vgetq_lane_u64(match64, 0) | vgetq_lane_u64(match64, 1)) != 0;
+}
+#else
+static inline unsigned bucket_contains(const struct DedupBucket* bucket, uint32_t fingerprint)
+{
+    unsigned match = 0;
     unsigned i;
 
-    /* THREAT: probably need to secure this hash, though the syn-cookies
-     * provides some protection */
-    hash = (ip_them.ipv4 + port_them) ^ ((ip_me.ipv4) + (ip_them.ipv4 >> 16)) ^
-           (ip_them.ipv4 >> 24) ^ port_me;
-    hash &= DEDUP_ENTRIES - 1;
+    for (i = 0; i < DEDUP_SLOTS; i++) match |= (bucket->fingerprints[i] == fingerprint);
+    return match;
+}
+#endif
 
-    /* Search in this bucket */
-    bucket = dedup->entries[hash];
+/***************************************************************************
+ * Look for the hash in the table, adding it if it isn't there. New entries
+ * go to the front of the bucket, pushing the oldest off the end. Unlike
+ * an LRU, hits don't change anything, so the common case of a duplicate
+ * doesn't write to memory.
+ *
+ * Only a fingerprint is stored, so there's a 16 in 2^32 chance that a new
+ * response gets mistaken for a duplicate.
+ ***************************************************************************/
+static inline unsigned dedup_lookup(struct DedupTable* dedup, uint64_t hash)
+{
+    struct DedupBucket* bucket = &dedup->buckets[hash >> dedup->bucket_shift];
+    uint32_t fingerprint = (uint32_t) (hash >> (dedup->bucket_shift - 32));
 
-    /* If we find the entry in our table, move it to the front, so
-     * that it won't be aged out as quickly. We keep prepending new
-     * addresses to front, aging older addresses that haven't been
-     * seen in a while. */
-    for (i = 0; i < 4; i++)
-    {
-        if (bucket[i].ip_them == ip_them.ipv4 && bucket[i].port_them == port_them &&
-            bucket[i].ip_me == ip_me.ipv4 && bucket[i].port_me == port_me)
-        {
-            /* move to end of list so constant repeats get ignored */
-            if (i > 0)
-            {
-                bucket[i].ip_them ^= bucket[0].ip_them;
-                bucket[i].port_them ^= bucket[0].port_them;
-                bucket[i].ip_me ^= bucket[0].ip_me;
-                bucket[i].port_me ^= bucket[0].port_me;
-
-                bucket[0].ip_them ^= bucket[i].ip_them;
-                bucket[0].port_them ^= bucket[i].port_them;
-                bucket[0].ip_me ^= bucket[i].ip_me;
-                bucket[0].port_me ^= bucket[i].port_me;
-
-                bucket[i].ip_them ^= bucket[0].ip_them;
-                bucket[i].port_them ^= bucket[0].port_them;
-                bucket[i].ip_me ^= bucket[0].ip_me;
-                bucket[i].port_me ^= bucket[0].port_me;
-            }
-            return 1;
-        }
-    }
+    /* zero marks an empty slot */
+    if (fingerprint == 0)
+        fingerprint = 1;
 
-    /* We didn't find it, so add it to our list. This will push
-     * older entries at this bucket off the list */
-    memmove(bucket, bucket + 1, 3 * sizeof(*bucket));
-    bucket[0].ip_them = ip_them.ipv4;
-    bucket[0].port_them = port_them;
-    bucket[0].ip_me = ip_me.ipv4;
-    bucket[0].port_me = port_me;
+    if (bucket_contains(bucket, fingerprint))
+        return 1;
 
+    memmove(&bucket->fingerprints[1], &bucket->fingerprints[0],
+            (DEDUP_SLOTS - 1) * sizeof(bucket->fingerprints[0]));
+    bucket->fingerprints[0] = fingerprint;
     return 0;
 }
 
@@ -287,10 +364,23 @@ static unsigned dedup_is_duplicate_ipv4(struct DedupTable* dedup, ipaddress ip_t
 unsigned dedup_is_duplicate(struct DedupTable* dedup, ipaddress ip_them, unsigned port_them,
                             ipaddress ip_me, unsigned port_me)
 {
+    if (dedup->bitmap)
+    {
+        uint64_t index;
+        if (massip_rank(dedup->bitmap->targets, ip_them, port_them, &index) &&
+            index < dedup->bitmap->range)
+            return dedup_bitmap_test_and_set(dedup->bitmap, index);
+    }
+
+    /* THREAT: the keys are random, and the syn-cookies provide some
+     * protection too */
     if (ip_them.version == 6)
-        return dedup_is_duplicate_ipv6(dedup, ip_them, port_them, ip_me, port_me);
+        return dedup_lookup(dedup, dedup_hash(dedup, ip_them.ipv6.hi, ip_them.ipv6.lo,
+                                              ip_me.ipv6.hi, ip_me.ipv6.lo,
+                                              (uint64_t) port_them << 32 | port_me | 1ULL << 63));
     else
-        return dedup_is_duplicate_ipv4(dedup, ip_them, port_them, ip_me, port_me);
+        return dedup_lookup(dedup, dedup_hash(dedup, ip_them.ipv4, ip_me.ipv4, port_them, port_me,
+                                              0));
 }
 
 /**
@@ -329,7 +419,7 @@ int dedup_selftest(void)
     unsigned found_match = 0;
     unsigned line = 0;
 
-    dedup = dedup_create();
+    dedup = dedup_create(0, 0);
 
     /* Deterministic test.
      *
@@ -456,6 +546,93 @@ int dedup_selftest(void)
         goto fail;
     }
 
+    /* A table sized for a high rate: a thousand different responses
+     * are all new, and are all found again */
+    {
+        struct DedupTable* big = dedup_create(dedup_entries_for_rate(1000000.0, 2), 12345);
+        unsigned pass;
+
+        for (pass = 0; pass < 2; pass++)
+        {
+            ipaddress ip_me = {0};
+            seed = 1;
+            for (i = 0; i < 1000; i++)
+            {
+                ipaddress ip_them = {0};
+                ip_them.version = 4;
+                ip_them.ipv4 = _rand(&seed) << 16 | _rand(&seed);
+                ip_me.version = 4;
+                if (dedup_is_duplicate(big, ip_them, 443, ip_me, 40000) != pass)
+                {
+                    line = __LINE__;
+                    goto fail;
+                }
+            }
+        }
+        dedup_destroy(big);
+    }
+
+    /* Exact mode: every target is new the first time we see it, and
+     * a duplicate forever after, no matter how many other responses
+     * come in between */
+    {
+        struct MassIP targets;
+        struct DedupBitmap* bitmap;
+        massint128_t range;
+        ipaddress ip_me = {0};
+        uint64_t index;
+        unsigned pass;
+
+        memset(&targets, 0, sizeof(targets));
+        massip_add_target_string(&targets, "10.0.0.0/22,2001:db8::/120");
+        massip_add_port_string(&targets, "80,443,8000-8009", 0);
+        massip_optimize(&targets);
+        range = massip_range(&targets);
+
+        bitmap = dedup_bitmap_create(&targets);
+        if (bitmap == NULL)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        dedup_set_bitmap(dedup, bitmap);
+
+        for (pass = 0; pass < 2; pass++)
+        {
+            for (index = 0; index < range.lo; index++)
+            {
+                ipaddress ip_them;
+                unsigned port_them;
+
+                massip_pick(&targets, index, &ip_them, &port_them);
+                ip_me.version = ip_them.version;
+                if (dedup_is_duplicate(dedup, ip_them, port_them, ip_me, 0x1234) != pass)
+                {
+                    line = __LINE__;
+                    goto fail;
+                }
+            }
+        }
+
+        /* Responses that aren't from our targets still use the table */
+        {
+            ipaddress ip_them = {0};
+            ip_them.version = 4;
+            ip_them.ipv4 = 0x0b000001;
+            if (dedup_is_duplicate(dedup, ip_them, 80, ip_me, 0x1234) ||
+                !dedup_is_duplicate(dedup, ip_them, 80, ip_me, 0x1234))
+            {
+                line = __LINE__;
+                goto fail;
+            }
+        }
+
+        dedup_set_bitmap(dedup, NULL);
+        dedup_bitmap_destroy(bitmap);
+    }
+
+    dedup_destroy(dedup);
+
     /* All tests have passed */
     return 0; /* success :) */
 
@@ -463,3 +640,70 @@ fail:
     fprintf(stderr, "[-] selftest: 'dedup' failed, file=%s, line=%u\n", __FILE__, line);
     return 1;
 }
+
+/***************************************************************************
+ * Benchmark with something like real traffic: a SYN/ACK from every
+ * target that responds, and for a third of them another one or two,
+ * either retransmitted by the target or in response to a retry.
+ ***************************************************************************/
+void dedup_benchmark(void)
+{
+    static const size_t COUNT = 4000000;
+    struct DedupTable* dedup;
+    unsigned* targets;
+    unsigned seed = 0;
+    size_t i;
+    static const double rates[] = {0.0, 1000000.0};
+    size_t expected = 0;
+    uint64_t start, stop;
+    ipaddress ip_me = {0};
+    unsigned r;
+
+    printf("-- dedup --\n");
+
+    /* Each entry is either a new target, or repeats one from a little
+     * while ago */
+    targets = MALLOC(COUNT * sizeof(targets[0]));
+    for (i = 0; i < COUNT; i++)
+    {
+        if (i > 100000 && _rand(&seed) % 3 == 0)
+        {
+            targets[i] = targets[i - 1 - (_rand(&seed) * 3) % 100000];
+            expected++;
+        }
+        else
+            targets[i] = (unsigned) i * 2654435761U; /* all different */
+    }
+
+    ip_me.version = 4;
+    ip_me.ipv4 = 0x0a000001;
+
+    /* The smallest table, and one sized for a fast scan */
+    for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        size_t entries = dedup_entries_for_rate(rates[r], 1);
+        size_t found = 0;
+
+        if (entries < DEDUP_ENTRIES_MIN)
+            entries = DEDUP_ENTRIES_MIN;
+
+        dedup = dedup_create(entries, 0);
+        start = pixie_nanotime();
+        for (i = 0; i < COUNT; i++)
+        {
+            ipaddress ip_them;
+            ip_them.version = 4;
+            ip_them.ipv4 = targets[i];
+            found += dedup_is_duplicate(dedup, ip_them, 80, ip_me, 40000);
+        }
+        stop = pixie_nanotime();
+        dedup_destroy(dedup);
+
+        printf("%8uk entries: lookups/second = %5.3f-million, duplicates = %llu/%llu found\n",
+               (unsigned) (entries / 1000), COUNT / ((stop - start) / 1000.0),
+               (unsigned long long) found, (unsigned long long) expected);
+    }
+    printf("\n");
+
+    free(targets);
+}
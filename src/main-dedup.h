@@ -1,11 +1,58 @@
 #ifndef MAIN_DEDUP_H
 #define MAIN_DEDUP_H
 #include "massip-addr.h"
+#include <stddef.h>
+#include <stdint.h>
 
-struct DedupTable* dedup_create(void);
+struct MassIP;
+
+/**
+ * Create a table remembering recent responses.
+ * @param entries
+ *      How many responses to remember, such as from
+ *      'dedup_entries_for_rate()', or 0 for the minimum.
+ * @param entropy
+ *      Seeds the hash, so that nobody can predict which responses
+ *      collide.
+ */
+struct DedupTable* dedup_create(size_t entries, uint64_t entropy);
 
 void dedup_destroy(struct DedupTable* table);
 
+/**
+ * How many responses a table needs to remember to catch the duplicates
+ * at this rate, which keep arriving through the retries and a round trip
+ * after that, assuming every probe gets a response.
+ */
+size_t dedup_entries_for_rate(double rate, unsigned retries);
+
+/**
+ * Create the bitmap for --dedup-exact, with a bit for every target,
+ * which can be shared by all the receive threads.
+ * @param targets
+ *      The optimized targets of the scan, which must remain unchanged
+ *      while the bitmap is in use.
+ * @return
+ *      the bitmap, or NULL if the scan is too big (which has been logged)
+ */
+struct DedupBitmap* dedup_bitmap_create(const struct MassIP* targets);
+
+void dedup_bitmap_destroy(struct DedupBitmap* bitmap);
+
+/**
+ * Look up responses from our targets in the shared bitmap, only using the
+ * table for anything else.
+ */
+void dedup_set_bitmap(struct DedupTable* dedup, struct DedupBitmap* bitmap);
+
+/**
+ * @param port_them
+ *      The port as it's stored in the target list, where TCP ports are
+ *      just the port number, and other protocols are offset, such
+ *      as 'Templ_ARP'.
+ * @return
+ *      1 if this response has been seen before, 0 if it's new.
+ */
 unsigned dedup_is_duplicate(struct DedupTable* dedup, ipaddress ip_them, unsigned port_them,
                             ipaddress ip_me, unsigned port_me);
 
@@ -15,4 +62,9 @@ unsigned dedup_is_duplicate(struct DedupTable* dedup, ipaddress ip_them, unsigne
  */
 int dedup_selftest(void);
 
+/**
+ * Measure lookups per second with a mix of new responses and duplicates.
+ */
+void dedup_benchmark(void);
+
 #endif
@@ -61,9 +61,9 @@ int masscan_initialize_adapter(struct Masscan* masscan, unsigned index, macaddre
      * turn it on.
      */
     masscan->nic[index].adapter = rawsock_init_adapter(
-        ifname, masscan->is_pfring, masscan->is_sendq, masscan->nmap.packet_trace,
-        masscan->is_offline, (void*) masscan->bpf_filter, masscan->nic[index].is_vlan,
-        masscan->nic[index].vlan_id);
+        ifname, masscan->is_pfring, masscan->is_sendq, masscan->is_txring, masscan->is_rxring,
+        masscan->nmap.packet_trace, masscan->is_offline, (void*) masscan->bpf_filter,
+        masscan->nic[index].is_vlan, masscan->nic[index].vlan_id);
     if (masscan->nic[index].adapter == 0)
     {
         LOG(0, "[-] if:%s:init: failed\n", ifname);
@@ -18,10 +18,22 @@
 */
 #include "main-throttle.h"
 #include "pixie-timer.h"
+#include "rawsock-pcapfile.h"
 #include "util-logger.h"
+#include "util-malloc.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* With pacing, batches are due no closer together than this many
+ * nanoseconds. Below about 2,000,000 packets/second that means a batch of
+ * one, above that, small batches */
+#define PACING_GRANULARITY 500.0
+
+/* With SO_TXTIME, how far ahead of a batch's departure we hand it to the
+ * kernel, in nanoseconds */
+#define PACING_TXTIME_LEAD 500000
+
 /***************************************************************************
  ***************************************************************************/
 void throttler_start(struct Throttler* throttler, double max_rate)
@@ -43,6 +55,62 @@ void throttler_start(struct Throttler* throttler, double max_rate)
     LOG(1, "[+] starting throttler: rate = %0.2f-pps\n", throttler->max_rate);
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void throttler_set_pacing(struct Throttler* throttler, enum PacingMode pacing)
+{
+    throttler->pacing = pacing;
+    throttler->next_departure = 0;
+    throttler->departure = 0;
+}
+
+/***************************************************************************
+ * The paced version of throttler_next_batch(). Rather than averaging the
+ * rate over recent batches, which lets packets go out in bursts as long
+ * as the average is right, every batch has a departure time, spaced
+ * evenly from the last, and we wait for it on the fast clock.
+ ***************************************************************************/
+static uint64_t throttler_next_paced(struct Throttler* throttler, uint64_t packet_count)
+{
+    double gap = 1000000000.0 / throttler->max_rate;
+    uint64_t now = pixie_fasttime();
+    uint64_t batch_size;
+
+    /* If we've fallen more than a millisecond behind, such as when the
+     * thread wasn't scheduled for a while, start again from now rather
+     * than sending a burst to catch up */
+    if (throttler->next_departure + 1000000.0 < (double) now)
+        throttler->next_departure = (double) now;
+
+    batch_size = (uint64_t) (PACING_GRANULARITY / gap);
+    if (batch_size < 1)
+        batch_size = 1;
+
+    if (throttler->pacing == Pacing_TxTime)
+    {
+        throttler->departure = (uint64_t) throttler->next_departure;
+        pixie_wait_until(throttler->departure - PACING_TXTIME_LEAD);
+    }
+    else
+        pixie_wait_until((uint64_t) throttler->next_departure);
+
+    throttler->next_departure += batch_size * gap;
+
+    /* The rate for the status line, measured every 100 milliseconds */
+    now = pixie_fasttime();
+    if (now - throttler->test_timestamp >= 100000000)
+    {
+        if (throttler->test_timestamp)
+            throttler->current_rate = (packet_count - throttler->test_packet_count) *
+                                      1000000000.0 / (now - throttler->test_timestamp);
+        throttler->test_timestamp = now;
+        throttler->test_packet_count = packet_count;
+    }
+
+    throttler->batch_size = (double) batch_size;
+    return batch_size;
+}
+
 /***************************************************************************
  * We return the number of packets that can be sent in a batch. Thus,
  * instead of trying to throttle each packet individually, which has a
@@ -62,6 +130,9 @@ uint64_t throttler_next_batch(struct Throttler* throttler, uint64_t packet_count
     double current_rate;
     double max_rate = throttler->max_rate;
 
+    if (throttler->pacing != Pacing_None)
+        return throttler_next_paced(throttler, packet_count);
+
 again:
 
     /* NOTE: this uses CLOCK_MONOTONIC_RAW on Linux, so the timstamp doesn't
@@ -160,3 +231,326 @@ again:
     throttler->test_packet_count = packet_count;
     return (uint64_t) throttler->batch_size;
 }
+
+/***************************************************************************
+ ***************************************************************************/
+void throttler_set_rate(struct Throttler* throttler, double max_rate)
+{
+    throttler->max_rate = max_rate;
+}
+
+/*
+ * Tuning for the adaptive rate controller
+ */
+#define RATECTL_DECREASE 0.7   /* multiply the rate by this on overload */
+#define RATECTL_INCREASE 0.05  /* then grow by this much of the cut rate */
+#define RATECTL_HOLDOFF 2      /* intervals to wait after a cut */
+#define RATECTL_MAX_LOSS 0.001 /* fraction of drops we'll tolerate */
+#define RATECTL_MAX_BACKLOG 0.5
+#define RATECTL_MIN_YIELD 0.8  /* as a fraction of the normal yield */
+#define RATECTL_MIN_SAMPLE 400 /* SYN-ACKs needed to judge the yield */
+#define RATECTL_MIN_USED 0.8   /* of the rate, before we raise it */
+
+/***************************************************************************
+ ***************************************************************************/
+void ratectl_start(struct RateControl* ctl, double min_rate, double max_rate)
+{
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->min_rate = min_rate;
+    ctl->max_rate = max_rate;
+    ctl->rate = min_rate;
+    ctl->step = min_rate;
+    ctl->is_slow_start = 1;
+
+    LOG(1, "[+] starting rate control: rate = %0.2f-pps to %0.2f-pps\n", min_rate, max_rate);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+double ratectl_update(struct RateControl* ctl, double elapsed, uint64_t syns, uint64_t synacks,
+                      uint64_t drops, double backlog)
+{
+    uint64_t sent = syns - ctl->syns;
+    uint64_t responses = synacks - ctl->synacks;
+    uint64_t lost = drops - ctl->drops;
+    const char* overload = NULL;
+
+    ctl->syns = syns;
+    ctl->synacks = synacks;
+    ctl->drops = drops;
+
+    /* Right after a cut, the counters still reflect the old rate */
+    if (ctl->holdoff)
+    {
+        ctl->holdoff--;
+        return ctl->rate;
+    }
+
+    /*
+     * Look for signs that we are going too fast. Drops and a full transmit
+     * queue are problems on this machine. The yield falling is a problem
+     * somewhere upstream, such as a policer on the path discarding a share
+     * of our probes. Responses trail the probes by a round-trip, but that's
+     * small compared to the interval, so we don't try to line them up.
+     */
+    if (lost > sent * RATECTL_MAX_LOSS)
+        overload = "packets dropped";
+    else if (backlog > RATECTL_MAX_BACKLOG)
+        overload = "transmit queue full";
+    else if (sent && responses + sent * ctl->yield >= RATECTL_MIN_SAMPLE)
+    {
+        double yield = (double) responses / (double) sent;
+
+        /* The normal yield follows the best we've seen, but only drifts
+         * down slowly, so that running a little too fast for a long time
+         * doesn't become the new normal */
+        if (yield < ctl->yield * RATECTL_MIN_YIELD)
+            overload = "responses collapsed";
+        else if (yield > ctl->yield)
+            ctl->yield = yield;
+        else
+            ctl->yield = ctl->yield * 0.99 + yield * 0.01;
+    }
+
+    if (overload)
+    {
+        ctl->rate *= RATECTL_DECREASE;
+        if (ctl->rate < ctl->min_rate)
+            ctl->rate = ctl->min_rate;
+        ctl->step = ctl->rate * RATECTL_INCREASE;
+        ctl->is_slow_start = 0;
+        ctl->holdoff = RATECTL_HOLDOFF;
+        LOG(1, "[+] rate control: %s, slowing to %0.2f-pps\n", overload, ctl->rate);
+        return ctl->rate;
+    }
+
+    /* If we aren't managing to send at the current rate, such as when the
+     * CPU can't keep up, then raising it would only build up a burst */
+    if (sent < ctl->rate * elapsed * RATECTL_MIN_USED)
+        return ctl->rate;
+
+    if (ctl->is_slow_start)
+        ctl->rate *= 2.0;
+    else
+        ctl->rate += ctl->step;
+    if (ctl->rate > ctl->max_rate)
+        ctl->rate = ctl->max_rate;
+
+    LOG(2, "[+] rate control: %0.2f-pps\n", ctl->rate);
+    return ctl->rate;
+}
+
+/***************************************************************************
+ * Run the controller against a simulated network, returning the average
+ * rate it settles on.
+ * @param policer
+ *      Probes above this rate are silently discarded upstream.
+ * @param nic
+ *      Probes above this rate are dropped by the adapter.
+ * @param cpu
+ *      We can't send faster than this.
+ ***************************************************************************/
+static double ratectl_simulate(double policer, double nic, double cpu)
+{
+    struct RateControl ctl;
+    uint64_t syns = 0;
+    uint64_t synacks = 0;
+    uint64_t drops = 0;
+    double total = 0;
+    unsigned i;
+
+    ratectl_start(&ctl, 100, 1000000);
+    for (i = 0; i < 200; i++)
+    {
+        double sent = ctl.rate < cpu ? ctl.rate : cpu;
+        double delivered = sent < policer ? sent : policer;
+
+        if (sent > nic)
+        {
+            drops += (uint64_t) (sent - nic);
+            delivered = nic < policer ? nic : policer;
+        }
+        syns += (uint64_t) sent;
+        synacks += (uint64_t) (delivered * 0.01);
+
+        ratectl_update(&ctl, 1.0, syns, synacks, drops, 0.0);
+        if (i >= 100)
+            total += ctl.rate;
+    }
+    return total / 100;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int throttler_selftest(void)
+{
+    struct RateControl ctl;
+    double rate;
+
+    /* Nothing in the way, so it should reach the maximum */
+    rate = ratectl_simulate(1e9, 1e9, 1e9);
+    if (rate != 1000000)
+        goto fail;
+
+    /* An upstream policer only shows up as fewer responses */
+    rate = ratectl_simulate(50000, 1e9, 1e9);
+    if (rate < 50000 * 0.6 || rate > 50000 * 1.3)
+        goto fail;
+
+    /* The adapter dropping packets */
+    rate = ratectl_simulate(1e9, 200000, 1e9);
+    if (rate < 200000 * 0.6 || rate > 200000 * 1.1)
+        goto fail;
+
+    /* Don't run away when we can't send any faster */
+    rate = ratectl_simulate(1e9, 1e9, 30000);
+    if (rate > 30000 * 2.2)
+        goto fail;
+
+    /* A full transmit queue, and never below the minimum */
+    ratectl_start(&ctl, 100, 1000000);
+    ctl.rate = 120;
+    if (ratectl_update(&ctl, 1.0, 120, 0, 0, 0.9) != 100)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] throttler: selftest failed\n");
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int compare_uint64(const void* lhs, const void* rhs)
+{
+    uint64_t a = *(const uint64_t*) lhs;
+    uint64_t b = *(const uint64_t*) rhs;
+    return (a > b) - (a < b);
+}
+
+/***************************************************************************
+ * Print how far the gaps between packets stray from the ideal gap. The
+ * array of gaps is overwritten.
+ ***************************************************************************/
+static void jitter_report(const char* name, uint64_t* gaps, size_t count, double ideal)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        double deviation = (double) gaps[i] - ideal;
+        gaps[i] = (uint64_t) (deviation < 0 ? -deviation : deviation);
+    }
+    qsort(gaps, count, sizeof(gaps[0]), compare_uint64);
+
+    printf("%-10s gap=%8.0f-ns, jitter: p50=%8llu p99=%8llu p99.9=%9llu max=%10llu-ns\n", name,
+           ideal, (unsigned long long) gaps[count / 2],
+           (unsigned long long) gaps[count * 99 / 100],
+           (unsigned long long) gaps[count * 999 / 1000], (unsigned long long) gaps[count - 1]);
+}
+
+/***************************************************************************
+ * We can't transmit from the benchmark, so instead we timestamp the
+ * moment each packet would have been sent, which is what the pacing
+ * controls.
+ ***************************************************************************/
+void throttler_benchmark(void)
+{
+    static const double rates[] = {100000.0, 1000000.0};
+    static const char* names[] = {"burst", "paced"};
+    size_t max_count = 100001;
+    uint64_t* stamps = MALLOC(max_count * sizeof(stamps[0]));
+    unsigned r;
+
+    pixie_fasttime_calibrate();
+    printf("-- throttler --\n");
+    printf("clock: %s\n", pixie_fasttime_is_tsc() ? "cycle counter" : "clock_gettime()");
+
+    for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        unsigned pacing;
+
+        for (pacing = Pacing_None; pacing <= Pacing_Spin; pacing++)
+        {
+            struct Throttler throttler;
+            uint64_t packets_sent = 0;
+            size_t count = (size_t) (rates[r] / 10.0) + 1;
+            size_t n = 0;
+            size_t i;
+            char name[32];
+
+            if (count > max_count)
+                count = max_count;
+
+            throttler_start(&throttler, rates[r]);
+            throttler_set_pacing(&throttler, (enum PacingMode) pacing);
+            while (n < count)
+            {
+                uint64_t batch_size = throttler_next_batch(&throttler, packets_sent);
+
+                for (; batch_size && n < count; batch_size--)
+                {
+                    stamps[n++] = pixie_fasttime();
+                    packets_sent++;
+                }
+            }
+
+            for (i = 0; i + 1 < count; i++)
+                stamps[i] = stamps[i + 1] - stamps[i];
+            snprintf(name, sizeof(name), "%s %uk", names[pacing], (unsigned) (rates[r] / 1000));
+            jitter_report(name, stamps, count - 1, 1000000000.0 / rates[r]);
+        }
+    }
+    printf("\n");
+    free(stamps);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int throttler_benchmark_pcap(const char* filename)
+{
+    struct PcapFile* capfile;
+    unsigned char* buf;
+    uint64_t* stamps = NULL;
+    size_t count = 0;
+    size_t max = 0;
+    size_t i;
+    unsigned secs, usecs, original_length, captured_length;
+    double ideal;
+
+    capfile = pcapfile_openread(filename);
+    if (capfile == NULL)
+        return 1;
+
+    buf = MALLOC(65536);
+    while (pcapfile_readframe(capfile, &secs, &usecs, &original_length, &captured_length, buf,
+                              65536))
+    {
+        if (count >= max)
+        {
+            max = max * 2 + 1024;
+            stamps = REALLOCARRAY(stamps, max, sizeof(stamps[0]));
+        }
+        stamps[count++] = secs * 1000000000ULL + usecs * 1000ULL;
+    }
+    pcapfile_close(capfile);
+    free(buf);
+
+    if (count < 2 || stamps[count - 1] <= stamps[0])
+    {
+        fprintf(stderr, "[-] %s: not enough packets to measure\n", filename);
+        free(stamps);
+        return 1;
+    }
+
+    /* The ideal gap is the average over the whole capture */
+    ideal = (double) (stamps[count - 1] - stamps[0]) / (double) (count - 1);
+    for (i = 0; i + 1 < count; i++)
+        stamps[i] = stamps[i + 1] > stamps[i] ? stamps[i + 1] - stamps[i] : 0;
+
+    printf("-- %s: %llu packets at %0.0f-pps, microsecond timestamps --\n", filename,
+           (unsigned long long) count, 1000000000.0 / ideal);
+    jitter_report("capture", stamps, count - 1, ideal);
+    free(stamps);
+    return 0;
+}
@@ -2,12 +2,32 @@
 #define MAIN_THROTTLE_H
 #include <stdint.h>
 
+/**
+ * How the throttler spaces out packets (--pacing)
+ */
+enum PacingMode
+{
+    Pacing_None,   /* batches sent back-to-back, sleeping between them */
+    Pacing_Spin,   /* evenly spaced, waiting on the cycle counter */
+    Pacing_TxTime, /* evenly spaced by the kernel, using SO_TXTIME */
+};
+
 struct Throttler
 {
     double max_rate;
     double current_rate;
     double batch_size;
 
+    enum PacingMode pacing;
+
+    /** With pacing, when the next batch is due, in pixie_fasttime() units */
+    double next_departure;
+
+    /** With Pacing_TxTime, when the current batch should leave. We return
+     * from throttler_next_batch() a little ahead of this, so that the
+     * kernel has it queued in time. */
+    uint64_t departure;
+
     unsigned index;
 
     struct
@@ -23,4 +43,87 @@ struct Throttler
 uint64_t throttler_next_batch(struct Throttler* throttler, uint64_t count);
 void throttler_start(struct Throttler* status, double max_rate);
 
+/**
+ * Change the rate of a running throttler. This is called from the main
+ * thread while the transmit thread is using the throttler.
+ */
+void throttler_set_rate(struct Throttler* throttler, double max_rate);
+
+/**
+ * Pace packets evenly instead of in bursts. Call after throttler_start().
+ */
+void throttler_set_pacing(struct Throttler* throttler, enum PacingMode pacing);
+
+/**
+ * The adaptive rate controller for "--rate auto". The throttler above
+ * holds the transmit threads to a rate, this decides what that rate
+ * should be. It's AIMD, like TCP congestion control: the rate grows
+ * while the network keeps up, and is cut back by a fraction whenever
+ * it shows signs of overload.
+ */
+struct RateControl
+{
+    double min_rate;
+    double max_rate;
+    double rate;
+
+    /** How much the rate grows each interval after the first cut */
+    double step;
+
+    /** Doubling the rate each interval until the first sign of trouble */
+    unsigned is_slow_start : 1;
+
+    /** Intervals to wait after a cut before trusting the signals again,
+     * as they still reflect the old rate */
+    unsigned holdoff;
+
+    /** The counters as of the last update */
+    uint64_t syns;
+    uint64_t synacks;
+    uint64_t drops;
+
+    /** The fraction of probes that got a SYN-ACK, while the network was
+     * keeping up. A sharp drop from this means something upstream has
+     * started discarding our probes or their responses */
+    double yield;
+};
+
+void ratectl_start(struct RateControl* ctl, double min_rate, double max_rate);
+
+/**
+ * Called about once a second with the running totals.
+ * @param elapsed
+ *      Seconds since the last update.
+ * @param syns
+ *      Probes sent.
+ * @param synacks
+ *      SYN-ACKs received.
+ * @param drops
+ *      Packets lost by the adapters, either failing to transmit or that
+ *      the kernel dropped before we could receive them.
+ * @param backlog
+ *      How full the queues of packets waiting to be transmitted are,
+ *      from 0.0 to 1.0.
+ * @return
+ *      The new rate, in packets/second.
+ */
+double ratectl_update(struct RateControl* ctl, double elapsed, uint64_t syns, uint64_t synacks,
+                      uint64_t drops, double backlog);
+
+int throttler_selftest(void);
+
+/**
+ * Report the spread of inter-packet gaps the throttler achieves, with and
+ * without pacing, for --benchmark.
+ */
+void throttler_benchmark(void);
+
+/**
+ * Report the spread of inter-packet gaps in a packet capture, such as one
+ * taken on a mirror port during a scan (--benchmark-pcap).
+ * @return
+ *      0 on success, or 1 if the file couldn't be read
+ */
+int throttler_benchmark_pcap(const char* filename);
+
 #endif
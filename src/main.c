@@ -19,6 +19,7 @@
 #include "crypto-blackrock.h" /* the BlackRock shuffling func */
 #include "crypto-lcg.h"       /* the LCG randomization func */
 #include "crypto-siphash24.h" /* hash function, for hash tables */
+#include "event-timeout.h"    /* TCP timeout wheel selftest */
 #include "in-binary.h"        /* convert binary output to XML/JSON */
 #include "main-dedup.h"       /* ignore duplicate responses */
 #include "main-globals.h"     /* all the global variables in the program */
@@ -29,8 +30,10 @@
 #include "masscan-status.h" /* open or closed */
 #include "masscan-version.h"
 #include "masscan.h"
+#include "massip-image.h"
 #include "massip-parse.h"
 #include "massip-port.h"
+#include "massip-trie.h"
 #include "misc-rstfilter.h"
 #include "output.h"           /* for outputting results */
 #include "pixie-backtrace.h"  /* maybe print backtrace on crash */
@@ -65,6 +68,8 @@
 #include "util-checksum.h"
 #include "util-logger.h" /* adjust with -v command-line opt */
 #include "util-malloc.h"
+#include "util-json.h"
+#include "util-slab.h"
 #include "vulncheck.h" /* checking vulns like monlist, poodle, heartblee */
 
 #include <assert.h>
@@ -95,6 +100,49 @@ time_t global_now;
 
 uint64_t usec_start;
 
+/***************************************************************************
+ * Each adapter can have more than one transmit thread (--tx-threads). The
+ * threads split the adapter's share of the scan between them, each with
+ * its own throttler and its own transmit queue.
+ ***************************************************************************/
+struct TransmitThread
+{
+    /** The thread-pair (adapter) this transmit thread belongs to */
+    struct ThreadPair* parms;
+
+    /**
+     * Which of the adapter's transmit threads this is. Thread #0 also
+     * transmits the packets queued by the receive thread, such as
+     * responses for --banners.
+     */
+    unsigned tx_index;
+
+    /** Either the thread-pair's adapter, or a clone of it with its own
+     * transmit ring */
+    struct Adapter* adapter;
+
+    /** The processor to run on (--cpu-map), or -1 */
+    int cpu;
+
+    /**
+     * A copy of the master 'index' variable. This is just advisory for
+     * other threads, to tell them how far we've gotten.
+     */
+    volatile uint64_t my_index;
+
+    unsigned done_transmitting;
+
+    struct Throttler throttler[1];
+
+    uint64_t* total_syns;
+
+    /** Packets left in the stack's transmit queue after the last flush,
+     * for --rate auto. Only thread #0 flushes the queue. */
+    volatile unsigned tx_backlog;
+
+    size_t thread_handle_xmit;
+};
+
 /***************************************************************************
  * We create a pair of transmit/receive threads for each network adapter.
  * This structure contains the parameters we send to each pair.
@@ -124,10 +172,11 @@ struct ThreadPair
     unsigned nic_index;
 
     /**
-     * A copy of the master 'index' variable. This is just advisory for
-     * other threads, to tell them how far we've gotten.
+     * The transmit threads for this adapter (--tx-threads). There is
+     * always at least one.
      */
-    volatile uint64_t my_index;
+    struct TransmitThread* xmit;
+    unsigned xmit_count;
 
     /* This is used both by the transmit and receive thread for
      * formatting packets */
@@ -142,18 +191,25 @@ struct ThreadPair
     macaddress_t router_mac_ipv4;
     macaddress_t router_mac_ipv6;
 
-    unsigned done_transmitting;
-    unsigned done_receiving;
+    /**
+     * The receive threads for this adapter (--rx-threads). There is
+     * always at least one.
+     */
+    struct ReceiveThread* rx;
+    unsigned rx_count;
 
-    double pt_start;
+    /** With --dedup-exact, the responses seen by all the receive threads */
+    struct DedupBitmap* dedup_bitmap;
 
-    struct Throttler throttler[1];
+    /** The processor the receive thread runs on (--cpu-map), or -1, and
+     * the NUMA node the adapter is attached to, or -1 */
+    int cpu;
+    int numa_node;
 
-    uint64_t* total_synacks;
-    uint64_t* total_tcbs;
-    uint64_t* total_syns;
+    unsigned done_receiving;
+
+    double pt_start;
 
-    size_t thread_handle_xmit;
     size_t thread_handle_recv;
 };
 
@@ -190,6 +246,18 @@ static void adapter_get_source_addresses(const struct Masscan* masscan, unsigned
     src->ipv6_mask = mask;
 }
 
+/***************************************************************************
+ * Pin the calling thread to its processor, and have the memory it
+ * allocates come from the same NUMA node as its network adapter.
+ ***************************************************************************/
+static void thread_placement(int cpu, int numa_node)
+{
+    if (cpu >= 0)
+        pixie_cpu_set_affinity((unsigned) cpu);
+    if (numa_node >= 0)
+        pixie_numa_set_preferred(numa_node);
+}
+
 /***************************************************************************
  * This thread spews packets as fast as it can
  *
@@ -199,7 +267,8 @@ static void adapter_get_source_addresses(const struct Masscan* masscan, unsigned
  ***************************************************************************/
 static void transmit_thread(void* v) /*aka. scanning_thread() */
 {
-    struct ThreadPair* parms = (struct ThreadPair*) v;
+    struct TransmitThread* xmit = (struct TransmitThread*) v;
+    struct ThreadPair* parms = xmit->parms;
     uint64_t i;
     uint64_t start;
     uint64_t end;
@@ -212,35 +281,56 @@ static void transmit_thread(void* v) /*aka. scanning_thread() */
     struct BlackRock blackrock;
     uint64_t count_ipv4 = rangelist_count(&masscan->targets.ipv4);
     uint64_t count_ipv6 = range6list_count(&masscan->targets.ipv6).lo;
-    struct Throttler* throttler = parms->throttler;
+    struct Throttler* throttler = xmit->throttler;
     struct TemplateSet pkt_template = templ_copy(parms->tmplset);
-    struct Adapter* adapter = parms->adapter;
+    struct Adapter* adapter = xmit->adapter;
     uint64_t packets_sent = 0;
-    unsigned increment = masscan->shard.of * masscan->nic_count;
+    unsigned increment = masscan->shard.of * masscan->nic_count * parms->xmit_count;
     struct source_t src;
     uint64_t seed = masscan->seed;
     uint64_t repeats = 0; /* --infinite repeats */
     uint64_t* status_syn_count;
     uint64_t entropy = masscan->seed;
+    struct TemplateTargetIPv4 probes[64];
+    unsigned probe_count = 0;
+    uint64_t shuffled[8];
+    unsigned shuffled_next;
+
+    thread_placement(xmit->cpu, parms->numa_node);
 
     /* Wait to make sure receive_thread is ready */
     pixie_usleep(1000000);
-    LOG(1, "[+] starting transmit thread #%u\n", parms->nic_index);
+    LOG(1, "[+] starting transmit thread #%u.%u\n", parms->nic_index, xmit->tx_index);
 
     /* export a pointer to this variable outside this threads so
      * that the 'status' system can print the rate of syns we are
      * sending */
     status_syn_count = MALLOC(sizeof(uint64_t));
     *status_syn_count = 0;
-    parms->total_syns = status_syn_count;
+    xmit->total_syns = status_syn_count;
 
     /* Normally, we have just one source address. In special cases, though
      * we can have multiple. */
     adapter_get_source_addresses(masscan, parms->nic_index, &src);
 
     /* "THROTTLER" rate-limits how fast we transmit, set with the
-     * --max-rate parameter */
-    throttler_start(throttler, masscan->max_rate / masscan->nic_count);
+     * --max-rate parameter. Each transmit thread gets an equal share. With
+     * --rate auto, we start slow, and the main thread speeds us up. */
+    if (masscan->rate_auto.is_enabled)
+        throttler_start(throttler,
+                        masscan->rate_auto.min_rate / masscan->nic_count / parms->xmit_count);
+    else
+        throttler_start(throttler, masscan->max_rate / masscan->nic_count / parms->xmit_count);
+
+    /* --pacing: spread packets out evenly, possibly having the kernel
+     * schedule them for us */
+    if (masscan->pacing == Pacing_TxTime && rawsock_enable_txtime(adapter) != 0)
+    {
+        LOG(0, "[-] --pacing txtime unavailable, using --pacing spin\n");
+        throttler_set_pacing(throttler, Pacing_Spin);
+    }
+    else
+        throttler_set_pacing(throttler, (enum PacingMode) masscan->pacing);
 
 infinite:
 
@@ -253,15 +343,19 @@ infinite:
             count_ipv6 * rangelist_count(&masscan->targets.ports);
     range_ipv6 = count_ipv6 * rangelist_count(&masscan->targets.ports);
     blackrock_init(&blackrock, range, seed, masscan->blackrock_rounds);
+    shuffled_next = 8;
 
     /* Calculate the 'start' and 'end' of a scan. One reason to do this is
      * to support --shard, so that multiple machines can co-operate on
      * the same scan. Another reason to do this is so that we can bleed
      * a little bit past the end when we have --retries. Yet another
      * thing to do here is deal with multiple network adapters, which
-     * is essentially the same logic as shards. */
-    start =
-        masscan->resume.index + (masscan->shard.one - 1) * masscan->nic_count + parms->nic_index;
+     * is essentially the same logic as shards. Multiple transmit threads
+     * on an adapter further split that adapter's share the same way. */
+    start = masscan->resume.index +
+            ((masscan->shard.one - 1) * masscan->nic_count + parms->nic_index) *
+                parms->xmit_count +
+            xmit->tx_index;
     end = range;
     if (masscan->resume.count && end > start + masscan->resume.count)
         end = start + masscan->resume.count;
@@ -282,15 +376,20 @@ infinite:
          * size will always be one. (--max-rate)
          */
         batch_size = throttler_next_batch(throttler, packets_sent);
+        if (throttler->departure)
+            rawsock_set_departure(adapter, throttler->departure);
 
         /*
          * Transmit packets from other thread, when doing --banners. This
          * takes priority over sending SYN packets. If there is so much
          * activity grabbing banners that we cannot transmit more SYN packets,
          * then "batch_size" will get decremented to zero, and we won't be
-         * able to transmit SYN packets.
+         * able to transmit SYN packets. The stack's queue has a single
+         * consumer, so only the first transmit thread drains it.
          */
-        stack_flush_packets(parms->stack, adapter, &packets_sent, &batch_size);
+        if (xmit->tx_index == 0)
+            xmit->tx_backlog =
+                stack_flush_packets(parms->stack, adapter, &packets_sent, &batch_size);
 
         /*
          * Transmit a bunch of packets. At any rate slower than 100,000
@@ -317,12 +416,35 @@ infinite:
              *  order. Then, once we've shuffled the index, we "pick" the
              *  IP address and port that the index refers to.
              */
-            xXx = (i + (r--) * rate);
-            if (rate > range)
-                xXx %= range;
-            else
-                while (xXx >= range) xXx -= range;
-            xXx = blackrock_shuffle(&blackrock, xXx);
+            if (shuffled_next == 8)
+            {
+                /* Shuffle the next 8 indexes together, which is faster
+                 * than one at a time. This walks 'i' and 'r' forward the
+                 * same way the loop below does, without changing them. */
+                uint64_t index[8];
+                uint64_t ii = i;
+                unsigned rr = r;
+                unsigned k;
+
+                for (k = 0; k < 8; k++)
+                {
+                    xXx = (ii + (rr--) * rate);
+                    if (rate > range)
+                        xXx %= range;
+                    else
+                        while (xXx >= range) xXx -= range;
+                    index[k] = xXx;
+                    if (rr == 0)
+                    {
+                        ii += increment;
+                        rr = (unsigned) retries + 1;
+                    }
+                }
+                blackrock_shuffle_x8(&blackrock, index, shuffled);
+                shuffled_next = 0;
+            }
+            r--;
+            xXx = shuffled[shuffled_next++];
 
             if (xXx < range_ipv6)
             {
@@ -339,6 +461,13 @@ infinite:
 
                 cookie = syn_cookie_ipv6(ip_them, port_them, ip_me, port_me, entropy);
 
+                /* Keep probes in the order we picked them */
+                if (probe_count)
+                {
+                    rawsock_send_probes_ipv4(adapter, probes, probe_count, 0, &pkt_template);
+                    probe_count = 0;
+                }
+
                 rawsock_send_probe_ipv6(adapter, ip_them, port_them, ip_me, port_me,
                                         (unsigned) cookie,
                                         !batch_size, /* flush queue on last packet in batch */
@@ -386,11 +515,19 @@ infinite:
                  *  exciting happens here. The thing to note that this may
                  *  be a "raw" transmit that bypasses the kernel, meaning
                  *  we can call this function millions of times a second.
+                 *  Probes are queued up and formatted together, which
+                 *  is cheaper than formatting them one at a time.
                  */
-                rawsock_send_probe_ipv4(adapter, ip_them, port_them, ip_me, port_me,
-                                        (unsigned) cookie,
-                                        !batch_size, /* flush queue on last packet in batch */
-                                        &pkt_template);
+                probes[probe_count].ip_them = ip_them;
+                probes[probe_count].port_them = port_them;
+                probes[probe_count].ip_me = ip_me;
+                probes[probe_count].port_me = port_me;
+                probes[probe_count].seqno = (unsigned) cookie;
+                if (++probe_count == sizeof(probes) / sizeof(probes[0]))
+                {
+                    rawsock_send_probes_ipv4(adapter, probes, probe_count, 0, &pkt_template);
+                    probe_count = 0;
+                }
             }
 
             batch_size--;
@@ -415,9 +552,14 @@ infinite:
 
         } /* end of batch */
 
+        /* Send whatever probes are left, and flush the queue, so that
+         * the throttler's timing is what goes out on the wire */
+        rawsock_send_probes_ipv4(adapter, probes, probe_count, 1, &pkt_template);
+        probe_count = 0;
+
         /* save our current location for resuming, if the user pressed
          * <ctrl-c> to exit early */
-        parms->my_index = i;
+        xmit->my_index = i;
 
         /* If the user pressed <ctrl-c>, then we need to exit. In case
          * the user wants to --resume the scan later, we save the current
@@ -450,14 +592,17 @@ infinite:
     /*
      * Wait until the receive thread realizes the scan is over
      */
-    LOG(1, "[+] transmit thread #%u complete\n", parms->nic_index);
+    LOG(1, "[+] transmit thread #%u.%u complete\n", parms->nic_index, xmit->tx_index);
 
     /*
      * We are done transmitting. However, response packets will take several
      * seconds to arrive. Therefore, sit in short loop waiting for those
      * packets to arrive. Pressing <ctrl-c> a second time will exit this
-     * prematurely.
+     * prematurely. Only the first transmit thread has any responses to
+     * send; the others simply wait.
      */
+    while (!is_rx_done && xmit->tx_index != 0)
+        pixie_usleep(1000);
     while (!is_rx_done)
     {
         unsigned k;
@@ -483,8 +628,9 @@ infinite:
     }
 
     /* Thread is about to exit */
-    parms->done_transmitting = 1;
-    LOG(1, "[+] exiting transmit thread #%u                    \n", parms->nic_index);
+    xmit->done_transmitting = 1;
+    LOG(1, "[+] exiting transmit thread #%u.%u                    \n", parms->nic_index,
+        xmit->tx_index);
 }
 
 /***************************************************************************
@@ -506,99 +652,121 @@ static unsigned is_ipv6_multicast(ipaddress ip_me)
 }
 
 /***************************************************************************
- *
- * Asynchronous receive thread
- *
- * The transmit and receive threads run independently of each other. There
- * is no record what was transmitted. Instead, the transmit thread sets a
- * "SYN-cookie" in transmitted packets, which the receive thread will then
- * use to match up requests with responses.
+ * With --rx-threads, the thread reading from the adapter hands packets to
+ * the worker threads as copies in these buffers.
  ***************************************************************************/
-static void receive_thread(void* v)
+struct ReceivedPacket
 {
-    struct ThreadPair* parms = (struct ThreadPair*) v;
-    const struct Masscan* masscan = parms->masscan;
-    struct Adapter* adapter = parms->adapter;
-    int data_link = stack_if_datalink(adapter);
+    unsigned length;
+    unsigned secs;
+    unsigned usecs;
+    unsigned char px[2048];
+};
+#define RECEIVED_PACKET_COUNT 4096
+
+/***************************************************************************
+ * The state for processing received packets. Normally there's one of these
+ * per adapter. With --rx-threads, each worker thread has its own, owning
+ * the TCP connections, duplicates and output for its share of the flows.
+ ***************************************************************************/
+struct ReceiveThread
+{
+    /** The thread-pair (adapter) this receive thread belongs to */
+    struct ThreadPair* parms;
+
+    /** Which of the adapter's receive threads this is */
+    unsigned rx_index;
+
+    /** The processor to run on (--cpu-map), or -1 */
+    int cpu;
+
+    int data_link;
     struct Output* out;
     struct DedupTable* dedup;
-    struct PcapFile* pcapfile = NULL;
-    struct TCP_ConnectionTable* tcpcon = 0;
-    uint64_t* status_synack_count;
-    uint64_t* status_tcb_count;
-    uint64_t entropy = masscan->seed;
+    struct DedupTable* echo_reply_dedup;
+    struct PcapFile* pcapfile;
+    struct TCP_ConnectionTable* tcpcon;
     struct ResetFilter* rf;
-    struct stack_t* stack = parms->stack;
-    struct source_t src = {0};
 
-    /* For reducing RST responses, see rstfilter_is_filter() below */
-    rf = rstfilter_create(entropy, 16384);
+    /** This thread's clone of the adapter's stack, for queueing packets
+     * to transmit from its own cache of buffers */
+    struct stack_t* stack;
 
-    /* some status variables */
-    status_synack_count = MALLOC(sizeof(uint64_t));
-    *status_synack_count = 0;
-    parms->total_synacks = status_synack_count;
+    /** With --rx-threads, the packets dispatched to this worker, and the
+     * empty buffers going back to the dispatcher */
+    struct rte_ring* packets;
+    struct rte_ring* free_packets;
 
-    status_tcb_count = MALLOC(sizeof(uint64_t));
-    *status_tcb_count = 0;
-    parms->total_tcbs = status_tcb_count;
+    uint64_t* total_synacks;
+    uint64_t* total_tcbs;
 
-    LOG(1, "[+] starting receive thread #%u\n", parms->nic_index);
+    size_t thread_handle_recv;
+};
 
-    /* Lock this thread to a CPU. Transmit threads are on even CPUs,
-     * receive threads on odd CPUs */
-    if (pixie_cpu_get_count() > 1)
-    {
-        unsigned cpu_count = pixie_cpu_get_count();
-        unsigned cpu = parms->nic_index * 2 + 1;
-        while (cpu >= cpu_count)
-        {
-            cpu -= cpu_count;
-            cpu++;
-        }
-        // TODO:
-        // pixie_cpu_set_affinity(cpu);
-    }
+/***************************************************************************
+ * Create the output, deduplication table, and (with --banners) the TCP
+ * connection table for a receive thread.
+ ***************************************************************************/
+static void receive_thread_init(struct ReceiveThread* rx)
+{
+    struct ThreadPair* parms = rx->parms;
+    const struct Masscan* masscan = parms->masscan;
+    struct TCP_ConnectionTable* tcpcon = 0;
+    struct source_t src = {0};
 
-    /*
-     * If configured, open a --pcap file for saving raw packets. This is
-     * so that we can debug scans, but also so that we can look at the
-     * strange things people send us. Note that we don't record transmitted
-     * packets, just the packets we've received.
-     */
-    if (masscan->pcap_filename[0])
-    {
-        pcapfile = pcapfile_openwrite(masscan->pcap_filename, 1);
-    }
+    rx->data_link = stack_if_datalink(parms->adapter);
+    rx->stack = stack_clone(parms->stack);
+
+    /* For reducing RST responses, see rstfilter_is_filter() below */
+    rx->rf = rstfilter_create(masscan->seed, 16384);
+
+    /* some status variables */
+    rx->total_synacks = MALLOC(sizeof(uint64_t));
+    *rx->total_synacks = 0;
+
+    rx->total_tcbs = MALLOC(sizeof(uint64_t));
+    *rx->total_tcbs = 0;
 
     /*
      * Open output. This is where results are reported when saving
      * the --output-format to the --output-filename
      */
-    out = output_create(masscan, parms->nic_index);
+    rx->out = output_create(masscan, parms->nic_index * parms->rx_count + rx->rx_index);
 
     /*
      * Create deduplication table. This is so when somebody sends us
-     * multiple responses, we only record the first one.
+     * multiple responses, we only record the first one. It's sized to
+     * hold all the responses to this thread's share of the probes that
+     * might be duplicated.
      */
-    dedup = dedup_create();
+    rx->dedup = dedup_create(dedup_entries_for_rate(masscan->max_rate / masscan->nic_count /
+                                                        parms->rx_count,
+                                                    masscan->retries),
+                             masscan->seed);
+    if (parms->dedup_bitmap)
+        dedup_set_bitmap(rx->dedup, parms->dedup_bitmap);
+
+    /* Echo replies are deduplicated separately, each thread with its own
+     * table, as the replies from a host all come to the same thread */
+    rx->echo_reply_dedup = dedup_create(0, masscan->seed);
 
     /*
-     * Create a TCP connection table (per thread pair) for interacting with live
-     * connections when doing --banners
+     * Create a TCP connection table (per receive thread) for interacting with
+     * live connections when doing --banners
      */
     if (masscan->is_banners)
     {
         struct TcpCfgPayloads* pay;
+        struct TcpCfgHelloSet* set;
         size_t i;
 
         /*
          * Create TCP connection table
          */
-        tcpcon =
-            tcpcon_create_table((size_t) ((masscan->max_rate / 5) / masscan->nic_count),
-                                parms->stack, &parms->tmplset->pkts[Proto_TCP],
-                                output_report_banner, out, masscan->tcb.timeout, masscan->seed);
+        tcpcon = tcpcon_create_table(
+            (size_t) ((masscan->max_rate / 5) / masscan->nic_count / parms->rx_count), rx->stack,
+            &parms->tmplset->pkts[Proto_TCP], output_report_banner, rx->out, masscan->tcb.timeout,
+            masscan->seed);
 
         /*
          * Initialize TCP scripting
@@ -677,13 +845,549 @@ static void receive_thread(void* v)
             tcpcon_set_http_header(tcpcon, masscan->http.headers[i].name, 0, 0, http_field_remove);
         }
 
-        for (pay = masscan->payloads.tcp; pay; pay = pay->next)
-        {
-            char name[64];
-            snprintf(name, sizeof(name), "hello-string[%u]", pay->port);
-            tcpcon_set_parameter(tcpcon, name, strlen(pay->payload_base64), pay->payload_base64);
+        for (set = masscan->payloads.hello_sets; set; set = set->next)
+        {
+            tcpcon_set_parameter(tcpcon, "hello-set", strlen(set->value), set->value);
+        }
+        for (pay = masscan->payloads.tcp; pay; pay = pay->next)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "hello-string[%u]", pay->port);
+            tcpcon_set_parameter(tcpcon, name, strlen(pay->payload_base64), pay->payload_base64);
+        }
+    }
+
+    rx->tcpcon = tcpcon;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void receive_thread_cleanup(struct ReceiveThread* rx)
+{
+    const struct stack_stats_t* stats = &rx->stack->stats;
+
+    if (rx->tcpcon)
+        tcpcon_destroy_table(rx->tcpcon);
+    if (stats->buffer_waits || stats->transmit_waits)
+        LOG(1, "[+] receive thread #%u.%u: waited for buffers %llu times, for transmit %llu\n",
+            rx->parms->nic_index, rx->rx_index, (unsigned long long) stats->buffer_waits,
+            (unsigned long long) stats->transmit_waits);
+    stack_destroy_clone(rx->stack);
+    dedup_destroy(rx->dedup);
+    dedup_destroy(rx->echo_reply_dedup);
+    output_destroy(rx->out);
+}
+
+/***************************************************************************
+ * Process a single received packet: respond to ARP/NDP, match responses
+ * against SYN-cookies, report open ports, and drive --banners connections.
+ ***************************************************************************/
+static void receive_packet(struct ReceiveThread* rx, const unsigned char* px, unsigned length,
+                           unsigned secs, unsigned usecs)
+{
+    struct ThreadPair* parms = rx->parms;
+    const struct Masscan* masscan = parms->masscan;
+    struct stack_t* stack = rx->stack;
+    struct Output* out = rx->out;
+    struct DedupTable* dedup = rx->dedup;
+    struct TCP_ConnectionTable* tcpcon = rx->tcpcon;
+    uint64_t entropy = masscan->seed;
+    int status;
+    unsigned x;
+    struct PreprocessedInfo parsed;
+    ipaddress ip_me;
+    unsigned port_me;
+    ipaddress ip_them;
+    unsigned port_them;
+    unsigned seqno_me;
+    unsigned seqno_them;
+    unsigned cookie;
+    unsigned Q = 0;
+
+    /*
+     * Do any TCP event timeouts based on the current timestamp from
+     * the packet. For example, if the connection has been open for
+     * around 10 seconds, we'll close the connection. (--banners)
+     */
+    if (tcpcon)
+    {
+        tcpcon_timeouts(tcpcon, secs, usecs);
+    }
+
+    if (length > 1514)
+        return;
+
+    /*
+     * "Preprocess" the response packet. This means to go through and
+     * figure out where the TCP/IP headers are and the locations of
+     * some fields, like IP address and port numbers.
+     */
+    x = preprocess_frame(px, length, rx->data_link, &parsed);
+    if (!x)
+        return; /* corrupt packet */
+    ip_me = parsed.dst_ip;
+    ip_them = parsed.src_ip;
+    port_me = parsed.port_dst;
+    port_them = parsed.port_src;
+    seqno_them = TCP_SEQNO(px, parsed.transport_offset);
+    seqno_me = TCP_ACKNO(px, parsed.transport_offset);
+
+    assert(ip_me.version != 0);
+    assert(ip_them.version != 0);
+
+    switch (parsed.ip_protocol)
+    {
+        case 132: /* SCTP */
+            cookie = syn_cookie(ip_them, port_them | (Proto_SCTP << 16), ip_me, port_me,
+                                entropy) &
+                     0xFFFFFFFF;
+            break;
+        default:
+            cookie = syn_cookie(ip_them, port_them, ip_me, port_me, entropy) & 0xFFFFFFFF;
+    }
+
+    /* verify: my IP address */
+    if (!is_my_ip(stack->src, ip_me))
+    {
+        /* NDP Neighbor Solicitations don't come to our IP address, but to
+         * a multicast address */
+        if (is_ipv6_multicast(ip_me))
+        {
+            if (parsed.found == FOUND_NDPv6 && parsed.opcode == 135)
+            {
+                stack_ndpv6_incoming_request(stack, &parsed, px, length);
+            }
+        }
+        return;
+    }
+
+    /*
+     * Handle non-TCP protocols
+     */
+    switch (parsed.found)
+    {
+        case FOUND_NDPv6:
+            switch (parsed.opcode)
+            {
+                case 133: /* Router Solicitation */
+                    /* Ignore router solicitations, since we aren't a router */
+                    return;
+                case 134: /* Router advertisement */
+                    /* TODO: We need to process router advertisements while scanning
+                     * so that we can print warning messages if router information
+                     * changes while scanning. */
+                    return;
+                case 135: /* Neighbor Solicitation */
+                    /* When responses come back from our scans, the router will send us
+                     * these packets. We need to respond to them, so that the router
+                     * can then forward the packets to us. If we don't respond, we'll
+                     * get no responses. */
+                    stack_ndpv6_incoming_request(stack, &parsed, px, length);
+                    return;
+                case 136: /* Neighbor Advertisement */
+                    /* TODO: If doing an --ndpscan, the scanner subsystem needs to deal
+                     * with these */
+                    return;
+                case 137: /* Redirect */
+                    /* We ignore these, since we really don't have the capability to send
+                     * packets to one router for some destinations and to another router
+                     * for other destinations */
+                    return;
+                default:
+                    break;
+            }
+            return;
+        case FOUND_ARP:
+            LOGip(2, ip_them, 0, "-> ARP [%u] \n", px[parsed.found_offset]);
+
+            switch (parsed.opcode)
+            {
+                case 1: /* request */
+                    /* This function will transmit a "reply" to somebody's ARP request
+                     * for our IP address (as part of our user-mode TCP/IP).
+                     * Since we completely bypass the TCP/IP stack, we  have to handle ARPs
+                     * ourself, or the router will lose track of us.*/
+                    stack_arp_incoming_request(stack, ip_me.ipv4, parms->source_mac, px,
+                                               length);
+                    break;
+                case 2: /* response */
+                    /* This is for "arp scan" mode, where we are ARPing targets rather
+                     * than port scanning them */
+
+                    /* If we aren't doing an ARP scan, then ignore ARP responses */
+                    if (!masscan->scan_type.arp)
+                        break;
+
+                    /* If this response isn't in our range, then ignore it */
+                    if (!massip_has_ip(&masscan->targets, ip_them))
+                        break;
+
+                    /* Ignore duplicates */
+                    if (dedup_is_duplicate(dedup, ip_them, Templ_ARP, ip_me, 0))
+                        return;
+
+                    /* ...everything good, so now report this response */
+                    arp_recv_response(out, secs, px, length, &parsed);
+                    break;
+            }
+            return;
+        case FOUND_UDP:
+        case FOUND_DNS:
+            if (!is_nic_port(masscan, port_me))
+                return;
+            if (parms->masscan->nmap.packet_trace)
+                packet_trace(stdout, parms->pt_start, px, length, 0);
+            handle_udp(out, secs, px, length, &parsed, entropy);
+            return;
+        case FOUND_ICMP:
+            handle_icmp(out, secs, px, length, &parsed, entropy, rx->echo_reply_dedup);
+            return;
+        case FOUND_SCTP:
+            handle_sctp(out, secs, px, length, cookie, &parsed, entropy);
+            break;
+        case FOUND_OPROTO: /* other IP proto */
+            handle_oproto(out, secs, px, length, &parsed, entropy);
+            break;
+        case FOUND_TCP:
+            /* fall down to below */
+            break;
+        default:
+            return;
+    }
+
+    /* verify: my port number */
+    if (!is_my_port(stack->src, port_me))
+        return;
+    if (parms->masscan->nmap.packet_trace)
+        packet_trace(stdout, parms->pt_start, px, length, 0);
+
+    Q = 0;
+
+    /* Save raw packet in --pcap file */
+    if (rx->pcapfile)
+    {
+        pcapfile_writeframe(rx->pcapfile, px, length, length, secs, usecs);
+    }
+
+    {
+        char buf[64];
+        LOGip(5, ip_them, port_them, "-> TCP ackno=0x%08x flags=0x%02x(%s)\n", seqno_me,
+              TCP_FLAGS(px, parsed.transport_offset),
+              reason_string(TCP_FLAGS(px, parsed.transport_offset), buf, sizeof(buf)));
+    }
+
+    /* If recording --banners, create a new "TCP Control Block (TCB)" */
+    if (tcpcon)
+    {
+        struct TCP_Control_Block* tcb;
+
+        /* does a TCB already exist for this connection? */
+        tcb = tcpcon_lookup_tcb(tcpcon, ip_me, ip_them, port_me, port_them);
+
+        if (TCP_IS_SYNACK(px, parsed.transport_offset))
+        {
+            if (cookie != seqno_me - 1)
+            {
+                ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
+                LOG(0, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n", fmt.string,
+                    seqno_me - 1, cookie);
+                return;
+            }
+            if (tcb == NULL)
+            {
+                tcb = tcpcon_create_tcb(tcpcon, ip_me, ip_them, port_me, port_them,
+                                        seqno_me, seqno_them + 1, parsed.ip_ttl, NULL,
+                                        secs, usecs);
+                (*rx->total_tcbs)++;
+            }
+            Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_SYNACK, 0, 0, secs, usecs,
+                                    seqno_them + 1, seqno_me);
+        }
+        else if (tcb)
+        {
+            /* If this is an ACK, then handle that first */
+            if (TCP_IS_ACK(px, parsed.transport_offset))
+            {
+                Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_ACK, 0, 0, secs, usecs,
+                                        seqno_them, seqno_me);
+            }
+
+            /* If this contains payload, handle that second */
+            if (parsed.app_length)
+            {
+                Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_DATA,
+                                        px + parsed.app_offset, parsed.app_length, secs,
+                                        usecs, seqno_them, seqno_me);
+            }
+
+            /* If this is a FIN, handle that. Note that ACK +
+             * payload + FIN can come together */
+            if (TCP_IS_FIN(px, parsed.transport_offset) &&
+                !TCP_IS_RST(px, parsed.transport_offset))
+            {
+                Q += stack_incoming_tcp(
+                    tcpcon, tcb, TCP_WHAT_FIN, 0, 0, secs, usecs,
+                    seqno_them + parsed.app_length, /* the FIN comes after any data in
+                                                       the packet */
+                    seqno_me);
+            }
+
+            /* If this is a RST, then we'll be closing the connection */
+            if (TCP_IS_RST(px, parsed.transport_offset))
+            {
+                Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_RST, 0, 0, secs, usecs,
+                                        seqno_them, seqno_me);
+            }
+        }
+        else if (TCP_IS_FIN(px, parsed.transport_offset))
+        {
+            ipaddress_formatted_t fmt;
+            /*
+             * NO TCB!
+             *  This happens when we've sent a FIN, deleted our connection,
+             *  but the other side didn't get the packet.
+             */
+            fmt = ipaddress_fmt(ip_them);
+            LOG(4, "%s: received FIN but no TCB\n", fmt.string);
+            if (TCP_IS_RST(px, parsed.transport_offset))
+                ; /* ignore if it's own TCP flag is set */
+            else
+            {
+                int is_suppress;
+
+                is_suppress = rstfilter_is_filter(rx->rf, ip_me, port_me, ip_them, port_them);
+                if (!is_suppress)
+                    tcpcon_send_RST(tcpcon, ip_me, ip_them, port_me, port_them, seqno_them,
+                                    seqno_me);
+            }
+        }
+    }
+
+    if (Q == 0)
+        ;  // printf("\nerr\n");
+
+    if (TCP_IS_SYNACK(px, parsed.transport_offset) ||
+        TCP_IS_RST(px, parsed.transport_offset))
+    {
+        /* figure out the status */
+        status = PortStatus_Unknown;
+        if (TCP_IS_SYNACK(px, parsed.transport_offset))
+            status = PortStatus_Open;
+        if (TCP_IS_RST(px, parsed.transport_offset))
+        {
+            status = PortStatus_Closed;
+        }
+
+        /* verify: syn-cookies */
+        if (cookie != seqno_me - 1)
+        {
+            ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
+            LOG(2, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n", fmt.string,
+                seqno_me - 1, cookie);
+            return;
+        }
+
+        /* verify: ignore duplicates */
+        if (dedup_is_duplicate(dedup, ip_them, port_them, ip_me, port_me))
+            return;
+
+        /* keep statistics on number received */
+        if (TCP_IS_SYNACK(px, parsed.transport_offset))
+            (*rx->total_synacks)++;
+
+        /*
+         * This is where we do the output
+         */
+        output_report_status(out, global_now, status, ip_them, 6, /* ip proto = tcp */
+                             port_them,
+                             px[parsed.transport_offset + 13], /* tcp flags */
+                             parsed.ip_ttl, parsed.mac_src);
+
+        /*
+         * Send RST so other side isn't left hanging (only doing this in
+         * complete stateless mode where we aren't tracking banners)
+         */
+        if (tcpcon == NULL && !masscan->is_noreset)
+            tcp_send_RST(&parms->tmplset->pkts[Proto_TCP], stack, ip_them, ip_me,
+                         port_them, port_me, 0, seqno_me);
+    }
+}
+
+/***************************************************************************
+ * With --rx-threads, a worker thread processes the packets dispatched to
+ * it, owning its share of the TCP connections.
+ ***************************************************************************/
+static void receive_worker_thread(void* v)
+{
+    struct ReceiveThread* rx = (struct ReceiveThread*) v;
+
+    LOG(1, "[+] starting receive thread #%u.%u\n", rx->parms->nic_index, rx->rx_index);
+
+    /* Pin before creating the tables, so that they are allocated in
+     * memory local to this processor */
+    thread_placement(rx->cpu, rx->parms->numa_node);
+    receive_thread_init(rx);
+
+    for (;;)
+    {
+        struct ReceivedPacket* packets[64];
+        unsigned count;
+        unsigned i;
+
+        count = rte_ring_sc_dequeue_burst(rx->packets, (void**) packets, 64);
+        if (count == 0)
+        {
+            /* Only stop once everything dispatched so far is processed */
+            if (is_rx_done)
+                break;
+            if (rx->tcpcon)
+                tcpcon_timeouts(rx->tcpcon, (unsigned) time(0), 0);
+            pixie_usleep(100);
+            continue;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            receive_packet(rx, packets[i]->px, packets[i]->length, packets[i]->secs,
+                           packets[i]->usecs);
+            rte_ring_sp_enqueue(rx->free_packets, packets[i]);
+        }
+    }
+
+    LOG(1, "[+] exiting receive thread #%u.%u                    \n", rx->parms->nic_index,
+        rx->rx_index);
+    receive_thread_cleanup(rx);
+}
+
+/***************************************************************************
+ * With --rx-threads, the thread reading from the adapter only parses
+ * enough of each packet to find its flow, then hands it to the worker
+ * owning that flow. The flow hash is symmetric, the same one that the
+ * TCB table uses, so every packet of a connection goes to the same
+ * worker. A different seed than the TCB tables is used, so that each
+ * worker's share still spreads across all of its own table.
+ ***************************************************************************/
+static void receive_dispatch(struct ThreadPair* parms, struct PcapFile* pcapfile)
+{
+    const struct Masscan* masscan = parms->masscan;
+    struct Adapter* adapter = parms->adapter;
+    struct stack_t* stack = parms->stack;
+    int data_link = stack_if_datalink(adapter);
+    uint64_t entropy = masscan->seed + 1;
+    unsigned i;
+
+    /*
+     * Create the queues to each worker, then start them
+     */
+    for (i = 0; i < parms->rx_count; i++)
+    {
+        struct ReceiveThread* rx = &parms->rx[i];
+        unsigned j;
+
+        rx->packets = rte_ring_create(RECEIVED_PACKET_COUNT, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        rx->free_packets = rte_ring_create(RECEIVED_PACKET_COUNT, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        for (j = 0; j < RECEIVED_PACKET_COUNT - 1; j++)
+            rte_ring_sp_enqueue(rx->free_packets, MALLOC(sizeof(struct ReceivedPacket)));
+
+        rx->thread_handle_recv = pixie_begin_thread(receive_worker_thread, 0, rx);
+    }
+
+    LOG(2, "[+] THREAD: recv: starting dispatch loop\n");
+    while (!is_rx_done)
+    {
+        struct RawsockBatch batch;
+        unsigned length;
+        unsigned secs;
+        unsigned usecs;
+        const unsigned char* px;
+
+        if (rawsock_recv_batch(adapter, &batch) != 0)
+            continue;
+
+        while (rawsock_batch_next(&batch, &length, &secs, &usecs, &px))
+        {
+            struct PreprocessedInfo parsed;
+            struct ReceiveThread* rx;
+            struct ReceivedPacket* p = NULL;
+            unsigned port_me = 0;
+            unsigned port_them = 0;
+            unsigned hash;
+
+            if (length > 1514)
+                continue;
+            if (!preprocess_frame(px, length, data_link, &parsed))
+                continue; /* corrupt packet */
+
+            switch (parsed.found)
+            {
+                case FOUND_TCP:
+                case FOUND_UDP:
+                case FOUND_DNS:
+                case FOUND_SCTP:
+                    port_me = parsed.port_dst;
+                    port_them = parsed.port_src;
+                    break;
+            }
+            hash = tcb_hash(parsed.dst_ip, port_me, parsed.src_ip, port_them, entropy);
+            rx = &parms->rx[hash % parms->rx_count];
+
+            /* Save raw packet in --pcap file. The workers don't, since
+             * they'd each need their own file */
+            if (pcapfile && parsed.found == FOUND_TCP && is_my_ip(stack->src, parsed.dst_ip) &&
+                is_my_port(stack->src, port_me))
+            {
+                pcapfile_writeframe(pcapfile, px, length, length, secs, usecs);
+            }
+
+            /* Wait for the worker to free up a buffer */
+            while (rte_ring_sc_dequeue(rx->free_packets, (void**) &p) != 0)
+            {
+                if (is_rx_done)
+                    break;
+                pixie_usleep(100);
+            }
+            if (is_rx_done)
+                break;
+
+            p->length = length;
+            p->secs = secs;
+            p->usecs = usecs;
+            memcpy(p->px, px, length);
+            rte_ring_sp_enqueue(rx->packets, p);
         }
+
+        rawsock_release_batch(adapter, &batch);
+    }
+
+    for (i = 0; i < parms->rx_count; i++)
+        pixie_thread_join(parms->rx[i].thread_handle_recv);
+
+    /* Free the buffers, including any dispatched after a worker's last
+     * look at its queue */
+    for (i = 0; i < parms->rx_count; i++)
+    {
+        struct ReceiveThread* rx = &parms->rx[i];
+        void* p;
+
+        while (rte_ring_sc_dequeue(rx->packets, &p) == 0) free(p);
+        while (rte_ring_sc_dequeue(rx->free_packets, &p) == 0) free(p);
+        free(rx->packets);
+        free(rx->free_packets);
+        rx->packets = NULL;
+        rx->free_packets = NULL;
     }
+}
+
+/***************************************************************************
+ * Receive packets from the adapter and process them in this thread.
+ ***************************************************************************/
+static void receive_inline(struct ReceiveThread* rx)
+{
+    struct ThreadPair* parms = rx->parms;
+    const struct Masscan* masscan = parms->masscan;
+    struct Adapter* adapter = parms->adapter;
+
+    receive_thread_init(rx);
 
     /*
      * In "offline" mode, we don't have any receive threads, so simply
@@ -692,8 +1396,8 @@ static void receive_thread(void* v)
     if (masscan->is_offline)
     {
         while (!is_rx_done) pixie_usleep(10000);
-        parms->done_receiving = 1;
-        goto end;
+        receive_thread_cleanup(rx);
+        return;
     }
 
     /*
@@ -703,351 +1407,87 @@ static void receive_thread(void* v)
     LOG(2, "[+] THREAD: recv: starting main loop\n");
     while (!is_rx_done)
     {
-        int status;
+        struct RawsockBatch batch;
         unsigned length;
         unsigned secs;
         unsigned usecs;
         const unsigned char* px;
         int err;
-        unsigned x;
-        struct PreprocessedInfo parsed;
-        ipaddress ip_me;
-        unsigned port_me;
-        ipaddress ip_them;
-        unsigned port_them;
-        unsigned seqno_me;
-        unsigned seqno_them;
-        unsigned cookie;
-        unsigned Q = 0;
 
         /*
          * RECEIVE
          *
-         * This is the boring part of actually receiving a packet
+         * This is the boring part of actually receiving packets. With
+         * --rx-ring, this is a whole block of packets retired by the
+         * kernel, which we process in place without copying. Otherwise,
+         * it's the single packet returned by libpcap.
          */
-        err = rawsock_recv_packet(adapter, &length, &secs, &usecs, &px);
+        err = rawsock_recv_batch(adapter, &batch);
         if (err != 0)
         {
-            if (tcpcon)
-                tcpcon_timeouts(tcpcon, (unsigned) time(0), 0);
-            continue;
-        }
-
-        /*
-         * Do any TCP event timeouts based on the current timestamp from
-         * the packet. For example, if the connection has been open for
-         * around 10 seconds, we'll close the connection. (--banners)
-         */
-        if (tcpcon)
-        {
-            tcpcon_timeouts(tcpcon, secs, usecs);
-        }
-
-        if (length > 1514)
-            continue;
-
-        /*
-         * "Preprocess" the response packet. This means to go through and
-         * figure out where the TCP/IP headers are and the locations of
-         * some fields, like IP address and port numbers.
-         */
-        x = preprocess_frame(px, length, data_link, &parsed);
-        if (!x)
-            continue; /* corrupt packet */
-        ip_me = parsed.dst_ip;
-        ip_them = parsed.src_ip;
-        port_me = parsed.port_dst;
-        port_them = parsed.port_src;
-        seqno_them = TCP_SEQNO(px, parsed.transport_offset);
-        seqno_me = TCP_ACKNO(px, parsed.transport_offset);
-
-        assert(ip_me.version != 0);
-        assert(ip_them.version != 0);
-
-        switch (parsed.ip_protocol)
-        {
-            case 132: /* SCTP */
-                cookie =
-                    syn_cookie(ip_them, port_them | (Proto_SCTP << 16), ip_me, port_me, entropy) &
-                    0xFFFFFFFF;
-                break;
-            default:
-                cookie = syn_cookie(ip_them, port_them, ip_me, port_me, entropy) & 0xFFFFFFFF;
-        }
-
-        /* verify: my IP address */
-        if (!is_my_ip(stack->src, ip_me))
-        {
-            /* NDP Neighbor Solicitations don't come to our IP address, but to
-             * a multicast address */
-            if (is_ipv6_multicast(ip_me))
-            {
-                if (parsed.found == FOUND_NDPv6 && parsed.opcode == 135)
-                {
-                    stack_ndpv6_incoming_request(stack, &parsed, px, length);
-                }
-            }
-            continue;
-        }
-
-        /*
-         * Handle non-TCP protocols
-         */
-        switch (parsed.found)
-        {
-            case FOUND_NDPv6:
-                switch (parsed.opcode)
-                {
-                    case 133: /* Router Solicitation */
-                        /* Ignore router solicitations, since we aren't a router */
-                        continue;
-                    case 134: /* Router advertisement */
-                        /* TODO: We need to process router advertisements while scanning
-                         * so that we can print warning messages if router information
-                         * changes while scanning. */
-                        continue;
-                    case 135: /* Neighbor Solicitation */
-                        /* When responses come back from our scans, the router will send us
-                         * these packets. We need to respond to them, so that the router
-                         * can then forward the packets to us. If we don't respond, we'll
-                         * get no responses. */
-                        stack_ndpv6_incoming_request(stack, &parsed, px, length);
-                        continue;
-                    case 136: /* Neighbor Advertisement */
-                        /* TODO: If doing an --ndpscan, the scanner subsystem needs to deal
-                         * with these */
-                        continue;
-                    case 137: /* Redirect */
-                        /* We ignore these, since we really don't have the capability to send
-                         * packets to one router for some destinations and to another router
-                         * for other destinations */
-                        continue;
-                    default:
-                        break;
-                }
-                continue;
-            case FOUND_ARP:
-                LOGip(2, ip_them, 0, "-> ARP [%u] \n", px[parsed.found_offset]);
-
-                switch (parsed.opcode)
-                {
-                    case 1: /* request */
-                        /* This function will transmit a "reply" to somebody's ARP request
-                         * for our IP address (as part of our user-mode TCP/IP).
-                         * Since we completely bypass the TCP/IP stack, we  have to handle ARPs
-                         * ourself, or the router will lose track of us.*/
-                        stack_arp_incoming_request(stack, ip_me.ipv4, parms->source_mac, px,
-                                                   length);
-                        break;
-                    case 2: /* response */
-                        /* This is for "arp scan" mode, where we are ARPing targets rather
-                         * than port scanning them */
-
-                        /* If we aren't doing an ARP scan, then ignore ARP responses */
-                        if (!masscan->scan_type.arp)
-                            break;
-
-                        /* If this response isn't in our range, then ignore it */
-                        if (!rangelist_is_contains(&masscan->targets.ipv4, ip_them.ipv4))
-                            break;
-
-                        /* Ignore duplicates */
-                        if (dedup_is_duplicate(dedup, ip_them, 0, ip_me, 0))
-                            continue;
-
-                        /* ...everything good, so now report this response */
-                        arp_recv_response(out, secs, px, length, &parsed);
-                        break;
-                }
-                continue;
-            case FOUND_UDP:
-            case FOUND_DNS:
-                if (!is_nic_port(masscan, port_me))
-                    continue;
-                if (parms->masscan->nmap.packet_trace)
-                    packet_trace(stdout, parms->pt_start, px, length, 0);
-                handle_udp(out, secs, px, length, &parsed, entropy);
-                continue;
-            case FOUND_ICMP:
-                handle_icmp(out, secs, px, length, &parsed, entropy);
-                continue;
-            case FOUND_SCTP:
-                handle_sctp(out, secs, px, length, cookie, &parsed, entropy);
-                break;
-            case FOUND_OPROTO: /* other IP proto */
-                handle_oproto(out, secs, px, length, &parsed, entropy);
-                break;
-            case FOUND_TCP:
-                /* fall down to below */
-                break;
-            default:
-                continue;
-        }
-
-        /* verify: my port number */
-        if (!is_my_port(stack->src, port_me))
+            if (rx->tcpcon)
+                tcpcon_timeouts(rx->tcpcon, (unsigned) time(0), 0);
             continue;
-        if (parms->masscan->nmap.packet_trace)
-            packet_trace(stdout, parms->pt_start, px, length, 0);
-
-        Q = 0;
-
-        /* Save raw packet in --pcap file */
-        if (pcapfile)
-        {
-            pcapfile_writeframe(pcapfile, px, length, length, secs, usecs);
-        }
-
-        {
-            char buf[64];
-            LOGip(5, ip_them, port_them, "-> TCP ackno=0x%08x flags=0x%02x(%s)\n", seqno_me,
-                  TCP_FLAGS(px, parsed.transport_offset),
-                  reason_string(TCP_FLAGS(px, parsed.transport_offset), buf, sizeof(buf)));
         }
 
-        /* If recording --banners, create a new "TCP Control Block (TCB)" */
-        if (tcpcon)
-        {
-            struct TCP_Control_Block* tcb;
-
-            /* does a TCB already exist for this connection? */
-            tcb = tcpcon_lookup_tcb(tcpcon, ip_me, ip_them, port_me, port_them);
-
-            if (TCP_IS_SYNACK(px, parsed.transport_offset))
-            {
-                if (cookie != seqno_me - 1)
-                {
-                    ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
-                    LOG(0, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n", fmt.string,
-                        seqno_me - 1, cookie);
-                    continue;
-                }
-                if (tcb == NULL)
-                {
-                    tcb = tcpcon_create_tcb(tcpcon, ip_me, ip_them, port_me, port_them, seqno_me,
-                                            seqno_them + 1, parsed.ip_ttl, NULL, secs, usecs);
-                    (*status_tcb_count)++;
-                }
-                Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_SYNACK, 0, 0, secs, usecs,
-                                        seqno_them + 1, seqno_me);
-            }
-            else if (tcb)
-            {
-                /* If this is an ACK, then handle that first */
-                if (TCP_IS_ACK(px, parsed.transport_offset))
-                {
-                    Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_ACK, 0, 0, secs, usecs,
-                                            seqno_them, seqno_me);
-                }
-
-                /* If this contains payload, handle that second */
-                if (parsed.app_length)
-                {
-                    Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_DATA, px + parsed.app_offset,
-                                            parsed.app_length, secs, usecs, seqno_them, seqno_me);
-                }
-
-                /* If this is a FIN, handle that. Note that ACK +
-                 * payload + FIN can come together */
-                if (TCP_IS_FIN(px, parsed.transport_offset) &&
-                    !TCP_IS_RST(px, parsed.transport_offset))
-                {
-                    Q += stack_incoming_tcp(
-                        tcpcon, tcb, TCP_WHAT_FIN, 0, 0, secs, usecs,
-                        seqno_them + parsed.app_length, /* the FIN comes after any data in
-                                                           the packet */
-                        seqno_me);
-                }
-
-                /* If this is a RST, then we'll be closing the connection */
-                if (TCP_IS_RST(px, parsed.transport_offset))
-                {
-                    Q += stack_incoming_tcp(tcpcon, tcb, TCP_WHAT_RST, 0, 0, secs, usecs,
-                                            seqno_them, seqno_me);
-                }
-            }
-            else if (TCP_IS_FIN(px, parsed.transport_offset))
-            {
-                ipaddress_formatted_t fmt;
-                /*
-                 * NO TCB!
-                 *  This happens when we've sent a FIN, deleted our connection,
-                 *  but the other side didn't get the packet.
-                 */
-                fmt = ipaddress_fmt(ip_them);
-                LOG(4, "%s: received FIN but no TCB\n", fmt.string);
-                if (TCP_IS_RST(px, parsed.transport_offset))
-                    ; /* ignore if it's own TCP flag is set */
-                else
-                {
-                    int is_suppress;
-
-                    is_suppress = rstfilter_is_filter(rf, ip_me, port_me, ip_them, port_them);
-                    if (!is_suppress)
-                        tcpcon_send_RST(tcpcon, ip_me, ip_them, port_me, port_them, seqno_them,
-                                        seqno_me);
-                }
-            }
-        }
+        while (rawsock_batch_next(&batch, &length, &secs, &usecs, &px))
+            receive_packet(rx, px, length, secs, usecs);
 
-        if (Q == 0)
-            ;  // printf("\nerr\n");
+        /* The packets point into the kernel's ring, so only hand the block
+         * back after we've finished with all of them */
+        rawsock_release_batch(adapter, &batch);
+    }
 
-        if (TCP_IS_SYNACK(px, parsed.transport_offset) || TCP_IS_RST(px, parsed.transport_offset))
-        {
-            /* figure out the status */
-            status = PortStatus_Unknown;
-            if (TCP_IS_SYNACK(px, parsed.transport_offset))
-                status = PortStatus_Open;
-            if (TCP_IS_RST(px, parsed.transport_offset))
-            {
-                status = PortStatus_Closed;
-            }
+    LOG(1, "[+] exiting receive thread #%u                    \n", parms->nic_index);
 
-            /* verify: syn-cookies */
-            if (cookie != seqno_me - 1)
-            {
-                ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
-                LOG(2, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n", fmt.string, seqno_me - 1,
-                    cookie);
-                continue;
-            }
+    receive_thread_cleanup(rx);
+}
 
-            /* verify: ignore duplicates */
-            if (dedup_is_duplicate(dedup, ip_them, port_them, ip_me, port_me))
-                continue;
+/***************************************************************************
+ *
+ * Asynchronous receive thread
+ *
+ * The transmit and receive threads run independently of each other. There
+ * is no record what was transmitted. Instead, the transmit thread sets a
+ * "SYN-cookie" in transmitted packets, which the receive thread will then
+ * use to match up requests with responses.
+ ***************************************************************************/
+static void receive_thread(void* v)
+{
+    struct ThreadPair* parms = (struct ThreadPair*) v;
+    const struct Masscan* masscan = parms->masscan;
+    struct PcapFile* pcapfile = NULL;
 
-            /* keep statistics on number received */
-            if (TCP_IS_SYNACK(px, parsed.transport_offset))
-                (*status_synack_count)++;
+    LOG(1, "[+] starting receive thread #%u\n", parms->nic_index);
 
-            /*
-             * This is where we do the output
-             */
-            output_report_status(out, global_now, status, ip_them, 6,         /* ip proto = tcp */
-                                 port_them, px[parsed.transport_offset + 13], /* tcp flags */
-                                 parsed.ip_ttl, parsed.mac_src);
+    /* Lock this thread to a CPU (--cpu-map) */
+    thread_placement(parms->cpu, parms->numa_node);
 
-            /*
-             * Send RST so other side isn't left hanging (only doing this in
-             * complete stateless mode where we aren't tracking banners)
-             */
-            if (tcpcon == NULL && !masscan->is_noreset)
-                tcp_send_RST(&parms->tmplset->pkts[Proto_TCP], parms->stack, ip_them, ip_me,
-                             port_them, port_me, 0, seqno_me);
-        }
+    /*
+     * If configured, open a --pcap file for saving raw packets. This is
+     * so that we can debug scans, but also so that we can look at the
+     * strange things people send us. Note that we don't record transmitted
+     * packets, just the packets we've received.
+     */
+    if (masscan->pcap_filename[0])
+    {
+        pcapfile = pcapfile_openwrite(masscan->pcap_filename, 1);
     }
 
-    LOG(1, "[+] exiting receive thread #%u                    \n", parms->nic_index);
-
     /*
-     * cleanup
+     * With --rx-threads, this thread only reads packets and dispatches
+     * them to the workers. Otherwise, it processes them itself.
      */
-end:
-    if (tcpcon)
-        tcpcon_destroy_table(tcpcon);
-    dedup_destroy(dedup);
-    output_destroy(out);
+    if (parms->rx_count > 1 && !masscan->is_offline)
+    {
+        receive_dispatch(parms, pcapfile);
+    }
+    else
+    {
+        parms->rx[0].pcapfile = pcapfile;
+        receive_inline(&parms->rx[0]);
+    }
+
     if (pcapfile)
         pcapfile_close(pcapfile);
 
@@ -1057,6 +1497,74 @@ end:
     parms->done_receiving = 1;
 }
 
+/***************************************************************************
+ * Decide which processor each of an adapter's threads runs on. They are
+ * assigned in order: the transmit threads, the receive thread, then any
+ * receive workers. With --cpu-map, processors are taken from that list,
+ * continuing from where the previous adapter left off. Otherwise, they
+ * are taken from the processors on the adapter's NUMA node, so that
+ * packets and tables don't cross between sockets, or not pinned at all
+ * if we don't know the adapter's node.
+ ***************************************************************************/
+static void assign_cpus(const struct Masscan* masscan, struct ThreadPair* parms,
+                        unsigned* next_cpu)
+{
+    unsigned allowed[256];
+    unsigned allowed_count;
+    unsigned cpus[256];
+    unsigned cpu_count = 0;
+    unsigned* next;
+    unsigned i;
+
+    parms->cpu = -1;
+    for (i = 0; i < parms->xmit_count; i++)
+        parms->xmit[i].cpu = -1;
+    for (i = 0; i < parms->rx_count; i++)
+        parms->rx[i].cpu = -1;
+
+    if (masscan->cpu_map.is_none)
+        return;
+
+    if (masscan->cpu_map.count)
+    {
+        memcpy(cpus, masscan->cpu_map.list, masscan->cpu_map.count * sizeof(cpus[0]));
+        cpu_count = masscan->cpu_map.count;
+        next = &next_cpu[0];
+    }
+    else
+    {
+        /* Without knowing the adapter's node, there's no reason to pin
+         * threads anywhere in particular, so leave them to the system */
+        if (parms->numa_node < 0 || parms->numa_node >= 64)
+            return;
+        allowed_count = pixie_cpu_get_allowed(allowed, 256);
+        if (allowed_count <= 1)
+            return;
+
+        /* Use only the processors on the adapter's node */
+        for (i = 0; i < allowed_count; i++)
+            if (pixie_cpu_get_numa_node(allowed[i]) == parms->numa_node)
+                cpus[cpu_count++] = allowed[i];
+        if (cpu_count == 0)
+            return;
+        next = &next_cpu[1 + parms->numa_node];
+    }
+
+    for (i = 0; i < parms->xmit_count; i++)
+        parms->xmit[i].cpu = cpus[(*next)++ % cpu_count];
+    parms->cpu = cpus[(*next)++ % cpu_count];
+    if (parms->rx_count > 1)
+    {
+        for (i = 0; i < parms->rx_count; i++)
+            parms->rx[i].cpu = cpus[(*next)++ % cpu_count];
+    }
+
+    for (i = 0; i < parms->xmit_count; i++)
+        LOG(1, "[+] transmit thread #%u.%u: cpu %d\n", parms->nic_index, i, parms->xmit[i].cpu);
+    LOG(1, "[+] receive thread #%u: cpu %d, numa node %d\n", parms->nic_index, parms->cpu,
+        parms->numa_node);
+}
+
 /***************************************************************************
  * We trap the <ctrl-c> so that instead of exiting immediately, we sit in
  * a loop for a few seconds waiting for any late response. But, the user
@@ -1108,9 +1616,17 @@ static int main_scan(struct Masscan* masscan)
     uint64_t min_index = UINT64_MAX;
     struct MassVulnCheck* vulncheck = NULL;
     struct stack_t* stack;
+    unsigned next_cpu[65] = {0};
+    struct RateControl ratectl;
+    uint64_t ratectl_timestamp;
+    struct DedupBitmap* dedup_bitmap = NULL;
 
     memset(parms_array, 0, sizeof(parms_array));
 
+    /* The transmit threads pace packets on this clock */
+    if (masscan->pacing != Pacing_None)
+        pixie_fasttime_calibrate();
+
     /*
      * Vuln check initialization
      */
@@ -1169,6 +1685,16 @@ static int main_scan(struct Masscan* masscan)
         }
     }
 
+    /*
+     * PF_RING has a single transmit ring per adapter, which isn't safe
+     * to share between threads
+     */
+    if (masscan->is_pfring && masscan->tx_thread_count > 1)
+    {
+        LOG(0, "FAIL: --tx-threads cannot be used with --pfring\n");
+        return 1;
+    }
+
     /*
      * If the IP address range is very big, then require that that the
      * user apply an exclude range
@@ -1190,6 +1716,13 @@ static int main_scan(struct Masscan* masscan)
     payloads_udp_trim(masscan->payloads.udp, &masscan->targets);
     payloads_oproto_trim(masscan->payloads.oproto, &masscan->targets);
 
+    /*
+     * With --dedup-exact, all the receive threads share one bit for
+     * every target, rather than each remembering recent responses
+     */
+    if (masscan->is_dedup_exact)
+        dedup_bitmap = dedup_bitmap_create(&masscan->targets);
+
 #ifdef __AFL_HAVE_MANUAL_CONTROL
     __AFL_INIT();
 #endif
@@ -1200,18 +1733,35 @@ static int main_scan(struct Masscan* masscan)
     for (index = 0; index < masscan->nic_count; index++)
     {
         struct ThreadPair* parms = &parms_array[index];
+        char ifname[256] = "";
+        unsigned i;
         int err;
 
         parms->masscan = masscan;
         parms->nic_index = index;
-        parms->my_index = masscan->resume.index;
-        parms->done_transmitting = 0;
         parms->done_receiving = 0;
+        parms->dedup_bitmap = dedup_bitmap;
 
         /* needed for --packet-trace option so that we know when we started
          * the scan */
         parms->pt_start = 1.0 * pixie_gettime() / 1000000.0;
 
+        /*
+         * Allocate this adapter's transmit rings, packet buffers and
+         * templates in memory local to its NUMA node, which means knowing
+         * which interface we'll use before opening it
+         */
+        if (masscan->nic[index].ifname[0])
+            parms->numa_node = rawsock_get_adapter_numa_node(masscan->nic[index].ifname);
+        else if (rawsock_get_default_interface(ifname, sizeof(ifname)) == 0)
+            parms->numa_node = rawsock_get_adapter_numa_node(ifname);
+        else
+            parms->numa_node = -1;
+        if (masscan->cpu_map.is_none)
+            parms->numa_node = -1;
+        if (parms->numa_node >= 0)
+            pixie_numa_set_preferred(parms->numa_node);
+
         /*
          * Turn the adapter on, and get the running configuration
          */
@@ -1253,7 +1803,20 @@ static int main_scan(struct Masscan* masscan)
             masscan->nic[index].src.port.range = 16;
         }
 
-        stack = stack_create(parms->source_mac, &masscan->nic[index].src);
+        /*
+         * Create the receive threads for this adapter (--rx-threads). With
+         * more than one, they all queue packets on the same stack, each
+         * through its own clone.
+         */
+        parms->rx_count = masscan->rx_thread_count ? masscan->rx_thread_count : 1;
+        parms->rx = CALLOC(parms->rx_count, sizeof(parms->rx[0]));
+        for (i = 0; i < parms->rx_count; i++)
+        {
+            parms->rx[i].parms = parms;
+            parms->rx[i].rx_index = i;
+        }
+
+        stack = stack_create(parms->source_mac, &masscan->nic[index].src, parms->rx_count > 1);
         parms->stack = stack;
 
         /*
@@ -1265,6 +1828,33 @@ static int main_scan(struct Masscan* masscan)
         if (masscan->nic[0].is_vlan)
             template_set_vlan(parms->tmplset, masscan->nic[0].vlan_id);
 
+        /*
+         * Create the transmit threads for this adapter (--tx-threads). The
+         * first uses the adapter itself, the others get their own clone
+         * of it, so that each has a separate transmit queue.
+         */
+        parms->xmit_count = masscan->tx_thread_count ? masscan->tx_thread_count : 1;
+        parms->xmit = CALLOC(parms->xmit_count, sizeof(parms->xmit[0]));
+        for (i = 0; i < parms->xmit_count; i++)
+        {
+            struct TransmitThread* xmit = &parms->xmit[i];
+
+            xmit->parms = parms;
+            xmit->tx_index = i;
+            xmit->my_index = masscan->resume.index;
+            xmit->done_transmitting = 0;
+            if (i == 0)
+                xmit->adapter = parms->adapter;
+            else
+                xmit->adapter = rawsock_clone_adapter(parms->adapter);
+        }
+
+        /*
+         * Decide which processors the threads will run on
+         */
+        assign_cpus(masscan, parms, next_cpu);
+        pixie_numa_set_preferred(-1);
+
         /*
          * trap <ctrl-c> to pause
          */
@@ -1307,13 +1897,16 @@ static int main_scan(struct Masscan* masscan)
     for (index = 0; index < masscan->nic_count; index++)
     {
         struct ThreadPair* parms = &parms_array[index];
+        unsigned i;
 
         /*
-         * Start the scanning thread.
+         * Start the scanning threads.
          * THIS IS WHERE THE PROGRAM STARTS SPEWING OUT PACKETS AT A HIGH
          * RATE OF SPEED.
          */
-        parms->thread_handle_xmit = pixie_begin_thread(transmit_thread, 0, parms);
+        for (i = 0; i < parms->xmit_count; i++)
+            parms->xmit[i].thread_handle_xmit =
+                pixie_begin_thread(transmit_thread, 0, &parms->xmit[i]);
 
         /*
          * Start the MATCHING receive thread. Transmit and receive threads
@@ -1329,31 +1922,58 @@ static int main_scan(struct Masscan* masscan)
     LOG(1, "[+] waiting for threads to finish\n");
     status_start(&status);
     status.is_infinite = masscan->is_infinite;
-    while (!is_tx_done && masscan->output.is_status_updates)
+    if (masscan->rate_auto.is_enabled)
+        ratectl_start(&ratectl, masscan->rate_auto.min_rate, masscan->max_rate);
+    ratectl_timestamp = pixie_gettime();
+    while (!is_tx_done && (masscan->output.is_status_updates || masscan->rate_auto.is_enabled))
     {
         unsigned i;
         double rate = 0;
         uint64_t total_tcbs = 0;
         uint64_t total_synacks = 0;
         uint64_t total_syns = 0;
+        uint64_t total_drops = 0;
+        double backlog = 0;
 
         /* Find the minimum index of all the threads */
         min_index = UINT64_MAX;
         for (i = 0; i < masscan->nic_count; i++)
         {
             struct ThreadPair* parms = &parms_array[i];
+            unsigned j;
+
+            for (j = 0; j < parms->xmit_count; j++)
+            {
+                struct TransmitThread* xmit = &parms->xmit[j];
+
+                if (min_index > xmit->my_index)
+                    min_index = xmit->my_index;
+
+                rate += xmit->throttler->current_rate;
 
-            if (min_index > parms->my_index)
-                min_index = parms->my_index;
+                if (xmit->total_syns)
+                    total_syns += *xmit->total_syns;
 
-            rate += parms->throttler->current_rate;
+                /* Clones share the receive side with the adapter, so only
+                 * their transmit failures are their own */
+                if (xmit->adapter && xmit->adapter != parms->adapter)
+                    total_drops += xmit->adapter->tx_dropped;
+                if (backlog < (double) xmit->tx_backlog / STACK_BUFFER_COUNT)
+                    backlog = (double) xmit->tx_backlog / STACK_BUFFER_COUNT;
+            }
+
+            for (j = 0; j < parms->rx_count; j++)
+            {
+                struct ReceiveThread* rx = &parms->rx[j];
+
+                if (rx->total_tcbs)
+                    total_tcbs += *rx->total_tcbs;
+                if (rx->total_synacks)
+                    total_synacks += *rx->total_synacks;
+            }
 
-            if (parms->total_tcbs)
-                total_tcbs += *parms->total_tcbs;
-            if (parms->total_synacks)
-                total_synacks += *parms->total_synacks;
-            if (parms->total_syns)
-                total_syns += *parms->total_syns;
+            if (masscan->rate_auto.is_enabled)
+                total_drops += rawsock_get_drops(parms->adapter);
         }
 
         if (min_index >= range && !masscan->is_infinite)
@@ -1370,6 +1990,26 @@ static int main_scan(struct Masscan* masscan)
             status_print(&status, min_index, range, rate, total_tcbs, total_synacks, total_syns, 0,
                          masscan->output.is_status_ndjson);
 
+        /* --rate auto: speed up or slow down all the transmit threads */
+        if (masscan->rate_auto.is_enabled)
+        {
+            uint64_t timestamp = pixie_gettime();
+            double new_rate;
+
+            new_rate = ratectl_update(&ratectl, (timestamp - ratectl_timestamp) / 1000000.0,
+                                      total_syns, total_synacks, total_drops, backlog);
+            ratectl_timestamp = timestamp;
+            for (i = 0; i < masscan->nic_count; i++)
+            {
+                struct ThreadPair* parms = &parms_array[i];
+                unsigned j;
+
+                for (j = 0; j < parms->xmit_count; j++)
+                    throttler_set_rate(parms->xmit[j].throttler,
+                                       new_rate / masscan->nic_count / parms->xmit_count);
+            }
+        }
+
         /* Sleep for almost a second */
         pixie_mssleep(750);
     }
@@ -1394,6 +2034,7 @@ static int main_scan(struct Masscan* masscan)
     for (;;)
     {
         unsigned transmit_count = 0;
+        unsigned transmit_total = 0;
         unsigned receive_count = 0;
         unsigned i;
         double rate = 0;
@@ -1406,18 +2047,30 @@ static int main_scan(struct Masscan* masscan)
         for (i = 0; i < masscan->nic_count; i++)
         {
             struct ThreadPair* parms = &parms_array[i];
+            unsigned j;
+
+            for (j = 0; j < parms->xmit_count; j++)
+            {
+                struct TransmitThread* xmit = &parms->xmit[j];
 
-            if (min_index > parms->my_index)
-                min_index = parms->my_index;
+                if (min_index > xmit->my_index)
+                    min_index = xmit->my_index;
 
-            rate += parms->throttler->current_rate;
+                rate += xmit->throttler->current_rate;
 
-            if (parms->total_tcbs)
-                total_tcbs += *parms->total_tcbs;
-            if (parms->total_synacks)
-                total_synacks += *parms->total_synacks;
-            if (parms->total_syns)
-                total_syns += *parms->total_syns;
+                if (xmit->total_syns)
+                    total_syns += *xmit->total_syns;
+            }
+
+            for (j = 0; j < parms->rx_count; j++)
+            {
+                struct ReceiveThread* rx = &parms->rx[j];
+
+                if (rx->total_tcbs)
+                    total_tcbs += *rx->total_tcbs;
+                if (rx->total_synacks)
+                    total_synacks += *rx->total_synacks;
+            }
         }
 
         if (time(0) - now >= masscan->wait)
@@ -1439,14 +2092,17 @@ static int main_scan(struct Masscan* masscan)
             for (i = 0; i < masscan->nic_count; i++)
             {
                 struct ThreadPair* parms = &parms_array[i];
+                unsigned j;
 
-                transmit_count += parms->done_transmitting;
+                for (j = 0; j < parms->xmit_count; j++)
+                    transmit_count += parms->xmit[j].done_transmitting;
+                transmit_total += parms->xmit_count;
                 receive_count += parms->done_receiving;
             }
 
             pixie_mssleep(250);
 
-            if (transmit_count < masscan->nic_count)
+            if (transmit_count < transmit_total)
                 continue;
             is_tx_done = 1;
             is_rx_done = 1;
@@ -1462,9 +2118,13 @@ static int main_scan(struct Masscan* masscan)
             for (i = 0; i < masscan->nic_count; i++)
             {
                 struct ThreadPair* parms = &parms_array[i];
+                unsigned j;
 
-                pixie_thread_join(parms->thread_handle_xmit);
-                parms->thread_handle_xmit = 0;
+                for (j = 0; j < parms->xmit_count; j++)
+                {
+                    pixie_thread_join(parms->xmit[j].thread_handle_xmit);
+                    parms->xmit[j].thread_handle_xmit = 0;
+                }
                 pixie_thread_join(parms->thread_handle_recv);
                 parms->thread_handle_recv = 0;
             }
@@ -1479,6 +2139,27 @@ static int main_scan(struct Masscan* masscan)
      * Now cleanup everything
      */
     status_finish(&status);
+    dedup_bitmap_destroy(dedup_bitmap);
+
+    /* The transmit threads are done, but may not have returned yet, so
+     * wait for them before closing their clones of the adapter */
+    for (index = 0; index < masscan->nic_count; index++)
+    {
+        struct ThreadPair* parms = &parms_array[index];
+        unsigned j;
+
+        for (j = 0; j < parms->xmit_count; j++)
+        {
+            struct TransmitThread* xmit = &parms->xmit[j];
+
+            if (xmit->thread_handle_xmit)
+                pixie_thread_join(xmit->thread_handle_xmit);
+            xmit->thread_handle_xmit = 0;
+            if (xmit->adapter != parms->adapter)
+                rawsock_close_clone(xmit->adapter);
+            xmit->adapter = NULL;
+        }
+    }
 
     if (!masscan->output.is_status_updates)
     {
@@ -1605,6 +2286,19 @@ int main(int argc, char* argv[])
      * of their ranges, and when doing wide scans, add the exclude list to
      * prevent them from being scanned.
      */
+    if (masscan->target_image.load_filename[0])
+    {
+        /* The saved image already has its excludes applied; any given now
+         * are applied on top of it below */
+        if (massip_has_ipv4_targets(&masscan->targets) ||
+            massip_has_ipv6_targets(&masscan->targets))
+        {
+            LOG(0, "[-] FAIL: --load-targets cannot be combined with other target ranges\n");
+            exit(1);
+        }
+        if (massip_image_load(&masscan->targets, masscan->target_image.load_filename) != 0)
+            exit(1);
+    }
     has_target_addresses =
         massip_has_ipv4_targets(&masscan->targets) || massip_has_ipv6_targets(&masscan->targets);
     has_target_ports = massip_has_target_ports(&masscan->targets);
@@ -1694,6 +2388,17 @@ int main(int argc, char* argv[])
             }
             return main_scan(masscan);
 
+        case Operation_SaveTargets:
+            /* Write the final targets so that later scans can skip parsing */
+            if (massip_image_save(&masscan->targets, masscan->target_image.save_filename,
+                                  masscan->target_image.sources,
+                                  masscan->target_image.source_count) != 0)
+                exit(1);
+            fprintf(stderr, "[+] saved %u IPv4 ranges, %u IPv6 ranges, %u port ranges to %s\n",
+                    masscan->targets.ipv4.count, (unsigned) masscan->targets.ipv6.count,
+                    masscan->targets.ports.count, masscan->target_image.save_filename);
+            return 0;
+
         case Operation_ListScan:
             /* Create a randomized list of IP addresses */
             main_listscan(masscan);
@@ -1739,10 +2444,17 @@ int main(int argc, char* argv[])
         break;
 
         case Operation_Benchmark:
+            if (masscan->benchmark_pcap[0])
+                return throttler_benchmark_pcap(masscan->benchmark_pcap);
             printf("=== benchmarking (%u-bits) ===\n\n", (unsigned) sizeof(void*) * 8);
             blackrock_benchmark(masscan->blackrock_rounds);
             blackrock2_benchmark(masscan->blackrock_rounds);
             smack_benchmark();
+            template_benchmark();
+            throttler_benchmark();
+            dedup_benchmark();
+            stack_queue_benchmark();
+            json_benchmark();
             exit(1);
             break;
 
@@ -1770,8 +2482,15 @@ int main(int argc, char* argv[])
                 extern int proto_isakmp_selftest(void);
 
                 x += massip_selftest();
+                x += masstrie_selftest();
+                x += throttler_selftest();
+                x += massip_image_selftest();
                 x += ranges6_selftest();
                 x += dedup_selftest();
+                x += slab_selftest();
+                x += json_selftest();
+                x += timeouts_selftest();
+                x += tcpcon_selftest();
                 x += checksum_selftest();
                 x += ipv4address_selftest();
                 x += ipv6address_selftest();
@@ -1794,6 +2513,7 @@ int main(int argc, char* argv[])
                 x += massip_parse_selftest();
                 x += pixie_time_selftest();
                 x += rte_ring_selftest();
+                x += stack_queue_selftest();
                 x += mainconf_selftest();
                 x += zeroaccess_selftest();
                 x += nmapserviceprobes_selftest();
@@ -88,6 +88,8 @@ const char* masscan_app_to_string(enum ApplicationProtocol proto)
 
         case PROTO_ERROR:
             return "error";
+        case PROTO_MINECRAFT_STATUS:
+            return "minecraft.status";
 
         default:
             snprintf(tmp, sizeof(tmp), "(%u)", proto);
@@ -139,6 +141,7 @@ enum ApplicationProtocol masscan_string_to_app(const char* str)
                 {"vnc-info", PROTO_VNC_INFO},
                 {"isakmp", PROTO_ISAKMP},
                 {"minecraft", PROTO_MINECRAFT},
+                {"minecraft.status", PROTO_MINECRAFT_STATUS},
                 {0, 0}};
     size_t i;
 
@@ -46,6 +46,7 @@ enum ApplicationProtocol
     PROTO_MINECRAFT,
 
     PROTO_ERROR,
+    PROTO_MINECRAFT_STATUS, /* 38 - fields from the Minecraft status */
 
     PROTO_end_of_list /* must be last one */
 };
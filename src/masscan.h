@@ -39,6 +39,7 @@ enum Operation
     Operation_Echo = 9,          /* --echo */
     Operation_EchoAll = 10,      /* --echo-all */
     Operation_EchoCidr = 11,     /* --echo-cidr */
+    Operation_SaveTargets = 12,  /* --save-targets */
 };
 
 /**
@@ -86,6 +87,19 @@ struct TcpCfgPayloads
     struct TcpCfgPayloads* next;
 };
 
+/**
+ * Holds the list of "--hello-set" options, like "minecraft:25500-25600",
+ * which send a probe's own hello to more ports
+ */
+struct TcpCfgHelloSet
+{
+    /** The option as given, a probe name, a colon, and the ports */
+    char* value;
+
+    /** These are applied in the order they were given */
+    struct TcpCfgHelloSet* next;
+};
+
 /**
  * This is the master MASSCAN configuration structure. It is created on startup
  * by reading the command-line and parsing configuration files.
@@ -147,6 +161,30 @@ struct Masscan
     } nic[8];
     unsigned nic_count;
 
+    /**
+     * The number of transmit threads per adapter (--tx-threads). Each
+     * thread transmits a share of that adapter's part of the scan.
+     */
+    unsigned tx_thread_count;
+
+    /**
+     * The number of receive worker threads per adapter (--rx-threads).
+     * Each worker owns the TCP connections for a share of the flows.
+     */
+    unsigned rx_thread_count;
+
+    /**
+     * Which processors to pin threads to (--cpu-map). When empty, threads
+     * are pinned automatically to processors on their adapter's NUMA node,
+     * unless --cpu-map none was given.
+     */
+    struct
+    {
+        unsigned list[256];
+        unsigned count;
+        unsigned is_none : 1;
+    } cpu_map;
+
     /**
      * The target ranges of IPv4 addresses that are included in the scan.
      * The user can specify anything here, and we'll resolve all overlaps
@@ -164,6 +202,21 @@ struct Masscan
      */
     struct MassIP exclude;
 
+    /**
+     * --save-targets, --load-targets
+     * A binary image of the final targets, after all the include and
+     * exclude files have been parsed and applied, so that later scans
+     * can skip that work. The include/exclude files we read are
+     * remembered, so that the image can tell when it's out of date.
+     */
+    struct
+    {
+        char save_filename[256];
+        char load_filename[256];
+        char** sources;
+        unsigned source_count;
+    } target_image;
+
     /**
      * Only output these types of banners
      */
@@ -176,6 +229,29 @@ struct Masscan
      */
     double max_rate;
 
+    /**
+     * --rate auto: instead of sending at a fixed rate, the rate is adjusted
+     * between 'min_rate' and 'max_rate' according to how many packets are
+     * being dropped and how many targets are responding.
+     */
+    struct
+    {
+        unsigned is_enabled : 1;
+        double min_rate;
+    } rate_auto;
+
+    /**
+     * --pacing: spread packets evenly rather than sending them in small
+     * bursts, an 'enum PacingMode' from main-throttle.h
+     */
+    unsigned pacing;
+
+    /**
+     * --benchmark-pcap: instead of the normal benchmarks, measure how
+     * evenly spaced the packets are in this capture file
+     */
+    char benchmark_pcap[256];
+
     /**
      * Number of retries (--retries or --max-retries parameter). Retries
      * happen a few seconds apart.
@@ -184,10 +260,13 @@ struct Masscan
 
     unsigned is_pfring : 1;              /* --pfring */
     unsigned is_sendq : 1;               /* --sendq */
+    unsigned is_txring : 1;              /* --tx-ring, Linux PACKET_TX_RING */
+    unsigned is_rxring : 1;              /* --rx-ring, Linux PACKET_RX_RING */
     unsigned is_banners : 1;             /* --banners */
     unsigned is_banners_rawudp : 1;      /* --rawudp */
     unsigned is_offline : 1;             /* --offline */
     unsigned is_noreset : 1;             /* --noreset, don't transmit RST */
+    unsigned is_dedup_exact : 1;         /* --dedup-exact, remember every response */
     unsigned is_gmt : 1;                 /* --gmt, all times in GMT */
     unsigned is_capture_cert : 1;        /* --capture cert */
     unsigned is_capture_html : 1;        /* --capture html */
@@ -397,6 +476,7 @@ struct Masscan
         struct PayloadsUDP* udp;
         struct PayloadsUDP* oproto;
         struct TcpCfgPayloads* tcp;
+        struct TcpCfgHelloSet* hello_sets;
         struct NmapServiceProbeList* probes;
     } payloads;
 
@@ -0,0 +1,457 @@
+/*
+    saved target images, see massip-image.h
+*/
+#include "massip-image.h"
+#include "crypto-siphash24.h"
+#include "massip.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* The version is written in native byte-order, so it also catches an
+ * image copied from a machine of the other endianness */
+#define IMAGE_MAGIC "MASSTGT\x1a"
+#define IMAGE_VERSION 2
+
+struct ImageSection
+{
+    uint64_t count;
+    uint64_t offset;
+};
+
+struct ImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_length;
+    uint64_t hash; /* of everything after the header */
+    uint64_t length;
+    struct ImageSection ipv4;
+    struct ImageSection ipv6;
+    struct ImageSection ports;
+    struct ImageSection sources;
+};
+
+/* Each source is followed by its filename, not nul-terminated, then
+ * padding to the next 8-byte boundary */
+struct ImageSource
+{
+    uint64_t size;
+    int64_t mtime;
+    uint64_t filename_length;
+};
+
+enum
+{
+    Image_Ok,
+    Image_Truncated,
+    Image_BadMagic,
+    Image_BadVersion,
+    Image_BadHash,
+    Image_Stale,
+};
+
+static const uint64_t image_key[2] = {0x6d61737363616e20ULL, 0x746172676574730aULL};
+
+/***************************************************************************
+ ***************************************************************************/
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int source_stat(const char* filename, uint64_t* size, int64_t* mtime)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0)
+        return 1;
+    *size = (uint64_t) st.st_size;
+    *mtime = (int64_t) st.st_mtime;
+    return 0;
+}
+
+/***************************************************************************
+ * Lay out the header and the sections into a single buffer.
+ ***************************************************************************/
+static unsigned char* image_build(const struct MassIP* targets, char* const* sources,
+                                  unsigned source_count, size_t* r_length)
+{
+    struct ImageHeader hdr;
+    unsigned char* buf;
+    size_t length;
+    size_t offset;
+    unsigned i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version = IMAGE_VERSION;
+    hdr.header_length = sizeof(hdr);
+
+    length = sizeof(hdr);
+    hdr.ipv4.count = targets->ipv4.count;
+    hdr.ipv4.offset = length;
+    length = align8(length + targets->ipv4.count * sizeof(struct Range));
+    hdr.ipv6.count = targets->ipv6.count;
+    hdr.ipv6.offset = length;
+    length = align8(length + targets->ipv6.count * sizeof(struct Range6));
+    hdr.ports.count = targets->ports.count;
+    hdr.ports.offset = length;
+    length = align8(length + targets->ports.count * sizeof(struct Range));
+    hdr.sources.count = source_count;
+    hdr.sources.offset = length;
+    for (i = 0; i < source_count; i++)
+        length += align8(sizeof(struct ImageSource) + strlen(sources[i]));
+    hdr.length = length;
+
+    buf = CALLOC(1, length);
+    if (targets->ipv4.count)
+        memcpy(buf + hdr.ipv4.offset, targets->ipv4.list,
+               targets->ipv4.count * sizeof(struct Range));
+    if (targets->ipv6.count)
+        memcpy(buf + hdr.ipv6.offset, targets->ipv6.list,
+               targets->ipv6.count * sizeof(struct Range6));
+    if (targets->ports.count)
+        memcpy(buf + hdr.ports.offset, targets->ports.list,
+               targets->ports.count * sizeof(struct Range));
+
+    /* A source we can't stat gets a zero size/time, and will be seen
+     * as stale when loaded */
+    offset = hdr.sources.offset;
+    for (i = 0; i < source_count; i++)
+    {
+        struct ImageSource src = {0};
+
+        src.filename_length = strlen(sources[i]);
+        source_stat(sources[i], &src.size, &src.mtime);
+        memcpy(buf + offset, &src, sizeof(src));
+        memcpy(buf + offset + sizeof(src), sources[i], (size_t) src.filename_length);
+        offset += align8(sizeof(src) + (size_t) src.filename_length);
+    }
+
+    hdr.hash = siphash24(buf + sizeof(hdr), length - sizeof(hdr), image_key);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    *r_length = length;
+    return buf;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int section_is_valid(const struct ImageSection* section, size_t element_size,
+                            size_t length)
+{
+    if (section->offset < sizeof(struct ImageHeader) || section->offset > length)
+        return 0;
+    if (section->count > (length - section->offset) / element_size)
+        return 0;
+    return 1;
+}
+
+/***************************************************************************
+ * Check the image, then copy its ranges into 'targets'.
+ * @param stale_source
+ *      if the image is stale, returns the name of the source file that
+ *      has changed, pointing into 'buf', and its length
+ ***************************************************************************/
+static int image_parse(const unsigned char* buf, size_t length, struct MassIP* targets,
+                       const char** stale_source, size_t* stale_length)
+{
+    struct ImageHeader hdr;
+    size_t offset;
+    uint64_t i;
+
+    if (length < sizeof(hdr))
+        return Image_Truncated;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (memcmp(hdr.magic, IMAGE_MAGIC, sizeof(hdr.magic)) != 0)
+        return Image_BadMagic;
+    if (hdr.version != IMAGE_VERSION || hdr.header_length != sizeof(hdr))
+        return Image_BadVersion;
+    if (hdr.length != length)
+        return Image_Truncated;
+    if (hdr.hash != siphash24(buf + sizeof(hdr), length - sizeof(hdr), image_key))
+        return Image_BadHash;
+    if (!section_is_valid(&hdr.ipv4, sizeof(struct Range), length) ||
+        !section_is_valid(&hdr.ipv6, sizeof(struct Range6), length) ||
+        !section_is_valid(&hdr.ports, sizeof(struct Range), length) ||
+        !section_is_valid(&hdr.sources, sizeof(struct ImageSource), length))
+        return Image_Truncated;
+
+    offset = (size_t) hdr.sources.offset;
+    for (i = 0; i < hdr.sources.count; i++)
+    {
+        struct ImageSource src;
+        const char* name;
+        char* filename;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        int is_stale;
+
+        if (length - offset < sizeof(src))
+            return Image_Truncated;
+        memcpy(&src, buf + offset, sizeof(src));
+        if (src.filename_length > length - offset - sizeof(src))
+            return Image_Truncated;
+        name = (const char*) buf + offset + sizeof(src);
+
+        filename = MALLOC((size_t) src.filename_length + 1);
+        memcpy(filename, name, (size_t) src.filename_length);
+        filename[src.filename_length] = '\0';
+        is_stale = source_stat(filename, &size, &mtime) != 0 || size != src.size ||
+                   mtime != src.mtime;
+        free(filename);
+        if (is_stale)
+        {
+            *stale_source = name;
+            *stale_length = (size_t) src.filename_length;
+            return Image_Stale;
+        }
+
+        offset += (size_t) align8(sizeof(src) + (size_t) src.filename_length);
+        if (offset > length)
+            offset = length;
+    }
+
+    rangelist_remove_all(&targets->ipv4);
+    if (hdr.ipv4.count)
+    {
+        targets->ipv4.list = CALLOC((size_t) hdr.ipv4.count, sizeof(struct Range));
+        memcpy(targets->ipv4.list, buf + hdr.ipv4.offset,
+               (size_t) hdr.ipv4.count * sizeof(struct Range));
+        targets->ipv4.count = (unsigned) hdr.ipv4.count;
+        targets->ipv4.max = targets->ipv4.count;
+    }
+    targets->ipv4.is_sorted = 1;
+
+    range6list_remove_all(&targets->ipv6);
+    if (hdr.ipv6.count)
+    {
+        targets->ipv6.list = CALLOC((size_t) hdr.ipv6.count, sizeof(struct Range6));
+        memcpy(targets->ipv6.list, buf + hdr.ipv6.offset,
+               (size_t) hdr.ipv6.count * sizeof(struct Range6));
+        targets->ipv6.count = (size_t) hdr.ipv6.count;
+        targets->ipv6.max = targets->ipv6.count;
+    }
+    targets->ipv6.is_sorted = 1;
+
+    if (targets->ports.count == 0 && hdr.ports.count)
+    {
+        rangelist_remove_all(&targets->ports);
+        targets->ports.list = CALLOC((size_t) hdr.ports.count, sizeof(struct Range));
+        memcpy(targets->ports.list, buf + hdr.ports.offset,
+               (size_t) hdr.ports.count * sizeof(struct Range));
+        targets->ports.count = (unsigned) hdr.ports.count;
+        targets->ports.max = targets->ports.count;
+        targets->ports.is_sorted = 1;
+    }
+
+    return Image_Ok;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int massip_image_save(const struct MassIP* targets, const char* filename, char* const* sources,
+                      unsigned source_count)
+{
+    unsigned char* buf;
+    size_t length;
+    FILE* fp;
+    int err = 0;
+
+    buf = image_build(targets, sources, source_count, &length);
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        LOG(0, "[-] FAIL: %s: could not open for writing\n", filename);
+        free(buf);
+        return 1;
+    }
+    if (fwrite(buf, 1, length, fp) != length)
+    {
+        LOG(0, "[-] FAIL: %s: could not write targets\n", filename);
+        err = 1;
+    }
+    if (fclose(fp) != 0)
+        err = 1;
+    free(buf);
+    return err;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int massip_image_load(struct MassIP* targets, const char* filename)
+{
+    unsigned char* buf;
+    long length;
+    FILE* fp;
+    const char* stale_source = "";
+    size_t stale_length = 0;
+    int err;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        LOG(0, "[-] FAIL: %s: could not open targets\n", filename);
+        return 1;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        LOG(0, "[-] FAIL: %s: could not read targets\n", filename);
+        fclose(fp);
+        return 1;
+    }
+    buf = MALLOC((size_t) length);
+    if (fread(buf, 1, (size_t) length, fp) != (size_t) length)
+    {
+        LOG(0, "[-] FAIL: %s: could not read targets\n", filename);
+        free(buf);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    err = image_parse(buf, (size_t) length, targets, &stale_source, &stale_length);
+    switch (err)
+    {
+        case Image_Ok:
+            break;
+        case Image_Truncated:
+            LOG(0, "[-] FAIL: %s: targets file is truncated\n", filename);
+            break;
+        case Image_BadMagic:
+            LOG(0, "[-] FAIL: %s: not a targets file\n", filename);
+            break;
+        case Image_BadVersion:
+            LOG(0, "[-] FAIL: %s: targets file is from a different version\n", filename);
+            break;
+        case Image_BadHash:
+            LOG(0, "[-] FAIL: %s: targets file is corrupt\n", filename);
+            break;
+        case Image_Stale:
+            LOG(0, "[-] FAIL: %s: targets are stale, \"%.*s\" has changed since they were saved\n",
+                filename, (int) stale_length, stale_source);
+            break;
+    }
+    if (err == Image_BadVersion || err == Image_Stale)
+        LOG(0, " [hint] create it again with --save-targets\n");
+
+    free(buf);
+    return err != Image_Ok;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int massip_image_selftest(void)
+{
+    struct MassIP targets;
+    struct MassIP loaded;
+    unsigned char* buf;
+    size_t length;
+    const char* stale_source = "";
+    size_t stale_length = 0;
+    char* long_path;
+    size_t i;
+    ipv6address a = {0x20010db800000000ULL, 0x10};
+    ipv6address b = {0x20010db800000000ULL, 0xFF};
+
+    memset(&targets, 0, sizeof(targets));
+    massip_add_target_string(&targets, "10.0.0.0/8,192.168.1.1-192.168.1.20");
+    range6list_add_range(&targets.ipv6, a, b);
+    massip_add_port_string(&targets, "80,443,U:53", 0);
+    massip_optimize(&targets);
+
+    buf = image_build(&targets, NULL, 0, &length);
+
+    /* It must round-trip exactly */
+    memset(&loaded, 0, sizeof(loaded));
+    if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Ok)
+        goto fail;
+    if (loaded.ipv4.count != targets.ipv4.count || loaded.ipv6.count != targets.ipv6.count ||
+        loaded.ports.count != targets.ports.count)
+        goto fail;
+    if (memcmp(loaded.ipv4.list, targets.ipv4.list, targets.ipv4.count * sizeof(struct Range)) ||
+        memcmp(loaded.ipv6.list, targets.ipv6.list, targets.ipv6.count * sizeof(struct Range6)) ||
+        memcmp(loaded.ports.list, targets.ports.list, targets.ports.count * sizeof(struct Range)))
+        goto fail;
+
+    /* Ports that are already there win */
+    rangelist_remove_all(&loaded.ports);
+    massip_add_port_string(&loaded, "22", 0);
+    if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Ok ||
+        loaded.ports.count != 1 || loaded.ports.list[0].begin != 22)
+        goto fail;
+
+    /* Damage must be detected */
+    if (image_parse(buf, length - 8, &loaded, &stale_source, &stale_length) != Image_Truncated)
+        goto fail;
+    buf[length - 1] ^= 1;
+    if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_BadHash)
+        goto fail;
+    buf[length - 1] ^= 1;
+    buf[8] ^= 0xFF;
+    if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_BadVersion)
+        goto fail;
+    free(buf);
+
+    /* A source that's gone means the image is stale */
+    {
+        char* sources[] = {"/nonexistent/masscan-excludes.txt"};
+        buf = image_build(&targets, sources, 1, &length);
+        if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Stale)
+            goto fail;
+        free(buf);
+    }
+
+    /* Long paths are kept whole, so an image made from them isn't stale,
+     * and a stale one names the whole path */
+    long_path = MALLOC(1024);
+    long_path[0] = '.';
+    for (i = 1; i + 2 < 1024; i += 2) memcpy(long_path + i, "/.", 2);
+    long_path[i] = '\0';
+    {
+        char* sources[] = {".", long_path};
+        struct ImageHeader hdr;
+        struct ImageSource src;
+
+        buf = image_build(&targets, sources + 1, 1, &length);
+        if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Ok)
+            goto fail_long;
+        free(buf);
+
+        long_path[i - 1] = 'x';
+        buf = image_build(&targets, sources, 2, &length);
+        if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Stale ||
+            stale_length != i || memcmp(stale_source, long_path, i) != 0)
+            goto fail_long;
+
+        /* The filename can't run past the end, even with a good hash */
+        memcpy(&hdr, buf, sizeof(hdr));
+        memcpy(&src, buf + hdr.sources.offset, sizeof(src));
+        src.filename_length = length;
+        memcpy(buf + hdr.sources.offset, &src, sizeof(src));
+        hdr.hash = siphash24(buf + sizeof(hdr), length - sizeof(hdr), image_key);
+        memcpy(buf, &hdr, sizeof(hdr));
+        if (image_parse(buf, length, &loaded, &stale_source, &stale_length) != Image_Truncated)
+            goto fail_long;
+        free(buf);
+    }
+    free(long_path);
+
+    return 0;
+fail_long:
+    free(buf);
+    free(long_path);
+fail:
+    fprintf(stderr, "[-] massip-image: selftest failed\n");
+    return 1;
+}
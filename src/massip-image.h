@@ -0,0 +1,43 @@
+/*
+    Saved target images
+
+    Parsing and excluding millions of lines of include/exclude files can
+    take many seconds before the first packet is sent. The option
+    "--save-targets" writes the final target lists to a binary image, and
+    "--load-targets" reads them back in, skipping all that work.
+
+    The image is a fixed header followed by the raw arrays of ranges, each
+    at an 8-byte aligned offset given in the header, so it can be used in
+    place if it's memory mapped. It's versioned and hashed, and records
+    the size and timestamp of each include/exclude file that went into it,
+    so that we can refuse to use a corrupt or stale image.
+*/
+#ifndef MASSIP_IMAGE_H
+#define MASSIP_IMAGE_H
+#include <stddef.h>
+
+struct MassIP;
+
+/**
+ * Write the targets to a file.
+ * @param sources
+ *      The include/exclude files the targets were built from.
+ * @return
+ *      0 on success, or non-zero on failure (which has been logged)
+ */
+int massip_image_save(const struct MassIP* targets, const char* filename, char* const* sources,
+                      unsigned source_count);
+
+/**
+ * Read targets from a file written by massip_image_save(), replacing any
+ * IPv4 and IPv6 ranges in 'targets'. Ports already in 'targets', such as
+ * from "-p" on the command-line, take precedence over the saved ones.
+ * @return
+ *      0 on success, or non-zero if the file can't be read, is corrupt,
+ *      or is stale because one of its source files has changed
+ */
+int massip_image_load(struct MassIP* targets, const char* filename);
+
+int massip_image_selftest(void);
+
+#endif
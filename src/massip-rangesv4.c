@@ -365,6 +365,7 @@ void rangelist_remove_all(struct RangeList* targets)
 {
     free(targets->list);
     free(targets->picker);
+    free(targets->picker_index);
     memset(targets, 0, sizeof(*targets));
 }
 
@@ -852,6 +853,25 @@ unsigned rangelist_pick(const struct RangeList* targets, uint64_t index)
         return rangelist_pick_linearsearch(targets, index);
     }
 
+    if (targets->picker_index)
+    {
+        /* The bucket tells us the first and last range this index can be
+         * in, which is normally the same range, or the next one */
+        const unsigned* bucket = &targets->picker_index[index >> targets->picker_shift];
+
+        min = bucket[0];
+        max = bucket[1];
+        while (min < max)
+        {
+            mid = min + (max - min + 1) / 2;
+            if (index >= picker[mid])
+                min = mid;
+            else
+                max = mid - 1;
+        }
+        return (unsigned) (targets->list[min].begin + (index - picker[min]));
+    }
+
     for (;;)
     {
         mid = min + (max - min) / 2;
@@ -874,18 +894,81 @@ unsigned rangelist_pick(const struct RangeList* targets, uint64_t index)
     return (unsigned) (targets->list[mid].begin + (index - picker[mid]));
 }
 
+/***************************************************************************
+ * The inverse of rangelist_pick(): binary search for the range holding
+ * this number, then count how far into the index space it is.
+ ***************************************************************************/
+int rangelist_rank(const struct RangeList* targets, unsigned number, uint64_t* r_index)
+{
+    const struct Range* list = targets->list;
+    unsigned min = 0;
+    unsigned max = targets->count;
+
+    if (targets->picker == NULL || targets->count == 0)
+        return 0;
+
+    /* Find the last range that begins at or before the number */
+    while (min + 1 < max)
+    {
+        unsigned mid = min + (max - min) / 2;
+        if (list[mid].begin <= number)
+            min = mid;
+        else
+            max = mid;
+    }
+    if (number < list[min].begin || list[min].end < number)
+        return 0;
+
+    *r_index = (uint64_t) targets->picker[min] + (number - list[min].begin);
+    return 1;
+}
+
 /***************************************************************************
  * The normal "pick" function is a linear search, which is slow when there
  * are a lot of ranges. Therefore, the "pick2" creates sort of binary
  * search that'll be a lot faster. We choose "binary search" because
  * it's the most cache-efficient, having the least overhead to fit within
  * the cache.
+ *
+ * When an exclude list fragments the targets into hundreds of thousands
+ * of ranges, even a binary search is a dozen cache misses per probe. So
+ * on top of that, we divide the index space into buckets, at least as
+ * many as there are ranges, and record which range each bucket starts
+ * in. Looking up an index is then normally just the bucket and the one
+ * range it points to.
  ***************************************************************************/
+static void rangelist_optimize_index(struct RangeList* targets, uint64_t total)
+{
+    unsigned* picker_index;
+    unsigned shift = 0;
+    uint64_t bucket_count;
+    uint64_t b;
+    unsigned k = 0;
+
+    while (((total - 1) >> shift) >= 2 * (uint64_t) targets->count) shift++;
+    bucket_count = ((total - 1) >> shift) + 1;
+
+    /* One extra at the end, so that a bucket's last range is always
+     * the next bucket's first */
+    picker_index = REALLOCARRAY(NULL, (size_t) bucket_count + 1, sizeof(*picker_index));
+    for (b = 0; b < bucket_count; b++)
+    {
+        uint64_t first = b << shift;
+
+        while (k + 1 < targets->count && targets->picker[k + 1] <= first) k++;
+        picker_index[b] = k;
+    }
+    picker_index[bucket_count] = targets->count - 1;
+
+    targets->picker_index = picker_index;
+    targets->picker_shift = shift;
+}
+
 void rangelist_optimize(struct RangeList* targets)
 {
     unsigned* picker;
     unsigned i;
-    unsigned total = 0;
+    uint64_t total = 0;
 
     if (targets->count == 0)
         return;
@@ -897,16 +980,19 @@ void rangelist_optimize(struct RangeList* targets)
 
     if (targets->picker)
         free(targets->picker);
+    free(targets->picker_index);
+    targets->picker_index = NULL;
 
     picker = REALLOCARRAY(NULL, targets->count, sizeof(*picker));
 
     for (i = 0; i < targets->count; i++)
     {
-        picker[i] = total;
-        total += targets->list[i].end - targets->list[i].begin + 1;
+        picker[i] = (unsigned) total;
+        total += (uint64_t) targets->list[i].end - targets->list[i].begin + 1;
     }
 
     targets->picker = picker;
+    rangelist_optimize_index(targets, total);
 }
 
 /***************************************************************************
@@ -981,6 +1067,60 @@ static int regress_pick2()
         rangelist_remove_all(duplicate);
     }
 
+    /*
+     * Now do some heavily fragmented lists, like the targets left after a
+     * large exclude file, including ranges much bigger than the rest, so
+     * that buckets cover many ranges or a range covers many buckets.
+     */
+    for (i = 0; i < 10; i++)
+    {
+        unsigned j;
+        unsigned num_targets;
+        unsigned begin = 0;
+        uint64_t range;
+        uint64_t index;
+        struct RangeList targets[1] = {{0}};
+
+        num_targets = r_rand(&seed) % 1000 + 1;
+        for (j = 0; j < num_targets; j++)
+        {
+            unsigned width = r_rand(&seed) % 4;
+
+            if (r_rand(&seed) % 100 == 0)
+                width = r_rand(&seed) * 1000;
+            begin += r_rand(&seed) % 64 + 2;
+            rangelist_add_range(targets, begin, begin + width);
+            begin += width;
+        }
+        if (i == 0)
+            rangelist_add_range(targets, 0xFFFFFF00, 0xFFFFFFFF);
+        rangelist_sort(targets);
+        rangelist_optimize(targets);
+        range = rangelist_count(targets);
+
+        /* the first and last index of every range, and a random sample
+         * of the rest, must give the same result as a linear walk */
+        for (j = 0; j < targets->count; j++)
+        {
+            index = targets->picker[j];
+            REGRESS(rangelist_pick(targets, index) ==
+                    rangelist_pick_linearsearch(targets, index));
+            if (index)
+                REGRESS(rangelist_pick(targets, index - 1) ==
+                        rangelist_pick_linearsearch(targets, index - 1));
+        }
+        for (j = 0; j < 1000; j++)
+        {
+            index = ((uint64_t) r_rand(&seed) << 15 | r_rand(&seed)) % range;
+            REGRESS(rangelist_pick(targets, index) ==
+                    rangelist_pick_linearsearch(targets, index));
+        }
+        REGRESS(rangelist_pick(targets, range - 1) ==
+                rangelist_pick_linearsearch(targets, range - 1));
+
+        rangelist_remove_all(targets);
+    }
+
     return 0;
 }
 
@@ -1123,6 +1263,7 @@ static void rangelist_copy(struct RangeList* dst, const struct RangeList* src)
 {
     free(dst->list);
     free(dst->picker);
+    free(dst->picker_index);
     memset(dst, 0, sizeof(*dst));
     dst->list = CALLOC(src->count, sizeof(src->list[0]));
     memcpy(dst->list, src->list, src->count * sizeof(src->list[0]));
@@ -59,6 +59,8 @@ struct RangeList
     unsigned count;
     unsigned max;
     unsigned* picker;
+    unsigned* picker_index; /* buckets of 'index >> picker_shift' */
+    unsigned picker_shift;
     unsigned is_sorted : 1;
 };
 
@@ -162,6 +164,15 @@ uint64_t rangelist_count(const struct RangeList* targets);
  */
 unsigned rangelist_pick(const struct RangeList* targets, uint64_t i);
 
+/**
+ * The inverse of 'rangelist_pick()', finding the index of a number in the
+ * list. Requires 'rangelist_optimize()' to have been called.
+ * @return
+ *      1 if the number is in the list, with its index in 'r_index',
+ *      or 0 if it isn't.
+ */
+int rangelist_rank(const struct RangeList* targets, unsigned number, uint64_t* r_index);
+
 /**
  * Given a string like "80,8080,20-25,U:161", parse it into a structure
  * containing a list of port ranges.
@@ -381,6 +381,7 @@ void range6list_remove_all(struct Range6List* targets)
         free(targets->list);
     if (targets->picker)
         free(targets->picker);
+    free(targets->picker_index);
     memset(targets, 0, sizeof(*targets));
 }
 
@@ -517,6 +518,24 @@ ipv6address range6list_pick(const struct Range6List* targets, uint64_t index)
         exit(1);
     }
 
+    if (targets->picker_index)
+    {
+        /* See rangelist_pick() */
+        const size_t* bucket = &targets->picker_index[index >> targets->picker_shift];
+
+        min = bucket[0];
+        max = bucket[1];
+        while (min < max)
+        {
+            mid = min + (max - min + 1) / 2;
+            if (index >= picker[mid])
+                min = mid;
+            else
+                max = mid - 1;
+        }
+        return _int128_add64(targets->list[min].begin, (index - picker[min]));
+    }
+
     for (;;)
     {
         mid = min + (max - min) / 2;
@@ -539,6 +558,63 @@ ipv6address range6list_pick(const struct Range6List* targets, uint64_t index)
     return _int128_add64(targets->list[mid].begin, (index - picker[mid]));
 }
 
+/***************************************************************************
+ * The inverse of range6list_pick(). See rangelist_rank().
+ ***************************************************************************/
+int range6list_rank(const struct Range6List* targets, const ipv6address ip, uint64_t* r_index)
+{
+    const struct Range6* list = targets->list;
+    size_t min = 0;
+    size_t max = targets->count;
+
+    if (targets->picker == NULL || targets->count == 0)
+        return 0;
+
+    while (min + 1 < max)
+    {
+        size_t mid = min + (max - min) / 2;
+        if (LESSEQ(list[mid].begin, ip))
+            min = mid;
+        else
+            max = mid;
+    }
+    if (!LESSEQ(list[min].begin, ip) || !LESSEQ(ip, list[min].end))
+        return 0;
+
+    /* Scannable lists fit in 64-bits, so the difference does too */
+    *r_index = (uint64_t) targets->picker[min] + (ip.lo - list[min].begin.lo);
+    return 1;
+}
+
+/***************************************************************************
+ * Divide the index space into buckets, recording which range each one
+ * starts in. This works just like rangelist_optimize_index() for IPv4.
+ ***************************************************************************/
+static void range6list_optimize_index(struct Range6List* targets, uint64_t total)
+{
+    size_t* picker_index;
+    unsigned shift = 0;
+    uint64_t bucket_count;
+    uint64_t b;
+    size_t k = 0;
+
+    while (((total - 1) >> shift) >= 2 * (uint64_t) targets->count) shift++;
+    bucket_count = ((total - 1) >> shift) + 1;
+
+    picker_index = REALLOCARRAY(NULL, (size_t) bucket_count + 1, sizeof(*picker_index));
+    for (b = 0; b < bucket_count; b++)
+    {
+        uint64_t first = b << shift;
+
+        while (k + 1 < targets->count && targets->picker[k + 1] <= first) k++;
+        picker_index[b] = k;
+    }
+    picker_index[bucket_count] = targets->count - 1;
+
+    targets->picker_index = picker_index;
+    targets->picker_shift = shift;
+}
+
 /***************************************************************************
  * The normal "pick" function is a linear search, which is slow when there
  * are a lot of ranges. Therefore, the "pick2" creates sort of binary
@@ -562,6 +638,8 @@ void range6list_optimize(struct Range6List* targets)
 
     if (targets->picker)
         free(targets->picker);
+    free(targets->picker_index);
+    targets->picker_index = NULL;
 
     picker = REALLOCARRAY(NULL, targets->count, sizeof(*picker));
 
@@ -575,6 +653,11 @@ void range6list_optimize(struct Range6List* targets)
     }
 
     targets->picker = picker;
+
+    /* Only indexes below 2^64 can be picked, so when the total is bigger
+     * than that, just use the binary search */
+    if (total.hi == 0)
+        range6list_optimize_index(targets, total.lo);
 }
 
 /***************************************************************************
@@ -680,6 +763,50 @@ static int regress_pick2()
         range6list_remove_all(duplicate);
     }
 
+    /*
+     * Heavily fragmented lists, with some ranges much bigger than the
+     * rest. Check the start and end of every range against a walk
+     * through the list.
+     */
+    for (i = 0; i < 10; i++)
+    {
+        size_t j;
+        unsigned num_targets;
+        ipv6address begin = {0x20010db800000000ULL, 0};
+        struct Range6List targets[1];
+        uint64_t first = 0;
+
+        seed = i;
+        memset(targets, 0, sizeof(targets[0]));
+
+        num_targets = r_rand(&seed) % 1000 + 1;
+        for (j = 0; j < num_targets; j++)
+        {
+            ipv6address end;
+            uint64_t width = r_rand(&seed) % 4;
+
+            if (r_rand(&seed) % 100 == 0)
+                width = (uint64_t) r_rand(&seed) << 20;
+            begin.lo += r_rand(&seed) % 64 + 2;
+            end = _int128_add64(begin, width);
+            range6list_add_range(targets, begin, end);
+            begin = end;
+        }
+        range6list_optimize(targets);
+        REGRESS(i, targets->picker_index != NULL);
+
+        for (j = 0; j < targets->count; j++)
+        {
+            uint64_t last = first + (targets->list[j].end.lo - targets->list[j].begin.lo);
+
+            REGRESS(i, _int128_is_equals(range6list_pick(targets, first), targets->list[j].begin));
+            REGRESS(i, _int128_is_equals(range6list_pick(targets, last), targets->list[j].end));
+            first = last + 1;
+        }
+
+        range6list_remove_all(targets);
+    }
+
     return 0;
 }
 
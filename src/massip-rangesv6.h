@@ -30,6 +30,8 @@ struct Range6List
     size_t count;
     size_t max;
     size_t* picker;
+    size_t* picker_index; /* buckets of 'index >> picker_shift' */
+    unsigned picker_shift;
     unsigned is_sorted : 1;
 };
 
@@ -135,6 +137,11 @@ massint128_t range6list_count(const struct Range6List* targets);
  */
 ipv6address range6list_pick(const struct Range6List* targets, uint64_t index);
 
+/**
+ * The inverse of 'range6list_pick()'. See 'rangelist_rank()'.
+ */
+int range6list_rank(const struct Range6List* targets, const ipv6address ip, uint64_t* r_index);
+
 /**
  * Remove all the ranges in the range list.
  */
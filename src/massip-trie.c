@@ -0,0 +1,464 @@
+/*
+    compiled address lists, see massip-trie.h
+*/
+#include "massip-trie.h"
+#include "massip-rangesv4.h"
+#include "massip-rangesv6.h"
+#include "util-malloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * One byte of an address. For each of the 256 values, either the 'full'
+ * bit is set (every address with this prefix is in the list), the
+ * 'child' bit is set (some are, look at the next byte), or neither.
+ */
+struct TrieNode
+{
+    uint64_t child[4];
+    uint64_t full[4];
+
+    /* Where the children for each 64-bit word of the bitmap start in
+     * the node array, so finding a child is one popcount */
+    unsigned base[4];
+};
+
+struct MassTrie
+{
+    struct TrieNode* nodes;
+    size_t count;
+    size_t max;
+    unsigned key_length;
+};
+
+/**
+ * A range with both ends as big-endian bytes, so that IPv4 and IPv6
+ * can be compiled by the same code.
+ */
+struct TrieRange
+{
+    unsigned char begin[16];
+    unsigned char end[16];
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static inline unsigned popcount64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned) __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return (unsigned) __popcnt64(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (unsigned) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/***************************************************************************
+ * Add 'n' empty nodes to the end of the array, returning the index of
+ * the first one. Any pointers into the array are invalid afterwards.
+ ***************************************************************************/
+static size_t trie_alloc(struct MassTrie* trie, size_t n)
+{
+    size_t index = trie->count;
+
+    if (trie->count + n > trie->max)
+    {
+        trie->max = (trie->max + n) * 2;
+        trie->nodes = REALLOCARRAY(trie->nodes, trie->max, sizeof(trie->nodes[0]));
+    }
+    memset(&trie->nodes[index], 0, n * sizeof(trie->nodes[0]));
+    trie->count += n;
+    return index;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int is_all(const unsigned char* bytes, unsigned length, unsigned char c)
+{
+    unsigned i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (bytes[i] != c)
+            return 0;
+    }
+    return 1;
+}
+
+/***************************************************************************
+ * Fill in the node for the addresses starting with 'prefix', which is
+ * 'depth' bytes long, from the sorted ranges that overlap it. Values of
+ * the next byte that are only partly covered by a range get a child node,
+ * which is filled in the same way from just the ranges that overlap it.
+ ***************************************************************************/
+static void trie_build(struct MassTrie* trie, size_t node_index, const struct TrieRange* ranges,
+                       size_t count, const unsigned char* prefix, unsigned depth)
+{
+    enum
+    {
+        Empty,
+        Full,
+        Mixed
+    };
+    unsigned char state[256];
+    size_t first[256];
+    size_t last[256];
+    unsigned rest = trie->key_length - depth - 1;
+    unsigned char child_prefix[16];
+    size_t child_count = 0;
+    size_t child_index;
+    size_t i;
+    unsigned c;
+
+    memset(state, Empty, sizeof(state));
+
+    for (i = 0; i < count; i++)
+    {
+        const struct TrieRange* r = &ranges[i];
+        unsigned b, e;
+        int b_whole, e_whole;
+
+        /* Where the range begins and ends within this node, and whether
+         * those ends cover the whole of their byte value */
+        if (memcmp(r->begin, prefix, depth) < 0)
+        {
+            b = 0;
+            b_whole = 1;
+        }
+        else
+        {
+            b = r->begin[depth];
+            b_whole = is_all(r->begin + depth + 1, rest, 0x00);
+        }
+        if (memcmp(r->end, prefix, depth) > 0)
+        {
+            e = 255;
+            e_whole = 1;
+        }
+        else
+        {
+            e = r->end[depth];
+            e_whole = is_all(r->end + depth + 1, rest, 0xFF);
+        }
+
+        for (c = b; c <= e; c++)
+        {
+            if ((c == b && !b_whole) || (c == e && !e_whole))
+            {
+                if (state[c] != Mixed)
+                {
+                    state[c] = Mixed;
+                    first[c] = i;
+                }
+                last[c] = i;
+            }
+            else
+                state[c] = Full;
+        }
+    }
+
+    for (c = 0; c < 256; c++)
+        child_count += (state[c] == Mixed);
+    child_index = trie_alloc(trie, child_count);
+
+    {
+        struct TrieNode* node = &trie->nodes[node_index];
+        size_t next = child_index;
+
+        for (c = 0; c < 256; c++)
+        {
+            if (c % 64 == 0)
+                node->base[c / 64] = (unsigned) next;
+            if (state[c] == Full)
+                node->full[c / 64] |= 1ULL << (c % 64);
+            else if (state[c] == Mixed)
+            {
+                node->child[c / 64] |= 1ULL << (c % 64);
+                next++;
+            }
+        }
+    }
+
+    memcpy(child_prefix, prefix, depth);
+    for (c = 0; c < 256; c++)
+    {
+        if (state[c] != Mixed)
+            continue;
+        child_prefix[depth] = (unsigned char) c;
+        trie_build(trie, child_index++, ranges + first[c], last[c] - first[c] + 1, child_prefix,
+                   depth + 1);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static struct MassTrie* trie_create(const struct TrieRange* ranges, size_t count,
+                                    unsigned key_length)
+{
+    struct MassTrie* trie = CALLOC(1, sizeof(*trie));
+    unsigned char prefix[16] = {0};
+
+    trie->key_length = key_length;
+    trie_alloc(trie, 1);
+    trie_build(trie, 0, ranges, count, prefix, 0);
+    return trie;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int trie_lookup(const struct MassTrie* trie, const unsigned char* key)
+{
+    const struct TrieNode* node = &trie->nodes[0];
+    unsigned depth;
+
+    for (depth = 0; depth < trie->key_length; depth++)
+    {
+        unsigned c = key[depth];
+        unsigned w = c / 64;
+        uint64_t bit = 1ULL << (c % 64);
+
+        if (node->full[w] & bit)
+            return 1;
+        if ((node->child[w] & bit) == 0)
+            return 0;
+        node = &trie->nodes[node->base[w] + popcount64(node->child[w] & (bit - 1))];
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void key_ipv4(unsigned char* key, ipv4address ip)
+{
+    key[0] = (unsigned char) (ip >> 24);
+    key[1] = (unsigned char) (ip >> 16);
+    key[2] = (unsigned char) (ip >> 8);
+    key[3] = (unsigned char) (ip >> 0);
+}
+
+static void key_ipv6(unsigned char* key, ipv6address ip)
+{
+    unsigned i;
+
+    for (i = 0; i < 8; i++)
+    {
+        key[i] = (unsigned char) (ip.hi >> (56 - i * 8));
+        key[i + 8] = (unsigned char) (ip.lo >> (56 - i * 8));
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct MassTrie* masstrie_create_ipv4(const struct RangeList* list)
+{
+    struct TrieRange* ranges = CALLOC(list->count + 1, sizeof(ranges[0]));
+    struct MassTrie* trie;
+    size_t i;
+
+    for (i = 0; i < list->count; i++)
+    {
+        key_ipv4(ranges[i].begin, list->list[i].begin);
+        key_ipv4(ranges[i].end, list->list[i].end);
+    }
+    trie = trie_create(ranges, list->count, 4);
+    free(ranges);
+    return trie;
+}
+
+struct MassTrie* masstrie_create_ipv6(const struct Range6List* list)
+{
+    struct TrieRange* ranges = CALLOC(list->count + 1, sizeof(ranges[0]));
+    struct MassTrie* trie;
+    size_t i;
+
+    for (i = 0; i < list->count; i++)
+    {
+        key_ipv6(ranges[i].begin, list->list[i].begin);
+        key_ipv6(ranges[i].end, list->list[i].end);
+    }
+    trie = trie_create(ranges, list->count, 16);
+    free(ranges);
+    return trie;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void masstrie_destroy(struct MassTrie* trie)
+{
+    if (trie == NULL)
+        return;
+    free(trie->nodes);
+    free(trie);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int masstrie_contains_ipv4(const struct MassTrie* trie, ipv4address ip)
+{
+    unsigned char key[4];
+
+    key_ipv4(key, ip);
+    return trie_lookup(trie, key);
+}
+
+int masstrie_contains_ipv6(const struct MassTrie* trie, ipv6address ip)
+{
+    unsigned char key[16];
+
+    key_ipv6(key, ip);
+    return trie_lookup(trie, key);
+}
+
+/***************************************************************************
+ * Provide my own rand() simply to avoid static-analysis warning me that
+ * 'rand()' is unrandom, when in fact we want the non-random properties of
+ * rand() for regression testing.
+ ***************************************************************************/
+static unsigned r_rand(unsigned* seed)
+{
+    static const unsigned a = 214013;
+    static const unsigned c = 2531011;
+
+    *seed = (*seed) * a + c;
+    return (*seed) >> 16 & 0x7fff;
+}
+
+/***************************************************************************
+ * Compile random lists, then check the edges of every range, and random
+ * addresses, against the list itself.
+ ***************************************************************************/
+int masstrie_selftest(void)
+{
+    unsigned seed = 1;
+    unsigned i;
+
+    for (i = 0; i < 20; i++)
+    {
+        struct RangeList list[1] = {{0}};
+        struct MassTrie* trie;
+        unsigned num_ranges = r_rand(&seed) % 2000;
+        unsigned begin = r_rand(&seed);
+        unsigned j;
+
+        for (j = 0; j < num_ranges; j++)
+        {
+            unsigned width = r_rand(&seed) % 300;
+
+            /* some CIDR-like ranges, some arbitrary, some huge */
+            if (j % 3 == 0)
+                width = (1 << (r_rand(&seed) % 12)) - 1;
+            if (r_rand(&seed) % 200 == 0)
+                width = r_rand(&seed) << 12;
+            if (0xFFFFFFFF - begin < width)
+                break;
+            rangelist_add_range(list, begin, begin + width);
+            if (0xFFFFFFFF - begin - width < 0x1000000)
+                break;
+            begin += width + r_rand(&seed) % 0x1000 + 2;
+        }
+        if (i == 1)
+            rangelist_add_range(list, 0, 0xFFFFFFFF);
+        if (i == 2)
+        {
+            rangelist_add_range(list, 0, 0);
+            rangelist_add_range(list, 0xFFFFFFFF, 0xFFFFFFFF);
+        }
+        rangelist_sort(list);
+
+        trie = masstrie_create_ipv4(list);
+        for (j = 0; j < list->count; j++)
+        {
+            struct Range r = list->list[j];
+
+            if (!masstrie_contains_ipv4(trie, r.begin) || !masstrie_contains_ipv4(trie, r.end))
+                goto fail;
+            if (r.begin && masstrie_contains_ipv4(trie, r.begin - 1) !=
+                               rangelist_is_contains(list, r.begin - 1))
+                goto fail;
+            if (r.end != 0xFFFFFFFF && masstrie_contains_ipv4(trie, r.end + 1) !=
+                                           rangelist_is_contains(list, r.end + 1))
+                goto fail;
+        }
+        for (j = 0; j < 2000; j++)
+        {
+            unsigned ip = r_rand(&seed) << 17 ^ r_rand(&seed) << 2 ^ r_rand(&seed);
+
+            if (list->count)
+                ip = list->list[0].begin + ip % 0x10000000;
+            if (masstrie_contains_ipv4(trie, ip) != rangelist_is_contains(list, ip))
+                goto fail;
+        }
+        masstrie_destroy(trie);
+        rangelist_remove_all(list);
+    }
+
+    for (i = 0; i < 10; i++)
+    {
+        struct Range6List list[1];
+        struct MassTrie* trie;
+        unsigned num_ranges = r_rand(&seed) % 500 + 1;
+        ipv6address begin = {0x20010db800000000ULL, 0};
+        size_t j;
+
+        memset(list, 0, sizeof(list[0]));
+        for (j = 0; j < num_ranges; j++)
+        {
+            ipv6address end = begin;
+            unsigned bits = r_rand(&seed) % 80;
+
+            /* CIDR-like ranges, some of which cross the 64-bit boundary */
+            if (bits < 64)
+                end.lo |= (bits ? (~0ULL >> (64 - bits)) : 0);
+            else
+            {
+                end.lo = ~0ULL;
+                end.hi |= (1ULL << (bits - 64)) - 1;
+            }
+            range6list_add_range(list, begin, end);
+
+            begin = end;
+            begin.lo += r_rand(&seed) + 2;
+            if (begin.lo < end.lo)
+                begin.hi++;
+            begin.hi += r_rand(&seed) % 4;
+        }
+        range6list_sort(list);
+
+        trie = masstrie_create_ipv6(list);
+        for (j = 0; j < list->count; j++)
+        {
+            struct Range6 r = list->list[j];
+            ipv6address before = r.begin;
+            ipv6address after = r.end;
+
+            if (!masstrie_contains_ipv6(trie, r.begin) || !masstrie_contains_ipv6(trie, r.end))
+                goto fail;
+            if (before.lo-- == 0)
+                before.hi--;
+            if (++after.lo == 0)
+                after.hi++;
+            if (masstrie_contains_ipv6(trie, before) != range6list_is_contains(list, before))
+                goto fail;
+            if (masstrie_contains_ipv6(trie, after) != range6list_is_contains(list, after))
+                goto fail;
+        }
+        masstrie_destroy(trie);
+        range6list_remove_all(list);
+    }
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] masstrie: selftest failed (%u)\n", i);
+    return 1;
+}
@@ -0,0 +1,44 @@
+/*
+    Compiled address lists
+
+    The range lists are what we need to pick targets from an index, but
+    testing whether an address is in one is a search over a flat array
+    that can have hundreds of thousands of entries once a large exclude
+    file has chopped it up.
+
+    This module compiles a finished range list into an immutable trie
+    for membership tests. Each node covers one byte of the address: a
+    bit for each of the 256 values saying either "everything under here
+    is in the list", or "look in a child node". Child nodes are packed
+    together, found by counting the bits before ours (like "poptrie").
+    A lookup is at most 4 nodes for IPv4 and 16 for IPv6, no matter how
+    many ranges there are.
+*/
+#ifndef MASSIP_TRIE_H
+#define MASSIP_TRIE_H
+#include "massip-addr.h"
+
+struct RangeList;
+struct Range6List;
+struct MassTrie;
+
+/**
+ * Compile a sorted list of ranges into a trie. The list is no longer
+ * needed afterwards; later changes to it won't be reflected in the trie.
+ */
+struct MassTrie* masstrie_create_ipv4(const struct RangeList* list);
+struct MassTrie* masstrie_create_ipv6(const struct Range6List* list);
+
+void masstrie_destroy(struct MassTrie* trie);
+
+/**
+ * Test whether the address was in the list the trie was created from.
+ * @return
+ *      1 if it's in the list, 0 otherwise
+ */
+int masstrie_contains_ipv4(const struct MassTrie* trie, ipv4address ip);
+int masstrie_contains_ipv6(const struct MassTrie* trie, ipv6address ip);
+
+int masstrie_selftest(void);
+
+#endif
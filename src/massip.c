@@ -2,6 +2,7 @@
 #include "massip-parse.h"
 #include "massip-rangesv4.h"
 #include "massip-rangesv6.h"
+#include "massip-trie.h"
 #include <ctype.h>
 #include <string.h>
 
@@ -22,6 +23,11 @@ void massip_optimize(struct MassIP* targets)
     targets->count_ipv4s = rangelist_count(&targets->ipv4);
     targets->count_ipv6s = range6list_count(&targets->ipv6).lo;
     targets->ipv4_index_threshold = targets->count_ipv4s * rangelist_count(&targets->ports);
+
+    masstrie_destroy(targets->ipv4_trie);
+    masstrie_destroy(targets->ipv6_trie);
+    targets->ipv4_trie = masstrie_create_ipv4(&targets->ipv4);
+    targets->ipv6_trie = masstrie_create_ipv6(&targets->ipv6);
 }
 
 int massip_pick(const struct MassIP* massip, uint64_t index, ipaddress* addr, unsigned* port)
@@ -45,12 +51,43 @@ int massip_pick(const struct MassIP* massip, uint64_t index, ipaddress* addr, un
     return 0;
 }
 
+int massip_rank(const struct MassIP* massip, ipaddress addr, unsigned port, uint64_t* r_index)
+{
+    uint64_t ip_index;
+    uint64_t port_index;
+
+    if (!rangelist_rank(&massip->ports, port, &port_index))
+        return 0;
+
+    if (addr.version == 6)
+    {
+        if (!range6list_rank(&massip->ipv6, addr.ipv6, &ip_index))
+            return 0;
+        *r_index = massip->ipv4_index_threshold + port_index * massip->count_ipv6s + ip_index;
+    }
+    else
+    {
+        if (!rangelist_rank(&massip->ipv4, addr.ipv4, &ip_index))
+            return 0;
+        *r_index = port_index * massip->count_ipv4s + ip_index;
+    }
+    return 1;
+}
+
 int massip_has_ip(const struct MassIP* massip, ipaddress ip)
 {
     if (ip.version == 6)
+    {
+        if (massip->ipv6_trie)
+            return masstrie_contains_ipv6(massip->ipv6_trie, ip.ipv6);
         return range6list_is_contains(&massip->ipv6, ip.ipv6);
+    }
     else
+    {
+        if (massip->ipv4_trie)
+            return masstrie_contains_ipv4(massip->ipv4_trie, ip.ipv4);
         return rangelist_is_contains(&massip->ipv4, ip.ipv4);
+    }
 }
 
 int massip_has_port(const struct MassIP* massip, unsigned port)
@@ -148,6 +185,42 @@ int massip_selftest(void)
     if (count.hi != 0 || count.lo != 12)
         goto fail;
 
+    /* Every index should map back to itself through massip_rank() */
+    line = __LINE__;
+    err = massip_add_target_string(&targets, "10.0.0.0/30,10.0.1.5-10.0.1.9");
+    if (err)
+        goto fail;
+    rangelist_parse_ports(&targets.ports, "443,1000-1002", 0, 0);
+    massip_optimize(&targets);
+    count = massip_range(&targets);
+    {
+        uint64_t i;
+        for (i = 0; i < count.lo; i++)
+        {
+            ipaddress addr;
+            unsigned port;
+            uint64_t index;
+
+            line = __LINE__;
+            massip_pick(&targets, i, &addr, &port);
+            if (!massip_rank(&targets, addr, port, &index) || index != i)
+                goto fail;
+        }
+    }
+    {
+        ipaddress addr = {0};
+        uint64_t index;
+
+        line = __LINE__;
+        addr.version = 4;
+        addr.ipv4 = 0x0a000104; /* 10.0.1.4, between the ranges */
+        if (massip_rank(&targets, addr, 80, &index))
+            goto fail;
+        addr.ipv4 = 0x0a000105;
+        if (massip_rank(&targets, addr, 81, &index))
+            goto fail;
+    }
+
     return 0;
 fail:
     fprintf(stderr, "[-] massip: test fail, line=%d\n", line);
@@ -4,6 +4,8 @@
 #include "massip-rangesv6.h"
 #include <stddef.h>
 
+struct MassTrie;
+
 struct MassIP
 {
     struct RangeList ipv4;
@@ -27,6 +29,14 @@ struct MassIP
     uint64_t count_ports;
     uint64_t count_ipv4s;
     uint64_t count_ipv6s;
+
+    /**
+     * The address lists compiled by `massip_optimize()`, so that
+     * `massip_has_ip()` is a quick lookup no matter how fragmented the
+     * lists are. These are NULL until then.
+     */
+    struct MassTrie* ipv4_trie;
+    struct MassTrie* ipv6_trie;
 };
 
 /**
@@ -50,6 +60,8 @@ void massip_apply_excludes(struct MassIP* targets, struct MassIP* exclude);
  * state to be used for scanning. This sorts the address, removes
  * duplicates, and creates an optimized 'picker' system to easily
  * find an address given an index, or find an index given an address.
+ * It also compiles the address lists for `massip_has_ip()`, so the lists
+ * shouldn't be changed after this without calling it again.
  */
 void massip_optimize(struct MassIP* targets);
 
@@ -66,6 +78,15 @@ void massip_optimize(struct MassIP* targets);
  */
 int massip_pick(const struct MassIP* massip, uint64_t index, ipaddress* addr, unsigned* port);
 
+/**
+ * The inverse of `massip_pick()`, finding the index of an IP+port
+ * combination, such as from a response.
+ * @return
+ *      1 if it's one of our targets, with its index in 'r_index',
+ *      or 0 if it isn't.
+ */
+int massip_rank(const struct MassIP* massip, ipaddress addr, unsigned port, uint64_t* r_index);
+
 int massip_has_ip(const struct MassIP* massip, ipaddress ip);
 
 int massip_has_port(const struct MassIP* massip, unsigned port);
@@ -2,6 +2,7 @@
 #include "masscan-status.h"
 #include "out-record.h"
 #include "output.h"
+#include "proto-minecraft.h"
 #include "util-safefunc.h"
 #include <assert.h>
 
@@ -211,6 +212,80 @@ static void binary_out_status(struct Output* out, FILE* fp, time_t timestamp, in
 
 /****************************************************************************
  ****************************************************************************/
+/****************************************************************************
+ * The Minecraft status fields get a compact record of their own, rather
+ * than a banner, so that --readscan can turn them back into typed columns.
+ * After the usual [TIMESTAMP], [IP PROTO], [PORT], [TTL], [IP VERSION] and
+ * [IP] fields come the protocol, max players, and players online, then the
+ * version name with a one-byte length, the description with a two-byte
+ * length, and the favicon's length and hash, zero if there's no favicon.
+ ****************************************************************************/
+static void binary_out_minecraft(struct Output* out, FILE* fp, time_t timestamp, ipaddress ip,
+                                 unsigned ip_proto, unsigned port, unsigned ttl,
+                                 const struct MinecraftStatus* status)
+{
+    unsigned char buf[64 + MINECRAFT_VERSION_MAX + MINECRAFT_DESCRIPTION_MAX];
+    size_t max = sizeof(buf);
+    size_t offset = 3; /* room for the [TYPE] and [LENGTH] fields */
+    size_t name_length = status->version_name_length;
+    size_t description_length = status->description_length;
+    size_t length;
+    size_t start;
+    size_t bytes_written;
+
+    if (name_length > MINECRAFT_VERSION_MAX)
+        name_length = MINECRAFT_VERSION_MAX;
+    if (description_length > MINECRAFT_DESCRIPTION_MAX)
+        description_length = MINECRAFT_DESCRIPTION_MAX;
+
+    _put_integer(buf, max, &offset, timestamp);
+    _put_byte(buf, max, &offset, ip_proto);
+    _put_short(buf, max, &offset, port);
+    _put_byte(buf, max, &offset, ttl);
+    _put_byte(buf, max, &offset, ip.version);
+    if (ip.version == 6)
+    {
+        _put_long(buf, max, &offset, ip.ipv6.hi);
+        _put_long(buf, max, &offset, ip.ipv6.lo);
+    }
+    else
+        _put_integer(buf, max, &offset, ip.ipv4);
+    _put_integer(buf, max, &offset, (unsigned) status->protocol);
+    _put_integer(buf, max, &offset, (unsigned) status->players_max);
+    _put_integer(buf, max, &offset, (unsigned) status->players_online);
+    _put_byte(buf, max, &offset, name_length);
+    memcpy(buf + offset, status->version_name, name_length);
+    offset += name_length;
+    _put_short(buf, max, &offset, description_length);
+    memcpy(buf + offset, status->description, description_length);
+    offset += description_length;
+    _put_integer(buf, max, &offset, status->favicon_length);
+    _put_long(buf, max, &offset, status->favicon_hash);
+
+    /* [TYPE] and [LENGTH] fields, the length taking one byte or two */
+    length = offset - 3;
+    if (length < 128)
+    {
+        start = 1;
+        buf[2] = (unsigned char) length;
+    }
+    else
+    {
+        start = 0;
+        buf[1] = (unsigned char) (length >> 7) | 0x80;
+        buf[2] = (unsigned char) (length & 0x7F);
+    }
+    buf[start] = Out_Minecraft;
+
+    bytes_written = fwrite(buf + start, 1, offset - start, fp);
+    if (bytes_written != offset - start)
+    {
+        perror("output");
+        exit(1);
+    }
+    out->rotate.bytes_written += bytes_written;
+}
+
 static void binary_out_banner_ipv6(struct Output* out, FILE* fp, time_t timestamp, ipaddress ip,
                                    unsigned ip_proto, unsigned port, enum ApplicationProtocol proto,
                                    unsigned ttl, const unsigned char* px, unsigned length)
@@ -296,6 +371,13 @@ static void binary_out_banner(struct Output* out, FILE* fp, time_t timestamp, ip
     unsigned i;
     size_t bytes_written;
     static const unsigned HeaderLength = 14;
+    struct MinecraftStatus minecraft;
+
+    if (proto == PROTO_MINECRAFT_STATUS && minecraft_status_parse(px, length, &minecraft))
+    {
+        binary_out_minecraft(out, fp, timestamp, ip, ip_proto, port, ttl, &minecraft);
+        return;
+    }
 
     if (ip.version == 6)
     {
@@ -1,6 +1,7 @@
 #include "masscan-app.h"
 #include "masscan-status.h"
 #include "output.h"
+#include "proto-minecraft.h"
 #include "util-safefunc.h"
 #include <ctype.h>
 
@@ -91,6 +92,30 @@ static const char* normalize_json_string(const unsigned char* px, size_t length,
     return buf;
 }
 
+/******************************************************************************
+ * The fields of a Minecraft server's status, as typed columns rather than a
+ * banner string.
+ ******************************************************************************/
+static void json_out_minecraft(FILE* fp, const struct MinecraftStatus* status)
+{
+    char name_buffer[MINECRAFT_VERSION_MAX * 6 + 8];
+    char description_buffer[MINECRAFT_DESCRIPTION_MAX * 6 + 8];
+
+    fprintf(fp,
+            "\"version\": {\"name\": \"%s\", \"protocol\": %d}, "
+            "\"players\": {\"max\": %d, \"online\": %d}, "
+            "\"description\": {\"text\": \"%s\"}",
+            normalize_json_string((const unsigned char*) status->version_name,
+                                  status->version_name_length, name_buffer, sizeof(name_buffer)),
+            status->protocol, status->players_max, status->players_online,
+            normalize_json_string((const unsigned char*) status->description,
+                                  status->description_length, description_buffer,
+                                  sizeof(description_buffer)));
+    if (status->favicon_length)
+        fprintf(fp, ", \"favicon\": {\"length\": %u, \"hash\": \"%016llx\"}",
+                status->favicon_length, (unsigned long long) status->favicon_hash);
+}
+
 /******************************************************************************
  ******************************************************************************/
 static void json_out_banner(struct Output* out, FILE* fp, time_t timestamp, ipaddress ip,
@@ -99,6 +124,7 @@ static void json_out_banner(struct Output* out, FILE* fp, time_t timestamp, ipad
 {
     char banner_buffer[65536];
     ipaddress_formatted_t fmt;
+    struct MinecraftStatus minecraft;
 
     UNUSEDPARM(ttl);
 
@@ -113,11 +139,23 @@ static void json_out_banner(struct Output* out, FILE* fp, time_t timestamp, ipad
     fprintf(fp, "{ ");
     fmt = ipaddress_fmt(ip);
     fprintf(fp, "  \"ip\": \"%s\", ", fmt.string);
-    fprintf(fp,
-            "  \"timestamp\": \"%d\", \"ports\": [ {\"port\": %u, \"proto\": \"%s\", "
-            "\"service\": {\"name\": \"%s\", \"banner\": \"%s\"} } ] ",
-            (int) timestamp, port, name_from_ip_proto(ip_proto), masscan_app_to_string(proto),
-            normalize_json_string(px, length, banner_buffer, sizeof(banner_buffer)));
+    if (proto == PROTO_MINECRAFT_STATUS && minecraft_status_parse(px, length, &minecraft))
+    {
+        fprintf(fp,
+                "  \"timestamp\": \"%d\", \"ports\": [ {\"port\": %u, \"proto\": \"%s\", "
+                "\"service\": {\"name\": \"%s\", ",
+                (int) timestamp, port, name_from_ip_proto(ip_proto), masscan_app_to_string(proto));
+        json_out_minecraft(fp, &minecraft);
+        fprintf(fp, "} } ] ");
+    }
+    else
+    {
+        fprintf(fp,
+                "  \"timestamp\": \"%d\", \"ports\": [ {\"port\": %u, \"proto\": \"%s\", "
+                "\"service\": {\"name\": \"%s\", \"banner\": \"%s\"} } ] ",
+                (int) timestamp, port, name_from_ip_proto(ip_proto), masscan_app_to_string(proto),
+                normalize_json_string(px, length, banner_buffer, sizeof(banner_buffer)));
+    }
     fprintf(fp, "}\n");
 
     UNUSEDPARM(out);
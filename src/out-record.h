@@ -14,6 +14,7 @@ enum OutputRecordType
     Out_Closed6 = 11,
     Out_Arp6 = 12,
     Out_Banner6 = 13,
+    Out_Minecraft = 14,
 
 };
 #endif
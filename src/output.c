@@ -398,7 +398,7 @@ struct Output* output_create(const struct Masscan* masscan, unsigned thread_inde
     out->is_append = masscan->output.is_append;
     out->xml.stylesheet = duplicate_string(masscan->output.stylesheet);
     out->rotate.directory = duplicate_string(masscan->output.rotate.directory);
-    if (masscan->nic_count <= 1)
+    if (masscan->nic_count <= 1 && masscan->rx_thread_count <= 1)
         out->filename = duplicate_string(masscan->output.filename);
     else
         out->filename = indexed_filename(masscan->output.filename, thread_index);
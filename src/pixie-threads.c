@@ -13,6 +13,14 @@
 #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+#include <ctype.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#endif
+
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <sys/sysctl.h>
 #include <sys/types.h>
@@ -54,9 +62,21 @@ void pixie_cpu_raise_priority(void)
 #endif
 }
 
+/****************************************************************************
+ ****************************************************************************/
+void pixie_cpu_yield(void)
+{
+#if defined WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
 /****************************************************************************
  * Set the current thread (implicit) to run exclusively on the explicit
- * process.
+ * processor. Processors are numbered from 0, as the operating system
+ * numbers them.
  * http://en.wikipedia.org/wiki/Processor_affinity
  ****************************************************************************/
 void pixie_cpu_set_affinity(unsigned processor)
@@ -64,8 +84,6 @@ void pixie_cpu_set_affinity(unsigned processor)
 #if defined WIN32
     DWORD_PTR mask;
     DWORD_PTR result;
-    if (processor > 0)
-        processor--;
     mask = ((size_t) 1) << processor;
 
     // printf("mask(%u) = 0x%08x\n", processor, mask);
@@ -81,16 +99,110 @@ void pixie_cpu_set_affinity(unsigned processor)
 
     CPU_ZERO(&cpuset);
 
-    CPU_SET(processor + 1, &cpuset);
+    CPU_SET(processor, &cpuset);
 
     x = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
     if (x != 0)
     {
-        fprintf(stderr, "set_affinity: returned error linux:%d\n", errno);
+        fprintf(stderr, "set_affinity: returned error linux:%d\n", x);
     }
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
     /* FIXME: add code here */
-    UNUSEDPARM(x);
+    UNUSEDPARM(processor);
+#endif
+}
+
+/****************************************************************************
+ * Get the list of processors this process is allowed to run on, which may
+ * be fewer than the system has, such as when started with 'taskset'.
+ ****************************************************************************/
+unsigned pixie_cpu_get_allowed(unsigned* processors, unsigned max)
+{
+    unsigned count = 0;
+    unsigned i;
+
+#if defined WIN32
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    {
+        for (i = 0; i < sizeof(process_mask) * 8 && count < max; i++)
+            if (process_mask & (((DWORD_PTR) 1) << i))
+                processors[count++] = i;
+    }
+#elif defined(__linux__) && defined(__GNUC__) && !defined(__TERMUX__)
+    cpu_set_t mask;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+    {
+        for (i = 0; i < CPU_SETSIZE && count < max; i++)
+            if (CPU_ISSET(i, &mask))
+                processors[count++] = i;
+    }
+#endif
+
+    /* If we can't tell, assume it's all of them */
+    if (count == 0)
+    {
+        unsigned cpu_count = pixie_cpu_get_count();
+        for (i = 0; i < cpu_count && count < max; i++)
+            processors[count++] = i;
+    }
+    return count;
+}
+
+/****************************************************************************
+ * On Linux, each processor's directory in sysfs contains a link named
+ * after the NUMA node it belongs to, like "node1".
+ ****************************************************************************/
+int pixie_cpu_get_numa_node(unsigned processor)
+{
+#if defined(__linux__)
+    char dirname[64];
+    DIR* dir;
+    struct dirent* entry;
+    int node = -1;
+
+    snprintf(dirname, sizeof(dirname), "/sys/devices/system/cpu/cpu%u", processor);
+    dir = opendir(dirname);
+    if (dir == NULL)
+        return -1;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (memcmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4] & 0xFF))
+        {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+#else
+    UNUSEDPARM(processor);
+    return -1;
+#endif
+}
+
+/****************************************************************************
+ * Ask the kernel to place memory this thread allocates from now on in
+ * the given NUMA node, falling back to other nodes when it's full. We
+ * call the system call directly rather than depending upon libnuma.
+ ****************************************************************************/
+void pixie_numa_set_preferred(int node)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    unsigned long nodemask = 0;
+
+    if (node < 0 || node >= (int) (sizeof(nodemask) * 8))
+        syscall(SYS_set_mempolicy, 0 /*MPOL_DEFAULT*/, NULL, 0);
+    else
+    {
+        nodemask = 1UL << node;
+        syscall(SYS_set_mempolicy, 1 /*MPOL_PREFERRED*/, &nodemask, sizeof(nodemask) * 8);
+    }
+#else
+    UNUSEDPARM(node);
 #endif
 }
 
@@ -22,9 +22,38 @@ size_t pixie_begin_thread(void (*worker_thread)(void*), unsigned flags, void* wo
 
 void pixie_thread_join(size_t thread_handle);
 
+/**
+ * Pin the calling thread to a single processor, numbered from 0.
+ */
 void pixie_cpu_set_affinity(unsigned processor);
 void pixie_cpu_raise_priority(void);
 
+/**
+ * Give up the rest of the calling thread's timeslice to other threads
+ * waiting to run.
+ */
+void pixie_cpu_yield(void);
+
+/**
+ * Fill in the list of processors this process may run on.
+ * @return
+ *      the number of processors in the list
+ */
+unsigned pixie_cpu_get_allowed(unsigned* processors, unsigned max);
+
+/**
+ * Get the NUMA node of a processor.
+ * @return
+ *      the node number, or -1 if unknown or not supported
+ */
+int pixie_cpu_get_numa_node(unsigned processor);
+
+/**
+ * Prefer the given NUMA node for memory the calling thread allocates
+ * from now on. A node of -1 restores the default policy.
+ */
+void pixie_numa_set_preferred(int node);
+
 void pixie_locked_subtract_u32(unsigned* lhs, unsigned rhs);
 
 #if defined(_MSC_VER)
@@ -33,6 +62,8 @@ void pixie_locked_subtract_u32(unsigned* lhs, unsigned rhs);
     (_InterlockedCompareExchange((volatile long*) dst, src, expected) == (expected))
 #define pixie_locked_CAS64(dst, src, expected) \
     (_InterlockedCompareExchange64((volatile long long*) dst, src, expected) == (expected))
+#define pixie_locked_fetch_or64(dst, src) \
+    ((uint64_t) _InterlockedOr64((volatile long long*) (dst), (long long) (src)))
 #define rte_atomic32_cmpset(dst, exp, src) \
     (_InterlockedCompareExchange((volatile long*) dst, (long) src, (long) exp) == (long) (exp))
 
@@ -45,6 +76,9 @@ void pixie_locked_subtract_u32(unsigned* lhs, unsigned rhs);
 #define pixie_locked_CAS64(dst, src, expected)                                              \
     __sync_bool_compare_and_swap((volatile long long int*) (dst), (long long int) expected, \
                                  (long long int) src);
+#define pixie_locked_fetch_or64(dst, src) \
+    ((uint64_t) __sync_fetch_and_or((volatile unsigned long long*) (dst), \
+                                    (unsigned long long) (src)))
 
 #if !defined(__x86_64__) && !defined(__i386__)
 #define rte_wmb() __sync_synchronize()
@@ -59,6 +93,7 @@ void pixie_locked_subtract_u32(unsigned* lhs, unsigned rhs);
 unsigned pixie_locked_add_u32(volatile unsigned* lhs, unsigned rhs);
 int pixie_locked_CAS32(volatile unsigned* dst, unsigned src, unsigned expected);
 int pixie_locked_CAS64(volatile uint64_t* dst, uint64_t src, uint64_t expected);
+uint64_t pixie_locked_fetch_or64(volatile uint64_t* dst, uint64_t src);
 #endif
 
 #endif
@@ -249,6 +249,137 @@ uint64_t pixie_nanotime(void)
 }
 #endif
 
+/*
+ * The fast clock for pacing packets. On x86 we read the cycle counter,
+ * which is many times cheaper than clock_gettime(), and scale it to
+ * nanoseconds using a rate we measure at startup. This is only safe when
+ * the CPU says the counter ticks at a constant rate regardless of power
+ * states ("invariant TSC"), which is true of anything from the last
+ * decade. Otherwise we fall back to pixie_nanotime().
+ */
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PIXIE_HAS_TSC 1
+static int tsc_is_invariant(void)
+{
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if ((unsigned) regs[0] < 0x80000007)
+        return 0;
+    __cpuid(regs, 0x80000007);
+    return (regs[3] >> 8) & 1;
+}
+#define cpu_relax() _mm_pause()
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define PIXIE_HAS_TSC 1
+static int tsc_is_invariant(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+#if defined(WIN32)
+#define cpu_yield() SwitchToThread()
+#else
+#include <sched.h>
+#define cpu_yield() sched_yield()
+#endif
+
+static struct
+{
+    int is_tsc;
+    uint64_t base_tsc;
+    uint64_t base_ns;
+    double ns_per_tick;
+} fastclock;
+
+void pixie_fasttime_calibrate(void)
+{
+#ifdef PIXIE_HAS_TSC
+    uint64_t start_ns, stop_ns;
+    uint64_t start_tsc, stop_tsc;
+
+    if (!tsc_is_invariant())
+        return;
+
+    /* Measure for 20 milliseconds, spinning rather than sleeping so
+     * that we aren't measuring across a context switch */
+    start_tsc = __rdtsc();
+    start_ns = pixie_nanotime();
+    do
+    {
+        stop_ns = pixie_nanotime();
+    } while (stop_ns - start_ns < 20000000);
+    stop_tsc = __rdtsc();
+
+    if (stop_tsc <= start_tsc)
+        return;
+    fastclock.ns_per_tick = (double) (stop_ns - start_ns) / (double) (stop_tsc - start_tsc);
+    fastclock.base_tsc = stop_tsc;
+    fastclock.base_ns = stop_ns;
+    fastclock.is_tsc = 1;
+#endif
+}
+
+uint64_t pixie_fasttime(void)
+{
+#ifdef PIXIE_HAS_TSC
+    if (fastclock.is_tsc)
+        return fastclock.base_ns +
+               (uint64_t) ((double) (__rdtsc() - fastclock.base_tsc) * fastclock.ns_per_tick);
+#endif
+    return pixie_nanotime();
+}
+
+int pixie_fasttime_is_tsc(void)
+{
+    return fastclock.is_tsc;
+}
+
+/*
+ * Sleeping is only accurate to around 50 microseconds on a good day, so
+ * we sleep for the bulk of a long wait, give up our timeslice while still
+ * some distance away, and spin for the final stretch.
+ */
+void pixie_wait_until(uint64_t deadline)
+{
+    for (;;)
+    {
+        uint64_t now = pixie_fasttime();
+        uint64_t remaining;
+
+        if (now >= deadline)
+            return;
+        remaining = deadline - now;
+        if (remaining > 200000)
+            pixie_usleep((remaining - 100000) / 1000);
+        else if (remaining > 20000)
+            cpu_yield();
+        else
+            cpu_relax();
+    }
+}
+
+uint64_t pixie_taitime(void)
+{
+#if defined(CLOCK_TAI)
+    struct timespec tv;
+
+    if (clock_gettime(CLOCK_TAI, &tv) == 0)
+        return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_nsec;
+#endif
+    return 0;
+}
+
 /*
  * Timing is incredibly importatn to masscan because we need to throttle
  * how fast we spew packets. Every platofrm has slightly different timing
@@ -283,5 +414,18 @@ int pixie_time_selftest(void)
         return 1;
     }
 
+    /* The fast clock must agree with the normal one, and waiting on it
+     * must never return early */
+    pixie_fasttime_calibrate();
+    start = pixie_gettime();
+    pixie_wait_until(pixie_fasttime() + duration * 1000);
+    stop = pixie_gettime();
+    elapsed = stop - start;
+    if (elapsed < 0.95 * duration || 1.9 * duration < elapsed)
+    {
+        fprintf(stderr, "timing error, fast clock %5.0f%%\n", elapsed * 100.0 / duration);
+        return 1;
+    }
+
     return 0;
 }
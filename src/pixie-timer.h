@@ -22,6 +22,37 @@ void pixie_usleep(uint64_t usec);
  */
 void pixie_mssleep(unsigned milliseconds);
 
+/**
+ * Measure the CPU's cycle counter against pixie_nanotime(), so that
+ * pixie_fasttime() can use it. This takes a few milliseconds, and must be
+ * called before any threads use pixie_fasttime().
+ */
+void pixie_fasttime_calibrate(void);
+
+/**
+ * The current time, in nanoseconds, on the same clock as pixie_nanotime(),
+ * but much cheaper to read once calibrated, for pacing packets.
+ */
+uint64_t pixie_fasttime(void);
+
+/**
+ * Whether pixie_fasttime() is using the cycle counter, or falling back
+ * to pixie_nanotime().
+ */
+int pixie_fasttime_is_tsc(void);
+
+/**
+ * Wait until pixie_fasttime() reaches 'deadline', sleeping while it's far
+ * away, then yielding, then spinning for the last few microseconds.
+ */
+void pixie_wait_until(uint64_t deadline);
+
+/**
+ * The current time on CLOCK_TAI, in nanoseconds, as used for SO_TXTIME on
+ * Linux. Returns 0 where that clock doesn't exist.
+ */
+uint64_t pixie_taitime(void);
+
 /**
  * Do a self-test. Note that in some cases, this may
  * actually fail when there is no problem. So far it hasn't, but I should
@@ -3,6 +3,7 @@
 */
 #include "proto-banner1.h"
 #include "masscan-app.h"
+#include "massip-rangesv4.h"
 #include "proto-minecraft.h"
 #include "proto-ftp.h"
 #include "proto-http.h"
@@ -247,9 +248,6 @@ struct Patterns patterns[] = {
                                         banout, socket);
                 break;
             case PROTO_MC:
-                banner_mc.parse(banner1, banner1->http_fields, tcb_state, px, length, banout,
-                                socket);
-                break;
             case PROTO_MINECRAFT:
                 banner_minecraft.parse(banner1, banner1->http_fields, tcb_state, px, length, banout,
                                        socket);
@@ -538,7 +536,6 @@ struct Patterns patterns[] = {
         banner_telnet.init(b);
         banner_rdp.init(b);
         banner_vnc.init(b);
-        banner_mc.init(b);
         banner_minecraft.init(b);
 
         /* scripting/versioning come after the rest */
@@ -558,9 +555,69 @@ struct Patterns patterns[] = {
             smack_destroy(b->smack);
         if (b->http_fields)
             smack_destroy(b->http_fields);
+        free(b->minecraft_hellos);
         free(b);
     }
 
+    /*
+     * The probes whose hello can be sent to ports of the user's choosing,
+     * with --hello-set NAME:PORTS
+     */
+    static const struct
+    {
+        const char* name;
+        void (*set_ports)(struct Banner1* b, const struct RangeList* ports);
+    } hello_sets[] = {
+        {"minecraft", minecraft_set_ports},
+        {0, 0},
+    };
+
+    /***************************************************************************
+     ***************************************************************************/
+    bool banner1_hello_set(struct Banner1* b, const char* value)
+    {
+        struct RangeList ports = {0};
+        const char* colon = strchr(value, ':');
+        void (*set_ports)(struct Banner1* b, const struct RangeList* ports);
+        const char* end;
+        unsigned is_error = 0;
+        size_t name_length;
+        size_t i;
+
+        if (colon == NULL)
+            return false;
+        name_length = colon - value;
+        for (i = 0; hello_sets[i].name; i++)
+        {
+            if (strlen(hello_sets[i].name) == name_length &&
+                memcmp(hello_sets[i].name, value, name_length) == 0)
+                break;
+        }
+        if (hello_sets[i].name == NULL)
+            return false;
+        set_ports = hello_sets[i].set_ports;
+
+        /* No "U:" and the like, these are all TCP */
+        end = rangelist_parse_ports(&ports, colon + 1, &is_error, 0);
+        if (*end != '\0' || ports.count == 0)
+            is_error = 1;
+        for (i = 0; i < ports.count; i++)
+        {
+            if (ports.list[i].end > 0xFFFF)
+                is_error = 1;
+        }
+        if (is_error)
+        {
+            rangelist_remove_all(&ports);
+            return false;
+        }
+
+        if (b)
+            set_ports(b, &ports);
+        rangelist_remove_all(&ports);
+        return true;
+    }
+
     /***************************************************************************
      * Test the banner1 detection system by throwing random frames at it
      ***************************************************************************/
@@ -674,6 +731,33 @@ struct Patterns patterns[] = {
 
         banner1_parse(b, tcb_state, px, length, banout, 0);
         banner1_destroy(b);
+
+        /*
+         * Test sending the Minecraft hello to more ports
+         */
+        if (banner1_hello_set(NULL, "minecraft") || banner1_hello_set(NULL, "mc:25565") ||
+            banner1_hello_set(NULL, "minecraft:") || banner1_hello_set(NULL, "minecraft:x") ||
+            banner1_hello_set(NULL, "minecraft:70000") ||
+            banner1_hello_set(NULL, "minecraft:u:25565") ||
+            !banner1_hello_set(NULL, "minecraft:25500-25502, 30000"))
+        {
+            fprintf(stderr, "banner1: hello-set: failed\n");
+            return 1;
+        }
+        b = banner1_create();
+        banner1_hello_set(b, "minecraft:25500-25502,30000");
+        if (b->payloads.tcp[25501] == NULL || b->payloads.tcp[30000] == NULL ||
+            b->payloads.tcp[25503] != NULL || b->payloads.tcp[25565] == NULL ||
+            b->payloads.tcp[25501]->hello_length != 20 ||
+            memcmp(b->payloads.tcp[25501]->hello, "\x07\x00\x82\x06\x00\x63\x9D", 7) != 0 ||
+            memcmp(b->payloads.tcp[30000]->hello, "\x07\x00\x82\x06\x00\x75\x30", 7) != 0)
+        {
+            fprintf(stderr, "banner1: hello-set: failed\n");
+            banner1_destroy(b);
+            return 1;
+        }
+        banner1_destroy(b);
+
         /*if (memcmp(banner, "Via:HTTP/1.1", 11) != 0) {
             printf("banner1: test failed\n");
             return 1;
@@ -724,6 +808,13 @@ struct Patterns patterns[] = {
                 return 1;
             }
 
+            x = banner_minecraft.selftest();
+            if (x)
+            {
+                fprintf(stderr, "Minecraft banner: selftest failed\n");
+                return 1;
+            }
+
             if (x)
                 goto failure;
             else
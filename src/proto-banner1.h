@@ -2,15 +2,18 @@
 #define PROTO_BANNER1_H
 #include <stdint.h>
 
+#include "crypto-siphash24.h"
 #include "masscan-app.h"
 #include "proto-banout.h"
 #include "proto-spnego.h"
 #include "proto-x509.h"
+#include "util-bool.h"
 #include <stdio.h>
 
 struct stack_handle_t;
 struct Banner1;
 struct StreamState;
+struct MinecraftHellos;
 
 typedef void (*BannerParser)(const struct Banner1* banner1, void* banner1_private,
                              struct StreamState* stream_state, const unsigned char* px,
@@ -39,6 +42,9 @@ struct Banner1
         const struct ProtocolParserStream* tcp[65536];
     } payloads;
 
+    /** Per-port hellos for --hello-set minecraft:PORTS */
+    struct MinecraftHellos* minecraft_hellos;
+
     BannerParser parser[PROTO_end_of_list];
 };
 
@@ -133,22 +139,28 @@ struct FTPSTUFF
     unsigned is_last : 1;
 };
 
-struct MCSTUFF
-{
-    char* banmem;
-    size_t totalLen;
-    size_t imgstart;
-    size_t imgend;
-    int brackcount;
-};
-
 struct MINECRAFTSTUFF
 {
-    char* version_name;
-    int version_id;
-    char* description;
-    int max_players;
-    int players_online;
+    /** The VarInt being decoded, which may be split across segments */
+    unsigned varint;
+    unsigned char varint_shift;
+
+    /** Bytes of the JSON string still to come */
+    unsigned json_remaining;
+
+    /** Bytes of the JSON kept in the banner, up to a limit */
+    unsigned json_length;
+    unsigned is_truncated : 1;
+
+    /** Just enough of the JSON's syntax to find the favicon */
+    unsigned is_escaped : 1;
+    unsigned has_favicon : 1;
+    unsigned char json_state;
+    unsigned char key_matched;
+
+    /** The favicon is hashed as it goes by, rather than kept */
+    unsigned favicon_length;
+    struct siphash24_state favicon_hash;
 };
 
 struct SMTPSTUFF
@@ -293,7 +305,6 @@ struct StreamState
         struct MEMCACHEDSTUFF memcached;
         struct SMBSTUFF smb;
         struct RDPSTUFF rdp;
-        struct MCSTUFF mc;
         struct MINECRAFTSTUFF minecraft;
         struct SSHSTUFF ssh;
     } sub;
@@ -304,6 +315,7 @@ enum StreamFlags
     SF__none = 0,
     SF__close = 0x01,        /* send FIN after the static Hello is sent*/
     SF__nowait_hello = 0x02, /* send our hello immediately, don't wait for their hello */
+    SF__hello_per_port = 0x04, /* each port has its own hello, like Minecraft's handshake */
 };
 
 /**
@@ -368,6 +380,16 @@ struct Banner1* banner1_create(void);
 
 void banner1_destroy(struct Banner1* b);
 
+/**
+ * Send a probe's hello to more ports, for --hello-set, like
+ * "minecraft:25500-25600,30000".
+ * @param b
+ *      The banner system to add the ports to, or NULL to just check the value
+ * @return
+ *      false if the probe is unknown or the ports are bad
+ */
+bool banner1_hello_set(struct Banner1* b, const char* value);
+
 unsigned banner1_parse(const struct Banner1* banner1, struct StreamState* pstate,
                        const unsigned char* px, size_t length, struct BannerOutput* banout,
                        struct stack_handle_t* socket);
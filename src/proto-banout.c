@@ -13,11 +13,91 @@
 */
 #include "proto-banner1.h"
 #include "util-malloc.h"
+#include "util-slab.h"
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * Records double in size as they grow, so the pool has a slab for each
+ * of the sizes 200, 400, ... 25600 bytes. Anything bigger than that is
+ * rare enough to come from the heap.
+ */
+#define BANOUT_POOL_CLASSES 8
+
+struct BanoutPool
+{
+    struct Slab* slabs[BANOUT_POOL_CLASSES];
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct BanoutPool* banout_pool_create(void)
+{
+    struct BanoutPool* pool = CALLOC(1, sizeof(*pool));
+    size_t max_length = sizeof(((struct BannerOutput*) 0)->banner);
+    unsigned i;
+
+    for (i = 0; i < BANOUT_POOL_CLASSES; i++, max_length *= 2)
+        pool->slabs[i] = slab_create(offsetof(struct BannerOutput, banner) + max_length);
+    return pool;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void banout_pool_destroy(struct BanoutPool* pool)
+{
+    unsigned i;
+
+    if (pool == NULL)
+        return;
+    for (i = 0; i < BANOUT_POOL_CLASSES; i++) slab_destroy(pool->slabs[i]);
+    free(pool);
+}
+
+/***************************************************************************
+ * Find the slab for records with room for this many bytes, or NULL if
+ * they come from the heap.
+ ***************************************************************************/
+static struct Slab* banout_pool_slab(struct BanoutPool* pool, unsigned max_length)
+{
+    unsigned i;
+
+    if (pool == NULL)
+        return NULL;
+    for (i = 0; i < BANOUT_POOL_CLASSES; i++)
+    {
+        if (offsetof(struct BannerOutput, banner) + max_length <= slab_object_size(pool->slabs[i]))
+            return pool->slabs[i];
+    }
+    return NULL;
+}
+
+/***************************************************************************
+ * Allocate a record with room for 'max_length' bytes of banner.
+ ***************************************************************************/
+static struct BannerOutput* banout_alloc(struct BanoutPool* pool, unsigned max_length)
+{
+    struct Slab* slab = banout_pool_slab(pool, max_length);
+
+    if (slab)
+        return slab_alloc(slab);
+    return MALLOC(offsetof(struct BannerOutput, banner) + max_length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void banout_free(struct BanoutPool* pool, struct BannerOutput* p)
+{
+    struct Slab* slab = banout_pool_slab(pool, p->max_length);
+
+    if (slab)
+        slab_free(slab, p);
+    else
+        free(p);
+}
+
 /***************************************************************************
  ***************************************************************************/
 void banout_init(struct BannerOutput* banout)
@@ -26,6 +106,15 @@ void banout_init(struct BannerOutput* banout)
     banout->protocol = 0;
     banout->next = 0;
     banout->max_length = sizeof(banout->banner);
+    banout->pool = NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void banout_init_pool(struct BannerOutput* banout, struct BanoutPool* pool)
+{
+    banout_init(banout);
+    banout->pool = pool;
 }
 
 /***************************************************************************
@@ -35,10 +124,10 @@ void banout_release(struct BannerOutput* banout)
     while (banout->next)
     {
         struct BannerOutput* next = banout->next->next;
-        free(banout->next);
+        banout_free(banout->pool, banout->next);
         banout->next = next;
     }
-    banout_init(banout);
+    banout_init_pool(banout, banout->pool);
 }
 
 /***************************************************************************
@@ -237,9 +326,11 @@ static struct BannerOutput* banout_new_proto(struct BannerOutput* banout, unsign
         return banout;
     }
 
-    p = CALLOC(1, sizeof(*p));
+    p = banout_alloc(banout->pool, sizeof(p->banner));
     p->protocol = proto;
+    p->length = 0;
     p->max_length = sizeof(p->banner);
+    p->pool = banout->pool;
     p->next = banout->next;
     banout->next = p;
     return p;
@@ -252,7 +343,7 @@ static struct BannerOutput* banout_expand(struct BannerOutput* banout, struct Ba
     struct BannerOutput* n;
 
     /* Double the space */
-    n = MALLOC(offsetof(struct BannerOutput, banner) + 2 * p->max_length);
+    n = banout_alloc(banout->pool, 2 * p->max_length);
 
     /* Copy the old structure */
     memcpy(n, p, offsetof(struct BannerOutput, banner) + p->max_length);
@@ -271,7 +362,7 @@ static struct BannerOutput* banout_expand(struct BannerOutput* banout, struct Ba
          * then free it. */
         while (banout->next != p) banout = banout->next;
         banout->next = n;
-        free(p);
+        banout_free(banout->pool, p);
     }
 
     return n;
@@ -282,7 +373,7 @@ static struct BannerOutput* banout_expand(struct BannerOutput* banout, struct Ba
 static void banout_vprintf(struct BannerOutput* banout, unsigned proto, const char* fmt,
                            va_list marker)
 {
-    char str[10];
+    char str[256]; /* most fields fit, so only rare long ones hit malloc() */
     int len;
     va_list marker_cpy;  // a va_list is consumed when passed to vsnprintf.
 
@@ -514,5 +605,36 @@ int banout_selftest(void)
         banout_release(banout);
     }
 
+    /*
+     * Pooled banners, growing through every size of record and past the
+     * biggest, should come out the same, and all go back to the pool
+     */
+    {
+        struct BanoutPool* pool = banout_pool_create();
+        struct BannerOutput banout[1];
+        unsigned i;
+
+        banout_init_pool(banout, pool);
+        for (i = 0; i < 10000; i++)
+        {
+            banout_append(banout, 1, "abcd", 4);
+            banout_append_char(banout, 2, 'x');
+        }
+        if (banout_string_length(banout, 1) != 40000 || banout_string_length(banout, 2) != 10000)
+            return 1;
+        if (memcmp(banout_string(banout, 1) + 39996, "abcd", 4) != 0)
+            return 1;
+
+        banout_release(banout);
+        if (banout->next != 0 || banout->pool != pool)
+            return 1;
+        for (i = 0; i < BANOUT_POOL_CLASSES; i++)
+        {
+            if (slab_count(pool->slabs[i]) != 0)
+                return 1;
+        }
+        banout_pool_destroy(pool);
+    }
+
     return 0;
 }
@@ -1,6 +1,7 @@
 #ifndef PROTO_BANOUT_H
 #define PROTO_BANOUT_H
 struct BannerBase64;
+struct BanoutPool;
 
 /**
  * A structure for tracking one or more banners from a target.
@@ -18,6 +19,7 @@ struct BannerOutput
     unsigned protocol;
     unsigned length;
     unsigned max_length;
+    struct BanoutPool* pool;
     unsigned char banner[200];
 };
 
@@ -27,6 +29,21 @@ struct BannerOutput
  */
 void banout_init(struct BannerOutput* banout);
 
+/**
+ * Initialize the list of banners, which will get any memory it needs from
+ * the pool instead of the heap. This is for banners on the TCP stack,
+ * where there are a lot of them.
+ */
+void banout_init_pool(struct BannerOutput* banout, struct BanoutPool* pool);
+
+/**
+ * Create a pool of banner records, with a slab for each size that
+ * 'banout_append()' grows them to.
+ */
+struct BanoutPool* banout_pool_create(void);
+
+void banout_pool_destroy(struct BanoutPool* pool);
+
 /**
  * Release any memory. If the list contains only one short
  * banner, then no memory was allocated, so nothing gets
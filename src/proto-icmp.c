@@ -51,7 +51,8 @@ static int parse_port_unreachable(const unsigned char* px, unsigned length, unsi
  * be inadvertent, such as "destination unreachable" messages.
  ***************************************************************************/
 void handle_icmp(struct Output* out, time_t timestamp, const unsigned char* px, unsigned length,
-                 struct PreprocessedInfo* parsed, uint64_t entropy)
+                 struct PreprocessedInfo* parsed, uint64_t entropy,
+                 struct DedupTable* echo_reply_dedup)
 {
     unsigned type = parsed->port_src;
     unsigned code = parsed->port_dst;
@@ -60,12 +61,6 @@ void handle_icmp(struct Output* out, time_t timestamp, const unsigned char* px,
     ipaddress ip_them = parsed->src_ip;
     unsigned cookie;
 
-    /* dedup ICMP echo replies as well as SYN/ACK replies */
-    static struct DedupTable* echo_reply_dedup = NULL;
-
-    if (!echo_reply_dedup)
-        echo_reply_dedup = dedup_create();
-
     seqno_me = px[parsed->transport_offset + 4] << 24 | px[parsed->transport_offset + 5] << 16 |
                px[parsed->transport_offset + 6] << 8 | px[parsed->transport_offset + 7] << 0;
 
@@ -5,8 +5,14 @@
 
 struct PreprocessedInfo;
 struct Output;
+struct DedupTable;
 
+/**
+ * @param echo_reply_dedup
+ *      The receive thread's own table for ignoring duplicate echo replies
+ */
 void handle_icmp(struct Output* out, time_t timestamp, const unsigned char* px, unsigned length,
-                 struct PreprocessedInfo* parsed, uint64_t entropy);
+                 struct PreprocessedInfo* parsed, uint64_t entropy,
+                 struct DedupTable* echo_reply_dedup);
 
 #endif
@@ -1,197 +1,499 @@
 #include "proto-minecraft.h"
 #include "masscan-app.h"
+#include "massip-rangesv4.h"
 #include "output.h"
 #include "proto-banner1.h"
 #include "stack-tcp-api.h"
 #include "unusedparm.h"
+#include "util-json.h"
 #include "util-logger.h"
-#include "jsmn.h"
+#include "util-malloc.h"
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define JSON_MAX_TOKEN_COUNT 128
+/*
+ * The status response is a single frame: a VarInt frame length, a VarInt
+ * packet id of 0, then the JSON as a string, which is a VarInt length
+ * followed by that many bytes. Servers with long MOTDs or favicons send it
+ * across many segments, splitting the VarInts anywhere, so we parse it a
+ * byte at a time, remembering where we are in 'StreamState'.
+ */
+enum
+{
+    MC_FRAME_LENGTH,
+    MC_PACKET_ID,
+    MC_JSON_LENGTH,
+    MC_JSON,
+    MC_SKIP, /* the rest of a frame we don't care about */
+    MC_DONE,
+};
+
+/** Frames are limited to what a 3-byte VarInt can hold */
+#define MC_FRAME_MAX ((1 << 21) - 1)
+
+/** How much of the JSON we keep as the banner, not counting the favicon */
+#define MC_JSON_MAX (32 * 1024)
+
+/*
+ * Where we are in the JSON, which we follow just closely enough to find
+ * the favicon.
+ */
+enum
+{
+    JSON_OUTSIDE,
+    JSON_STRING,
+    JSON_AFTER_KEY,    /* after a "favicon" string, expecting a colon */
+    JSON_BEFORE_VALUE, /* after the colon, expecting the value */
+    JSON_FAVICON,
+};
+
+/** The string so far isn't "favicon" */
+#define KEY_MISMATCH 0xFF
+
+/** The protocol version we put in the handshake, that of 1.21.5. Servers
+ * answer a status request whatever it is. */
+#define MC_PROTOCOL_VERSION 770
+
+/** The handshake, status request, and ping, with room to spare */
+#define MC_HELLO_MAX 32
+
+/*
+ * Each port gets its own hello, since the handshake names the port it's
+ * sent to. Allocated the first time a port needs one, but the pages of
+ * ports that don't aren't touched.
+ */
+struct MinecraftHellos
+{
+    struct ProtocolParserStream streams[65536];
+    unsigned char hellos[65536][MC_HELLO_MAX];
+};
 
-static unsigned char handshake[8] = {0x07, 0x00, 0x82, 0x06, 0x00, 0x00, 0x00, 0x01};
-static unsigned char status_request[2] = {0x01, 0x00};
-static unsigned char ping_request[10] = {0x09, 0x01, 0xF0, 0x0D, 0xBA,
-                                         0xD0, 0x00, 0x00, 0x00, 0x00};
+static const unsigned char status_request[2] = {0x01, 0x00};
+static const unsigned char ping_request[10] = {0x09, 0x01, 0xF0, 0x0D, 0xBA,
+                                               0xD0, 0x00, 0x00, 0x00, 0x00};
 
-int str2int(const unsigned char* s, int length)
+/***************************************************************************
+ * Get the fields we report out of the status JSON. The strings point into
+ * the JSON, and are still escaped.
+ ***************************************************************************/
+static int parse_json(const unsigned char* json, size_t json_size, struct MinecraftStatus* status)
 {
-    int out = 0;
-    for (int i = 0; i < length; i++)
+    struct JsonIndex* index;
+    size_t version;
+    size_t players;
+    size_t description;
+    const char* s;
+    size_t length;
+
+    index = json_index_create((const char*) json, json_size);
+    if (index == NULL || json_peek(index, 0) != '{')
+    {
+        LOG(1, "Failed to parse JSON from the status packet!\n");
+        json_index_destroy(index);
+        return -1;
+    }
+
+    version = json_object_get(index, 0, "version");
+    if (json_string(index, json_object_get(index, version, "name"), &s, &length))
     {
-        out = out * 10 + (s[i] - '0');
+        status->version_name = s;
+        status->version_name_length = (unsigned) length;
     }
+    json_int(index, json_object_get(index, version, "protocol"), &status->protocol);
+
+    players = json_object_get(index, 0, "players");
+    json_int(index, json_object_get(index, players, "max"), &status->players_max);
+    json_int(index, json_object_get(index, players, "online"), &status->players_online);
+
+    /* Older servers send the description as a plain string */
+    description = json_object_get(index, 0, "description");
+    if (json_peek(index, description) == '{')
+        description = json_object_get(index, description, "text");
+    if (json_string(index, description, &s, &length))
+    {
+        status->description = s;
+        status->description_length = (unsigned) length;
+    }
+
+    json_index_destroy(index);
+    return 0;
+}
 
-    return out;
+/***************************************************************************
+ * Add the next byte to the VarInt being decoded.
+ * @return
+ *      1 when the VarInt is complete, 0 if more bytes are needed, or -1 if
+ *      it's longer than the 5 bytes a 32-bit value can take.
+ ***************************************************************************/
+static int varint_next(struct MINECRAFTSTUFF* mc, unsigned char c)
+{
+    if (mc->varint_shift >= 35)
+        return -1;
+    mc->varint |= (unsigned) (c & 0x7F) << mc->varint_shift;
+    mc->varint_shift += 7;
+    return (c & 0x80) ? 0 : 1;
 }
 
-int compare(const unsigned char* json, jsmntok_t* tok, const char* s)
+/***************************************************************************
+ ***************************************************************************/
+static bool hex4(const char* s, unsigned* value)
 {
-    return (tok->type == JSMN_STRING && (int) strlen(s) == tok->end - tok->start &&
-            strncmp((const char*) json + tok->start, s, tok->end - tok->start) == 0);
+    unsigned i;
+
+    *value = 0;
+    for (i = 0; i < 4; i++)
+    {
+        unsigned char c = (unsigned char) s[i];
+
+        if (!isxdigit(c))
+            return false;
+        *value = *value << 4 | (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return true;
 }
 
-int read_varint(const unsigned char* data, int* value, int* bytes_read)
+/***************************************************************************
+ * Decode the escapes in a JSON string into UTF-8, as much as fits in 'max'
+ * bytes. Escaped control characters become spaces. Everything else, like
+ * the UTF-8 most servers send unescaped, is copied as it is.
+ ***************************************************************************/
+static size_t json_unescape(const char* s, size_t length, char* buf, size_t max)
 {
-    int result = 0;
-    int shift = 0;
-    *bytes_read = 0;
+    size_t i;
+    size_t n = 0;
 
-    for (int i = 0; i < 5; ++i)
+    for (i = 0; i < length && n + 4 <= max; i++)
     {
-        unsigned char byte = data[i];
-        (*bytes_read)++;
+        unsigned c = (unsigned char) s[i];
+        unsigned lo;
 
-        result |= (byte & 0x7F) << shift;
+        if (c != '\\' || i + 1 == length)
+        {
+            buf[n++] = (char) c;
+            continue;
+        }
 
-        if ((byte & 0x80) == 0)
+        c = (unsigned char) s[++i];
+        switch (c)
         {
-            *value = result;
-            return 0;
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+                c = ' ';
+                break;
+            case 'u':
+                if (i + 4 >= length || !hex4(s + i + 1, &c))
+                    break;
+                i += 4;
+
+                /* Characters outside the BMP, like emoji, are a pair */
+                if (c >= 0xD800 && c < 0xDC00 && i + 6 < length && s[i + 1] == '\\' &&
+                    s[i + 2] == 'u' && hex4(s + i + 3, &lo) && lo >= 0xDC00 && lo < 0xE000)
+                {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 6;
+                }
+                break;
+            default: /* quote, backslash, and slash are themselves */
+                break;
         }
 
-        shift += 7;
+        if (c < 0x80)
+            buf[n++] = (char) c;
+        else if (c < 0x800)
+        {
+            buf[n++] = (char) (0xC0 | c >> 6);
+            buf[n++] = (char) (0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            buf[n++] = (char) (0xE0 | c >> 12);
+            buf[n++] = (char) (0x80 | (c >> 6 & 0x3F));
+            buf[n++] = (char) (0x80 | (c & 0x3F));
+        }
+        else
+        {
+            buf[n++] = (char) (0xF0 | c >> 18);
+            buf[n++] = (char) (0x80 | (c >> 12 & 0x3F));
+            buf[n++] = (char) (0x80 | (c >> 6 & 0x3F));
+            buf[n++] = (char) (0x80 | (c & 0x3F));
+        }
     }
+    return n;
+}
 
-    return 1;
+/***************************************************************************
+ ***************************************************************************/
+static size_t status_copy(char* buf, const char* s, size_t length, size_t max)
+{
+    size_t i;
+
+    if (length > max)
+        length = max;
+    for (i = 0; i < length; i++)
+        buf[i] = ((unsigned char) s[i] < 0x20 || s[i] == 0x7F) ? ' ' : s[i];
+    return length;
 }
 
-int read_packet_information(const unsigned char* packet, int* length, int* id, int* bytes_read)
+/***************************************************************************
+ ***************************************************************************/
+size_t minecraft_status_format(const struct MinecraftStatus* status, char* buf)
 {
-    int bytes = 0;
-    if (read_varint(packet, length, &bytes))
+    size_t n;
+
+    n = status_copy(buf, status->version_name, status->version_name_length,
+                    MINECRAFT_VERSION_MAX);
+    n += snprintf(buf + n, 64, "\t%d\t%d\t%d\t%u\t", status->protocol, status->players_max,
+                  status->players_online, status->favicon_length);
+    if (status->favicon_length)
+        n += snprintf(buf + n, 20, "%016llx", (unsigned long long) status->favicon_hash);
+    buf[n++] = '\t';
+    n += status_copy(buf + n, status->description, status->description_length,
+                     MINECRAFT_DESCRIPTION_MAX);
+    return n;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static bool status_int(const char* s, size_t length, int* value)
+{
+    size_t i = 0;
+    int sign = 1;
+
+    if (length && s[0] == '-')
     {
-        return 1;
+        sign = -1;
+        i++;
     }
-
-    if (read_varint(packet + bytes, id, bytes_read))
+    if (i == length || length > 11)
+        return false;
+    for (*value = 0; i < length; i++)
     {
-        return 1;
+        if (!isdigit((unsigned char) s[i]))
+            return false;
+        *value = *value * 10 + (s[i] - '0');
     }
-
-    *bytes_read += bytes;
-
-    return 0;
+    *value *= sign;
+    return true;
 }
 
-int parse_json(const unsigned char* json, int json_size, struct StreamState* pstate)
+/***************************************************************************
+ ***************************************************************************/
+bool minecraft_status_parse(const unsigned char* px, size_t length,
+                            struct MinecraftStatus* status)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[JSON_MAX_TOKEN_COUNT];
+    const char* s = (const char*) px;
+    const char* end = s + length;
+    const char* field[6];
+    size_t field_length[6];
+    int favicon_length;
+    unsigned i;
+
+    for (i = 0; i < 6; i++)
+    {
+        const char* tab = memchr(s, '\t', end - s);
 
-    jsmn_init(&parser);
+        if (tab == NULL)
+            return false;
+        field[i] = s;
+        field_length[i] = tab - s;
+        s = tab + 1;
+    }
 
-    int token_count =
-        jsmn_parse(&parser, (const char*) json, json_size, tokens, JSON_MAX_TOKEN_COUNT);
+    status->version_name = field[0];
+    status->version_name_length = (unsigned) field_length[0];
+    if (!status_int(field[1], field_length[1], &status->protocol) ||
+        !status_int(field[2], field_length[2], &status->players_max) ||
+        !status_int(field[3], field_length[3], &status->players_online) ||
+        !status_int(field[4], field_length[4], &favicon_length) || favicon_length < 0)
+        return false;
+    status->favicon_length = (unsigned) favicon_length;
+    status->favicon_hash = 0;
+    if (field_length[5] != (status->favicon_length ? 16 : 0))
+        return false;
+    for (i = 0; i < field_length[5]; i++)
+    {
+        unsigned char c = (unsigned char) field[5][i];
 
-    if (token_count < 0)
+        if (!isxdigit(c))
+            return false;
+        status->favicon_hash = status->favicon_hash << 4 |
+                               (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    status->description = s;
+    status->description_length = (unsigned) (end - s);
+    return true;
+}
+
+/***************************************************************************
+ * Keep JSON for the banner, up to the limit.
+ ***************************************************************************/
+static void json_keep(struct MINECRAFTSTUFF* mc, struct BannerOutput* banout,
+                      const unsigned char* px, size_t length)
+{
+    if (length > MC_JSON_MAX - mc->json_length)
     {
-        LOG(1, "Failed to parse JSON from the status packet!\n");
-        return -1;
+        length = MC_JSON_MAX - mc->json_length;
+        mc->is_truncated = 1;
     }
+    if (length)
+        banout_append(banout, PROTO_MINECRAFT, px, length);
+    mc->json_length += (unsigned) length;
+}
 
-    LOG(1, "Successfully parsed JSON!\n");
+/***************************************************************************
+ * Follow the next piece of the JSON, keeping all of it for the banner
+ * except the favicon. That's a base64 image, usually most of the response,
+ * but all that matters about it is whether it's the same as other servers'
+ * favicons, so we hash it as it goes by. The banner gets an empty string
+ * in its place.
+ ***************************************************************************/
+static void minecraft_json(struct MINECRAFTSTUFF* mc, struct BannerOutput* banout,
+                           const unsigned char* px, size_t length)
+{
+    static const char favicon[] = "favicon";
+    static const uint64_t key[2] = {0, 0}; /* fixed, so hashes compare across scans */
+    size_t start = 0;
+    size_t i;
 
-    for (int current = 1; current < token_count; current++)
+    for (i = 0; i < length; i++)
     {
-        if (compare(json, &tokens[current], "version"))
-        {
-            current++;
+        unsigned char c = px[i];
 
-            int children = tokens[current].size;
-            for (int i = 0; i < children; i++)
-            {
-                current++;
-
-                if (compare(json, &tokens[current], "name"))
+        switch (mc->json_state)
+        {
+            case JSON_OUTSIDE:
+                if (c == '"')
                 {
-                    current++;
-
-                    int size = tokens[current].end - tokens[current].start;
-                    pstate->sub.minecraft.version_name = malloc(size + 1);
-                    memcpy(pstate->sub.minecraft.version_name, json + tokens[current].start, size);
-                    pstate->sub.minecraft.version_name[size] = '\0';
-                    LOG(1, "Version Name: %s\n", pstate->sub.minecraft.version_name);
+                    mc->json_state = JSON_STRING;
+                    mc->key_matched = 0;
                 }
-                else if (compare(json, &tokens[current], "protocol"))
-                {
-                    current++;
+                break;
 
-                    int size = tokens[current].end - tokens[current].start;
-                    pstate->sub.minecraft.version_id = str2int(json + tokens[current].start, size);
-                    LOG(1, "Protocol Version Number: %d\n", pstate->sub.minecraft.version_id);
+            case JSON_STRING:
+                if (mc->is_escaped)
+                {
+                    mc->is_escaped = 0;
+                    mc->key_matched = KEY_MISMATCH;
                 }
+                else if (c == '\\')
+                    mc->is_escaped = 1;
+                else if (c == '"')
+                    mc->json_state =
+                        mc->key_matched == sizeof(favicon) - 1 ? JSON_AFTER_KEY : JSON_OUTSIDE;
+                else if (mc->key_matched < sizeof(favicon) - 1 && c == favicon[mc->key_matched])
+                    mc->key_matched++;
                 else
+                    mc->key_matched = KEY_MISMATCH;
+                break;
+
+            case JSON_AFTER_KEY:
+                if (c == ':')
+                    mc->json_state = JSON_BEFORE_VALUE;
+                else if (c == '"')
                 {
-                    current++;
+                    mc->json_state = JSON_STRING;
+                    mc->key_matched = 0;
                 }
-            }
-        }
+                else if (!isspace(c))
+                    mc->json_state = JSON_OUTSIDE;
+                break;
 
-        else if (compare(json, &tokens[current], "players"))
-        {
-            current++;
+            case JSON_BEFORE_VALUE:
+                if (c == '"')
+                {
+                    /* Keep everything up to the opening quote */
+                    json_keep(mc, banout, px + start, i + 1 - start);
+                    start = i + 1;
+                    siphash24_init(&mc->favicon_hash, key);
+                    mc->favicon_length = 0;
+                    mc->has_favicon = 1;
+                    mc->json_state = JSON_FAVICON;
+                }
+                else if (!isspace(c))
+                    mc->json_state = JSON_OUTSIDE;
+                break;
 
-            int children = tokens[current].size;
-            for (int i = 0; i < children; i++)
+            case JSON_FAVICON:
             {
-                current++;
+                size_t n;
 
-                if (compare(json, &tokens[current], "max"))
+                /* Hash what an escape stands for, like the slashes some
+                 * servers escape, so they hash the same as others */
+                if (mc->is_escaped)
                 {
-                    current++;
-
-                    int size = tokens[current].end - tokens[current].start;
-                    pstate->sub.minecraft.max_players = str2int(json + tokens[current].start, size);
-                    LOG(1, "Max Players: %d\n", pstate->sub.minecraft.max_players);
+                    mc->is_escaped = 0;
+                    siphash24_update(&mc->favicon_hash, px + i, 1);
+                    mc->favicon_length++;
+                    break;
                 }
-                else if (compare(json, &tokens[current], "online"))
-                {
-                    current++;
 
-                    int size = tokens[current].end - tokens[current].start;
-                    pstate->sub.minecraft.players_online =
-                        str2int(json + tokens[current].start, size);
-                    LOG(1, "Players Online: %d\n", pstate->sub.minecraft.players_online);
+                for (n = i; n < length && px[n] != '"' && px[n] != '\\'; n++);
+                siphash24_update(&mc->favicon_hash, px + i, n - i);
+                mc->favicon_length += (unsigned) (n - i);
+                i = n;
+                if (n == length)
+                    break;
+                if (px[n] == '\\')
+                    mc->is_escaped = 1;
+                else
+                {
+                    /* Keep everything from the closing quote */
+                    start = n;
+                    mc->json_state = JSON_OUTSIDE;
                 }
+                break;
             }
         }
+    }
 
-        else if (compare(json, &tokens[current], "description"))
-        {
-            current++;
-
-            int children = tokens[current].size;
-            for (int i = 0; i < children; i++)
-            {
-                current++;
+    if (mc->json_state != JSON_FAVICON)
+        json_keep(mc, banout, px + start, length - start);
+}
 
-                if (compare(json, &tokens[current], "text"))
-                {
-                    current++;
+/***************************************************************************
+ * We have all of the status we are going to get, so there's no reason to
+ * wait for the server to time out. Besides the raw JSON, report the fields
+ * people look for, so they don't have to parse the JSON again themselves.
+ ***************************************************************************/
+static void minecraft_done(struct StreamState* pstate, struct BannerOutput* banout,
+                           struct stack_handle_t* socket)
+{
+    struct MINECRAFTSTUFF* mc = &pstate->sub.minecraft;
 
-                    int size = tokens[current].end - tokens[current].start;
-                    pstate->sub.minecraft.description = malloc(size + 1);
-                    memcpy(pstate->sub.minecraft.description, json + tokens[current].start, size);
-                    pstate->sub.minecraft.description[size] = '\0';
-                    LOG(1, "Description: %s\n", pstate->sub.minecraft.description);
-                }
-            }
-        }
+    if (mc->json_length && mc->json_remaining == 0 && !mc->is_truncated)
+    {
+        struct MinecraftStatus status = {0};
+        char version_name[MINECRAFT_VERSION_MAX];
+        char description[MINECRAFT_DESCRIPTION_MAX];
+        char buf[MINECRAFT_STATUS_LENGTH];
 
-        else if (compare(json, &tokens[current], "enforcesSecureChat"))
+        if (parse_json(banout_string(banout, PROTO_MINECRAFT), mc->json_length, &status) == 0)
         {
-            current++;
-            for (int _ = 0; _ <= tokens[current].size; _++)
+            status.version_name_length =
+                (unsigned) json_unescape(status.version_name, status.version_name_length,
+                                         version_name, sizeof(version_name));
+            status.version_name = version_name;
+            status.description_length =
+                (unsigned) json_unescape(status.description, status.description_length,
+                                         description, sizeof(description));
+            status.description = description;
+            if (mc->has_favicon)
             {
+                status.favicon_length = mc->favicon_length;
+                status.favicon_hash = siphash24_final(&mc->favicon_hash);
             }
+            banout_append(banout, PROTO_MINECRAFT_STATUS, buf,
+                          minecraft_status_format(&status, buf));
         }
     }
 
-    return 0;
+    pstate->state = MC_DONE;
+    tcpapi_close(socket);
 }
 
 /***************************************************************************
@@ -200,54 +502,461 @@ static void minecraft_parse(const struct Banner1* banner1, void* banner1_private
                             struct StreamState* pstate, const unsigned char* px, size_t length,
                             struct BannerOutput* banout, struct stack_handle_t* socket)
 {
-    int len = 0;
-    int id = 0;
-    int read = 0;
-    read_packet_information(px, &len, &id, &read);
+    struct MINECRAFTSTUFF* mc = &pstate->sub.minecraft;
+    size_t i;
+    int x;
+    UNUSEDPARM(banner1_private);
+    UNUSEDPARM(banner1);
 
-    if (id == 0x00)  // Status response packet
+    for (i = 0; i < length && pstate->state != MC_DONE; i++)
     {
-        int json_size = 0;
-        int bytes_read_json_length = 0;
-        read_varint(px + read, &json_size, &bytes_read_json_length);
+        switch (pstate->state)
+        {
+            case MC_FRAME_LENGTH:
+                x = varint_next(mc, px[i]);
+                if (x == 0)
+                    break;
+                if (x < 0 || mc->varint == 0 || mc->varint > MC_FRAME_MAX)
+                {
+                    minecraft_done(pstate, banout, socket);
+                    break;
+                }
+                pstate->remaining = mc->varint;
+                mc->varint = 0;
+                mc->varint_shift = 0;
+                pstate->state = MC_PACKET_ID;
+                break;
+
+            case MC_PACKET_ID:
+                pstate->remaining--;
+                x = varint_next(mc, px[i]);
+                if (x == 0 && pstate->remaining)
+                    break;
+                if (x > 0 && mc->varint == 0x00 && pstate->remaining)
+                    pstate->state = MC_JSON_LENGTH;
+                else if (x > 0 && pstate->remaining)
+                    pstate->state = MC_SKIP;
+                else if (x > 0)
+                    pstate->state = MC_FRAME_LENGTH;
+                else
+                {
+                    minecraft_done(pstate, banout, socket);
+                    break;
+                }
+                mc->varint = 0;
+                mc->varint_shift = 0;
+                break;
+
+            case MC_JSON_LENGTH:
+                pstate->remaining--;
+                x = varint_next(mc, px[i]);
+                if (x == 0 && pstate->remaining)
+                    break;
+                if (x <= 0 || mc->varint > pstate->remaining)
+                {
+                    minecraft_done(pstate, banout, socket);
+                    break;
+                }
+                mc->json_remaining = mc->varint;
+                mc->varint = 0;
+                mc->varint_shift = 0;
+                pstate->state = MC_JSON;
+                if (mc->json_remaining == 0)
+                    minecraft_done(pstate, banout, socket);
+                break;
+
+            case MC_JSON:
+            {
+                size_t n = length - i;
+
+                if (n > mc->json_remaining)
+                    n = mc->json_remaining;
+                minecraft_json(mc, banout, px + i, n);
+                mc->json_remaining -= (unsigned) n;
+                pstate->remaining -= (unsigned) n;
+                i += n - 1;
+
+                /* Anything after the JSON in the frame isn't part of the
+                 * status, so we are done */
+                if (mc->json_remaining == 0)
+                    minecraft_done(pstate, banout, socket);
+                break;
+            }
 
-        const unsigned char* json = px + read + bytes_read_json_length;
+            case MC_SKIP:
+            {
+                size_t n = length - i;
+
+                if (n > pstate->remaining)
+                    n = pstate->remaining;
+                pstate->remaining -= (unsigned) n;
+                i += n - 1;
+                if (pstate->remaining == 0)
+                    pstate->state = MC_FRAME_LENGTH;
+                break;
+            }
+        }
+    }
+}
 
-        banout_append(banout, PROTO_MINECRAFT, json, json_size);
+/***************************************************************************
+ ***************************************************************************/
+static size_t varint_write(unsigned char* px, unsigned value)
+{
+    size_t n = 0;
 
-        parse_json(json, json_size, pstate);
+    while (value > 0x7F)
+    {
+        px[n++] = (unsigned char) (0x80 | (value & 0x7F));
+        value >>= 7;
     }
+    px[n++] = (unsigned char) value;
+    return n;
+}
 
-    return;
+/***************************************************************************
+ * Build the hello for a port: the handshake, with an empty server address
+ * and the port, asking for the status, then the status request, and a
+ * ping so that servers that wait for one still answer.
+ * @return
+ *      the length of the hello, at most MC_HELLO_MAX
+ ***************************************************************************/
+static size_t minecraft_hello(unsigned char* px, unsigned port)
+{
+    unsigned char handshake[16];
+    size_t handshake_length = 0;
+    size_t n;
+
+    handshake[handshake_length++] = 0x00; /* packet id */
+    handshake_length += varint_write(handshake + handshake_length, MC_PROTOCOL_VERSION);
+    handshake[handshake_length++] = 0x00; /* server address */
+    handshake[handshake_length++] = (unsigned char) (port >> 8);
+    handshake[handshake_length++] = (unsigned char) (port & 0xFF);
+    handshake[handshake_length++] = 0x01; /* next state: status */
+
+    n = varint_write(px, (unsigned) handshake_length);
+    memcpy(px + n, handshake, handshake_length);
+    n += handshake_length;
+    memcpy(px + n, status_request, sizeof(status_request));
+    n += sizeof(status_request);
+    memcpy(px + n, ping_request, sizeof(ping_request));
+    n += sizeof(ping_request);
+    return n;
 }
 
 /***************************************************************************
  ***************************************************************************/
-static void* minecraft_init(struct Banner1* banner1)
+static void minecraft_set_port(struct Banner1* banner1, unsigned port)
 {
-    // LOG(1, "Called initialization function!\n");
+    struct MinecraftHellos* x = banner1->minecraft_hellos;
+    struct ProtocolParserStream* stream;
+
+    if (x == NULL)
+        x = banner1->minecraft_hellos = CALLOC(1, sizeof(*x));
+
+    stream = &x->streams[port];
+    *stream = banner_minecraft;
+    stream->flags |= SF__hello_per_port;
+    stream->hello = x->hellos[port];
+    stream->hello_length = minecraft_hello(x->hellos[port], port);
+    banner1->payloads.tcp[port] = stream;
+}
 
-    int total = sizeof(handshake) + sizeof(status_request) + sizeof(ping_request);
+/***************************************************************************
+ ***************************************************************************/
+void minecraft_set_ports(struct Banner1* banner1, const struct RangeList* ports)
+{
+    unsigned i;
 
-    unsigned char* hello = malloc(total);
+    for (i = 0; i < ports->count; i++)
+    {
+        unsigned port;
 
-    memcpy(hello, handshake, sizeof(handshake));
-    memcpy(hello + sizeof(handshake), status_request, sizeof(status_request));
-    memcpy(hello + sizeof(handshake) + sizeof(status_request), ping_request, sizeof(ping_request));
+        for (port = ports->list[i].begin; port <= ports->list[i].end && port < 65536; port++)
+            minecraft_set_port(banner1, port);
+    }
+}
 
-    banner_minecraft.hello = hello;
-    banner_minecraft.hello_length = total;
+/***************************************************************************
+ ***************************************************************************/
+static void* minecraft_init(struct Banner1* banner1)
+{
+    minecraft_set_port(banner1, 25565);
+    minecraft_set_port(banner1, 1337);
+    return 0;
+}
 
-    banner1->payloads.tcp[1337] = (void*) &banner_minecraft;
+/***************************************************************************
+ * Build a status response with the given JSON, preceded by some other
+ * packet we should skip, and followed by the pong to our ping.
+ * @return
+ *      the length of the response, with 'status_length' set to where the
+ *      status frame ends.
+ ***************************************************************************/
+static size_t minecraft_selftest_response(unsigned char* px, const char* json, size_t json_length,
+                                          size_t* status_length)
+{
+    static const unsigned char other[] = {0x03, 0x05, 0xAB, 0xCD};
+    static const unsigned char pong[] = {0x09, 0x01, 0xF0, 0x0D, 0xBA, 0xD0, 0, 0, 0, 0};
+    unsigned char json_varint[5];
+    size_t json_varint_length = varint_write(json_varint, (unsigned) json_length);
+    size_t n = 0;
+
+    memcpy(px + n, other, sizeof(other));
+    n += sizeof(other);
+    n += varint_write(px + n, (unsigned) (1 + json_varint_length + json_length));
+    px[n++] = 0x00;
+    memcpy(px + n, json_varint, json_varint_length);
+    n += json_varint_length;
+    memcpy(px + n, json, json_length);
+    n += json_length;
+    *status_length = n;
+    memcpy(px + n, pong, sizeof(pong));
+    n += sizeof(pong);
+    return n;
+}
 
+/***************************************************************************
+ * Feed the response as a first segment of 'split' bytes, then segments of
+ * 'step' bytes, checking that we are done exactly when the status frame
+ * is complete.
+ ***************************************************************************/
+static int minecraft_selftest_feed(struct StreamState* pstate, struct BannerOutput* banout,
+                                   const unsigned char* px, size_t length, size_t status_length,
+                                   size_t split, size_t step)
+{
+    struct stack_handle_t socket = {0, 0, 0, 0};
+    size_t offset;
+    size_t n;
+
+    memset(pstate, 0, sizeof(*pstate));
+    banout_init(banout);
+
+    for (offset = 0; offset < length; offset += n)
+    {
+        n = offset < split ? split - offset : step;
+        if (n > length - offset)
+            n = length - offset;
+        minecraft_parse(0, 0, pstate, px + offset, n, banout, &socket);
+        if ((pstate->state == MC_DONE) != (offset + n >= status_length))
+            return 1;
+    }
     return 0;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+static bool minecraft_selftest_banner(const struct BannerOutput* banout, unsigned proto,
+                                      const char* expected, size_t expected_length)
+{
+    return banout_string_length(banout, proto) == expected_length &&
+           memcmp(banout_string(banout, proto), expected, expected_length) == 0;
+}
+
 /***************************************************************************
  ***************************************************************************/
 static int minecraft_selftest(void)
 {
+    static const char json[] =
+        "{\"version\":{\"name\":\"1.21.4\",\"protocol\":769},"
+        "\"players\":{\"max\":20,\"online\":3},"
+        "\"description\":{\"text\":\"A Minecraft Server, with a message of the day long "
+        "enough that the JSON length takes two bytes\"}}";
+    static const char status[] = "1.21.4\t769\t20\t3\t0\t\tA Minecraft Server, with a message of "
+                                 "the day long enough that the JSON length takes two bytes";
+
+    /* An older server, with a plain description, and escapes to decode */
+    static const char json_old[] =
+        "{\"description\":\"\\u00a7aHello \\\"world\\\"\\n\\ud83d\\ude00\","
+        "\"players\":{\"max\":100,\"online\":0},"
+        "\"version\":{\"name\":\"Paper\\t1.8\",\"protocol\":47}}";
+    static const char status_old[] =
+        "Paper 1.8\t47\t100\t0\t0\t\t\xC2\xA7" "aHello \"world\" \xF0\x9F\x98\x80";
+
+    /* A newer server, sending UTF-8 as it is, next to an escape */
+    static const char json_utf8[] =
+        "{\"version\":{\"name\":\"Caf\xC3\xA9 1.21\",\"protocol\":769},"
+        "\"description\":\"\xC2\xA7" "a\xE2\x9C\xA8 Welcome \\u00a7b\xF0\x9F\x98\x80\"}";
+    static const char status_utf8[] =
+        "Caf\xC3\xA9 1.21\t769\t0\t0\t0\t\t\xC2\xA7" "a\xE2\x9C\xA8 Welcome \xC2\xA7"
+        "b\xF0\x9F\x98\x80";
+
+    /* A favicon with its slashes escaped, as some servers do, after a
+     * "favicon" that's a value rather than a key */
+    static const char json_favicon[] =
+        "{\"modinfo\":{\"type\":\"favicon\"},\"favicon\" : "
+        "\"data:image\\/png;base64,iVBORw0KGgoAAAANSUhEUgAAAEAAAABACAYAAACqaXHe\","
+        "\"version\":{\"name\":\"1.21.4\",\"protocol\":769}}";
+    static const char json_favicon_kept[] =
+        "{\"modinfo\":{\"type\":\"favicon\"},\"favicon\" : \"\","
+        "\"version\":{\"name\":\"1.21.4\",\"protocol\":769}}";
+    static const char favicon[] =
+        "data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAEAAAABACAYAAACqaXHe";
+    static const uint64_t key[2] = {0, 0};
+    static const char big_head[] = "{\"favicon\":\"";
+    static const char big_tail[] = "\",\"version\":{\"name\":\"1.21.4\",\"protocol\":769}}";
+    const size_t big_kept = sizeof(big_head) - 1 + sizeof(big_tail) - 1;
+    const size_t big_favicon_length = 2 * MC_JSON_MAX - big_kept;
+
+    static const unsigned char bad[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x8F, 0x80, 0x00};
+    /* The handshake, for protocol 770 and port 25565, then status, then ping */
+    static const unsigned char hello[] = {0x07, 0x00, 0x82, 0x06, 0x00, 0x63, 0xDD,
+                                          0x01, 0x01, 0x00, 0x09, 0x01, 0xF0, 0x0D,
+                                          0xBA, 0xD0, 0x00, 0x00, 0x00, 0x00};
+    struct MinecraftStatus fields;
+    struct StreamState pstate[1];
+    struct BannerOutput banout[1];
+    unsigned char* px;
+    char* big;
+    size_t length;
+    size_t status_length;
+    size_t i;
+    int line = 0;
+
+    px = MALLOC(2 * MC_JSON_MAX + 64);
+    length = minecraft_selftest_response(px, json, sizeof(json) - 1, &status_length);
+
+    /* Split once at every offset, so that every VarInt is split every way
+     * it can be, then one byte at a time */
+    for (i = 0; i <= length + 1; i++)
+    {
+        size_t split = i <= length ? i : 0;
+        size_t step = i <= length ? length : 1;
+
+        if (minecraft_selftest_feed(pstate, banout, px, length, status_length, split, step))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        if (!minecraft_selftest_banner(banout, PROTO_MINECRAFT, json, sizeof(json) - 1) ||
+            !minecraft_selftest_banner(banout, PROTO_MINECRAFT_STATUS, status, sizeof(status) - 1))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        banout_release(banout);
+    }
+
+    length = minecraft_selftest_response(px, json_old, sizeof(json_old) - 1, &status_length);
+    if (minecraft_selftest_feed(pstate, banout, px, length, status_length, 0, length) ||
+        !minecraft_selftest_banner(banout, PROTO_MINECRAFT_STATUS, status_old,
+                                   sizeof(status_old) - 1))
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    /* The outputs get the fields back out of the banner */
+    if (!minecraft_status_parse(banout_string(banout, PROTO_MINECRAFT_STATUS),
+                                banout_string_length(banout, PROTO_MINECRAFT_STATUS), &fields) ||
+        fields.version_name_length != 9 || memcmp(fields.version_name, "Paper 1.8", 9) != 0 ||
+        fields.protocol != 47 || fields.players_max != 100 || fields.players_online != 0 ||
+        fields.favicon_length != 0 || fields.description_length != sizeof(status_old) - 1 - 22 ||
+        memcmp(fields.description, status_old + 22, fields.description_length) != 0)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    banout_release(banout);
+
+    length = minecraft_selftest_response(px, json_utf8, sizeof(json_utf8) - 1, &status_length);
+    if (minecraft_selftest_feed(pstate, banout, px, length, status_length, 0, length) ||
+        !minecraft_selftest_banner(banout, PROTO_MINECRAFT_STATUS, status_utf8,
+                                   sizeof(status_utf8) - 1))
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    banout_release(banout);
+
+    /* The favicon is hashed, not kept, however the response is split */
+    length = minecraft_selftest_response(px, json_favicon, sizeof(json_favicon) - 1,
+                                         &status_length);
+    for (i = 0; i <= length; i++)
+    {
+        if (minecraft_selftest_feed(pstate, banout, px, length, status_length, i, length))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        if (!minecraft_selftest_banner(banout, PROTO_MINECRAFT, json_favicon_kept,
+                                       sizeof(json_favicon_kept) - 1) ||
+            !minecraft_status_parse(banout_string(banout, PROTO_MINECRAFT_STATUS),
+                                    banout_string_length(banout, PROTO_MINECRAFT_STATUS),
+                                    &fields) ||
+            fields.version_name_length != 6 || fields.protocol != 769 ||
+            fields.favicon_length != sizeof(favicon) - 1 ||
+            fields.favicon_hash != siphash24(favicon, sizeof(favicon) - 1, key))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        banout_release(banout);
+    }
+
+    /* A favicon bigger than we'd keep of the JSON doesn't stop the rest
+     * from being parsed */
+    big = MALLOC(2 * MC_JSON_MAX);
+    memset(big, 'A', 2 * MC_JSON_MAX);
+    memcpy(big, big_head, sizeof(big_head) - 1);
+    memcpy(big + 2 * MC_JSON_MAX - (sizeof(big_tail) - 1), big_tail, sizeof(big_tail) - 1);
+    length = minecraft_selftest_response(px, big, 2 * MC_JSON_MAX, &status_length);
+    if (minecraft_selftest_feed(pstate, banout, px, length, status_length, 1000, 1460) ||
+        banout_string_length(banout, PROTO_MINECRAFT) != big_kept ||
+        !minecraft_status_parse(banout_string(banout, PROTO_MINECRAFT_STATUS),
+                                banout_string_length(banout, PROTO_MINECRAFT_STATUS), &fields) ||
+        fields.protocol != 769 || fields.favicon_length != big_favicon_length ||
+        fields.favicon_hash != siphash24(big + sizeof(big_head) - 1, big_favicon_length, key))
+    {
+        free(big);
+        line = __LINE__;
+        goto fail;
+    }
+    banout_release(banout);
+
+    /* Only the first part of the rest of a huge response is kept, and
+     * isn't parsed */
+    memset(big, 'A', 2 * MC_JSON_MAX);
+    memcpy(big, json, sizeof(json) - 1);
+    length = minecraft_selftest_response(px, big, 2 * MC_JSON_MAX, &status_length);
+    free(big);
+    if (minecraft_selftest_feed(pstate, banout, px, length, status_length, 1000, 1460) ||
+        banout_string_length(banout, PROTO_MINECRAFT) != MC_JSON_MAX ||
+        banout_string_length(banout, PROTO_MINECRAFT_STATUS) != 0)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    banout_release(banout);
+
+    /* A VarInt longer than 5 bytes means it isn't Minecraft */
+    if (minecraft_selftest_feed(pstate, banout, bad, sizeof(bad), 6, 0, 1))
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    banout_release(banout);
+
+    /* The hello names the port it's sent to */
+    if (minecraft_hello(px, 25565) != sizeof(hello) || memcmp(px, hello, sizeof(hello)) != 0)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    if (minecraft_hello(px, 80) != sizeof(hello) || px[5] != 0x00 || px[6] != 0x50 ||
+        memcmp(px + 7, hello + 7, sizeof(hello) - 7) != 0)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    free(px);
     return 0;
+fail:
+    fprintf(stderr, "[-] minecraft: selftest failed, line=%d\n", line);
+    banout_release(banout);
+    free(px);
+    return 1;
 }
 
 /***************************************************************************
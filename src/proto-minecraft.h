@@ -2,7 +2,64 @@
 #define PROTO_MINECRAFT_H
 #include "proto-banner1.h"
 #include "util-bool.h"
+#include <stdint.h>
 
 extern struct ProtocolParserStream banner_minecraft;
 
+struct RangeList;
+
+/**
+ * Send the status request to these ports too, besides 25565. Each port
+ * gets its own hello, made once here, since the handshake names the port.
+ */
+void minecraft_set_ports(struct Banner1* banner1, const struct RangeList* ports);
+
+/**
+ * The fields of a server's status that we report as the "minecraft.status"
+ * banner, alongside the raw JSON. The strings aren't nul-terminated.
+ */
+struct MinecraftStatus
+{
+    const char* version_name;
+    unsigned version_name_length;
+    int protocol;
+    int players_max;
+    int players_online;
+    const char* description;
+    unsigned description_length;
+
+    /** The favicon isn't kept, just its length and hash, if there was one */
+    unsigned favicon_length;
+    uint64_t favicon_hash;
+};
+
+/** The longest version name we keep, so it fits in a byte */
+#define MINECRAFT_VERSION_MAX 255
+
+/** The longest description we keep */
+#define MINECRAFT_DESCRIPTION_MAX 1024
+
+/**
+ * Format the "minecraft.status" banner: the version name, protocol,
+ * max players, players online, favicon length, favicon hash in hex (empty
+ * if there's no favicon), and description, separated by tabs. The
+ * strings are truncated to the limits above, and any tabs or other control
+ * characters in them replaced with spaces.
+ * @param buf
+ *      A buffer of at least MINECRAFT_STATUS_LENGTH bytes.
+ * @return
+ *      the length of the banner
+ */
+size_t minecraft_status_format(const struct MinecraftStatus* status, char* buf);
+#define MINECRAFT_STATUS_LENGTH (MINECRAFT_VERSION_MAX + MINECRAFT_DESCRIPTION_MAX + 96)
+
+/**
+ * Parse a "minecraft.status" banner back into its fields, with the strings
+ * pointing into the banner.
+ * @return
+ *      true if it's well-formed
+ */
+bool minecraft_status_parse(const unsigned char* px, size_t length,
+                            struct MinecraftStatus* status);
+
 #endif
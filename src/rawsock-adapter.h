@@ -1,16 +1,24 @@
 #ifndef RAWSOCK_ADAPTER_H
 #define RAWSOCK_ADAPTER_H
+#include "rawsock-pktring.h"
 
 struct Adapter
 {
     struct pcap* pcap;
     struct pcap_send_queue* sendq;
     struct __pfring* ring;
+    struct PktRing* txring;       /* --tx-ring, Linux PACKET_TX_RING */
+    struct PktRing* rxring;       /* --rx-ring, Linux PACKET_RX_RING */
+    struct PktBlock rxblock;      /* current block for rawsock_recv_packet() */
+    char ifname[64];              /* name the adapter was opened with */
     unsigned is_packet_trace : 1; /* is --packet-trace option set? */
     unsigned is_vlan : 1;
     unsigned vlan_id;
     double pt_start;
     int link_type;
+    uint64_t tx_dropped; /* packets we failed to transmit */
+    uint64_t tai_offset; /* CLOCK_TAI minus pixie_fasttime(), for --pacing txtime */
+    uint64_t tai_checked;
 };
 
 /**
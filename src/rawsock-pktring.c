@@ -0,0 +1,719 @@
+/*
+    Linux PACKET_MMAP rings
+
+    The normal libpcap path costs us one syscall per probe. With
+    PACKET_TX_RING, the kernel maps a ring of fixed-size frame slots
+    into our address space. Each slot starts with a small "tpacket"
+    header whose 'tp_status' field says who owns the slot:
+
+        TP_STATUS_AVAILABLE     - we own it and can write a packet
+        TP_STATUS_SEND_REQUEST  - we've handed it to the kernel
+        TP_STATUS_SENDING       - the kernel is transmitting it
+
+    We fill slots in order, then call send() once per batch, which makes
+    the kernel walk the ring and transmit everything marked. We prefer
+    TPACKET_V3, falling back to TPACKET_V2 on kernels older than 4.11
+    that don't support V3 for transmit.
+
+    PACKET_RX_RING with TPACKET_V3 works in the other direction, but in
+    units of variable-sized blocks rather than fixed-sized frames. The
+    kernel packs received packets into a block, then marks the whole
+    block TP_STATUS_USER when it's full or when a timer expires. We
+    process every packet in the block then set it back to
+    TP_STATUS_KERNEL. This saves the per-packet syscall, copy, and
+    timestamp conversion that libpcap does.
+*/
+#include "rawsock-pktring.h"
+#include "unusedparm.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <string.h>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Frames are big enough to hold a max-size Ethernet frame with a VLAN
+ * tag plus the tpacket header. There are 16 frames per 64k block, and
+ * 128 blocks, for 2048 frames (8-megabytes) in the ring. */
+#define PKTRING_FRAME_SIZE 4096
+#define PKTRING_BLOCK_SIZE (1 << 16)
+#define PKTRING_BLOCK_COUNT 128
+
+/* Receive blocks are 1-megabyte, 64 of them. The kernel retires a
+ * partially filled block after 10 milliseconds, so that responses
+ * aren't delayed at low packet rates. */
+#define PKTRING_RX_BLOCK_SIZE (1 << 20)
+#define PKTRING_RX_BLOCK_COUNT 64
+#define PKTRING_RX_FRAME_SIZE 2048
+#define PKTRING_RX_RETIRE_MSECS 10
+
+struct PktRing
+{
+    int fd;
+    int version;
+    unsigned char* map;
+    size_t map_size;
+    unsigned frame_count;
+    unsigned frame_size;
+    unsigned data_offset;
+    unsigned next;
+    unsigned pending;
+    unsigned block_size;
+    unsigned block_count;
+    uint64_t drops; /* kernel statistics reset when read, so we keep a total */
+    unsigned is_txtime : 1;
+    uint64_t departure;
+};
+
+/***************************************************************************
+ * Both TPACKET_V2 and TPACKET_V3 headers have the 'status' and 'length'
+ * fields we need, just in different places.
+ ***************************************************************************/
+static volatile unsigned* frame_status(struct PktRing* ring, unsigned char* frame)
+{
+    if (ring->version == TPACKET_V3)
+        return (volatile unsigned*) &((struct tpacket3_hdr*) frame)->tp_status;
+    else
+        return (volatile unsigned*) &((struct tpacket2_hdr*) frame)->tp_status;
+}
+
+static void frame_set_length(struct PktRing* ring, unsigned char* frame, unsigned length)
+{
+    if (ring->version == TPACKET_V3)
+    {
+        struct tpacket3_hdr* hdr = (struct tpacket3_hdr*) frame;
+        hdr->tp_next_offset = 0;
+        hdr->tp_len = length;
+        hdr->tp_snaplen = length;
+    }
+    else
+    {
+        struct tpacket2_hdr* hdr = (struct tpacket2_hdr*) frame;
+        hdr->tp_len = length;
+        hdr->tp_snaplen = length;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int pktring_set_version(int fd, int version)
+{
+    return setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PktRing* pktring_tx_open(const char* ifname)
+{
+    struct PktRing* ring;
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    socklen_t req_length;
+    unsigned ifindex;
+    int one = 1;
+    int err;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+    {
+        LOG(0, "[-] tx-ring(%s): unknown interface\n", ifname);
+        return NULL;
+    }
+
+    ring = CALLOC(1, sizeof(*ring));
+    ring->fd = -1;
+
+    /* Protocol zero means this socket never receives anything, we are
+     * only using it to transmit */
+    ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (ring->fd < 0)
+    {
+        LOG(0, "[-] tx-ring(%s): socket: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    ring->version = TPACKET_V3;
+    if (pktring_set_version(ring->fd, TPACKET_V3) != 0)
+    {
+        ring->version = TPACKET_V2;
+        if (pktring_set_version(ring->fd, TPACKET_V2) != 0)
+        {
+            LOG(0, "[-] tx-ring(%s): PACKET_VERSION: %s\n", ifname, strerror(errno));
+            goto fail;
+        }
+    }
+
+    /* Don't go through the kernel's queueing discipline, and don't stall
+     * the ring if a slot is malformed. Both are optional, so ignore
+     * errors on older kernels. */
+    setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    setsockopt(ring->fd, SOL_PACKET, PACKET_LOSS, &one, sizeof(one));
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PKTRING_BLOCK_SIZE;
+    req.tp_block_nr = PKTRING_BLOCK_COUNT;
+    req.tp_frame_size = PKTRING_FRAME_SIZE;
+    req.tp_frame_nr = (PKTRING_BLOCK_SIZE / PKTRING_FRAME_SIZE) * PKTRING_BLOCK_COUNT;
+    req_length = (ring->version == TPACKET_V3) ? sizeof(req) : sizeof(struct tpacket_req);
+    err = setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, req_length);
+    if (err != 0 && ring->version == TPACKET_V3)
+    {
+        /* Kernels before 4.11 accept V3 for receive but not transmit */
+        ring->version = TPACKET_V2;
+        pktring_set_version(ring->fd, TPACKET_V2);
+        err = setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(struct tpacket_req));
+    }
+    if (err != 0)
+    {
+        LOG(0, "[-] tx-ring(%s): PACKET_TX_RING: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    ring->frame_count = req.tp_frame_nr;
+    ring->frame_size = req.tp_frame_size;
+    ring->map_size = (size_t) req.tp_block_size * req.tp_block_nr;
+
+    /* The kernel expects the packet data immediately after the header,
+     * where the 'sockaddr_ll' would be on receive. */
+    if (ring->version == TPACKET_V3)
+        ring->data_offset = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+    else
+        ring->data_offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+    ring->map = mmap(0, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd,
+                     0);
+    if (ring->map == MAP_FAILED)
+    {
+        /* MAP_LOCKED fails with a low RLIMIT_MEMLOCK, so try without */
+        ring->map = mmap(0, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    }
+    if (ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        LOG(0, "[-] tx-ring(%s): mmap: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = 0;
+    sll.sll_ifindex = (int) ifindex;
+    if (bind(ring->fd, (struct sockaddr*) &sll, sizeof(sll)) != 0)
+    {
+        LOG(0, "[-] tx-ring(%s): bind: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    LOG(1, "[+] tx-ring(%s): TPACKET_V%d, %u frames\n", ifname, ring->version + 1,
+        ring->frame_count);
+    return ring;
+
+fail:
+    pktring_close(ring);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_tx_flush(struct PktRing* ring)
+{
+    if (ring->pending == 0)
+        return;
+
+    /* A zero-length send() tells the kernel to walk the ring and transmit
+     * all the slots marked TP_STATUS_SEND_REQUEST */
+#if defined(SCM_TXTIME)
+    if (ring->is_txtime && ring->departure)
+    {
+        /* The departure time goes along as ancillary data, and applies to
+         * every packet in this flush */
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(uint64_t))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg;
+        struct cmsghdr* cmsg;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg), &ring->departure, sizeof(uint64_t));
+        if (sendmsg(ring->fd, &msg, MSG_DONTWAIT) < 0)
+        {
+            if (errno != EAGAIN && errno != ENOBUFS)
+                LOG(1, "tx-ring: sendmsg: %s\n", strerror(errno));
+        }
+        ring->pending = 0;
+        return;
+    }
+#endif
+    if (send(ring->fd, NULL, 0, MSG_DONTWAIT) < 0)
+    {
+        if (errno != EAGAIN && errno != ENOBUFS)
+            LOG(1, "tx-ring: send: %s\n", strerror(errno));
+    }
+    ring->pending = 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int pktring_tx_enable_txtime(struct PktRing* ring)
+{
+#if defined(SO_TXTIME) && defined(CLOCK_TAI)
+    struct
+    {
+        clockid_t clockid;
+        uint32_t flags;
+    } txtime; /* struct sock_txtime, which not all headers have */
+    int zero = 0;
+
+    txtime.clockid = CLOCK_TAI;
+    txtime.flags = 0;
+    if (setsockopt(ring->fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) != 0)
+    {
+        LOG(0, "[-] tx-ring: SO_TXTIME: %s\n", strerror(errno));
+        return 1;
+    }
+    setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &zero, sizeof(zero));
+    ring->is_txtime = 1;
+    return 0;
+#else
+    UNUSEDPARM(ring);
+    LOG(0, "[-] tx-ring: SO_TXTIME not supported\n");
+    return 1;
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_tx_set_departure(struct PktRing* ring, uint64_t departure)
+{
+    ring->departure = departure;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int pktring_tx_acquire(struct PktRing* ring, unsigned char** px, size_t* sizeof_px)
+{
+    unsigned char* frame = ring->map + (size_t) ring->next * ring->frame_size;
+
+    for (;;)
+    {
+        unsigned status = *frame_status(ring, frame);
+
+        if (status == TP_STATUS_AVAILABLE)
+            break;
+        if (status == TP_STATUS_WRONG_FORMAT)
+        {
+            LOG(0, "tx-ring: kernel rejected frame\n");
+            *frame_status(ring, frame) = TP_STATUS_AVAILABLE;
+            break;
+        }
+
+        /* Ring is full: transmit what's been queued and wait for the
+         * kernel to hand back slots */
+        if (ring->pending)
+            pktring_tx_flush(ring);
+        else
+        {
+            struct pollfd pfd;
+            pfd.fd = ring->fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 10) < 0 && errno != EINTR)
+                return 1;
+        }
+    }
+
+    *px = frame + ring->data_offset;
+    *sizeof_px = ring->frame_size - ring->data_offset;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_tx_commit(struct PktRing* ring, size_t length, unsigned flush)
+{
+    unsigned char* frame = ring->map + (size_t) ring->next * ring->frame_size;
+
+    frame_set_length(ring, frame, (unsigned) length);
+
+    /* The packet contents must be visible to the kernel before it sees
+     * the status change */
+    __sync_synchronize();
+    *frame_status(ring, frame) = TP_STATUS_SEND_REQUEST;
+
+    ring->pending++;
+    if (++ring->next >= ring->frame_count)
+        ring->next = 0;
+
+    if (flush || ring->pending >= ring->frame_count / 2)
+        pktring_tx_flush(ring);
+}
+
+/***************************************************************************
+ * Only the first slot is waited for. After that, we take consecutive free
+ * slots until we hit one the kernel still owns, so a nearly-full ring just
+ * gives a shorter batch.
+ ***************************************************************************/
+unsigned pktring_tx_acquire_batch(struct PktRing* ring, unsigned char** px, unsigned count,
+                                  size_t* sizeof_px)
+{
+    unsigned i;
+
+    if (count == 0 || pktring_tx_acquire(ring, &px[0], sizeof_px) != 0)
+        return 0;
+
+    if (count > ring->frame_count)
+        count = ring->frame_count;
+    for (i = 1; i < count; i++)
+    {
+        unsigned index = (ring->next + i) % ring->frame_count;
+        unsigned char* frame = ring->map + (size_t) index * ring->frame_size;
+
+        if (*frame_status(ring, frame) != TP_STATUS_AVAILABLE)
+            break;
+        px[i] = frame + ring->data_offset;
+    }
+    return i;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_tx_commit_batch(struct PktRing* ring, const size_t* lengths, unsigned count,
+                             unsigned flush)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+        pktring_tx_commit(ring, lengths[i], flush && i + 1 == count);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PktRing* pktring_rx_open(const char* ifname)
+{
+    struct PktRing* ring;
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    struct packet_mreq mreq;
+    unsigned ifindex;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+    {
+        LOG(0, "[-] rx-ring(%s): unknown interface\n", ifname);
+        return NULL;
+    }
+
+    ring = CALLOC(1, sizeof(*ring));
+    ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (ring->fd < 0)
+    {
+        LOG(0, "[-] rx-ring(%s): socket: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    ring->version = TPACKET_V3;
+    if (pktring_set_version(ring->fd, TPACKET_V3) != 0)
+    {
+        LOG(0, "[-] rx-ring(%s): TPACKET_V3: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PKTRING_RX_BLOCK_SIZE;
+    req.tp_block_nr = PKTRING_RX_BLOCK_COUNT;
+    req.tp_frame_size = PKTRING_RX_FRAME_SIZE;
+    req.tp_frame_nr = (PKTRING_RX_BLOCK_SIZE / PKTRING_RX_FRAME_SIZE) * PKTRING_RX_BLOCK_COUNT;
+    req.tp_retire_blk_tov = PKTRING_RX_RETIRE_MSECS;
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+    {
+        LOG(0, "[-] rx-ring(%s): PACKET_RX_RING: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+    ring->block_size = req.tp_block_size;
+    ring->block_count = req.tp_block_nr;
+    ring->map_size = (size_t) req.tp_block_size * req.tp_block_nr;
+
+    ring->map = mmap(0, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd,
+                     0);
+    if (ring->map == MAP_FAILED)
+        ring->map = mmap(0, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        LOG(0, "[-] rx-ring(%s): mmap: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = (int) ifindex;
+    if (bind(ring->fd, (struct sockaddr*) &sll, sizeof(sll)) != 0)
+    {
+        LOG(0, "[-] rx-ring(%s): bind: %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    /* Like libpcap, go promiscuous, because responses may be sent to
+     * a spoofed --source-mac */
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = (int) ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    LOG(1, "[+] rx-ring(%s): TPACKET_V3, %u blocks of %u bytes\n", ifname, ring->block_count,
+        ring->block_size);
+    return ring;
+
+fail:
+    pktring_close(ring);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int pktring_rx_ignore_outgoing(struct PktRing* ring)
+{
+#if defined(PACKET_IGNORE_OUTGOING)
+    int one = 1;
+    return setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#else
+    UNUSEDPARM(ring);
+    return -1;
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t pktring_rx_drops(struct PktRing* ring)
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t length = sizeof(stats);
+
+    memset(&stats, 0, sizeof(stats));
+    if (getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0)
+        ring->drops += stats.tp_drops;
+    return ring->drops;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int pktring_rx_acquire(struct PktRing* ring, struct PktBlock* block, unsigned timeout_ms)
+{
+    struct tpacket_block_desc* desc;
+
+    desc = (struct tpacket_block_desc*) (ring->map + (size_t) ring->next * ring->block_size);
+
+    if ((desc->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+    {
+        struct pollfd pfd;
+        pfd.fd = ring->fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        poll(&pfd, 1, (int) timeout_ms);
+        if ((desc->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            return 1;
+    }
+
+    /* Make sure we read the packets after we see the status */
+    __sync_synchronize();
+
+    block->hdr = (unsigned char*) desc;
+    block->remaining = desc->hdr.bh1.num_pkts;
+    block->frame = (const unsigned char*) desc + desc->hdr.bh1.offset_to_first_pkt;
+
+    if (++ring->next >= ring->block_count)
+        ring->next = 0;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int pktring_block_next(struct PktBlock* block, const unsigned char** packet, unsigned* length,
+                       unsigned* secs, unsigned* usecs)
+{
+    const struct tpacket3_hdr* hdr;
+
+    if (block->remaining == 0)
+        return 0;
+
+    hdr = (const struct tpacket3_hdr*) block->frame;
+    *packet = block->frame + hdr->tp_mac;
+    *length = hdr->tp_snaplen;
+    *secs = hdr->tp_sec;
+    *usecs = hdr->tp_nsec / 1000;
+
+    block->frame += hdr->tp_next_offset;
+    block->remaining--;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_rx_release(struct PktRing* ring, struct PktBlock* block)
+{
+    struct tpacket_block_desc* desc = (struct tpacket_block_desc*) block->hdr;
+
+    UNUSEDPARM(ring);
+    if (desc == NULL)
+        return;
+
+    /* We must be done reading the packets before the kernel gets the
+     * block back */
+    __sync_synchronize();
+    desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+    block->hdr = NULL;
+    block->frame = NULL;
+    block->remaining = 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void pktring_close(struct PktRing* ring)
+{
+    if (ring == NULL)
+        return;
+    if (ring->map)
+    {
+        pktring_tx_flush(ring);
+        munmap(ring->map, ring->map_size);
+    }
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+}
+
+#else
+
+/***************************************************************************
+ * PORTABILITY: PACKET_MMAP only exists on Linux
+ ***************************************************************************/
+struct PktRing* pktring_tx_open(const char* ifname)
+{
+    LOG(0, "[-] tx-ring(%s): only supported on Linux\n", ifname);
+    return NULL;
+}
+
+int pktring_tx_acquire(struct PktRing* ring, unsigned char** px, size_t* sizeof_px)
+{
+    UNUSEDPARM(ring);
+    *px = NULL;
+    *sizeof_px = 0;
+    return 1;
+}
+
+void pktring_tx_commit(struct PktRing* ring, size_t length, unsigned flush)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(length);
+    UNUSEDPARM(flush);
+}
+
+unsigned pktring_tx_acquire_batch(struct PktRing* ring, unsigned char** px, unsigned count,
+                                  size_t* sizeof_px)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(px);
+    UNUSEDPARM(count);
+    *sizeof_px = 0;
+    return 0;
+}
+
+void pktring_tx_commit_batch(struct PktRing* ring, const size_t* lengths, unsigned count,
+                             unsigned flush)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(lengths);
+    UNUSEDPARM(count);
+    UNUSEDPARM(flush);
+}
+
+void pktring_tx_flush(struct PktRing* ring)
+{
+    UNUSEDPARM(ring);
+}
+
+int pktring_tx_enable_txtime(struct PktRing* ring)
+{
+    UNUSEDPARM(ring);
+    LOG(0, "[-] tx-ring: SO_TXTIME only supported on Linux\n");
+    return 1;
+}
+
+void pktring_tx_set_departure(struct PktRing* ring, uint64_t departure)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(departure);
+}
+
+struct PktRing* pktring_rx_open(const char* ifname)
+{
+    LOG(0, "[-] rx-ring(%s): only supported on Linux\n", ifname);
+    return NULL;
+}
+
+int pktring_rx_ignore_outgoing(struct PktRing* ring)
+{
+    UNUSEDPARM(ring);
+    return -1;
+}
+
+uint64_t pktring_rx_drops(struct PktRing* ring)
+{
+    UNUSEDPARM(ring);
+    return 0;
+}
+
+int pktring_rx_acquire(struct PktRing* ring, struct PktBlock* block, unsigned timeout_ms)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(timeout_ms);
+    block->hdr = NULL;
+    block->frame = NULL;
+    block->remaining = 0;
+    return 1;
+}
+
+int pktring_block_next(struct PktBlock* block, const unsigned char** packet, unsigned* length,
+                       unsigned* secs, unsigned* usecs)
+{
+    UNUSEDPARM(block);
+    UNUSEDPARM(packet);
+    UNUSEDPARM(length);
+    UNUSEDPARM(secs);
+    UNUSEDPARM(usecs);
+    return 0;
+}
+
+void pktring_rx_release(struct PktRing* ring, struct PktBlock* block)
+{
+    UNUSEDPARM(ring);
+    UNUSEDPARM(block);
+}
+
+void pktring_close(struct PktRing* ring)
+{
+    UNUSEDPARM(ring);
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+    Linux PACKET_MMAP rings
+
+    This is an alternative to libpcap for high-speed transmit on plain
+    Linux, without needing a third-party driver like PF_RING. The kernel
+    and this process share a ring of packet slots. We format probes
+    directly into the slots, mark them as ready, then "kick" the kernel
+    with a single syscall that transmits everything we've queued.
+
+    For receive, the kernel fills whole blocks of packets and "retires"
+    them to us. We walk all the packets in a block in place, without
+    copying, then hand the block back to the kernel.
+*/
+#ifndef RAWSOCK_PKTRING_H
+#define RAWSOCK_PKTRING_H
+#include <stddef.h>
+#include <stdint.h>
+
+struct PktRing;
+
+/**
+ * Open a PACKET_TX_RING on the named interface. This is a separate
+ * socket from the libpcap handle, which is still used for receiving.
+ * @param ifname
+ *      The name of the adapter, like "eth0".
+ * @return
+ *      a ring ready for transmitting, or NULL on failure (such as when
+ *      not on Linux, or not running as root).
+ */
+struct PktRing* pktring_tx_open(const char* ifname);
+
+/**
+ * Get the next free slot in the transmit ring. If the ring is full, this
+ * kicks the kernel and waits until a slot becomes available.
+ * @param px
+ *      returns a pointer to where the packet should be formatted
+ * @param sizeof_px
+ *      returns the maximum packet size that can fit in the slot
+ * @return
+ *      0 on success, or non-zero if the ring has failed
+ */
+int pktring_tx_acquire(struct PktRing* ring, unsigned char** px, size_t* sizeof_px);
+
+/**
+ * Hand the slot we acquired back to the kernel for transmit.
+ * @param length
+ *      The number of bytes formatted into the slot.
+ * @param flush
+ *      Whether to tell the kernel now to transmit everything that's
+ *      been queued. This is normally set on the last packet of a
+ *      throttler batch.
+ */
+void pktring_tx_commit(struct PktRing* ring, size_t length, unsigned flush);
+
+/**
+ * Get up to "count" consecutive free slots, so that a batch of probes can
+ * be formatted in one pass. Like pktring_tx_acquire(), this waits if the
+ * ring is full, but only for the first slot.
+ * @param px
+ *      an array of "count" pointers, filled in with the slots
+ * @param sizeof_px
+ *      returns the maximum packet size that can fit in each slot
+ * @return
+ *      the number of slots acquired, which may be fewer than asked for,
+ *      or 0 if the ring has failed
+ */
+unsigned pktring_tx_acquire_batch(struct PktRing* ring, unsigned char** px, unsigned count,
+                                  size_t* sizeof_px);
+
+/**
+ * Hand back, in order, the slots from pktring_tx_acquire_batch().
+ * @param flush
+ *      Whether to kick the kernel after the last one.
+ */
+void pktring_tx_commit_batch(struct PktRing* ring, const size_t* lengths, unsigned count,
+                             unsigned flush);
+
+/**
+ * Tell the kernel to transmit any queued slots.
+ */
+void pktring_tx_flush(struct PktRing* ring);
+
+/**
+ * Have the kernel hold each flush until the time set with
+ * pktring_tx_set_departure(), using SO_TXTIME. This only works through an
+ * "etf" queueing discipline on the interface using CLOCK_TAI, so this also
+ * stops bypassing the queueing disciplines.
+ * @return
+ *      0 on success, or non-zero if the kernel doesn't support it
+ */
+int pktring_tx_enable_txtime(struct PktRing* ring);
+
+/**
+ * The time the packets in the following flushes should leave, in CLOCK_TAI
+ * nanoseconds, or 0 for as soon as possible.
+ */
+void pktring_tx_set_departure(struct PktRing* ring, uint64_t departure);
+
+/**
+ * A block of received packets retired to us by the kernel. The packet
+ * pointers returned by "pktring_block_next()" point into the ring, and
+ * are only valid until the block is released.
+ */
+struct PktBlock
+{
+    unsigned char* hdr;
+    const unsigned char* frame;
+    unsigned remaining;
+};
+
+/**
+ * Open a TPACKET_V3 PACKET_RX_RING on the named interface.
+ * @return
+ *      a ring ready for receiving, or NULL on failure.
+ */
+struct PktRing* pktring_rx_open(const char* ifname);
+
+/**
+ * Wait for the kernel to retire the next block of received packets.
+ * @param timeout_ms
+ *      How long to wait if no block is ready.
+ * @return
+ *      0 if a block was retrieved, non-zero on timeout or failure
+ */
+int pktring_rx_acquire(struct PktRing* ring, struct PktBlock* block, unsigned timeout_ms);
+
+/**
+ * Get the next packet from the block.
+ * @return
+ *      1 if a packet was returned, 0 if there are no more packets
+ */
+int pktring_block_next(struct PktBlock* block, const unsigned char** packet, unsigned* length,
+                       unsigned* secs, unsigned* usecs);
+
+/**
+ * Give the block back to the kernel so it can be refilled. All the
+ * packet pointers from this block become invalid.
+ */
+void pktring_rx_release(struct PktRing* ring, struct PktBlock* block);
+
+/**
+ * Don't receive the packets we transmit ourselves. Requires Linux 4.20.
+ * @return
+ *      0 on success
+ */
+int pktring_rx_ignore_outgoing(struct PktRing* ring);
+
+/**
+ * The number of packets the kernel has dropped so far because the
+ * receive ring was full.
+ */
+uint64_t pktring_rx_drops(struct PktRing* ring);
+
+void pktring_close(struct PktRing* ring);
+
+#endif
@@ -9,6 +9,7 @@
 #include "main-ptrace.h"
 #include "pixie-timer.h"
 #include "proto-preprocess.h"
+#include "rawsock-pktring.h"
 #include "stack-arpv4.h"
 #include "stack-ndpv6.h"
 #include "stub-pcap.h"
@@ -271,6 +272,10 @@ static const char* adapter_from_index(unsigned index)
  ***************************************************************************/
 void rawsock_flush(struct Adapter* adapter)
 {
+    if (adapter->txring)
+    {
+        pktring_tx_flush(adapter->txring);
+    }
     if (adapter->sendq)
     {
         PCAP.sendqueue_transmit(adapter->pcap, adapter->sendq, 0);
@@ -314,10 +319,29 @@ int rawsock_send_packet(struct Adapter* adapter, const unsigned char* packet, un
             err = PFRING.send(adapter->ring, packet, length, (unsigned char) flush);
         }
         if (err < 0)
+        {
             LOG(1, "pfring:xmit: ERROR %d\n", err);
+            adapter->tx_dropped++;
+        }
         return err;
     }
 
+    /* LINUX PACKET_TX_RING */
+    if (adapter->txring)
+    {
+        unsigned char* slot;
+        size_t sizeof_slot;
+
+        if (pktring_tx_acquire(adapter->txring, &slot, &sizeof_slot) != 0 || length > sizeof_slot)
+        {
+            adapter->tx_dropped++;
+            return -1;
+        }
+        memcpy(slot, packet, length);
+        pktring_tx_commit(adapter->txring, length, flush);
+        return 0;
+    }
+
     /* WINDOWS PCAP */
     if (adapter->sendq)
     {
@@ -343,17 +367,89 @@ int rawsock_send_packet(struct Adapter* adapter, const unsigned char* packet, un
 
     /* LIBPCAP */
     if (adapter->pcap)
-        return PCAP.sendpacket(adapter->pcap, packet, length);
+    {
+        int err = PCAP.sendpacket(adapter->pcap, packet, length);
+        if (err != 0)
+            adapter->tx_dropped++;
+        return err;
+    }
 
     return 0;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+uint64_t rawsock_get_drops(struct Adapter* adapter)
+{
+    uint64_t drops;
+
+    if (adapter == 0)
+        return 0;
+
+    drops = adapter->tx_dropped;
+    if (adapter->rxring)
+        drops += pktring_rx_drops(adapter->rxring);
+    else if (adapter->pcap)
+    {
+        struct pcap_stat stats;
+
+        if (PCAP.stats(adapter->pcap, &stats) == 0)
+            drops += stats.ps_drop;
+    }
+    return drops;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int rawsock_enable_txtime(struct Adapter* adapter)
+{
+    if (adapter == 0 || adapter->txring == 0)
+    {
+        LOG(0, "[-] --pacing txtime needs --tx-ring\n");
+        return 1;
+    }
+    if (pixie_taitime() == 0)
+    {
+        LOG(0, "[-] --pacing txtime: no CLOCK_TAI on this system\n");
+        return 1;
+    }
+    return pktring_tx_enable_txtime(adapter->txring);
+}
+
+/***************************************************************************
+ * The kernel wants CLOCK_TAI, but we pace on the cycle counter. The two
+ * drift apart slowly, so we re-measure the difference ten times a second.
+ ***************************************************************************/
+void rawsock_set_departure(struct Adapter* adapter, uint64_t departure)
+{
+    if (adapter == 0 || adapter->txring == 0)
+        return;
+    if (departure - adapter->tai_checked > 100000000)
+    {
+        uint64_t now = pixie_fasttime();
+        adapter->tai_offset = pixie_taitime() - now;
+        adapter->tai_checked = now;
+    }
+    pktring_tx_set_departure(adapter->txring, departure + adapter->tai_offset);
+}
+
 /***************************************************************************
  ***************************************************************************/
 int rawsock_recv_packet(struct Adapter* adapter, unsigned* length, unsigned* secs, unsigned* usecs,
                         const unsigned char** packet)
 {
-    if (adapter->ring)
+    if (adapter->rxring)
+    {
+        /* Walk through the current block one packet at a time, getting
+         * the next block from the kernel when this one runs out */
+        while (!pktring_block_next(&adapter->rxblock, packet, length, secs, usecs))
+        {
+            pktring_rx_release(adapter->rxring, &adapter->rxblock);
+            if (pktring_rx_acquire(adapter->rxring, &adapter->rxblock, 1000) != 0)
+                return 1;
+        }
+    }
+    else if (adapter->ring)
     {
         /* This is for doing libpfring instead of libpcap */
         struct pfring_pkthdr hdr;
@@ -402,11 +498,67 @@ int rawsock_recv_packet(struct Adapter* adapter, unsigned* length, unsigned* sec
     return 0;
 }
 
+/***************************************************************************
+ * With --rx-ring, a batch is a whole block from the kernel. Otherwise, it's
+ * a batch of one, from whatever "rawsock_recv_packet()" would return.
+ ***************************************************************************/
+int rawsock_recv_batch(struct Adapter* adapter, struct RawsockBatch* batch)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    if (adapter->rxring)
+    {
+        /* Finish up any block partially consumed through the
+         * one-at-a-time API, such as during ARP resolution at startup */
+        if (adapter->rxblock.remaining)
+        {
+            batch->block = adapter->rxblock;
+            memset(&adapter->rxblock, 0, sizeof(adapter->rxblock));
+            return 0;
+        }
+        pktring_rx_release(adapter->rxring, &adapter->rxblock);
+
+        return pktring_rx_acquire(adapter->rxring, &batch->block, 100);
+    }
+
+    return rawsock_recv_packet(adapter, &batch->length, &batch->secs, &batch->usecs, &batch->px);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int rawsock_batch_next(struct RawsockBatch* batch, unsigned* length, unsigned* secs,
+                       unsigned* usecs, const unsigned char** packet)
+{
+    if (batch->block.hdr)
+        return pktring_block_next(&batch->block, packet, length, secs, usecs);
+
+    if (batch->px == NULL)
+        return 0;
+    *packet = batch->px;
+    *length = batch->length;
+    *secs = batch->secs;
+    *usecs = batch->usecs;
+    batch->px = NULL;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void rawsock_release_batch(struct Adapter* adapter, struct RawsockBatch* batch)
+{
+    if (adapter->rxring)
+        pktring_rx_release(adapter->rxring, &batch->block);
+    batch->px = NULL;
+}
+
 /***************************************************************************
  * Sends the TCP SYN probe packet.
  *
  * Step 1: format the packet
  * Step 2: send it in a portable manner
+ *
+ * With --tx-ring, we skip the copy: the template is formatted directly into
+ * the next free slot of the memory-mapped ring shared with the kernel.
  ***************************************************************************/
 void rawsock_send_probe_ipv4(struct Adapter* adapter, ipv4address ip_them, unsigned port_them,
                              ipv4address ip_me, unsigned port_me, unsigned seqno, unsigned flush,
@@ -415,6 +567,24 @@ void rawsock_send_probe_ipv4(struct Adapter* adapter, ipv4address ip_them, unsig
     unsigned char px[2048];
     size_t packet_length;
 
+    if (adapter && adapter->txring)
+    {
+        unsigned char* slot;
+        size_t sizeof_slot;
+
+        if (pktring_tx_acquire(adapter->txring, &slot, &sizeof_slot) != 0)
+        {
+            adapter->tx_dropped++;
+            return;
+        }
+        template_set_target_ipv4(tmplset, ip_them, port_them, ip_me, port_me, seqno, slot,
+                                 sizeof_slot, &packet_length);
+        if (adapter->is_packet_trace)
+            packet_trace(stdout, adapter->pt_start, slot, packet_length, 1);
+        pktring_tx_commit(adapter->txring, packet_length, flush);
+        return;
+    }
+
     /*
      * Construct the destination packet
      */
@@ -427,6 +597,53 @@ void rawsock_send_probe_ipv4(struct Adapter* adapter, ipv4address ip_them, unsig
     rawsock_send_packet(adapter, px, (unsigned) packet_length, flush);
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void rawsock_send_probes_ipv4(struct Adapter* adapter, const struct TemplateTargetIPv4* targets,
+                              unsigned count, unsigned flush, struct TemplateSet* tmplset)
+{
+    unsigned i;
+
+    if (adapter && adapter->txring)
+    {
+        while (count)
+        {
+            unsigned char* slots[64];
+            size_t lengths[64];
+            size_t sizeof_slot;
+            unsigned n = count < 64 ? count : 64;
+
+            n = pktring_tx_acquire_batch(adapter->txring, slots, n, &sizeof_slot);
+            if (n == 0)
+            {
+                adapter->tx_dropped += count;
+                return;
+            }
+            template_set_target_ipv4_batch(tmplset, targets, n, slots, sizeof_slot, lengths);
+            if (adapter->is_packet_trace)
+            {
+                for (i = 0; i < n; i++)
+                    packet_trace(stdout, adapter->pt_start, slots[i], lengths[i], 1);
+            }
+            pktring_tx_commit_batch(adapter->txring, lengths, n, flush && n == count);
+            targets += n;
+            count -= n;
+        }
+        if (flush)
+            pktring_tx_flush(adapter->txring);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const struct TemplateTargetIPv4* t = &targets[i];
+        rawsock_send_probe_ipv4(adapter, t->ip_them, t->port_them, t->ip_me, t->port_me, t->seqno,
+                                flush && i + 1 == count, tmplset);
+    }
+    if (flush && count == 0 && adapter)
+        rawsock_flush(adapter);
+}
+
 void rawsock_send_probe_ipv6(struct Adapter* adapter, ipv6address ip_them, unsigned port_them,
                              ipv6address ip_me, unsigned port_me, unsigned seqno, unsigned flush,
                              struct TemplateSet* tmplset)
@@ -434,6 +651,24 @@ void rawsock_send_probe_ipv6(struct Adapter* adapter, ipv6address ip_them, unsig
     unsigned char px[2048];
     size_t packet_length;
 
+    if (adapter && adapter->txring)
+    {
+        unsigned char* slot;
+        size_t sizeof_slot;
+
+        if (pktring_tx_acquire(adapter->txring, &slot, &sizeof_slot) != 0)
+        {
+            adapter->tx_dropped++;
+            return;
+        }
+        template_set_target_ipv6(tmplset, ip_them, port_them, ip_me, port_me, seqno, slot,
+                                 sizeof_slot, &packet_length);
+        if (adapter->is_packet_trace)
+            packet_trace(stdout, adapter->pt_start, slot, packet_length, 1);
+        pktring_tx_commit(adapter->txring, packet_length, flush);
+        return;
+    }
+
     /*
      * Construct the destination packet
      */
@@ -501,6 +736,12 @@ const char* rawsock_win_name(const char* ifname)
  ***************************************************************************/
 void rawsock_ignore_transmits(struct Adapter* adapter, const char* ifname)
 {
+    if (adapter->rxring)
+    {
+        if (pktring_rx_ignore_outgoing(adapter->rxring) == 0)
+            LOG(2, "if:%s: rx-ring not receiving transmits\n", ifname);
+    }
+
     if (adapter->ring)
     {
         /* PORTABILITY: don't do anything for PF_RING, because it's
@@ -528,6 +769,14 @@ void rawsock_ignore_transmits(struct Adapter* adapter, const char* ifname)
  ***************************************************************************/
 static void rawsock_close_adapter(struct Adapter* adapter)
 {
+    if (adapter->txring)
+    {
+        pktring_close(adapter->txring);
+    }
+    if (adapter->rxring)
+    {
+        pktring_close(adapter->rxring);
+    }
     if (adapter->ring)
     {
         PFRING.close(adapter->ring);
@@ -587,9 +836,9 @@ static int is_pfring_dna(const char* name)
 /***************************************************************************
  ***************************************************************************/
 struct Adapter* rawsock_init_adapter(const char* adapter_name, unsigned is_pfring,
-                                     unsigned is_sendq, unsigned is_packet_trace,
-                                     unsigned is_offline, const char* bpf_filter, unsigned is_vlan,
-                                     unsigned vlan_id)
+                                     unsigned is_sendq, unsigned is_txring, unsigned is_rxring,
+                                     unsigned is_packet_trace, unsigned is_offline,
+                                     const char* bpf_filter, unsigned is_vlan, unsigned vlan_id)
 {
     struct Adapter* adapter;
     char errbuf[PCAP_ERRBUF_SIZE] = "pcap";
@@ -625,6 +874,7 @@ struct Adapter* rawsock_init_adapter(const char* adapter_name, unsigned is_pfrin
         else
             adapter_name = new_adapter_name;
     }
+    safe_strcpy(adapter->ifname, sizeof(adapter->ifname), adapter_name);
 
     /*----------------------------------------------------------------
      * PORTABILITY: PF_RING
@@ -832,6 +1082,35 @@ struct Adapter* rawsock_init_adapter(const char* adapter_name, unsigned is_pfrin
         adapter->sendq = PCAP.sendqueue_alloc(SENDQ_SIZE);
 #endif
 
+    /*----------------------------------------------------------------
+     * PORTABILITY: LINUX
+     *
+     * libpcap does one syscall per transmitted packet. The kernel's
+     * PACKET_TX_RING lets us queue many packets in shared memory then
+     * transmit them with a single syscall. We still use libpcap for
+     * receiving. If the ring can't be created, fall back to libpcap.
+     *----------------------------------------------------------------*/
+    adapter->txring = 0;
+    if (is_txring && !is_pcap_file)
+    {
+        adapter->txring = pktring_tx_open(adapter_name);
+        if (adapter->txring == 0)
+            LOG(0, "[-] if(%s): --tx-ring unavailable, using libpcap to transmit\n",
+                adapter_name);
+    }
+
+    /* Likewise, PACKET_RX_RING lets the kernel hand us a whole block of
+     * received packets at a time. The libpcap handle stays open, because
+     * it may still be used for transmit. */
+    adapter->rxring = 0;
+    if (is_rxring && !is_pcap_file)
+    {
+        adapter->rxring = pktring_rx_open(adapter_name);
+        if (adapter->rxring == 0)
+            LOG(0, "[-] if(%s): --rx-ring unavailable, using libpcap to receive\n",
+                adapter_name);
+    }
+
     return adapter;
 pcap_error:
     if (adapter->pcap)
@@ -851,6 +1130,82 @@ pcap_error:
     return NULL;
 }
 
+/***************************************************************************
+ * For --tx-threads, each additional transmit thread needs its own queue
+ * of outgoing packets, so that threads aren't contending for the same
+ * ring. The clone shares the libpcap handle, since sending a packet
+ * through it is a single syscall, but opens its own PACKET_TX_RING
+ * socket or Windows sendqueue. It is never used for receiving.
+ ***************************************************************************/
+struct Adapter* rawsock_clone_adapter(const struct Adapter* adapter)
+{
+    struct Adapter* clone;
+
+    clone = MALLOC(sizeof(*clone));
+    memcpy(clone, adapter, sizeof(*clone));
+    clone->rxring = 0;
+    clone->tx_dropped = 0;
+    memset(&clone->rxblock, 0, sizeof(clone->rxblock));
+
+    clone->sendq = 0;
+#if defined(WIN32)
+    if (adapter->sendq)
+        clone->sendq = PCAP.sendqueue_alloc(SENDQ_SIZE);
+#endif
+
+    clone->txring = 0;
+    if (adapter->txring)
+    {
+        clone->txring = pktring_tx_open(adapter->ifname);
+        if (clone->txring == 0)
+            LOG(0, "[-] if(%s): --tx-ring unavailable for extra thread, using libpcap\n",
+                adapter->ifname);
+    }
+
+    return clone;
+}
+
+/***************************************************************************
+ * Close what the clone opened for itself, but not the libpcap or PF_RING
+ * handles it shares with the original adapter.
+ ***************************************************************************/
+void rawsock_close_clone(struct Adapter* clone)
+{
+    if (clone == NULL)
+        return;
+    if (clone->txring)
+        pktring_close(clone->txring);
+    if (clone->sendq)
+        PCAP.sendqueue_destroy(clone->sendq);
+    free(clone);
+}
+
+/***************************************************************************
+ * On Linux, a PCI network adapter reports which NUMA node it's attached
+ * to in sysfs. It's -1 when the system has only one node, or when the
+ * adapter isn't a physical device, such as "lo" or a bridge.
+ ***************************************************************************/
+int rawsock_get_adapter_numa_node(const char* ifname)
+{
+#if defined(__linux__)
+    char filename[256];
+    FILE* fp;
+    int node = -1;
+
+    snprintf(filename, sizeof(filename), "/sys/class/net/%s/device/numa_node", ifname);
+    fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%d", &node) != 1)
+        node = -1;
+    fclose(fp);
+    return node;
+#else
+    UNUSEDPARM(ifname);
+    return -1;
+#endif
+}
+
 /***************************************************************************
  * for testing when two Windows adapters have the same name. Sometimes
  * the \Device\NPF_ string is prepended, sometimes not.
@@ -898,7 +1253,7 @@ int rawsock_selftest_if(const char* ifname)
     /*
      * Initialize the adapter.
      */
-    adapter = rawsock_init_adapter(ifname, 0, 0, 0, 0, 0, 0, 0);
+    adapter = rawsock_init_adapter(ifname, 0, 0, 0, 0, 0, 0, 0, 0, 0);
     if (adapter == 0)
     {
         printf("[-] pcap = failed\n");
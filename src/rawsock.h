@@ -4,9 +4,11 @@
 #ifndef RAWSOCK_H
 #define RAWSOCK_H
 #include "massip-addr.h"
+#include "rawsock-pktring.h"
 #include <stdio.h>
 struct Adapter;
 struct TemplateSet;
+struct TemplateTargetIPv4;
 #include "stack-queue.h"
 
 /**
@@ -32,6 +34,12 @@ void rawsock_init(void);
  *      Currently Windows-only, but it'll be enabled for Linux soon. Big
  *      performance gains for Windows, but insignificant performance
  *      difference for Linux.
+ * @param is_txring
+ *      Whether we should transmit through a Linux PACKET_TX_RING, a
+ *      memory-mapped ring shared with the kernel, instead of libpcap.
+ * @param is_rxring
+ *      Whether we should receive through a Linux PACKET_RX_RING, where
+ *      packets are processed a block at a time without copying.
  * @param is_packet_trace
  *      Whether then Nmap --packet-trace option was set on the command-line
  * @param is_offline
@@ -41,9 +49,22 @@ void rawsock_init(void);
  *      a fully instantiated network adapter
  */
 struct Adapter* rawsock_init_adapter(const char* adapter_name, unsigned is_pfring,
-                                     unsigned is_sendq, unsigned is_packet_trace,
-                                     unsigned is_offline, const char* bpf_filter, unsigned is_vlan,
-                                     unsigned vlan_id);
+                                     unsigned is_sendq, unsigned is_txring, unsigned is_rxring,
+                                     unsigned is_packet_trace, unsigned is_offline,
+                                     const char* bpf_filter, unsigned is_vlan, unsigned vlan_id);
+
+/**
+ * Create another handle on an already opened adapter, for use by an
+ * additional transmit thread (--tx-threads). The clone gets its own
+ * transmit queue (--tx-ring or sendqueue), but is never used to receive.
+ */
+struct Adapter* rawsock_clone_adapter(const struct Adapter* adapter);
+
+/**
+ * Close a clone made by 'rawsock_clone_adapter()', once its transmit
+ * thread has exited. The original adapter stays open.
+ */
+void rawsock_close_clone(struct Adapter* clone);
 
 /**
  * Print to the command-line the list of available adapters. It's called
@@ -55,6 +76,17 @@ void rawsock_send_probe_ipv4(struct Adapter* adapter, ipv4address ip_them, unsig
                              ipv4address ip_me, unsigned port_me, unsigned seqno, unsigned flush,
                              struct TemplateSet* tmplset);
 
+/**
+ * Send a batch of IPv4 probes. With --tx-ring, these are formatted
+ * straight into consecutive ring slots in one pass; otherwise, this is
+ * the same as calling rawsock_send_probe_ipv4() on each one.
+ * @param flush
+ *      Whether to transmit any queued packets afterwards. This is done
+ *      even if "count" is zero.
+ */
+void rawsock_send_probes_ipv4(struct Adapter* adapter, const struct TemplateTargetIPv4* targets,
+                              unsigned count, unsigned flush, struct TemplateSet* tmplset);
+
 void rawsock_send_probe_ipv6(struct Adapter* adapter, ipv6address ip_them, unsigned port_them,
                              ipv6address ip_me, unsigned port_me, unsigned seqno, unsigned flush,
                              struct TemplateSet* tmplset);
@@ -79,6 +111,14 @@ ipv6address rawsock_get_adapter_ipv6(const char* ifname);
  */
 int rawsock_get_adapter_mac(const char* ifname, unsigned char* mac);
 
+/**
+ * Find which NUMA node the adapter is attached to, so that the threads
+ * using it can be placed on processors and memory local to it.
+ * @return
+ *      the node number, or -1 if unknown
+ */
+int rawsock_get_adapter_numa_node(const char* ifname);
+
 int rawsock_get_default_gateway(const char* ifname, unsigned* ipv4);
 int rawsock_get_default_interface(char* ifname, size_t sizeof_ifname);
 
@@ -97,6 +137,28 @@ void rawsock_flush(struct Adapter* adapter);
 int rawsock_send_packet(struct Adapter* adapter, const unsigned char* packet, unsigned length,
                         unsigned flush);
 
+/**
+ * The number of packets lost so far on this adapter: those we failed to
+ * transmit, plus those the kernel dropped before we could receive them.
+ * This can be called from another thread while the adapter is in use.
+ */
+uint64_t rawsock_get_drops(struct Adapter* adapter);
+
+/**
+ * For --pacing txtime: have the kernel schedule the packets we transmit,
+ * using SO_TXTIME on the --tx-ring socket.
+ * @return
+ *      0 on success, or non-zero if that's not possible, in which case
+ *      the caller must do its own pacing
+ */
+int rawsock_enable_txtime(struct Adapter* adapter);
+
+/**
+ * For --pacing txtime: the time, from pixie_fasttime(), that the packets
+ * transmitted from now on should leave the adapter.
+ */
+void rawsock_set_departure(struct Adapter* adapter, uint64_t departure);
+
 /**
  * Called to read the next packet from the network.
  * @param adapter
@@ -120,6 +182,43 @@ int rawsock_send_packet(struct Adapter* adapter, const unsigned char* packet, un
 int rawsock_recv_packet(struct Adapter* adapter, unsigned* length, unsigned* secs, unsigned* usecs,
                         const unsigned char** packet);
 
+/**
+ * A batch of received packets. With --rx-ring, this is a whole block of
+ * packets retired by the kernel, which we walk in place without copying.
+ * Otherwise, it's just the single packet that libpcap returned.
+ */
+struct RawsockBatch
+{
+    struct PktBlock block;
+    const unsigned char* px;
+    unsigned length;
+    unsigned secs;
+    unsigned usecs;
+};
+
+/**
+ * Called to read the next batch of packets from the network.
+ * @return
+ *      0 for success, something else for failure or timeout
+ */
+int rawsock_recv_batch(struct Adapter* adapter, struct RawsockBatch* batch);
+
+/**
+ * Get the next packet in the batch. The parameters are the same as
+ * for "rawsock_recv_packet()", but the packet pointer remains valid
+ * until the batch is released.
+ * @return
+ *      1 if a packet was returned, 0 when the batch is exhausted
+ */
+int rawsock_batch_next(struct RawsockBatch* batch, unsigned* length, unsigned* secs,
+                       unsigned* usecs, const unsigned char** packet);
+
+/**
+ * Done processing all the packets in the batch, so hand the memory
+ * back to the kernel.
+ */
+void rawsock_release_batch(struct Adapter* adapter, struct RawsockBatch* batch);
+
 /**
  * Optimization functions to tell the underlying network stack
  * to not capture the packets we transmit. Most of the time, Ethernet
@@ -204,6 +204,15 @@ extern "C"
 #define RTE_RING_QUOT_EXCEED (1 << 31)           /**< Quota exceed for burst ops */
 #define RTE_RING_SZ_MASK (unsigned) (0x0fffffff) /**< Ring size mask */
 
+/**
+ * A multi-producer or multi-consumer operation waits for the ones before
+ * it to finish. If one of those was preempted, as happens when there are
+ * more threads than processors, it can't finish until it's scheduled
+ * again, so yield after pausing this many times rather than spin for a
+ * whole timeslice.
+ */
+#define RTE_RING_PAUSE_REP_COUNT 64
+
 /**
  * @internal When debug is enabled, store ring statistics.
  * @param r
@@ -382,7 +391,12 @@ extern "C"
          * If there are other enqueues in progress that preceded us,
          * we need to wait for them to complete
          */
-        while (unlikely(r->prod.tail != prod_head)) rte_pause();
+        for (i = 1; unlikely(r->prod.tail != prod_head); i++)
+        {
+            rte_pause();
+            if (i % RTE_RING_PAUSE_REP_COUNT == 0)
+                pixie_cpu_yield();
+        }
 
         r->prod.tail = prod_next;
         return ret;
@@ -560,7 +574,12 @@ extern "C"
          * If there are other dequeues in progress that preceded us,
          * we need to wait for them to complete
          */
-        while (unlikely(r->cons.tail != cons_head)) rte_pause();
+        for (i = 1; unlikely(r->cons.tail != cons_head); i++)
+        {
+            rte_pause();
+            if (i % RTE_RING_PAUSE_REP_COUNT == 0)
+                pixie_cpu_yield();
+        }
 
         __RING_STAT_ADD(r, deq_success, n);
         r->cons.tail = cons_next;
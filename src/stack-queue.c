@@ -1,38 +1,93 @@
 #include "stack-queue.h"
+#include "pixie-threads.h"
 #include "pixie-timer.h"
 #include "rawsock.h"
 #include "util-malloc.h"
 #include <stdio.h>
 #include <string.h>
 
-struct PacketBuffer* stack_get_packetbuffer(struct stack_t* stack)
+/*
+ * When the pool is empty, a thread first spins this many times, then
+ * sleeps, starting with a short sleep and doubling up to the longest.
+ * The transmit thread returns buffers every time it flushes, so the
+ * wait is usually short, and a full millisecond is a whole RTT on a LAN.
+ */
+#define STACK_WAIT_SPINS 64
+#define STACK_WAIT_USECS_MIN 10
+#define STACK_WAIT_USECS_MAX 1000
+
+/***************************************************************************
+ * Back off after the 'n'th failed attempt at a queue operation.
+ ***************************************************************************/
+static void stack_wait(unsigned n)
 {
-    int err;
-    struct PacketBuffer* response = NULL;
+    uint64_t usecs = STACK_WAIT_USECS_MIN;
 
-    for (err = 1; err;)
+    if (n < STACK_WAIT_SPINS)
     {
-        err = rte_ring_sc_dequeue(stack->packet_buffers, (void**) &response);
-        if (err != 0)
-        {
-            /* Pause and wait for a buffer to become available */
-            pixie_usleep(1000);
-        }
+        rte_pause();
+        return;
+    }
+    for (n -= STACK_WAIT_SPINS; n && usecs < STACK_WAIT_USECS_MAX; n--) usecs *= 2;
+    pixie_usleep(usecs < STACK_WAIT_USECS_MAX ? usecs : STACK_WAIT_USECS_MAX);
+}
+
+/***************************************************************************
+ * Refill this thread's cache from the shared pool, taking as many as are
+ * there, up to a cache full. Only waits if the pool is completely empty.
+ ***************************************************************************/
+static void stack_refill(struct stack_t* stack)
+{
+    unsigned n;
+
+    for (n = 0;; n++)
+    {
+        stack->cache_count = rte_ring_mc_dequeue_burst(stack->packet_buffers,
+                                                       (void**) stack->cache, STACK_CACHE_SIZE);
+        if (stack->cache_count)
+            break;
+        if (n == 0)
+            stack->stats.buffer_waits++;
+        stack_wait(n);
     }
-    return response;
+    stack->stats.refills++;
+}
+
+struct PacketBuffer* stack_get_packetbuffer(struct stack_t* stack)
+{
+    if (stack->cache_count == 0)
+        stack_refill(stack);
+    return stack->cache[--stack->cache_count];
 }
 
 void stack_transmit_packetbuffer(struct stack_t* stack, struct PacketBuffer* response)
 {
-    int err;
-    for (err = 1; err;)
+    unsigned n;
+
+    for (n = 0; rte_ring_enqueue(stack->transmit_queue, response) == -ENOBUFS; n++)
     {
-        err = rte_ring_sp_enqueue(stack->transmit_queue, response);
-        if (err)
-        {
-            fprintf(stderr, "[-] transmit queue full (should be impossible)\n");
-            pixie_usleep(1000);
-        }
+        /* There are fewer buffers than slots in the queue, so this
+         * should be impossible */
+        if (n == 0)
+            stack->stats.transmit_waits++;
+        stack_wait(n);
+    }
+}
+
+/***************************************************************************
+ * Return buffers to the shared pool. Like the transmit queue, the pool
+ * has room for every buffer, so this won't normally wait.
+ ***************************************************************************/
+static void stack_return_buffers(struct stack_t* stack, struct PacketBuffer** buffers,
+                                 unsigned count)
+{
+    unsigned n;
+
+    for (n = 0; rte_ring_mp_enqueue_bulk(stack->packet_buffers, (void**) buffers, count) ==
+                -ENOBUFS;
+         n++)
+    {
+        stack_wait(n);
     }
 }
 
@@ -45,58 +100,56 @@ void stack_transmit_packetbuffer(struct stack_t* stack, struct PacketBuffer* res
  * than individually. It increases latency, but increases performance. We
  * don't really care about latency.
  ***************************************************************************/
-void stack_flush_packets(struct stack_t* stack, struct Adapter* adapter, uint64_t* packets_sent,
-                         uint64_t* batchsize)
+unsigned stack_flush_packets(struct stack_t* stack, struct Adapter* adapter,
+                             uint64_t* packets_sent, uint64_t* batchsize)
 {
     /*
      * Send a batch of queued packets
      */
-    for (; (*batchsize); (*batchsize)--)
+    while (*batchsize)
     {
-        int err;
-        struct PacketBuffer* p;
+        struct PacketBuffer* p[STACK_CACHE_SIZE];
+        unsigned count;
+        unsigned i;
 
         /*
-         * Get the next packet from the transmit queue. This packet was
-         * put there by a receive thread, and will contain things like
+         * Get the next packets from the transmit queue. These were put
+         * there by a receive thread, and will contain things like
          * an ACK or an HTTP request
          */
-        err = rte_ring_sc_dequeue(stack->transmit_queue, (void**) &p);
-        if (err)
-        {
+        count = rte_ring_sc_dequeue_burst(
+            stack->transmit_queue, (void**) p,
+            *batchsize < STACK_CACHE_SIZE ? (unsigned) *batchsize : STACK_CACHE_SIZE);
+        if (count == 0)
             break; /* queue is empty, nothing to send */
-        }
 
         /*
-         * Actually send the packet
+         * Actually send the packets
          */
-        rawsock_send_packet(adapter, p->px, (unsigned) p->length, 1);
+        for (i = 0; i < count; i++)
+            rawsock_send_packet(adapter, p[i]->px, (unsigned) p[i]->length, 1);
 
         /*
-         * Now that we are done with the packet, put it on the free list
-         * of buffers that the transmit thread can reuse
+         * Now that we are done with the packets, put them back in the
+         * pool of buffers that the receive threads can reuse
          */
-        for (err = 1; err;)
-        {
-            err = rte_ring_sp_enqueue(stack->packet_buffers, p);
-            if (err)
-            {
-                fprintf(stderr, "[-] transmit queue full (should be impossible)\n");
-                pixie_usleep(10000);
-            }
-        }
+        stack_return_buffers(stack, p, count);
 
         /*
-         * Remember that we sent a packet, which will be used in
-         * throttling.
+         * Remember that we sent them, which will be used in throttling.
          */
-        (*packets_sent)++;
+        *packets_sent += count;
+        *batchsize -= count;
     }
+
+    return rte_ring_count(stack->transmit_queue);
 }
 
-struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src)
+struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src,
+                             unsigned is_multithreaded)
 {
     struct stack_t* stack;
+    unsigned producer_flag = is_multithreaded ? 0 : RING_F_SP_ENQ;
     size_t i;
 
     stack = CALLOC(1, sizeof(*stack));
@@ -104,12 +157,16 @@ struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src)
     stack->src = src;
 
     /*
-     * Allocate packet buffers for sending
+     * Allocate packet buffers for sending. Only the transmit thread
+     * sends buffers, but with --rx-threads there are several receive
+     * threads queueing them. The pool is shared by all of them: the
+     * receive threads take buffers out a cache-full at a time, the
+     * transmit thread puts them back, and clones return what's left in
+     * their caches when they are destroyed.
      */
-#define BUFFER_COUNT 16384
-    stack->packet_buffers = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ | RING_F_SC_DEQ);
-    stack->transmit_queue = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ | RING_F_SC_DEQ);
-    for (i = 0; i < BUFFER_COUNT - 1; i++)
+    stack->packet_buffers = rte_ring_create(STACK_BUFFER_COUNT, 0);
+    stack->transmit_queue = rte_ring_create(STACK_BUFFER_COUNT, producer_flag | RING_F_SC_DEQ);
+    for (i = 0; i < STACK_BUFFER_COUNT - 1; i++)
     {
         struct PacketBuffer* p;
         int err;
@@ -125,3 +182,204 @@ struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src)
 
     return stack;
 }
+
+struct stack_t* stack_clone(const struct stack_t* stack)
+{
+    struct stack_t* clone;
+
+    clone = CALLOC(1, sizeof(*clone));
+    clone->packet_buffers = stack->packet_buffers;
+    clone->transmit_queue = stack->transmit_queue;
+    clone->source_mac = stack->source_mac;
+    clone->src = stack->src;
+    return clone;
+}
+
+void stack_destroy_clone(struct stack_t* stack)
+{
+    if (stack == NULL)
+        return;
+    if (stack->cache_count)
+        stack_return_buffers(stack, stack->cache, stack->cache_count);
+    free(stack);
+}
+
+/***************************************************************************
+ * Destroy a stack made by 'stack_create()' for the tests, once all the
+ * clones are gone and all the buffers are back in the pool.
+ ***************************************************************************/
+static void stack_destroy(struct stack_t* stack)
+{
+    void* p;
+
+    while (rte_ring_sc_dequeue(stack->transmit_queue, &p) == 0) free(p);
+    while (rte_ring_sc_dequeue(stack->packet_buffers, &p) == 0) free(p);
+    free(stack->packet_buffers);
+    free(stack->transmit_queue);
+    free(stack);
+}
+
+/***************************************************************************
+ * Several threads queue packets, like receive threads with --rx-threads,
+ * while another flushes them, like the transmit thread.
+ ***************************************************************************/
+struct StackTest
+{
+    struct stack_t* stack;
+    unsigned index;
+    unsigned count;
+    volatile unsigned* done;
+    unsigned failed;
+    struct stack_stats_t stats;
+    size_t thread_handle;
+};
+
+static void stack_test_producer(void* v)
+{
+    struct StackTest* test = (struct StackTest*) v;
+    struct stack_t* clone = stack_clone(test->stack);
+    unsigned i;
+
+    for (i = 0; i < test->count; i++)
+    {
+        struct PacketBuffer* p = stack_get_packetbuffer(clone);
+        unsigned tag = test->index << 24 | i;
+
+        /* If another thread had this buffer at the same time, one of
+         * them will likely see the other's tag */
+        p->length = 60;
+        memcpy(p->px, &tag, sizeof(tag));
+        memset(p->px + sizeof(tag), (int) test->index, 56);
+        if (memcmp(p->px, &tag, sizeof(tag)) != 0 || p->px[59] != (unsigned char) test->index)
+            test->failed++;
+        stack_transmit_packetbuffer(clone, p);
+    }
+
+    test->stats = clone->stats;
+    stack_destroy_clone(clone);
+    pixie_locked_add_u32(test->done, 1);
+}
+
+/***************************************************************************
+ * Returns the number of packets flushed.
+ ***************************************************************************/
+static uint64_t stack_test_run(struct stack_t* stack, struct StackTest* tests, unsigned threads,
+                               unsigned count)
+{
+    volatile unsigned done = 0;
+    uint64_t packets_sent = 0;
+    unsigned i;
+
+    for (i = 0; i < threads; i++)
+    {
+        tests[i].stack = stack;
+        tests[i].index = i;
+        tests[i].count = count;
+        tests[i].done = &done;
+        tests[i].failed = 0;
+        tests[i].thread_handle = pixie_begin_thread(stack_test_producer, 0, &tests[i]);
+    }
+
+    for (;;)
+    {
+        uint64_t batch_size = 1000;
+        unsigned is_done = (done == threads);
+
+        stack_flush_packets(stack, NULL, &packets_sent, &batch_size);
+        if (is_done && rte_ring_empty(stack->transmit_queue))
+            break;
+
+        /* Like the transmit thread, which sleeps between batches, let the
+         * producers run if there's nothing to send */
+        if (batch_size == 1000)
+            pixie_cpu_yield();
+    }
+
+    /* They've said they're done, but make sure they're gone before the
+     * stack is destroyed */
+    for (i = 0; i < threads; i++)
+        pixie_thread_join(tests[i].thread_handle);
+    return packets_sent;
+}
+
+int stack_queue_selftest(void)
+{
+    static const unsigned THREADS = 4;
+    static const unsigned COUNT = 50000;
+    struct StackTest tests[4];
+    struct stack_t* stack;
+    macaddress_t mac = {{0}};
+    uint64_t packets_sent;
+    unsigned i;
+    int line = 0;
+
+    stack = stack_create(mac, NULL, 1);
+    packets_sent = stack_test_run(stack, tests, THREADS, COUNT);
+
+    if (packets_sent != (uint64_t) THREADS * COUNT)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    for (i = 0; i < THREADS; i++)
+    {
+        if (tests[i].failed)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+    }
+
+    /* Every buffer is back in the pool, including the ones left in the
+     * clones' caches */
+    if (rte_ring_count(stack->packet_buffers) != STACK_BUFFER_COUNT - 1)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    stack_destroy(stack);
+    return 0;
+fail:
+    fprintf(stderr, "[-] stack: selftest failed, line=%d\n", line);
+    stack_destroy(stack);
+    return 1;
+}
+
+/***************************************************************************
+ * Measure how many packets a second the receive threads can hand off to
+ * the transmit thread.
+ ***************************************************************************/
+void stack_queue_benchmark(void)
+{
+    static const unsigned COUNT = 2000000;
+    static const unsigned threads[] = {1, 2, 4};
+    struct StackTest tests[4];
+    macaddress_t mac = {{0}};
+    unsigned t;
+
+    printf("-- stack queue --\n");
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        struct stack_t* stack = stack_create(mac, NULL, threads[t] > 1);
+        uint64_t start, stop;
+        uint64_t packets_sent;
+        struct stack_stats_t stats = {0};
+        unsigned i;
+
+        start = pixie_nanotime();
+        packets_sent = stack_test_run(stack, tests, threads[t], COUNT / threads[t]);
+        stop = pixie_nanotime();
+
+        for (i = 0; i < threads[t]; i++)
+        {
+            stats.refills += tests[i].stats.refills;
+            stats.buffer_waits += tests[i].stats.buffer_waits;
+        }
+        printf("%u threads: packets/second = %5.3f-million, refills = %llu, waits = %llu\n",
+               threads[t], packets_sent / ((stop - start) / 1000.0),
+               (unsigned long long) stats.refills, (unsigned long long) stats.buffer_waits);
+        stack_destroy(stack);
+    }
+    printf("\n");
+}
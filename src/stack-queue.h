@@ -3,24 +3,61 @@
 #include "massip-addr.h"
 #include "rte-ring.h"
 #include <limits.h>
+#include <stdint.h>
 
 struct stack_src_t;
 struct Adapter;
 
 typedef struct rte_ring PACKET_QUEUE;
 
+#define STACK_BUFFER_COUNT 16384
+
+/**
+ * How many free buffers a thread takes from the shared pool at a time.
+ */
+#define STACK_CACHE_SIZE 32
+
 struct PacketBuffer
 {
     size_t length;
     unsigned char px[2040];
 };
 
+/**
+ * How often threads have had to wait on the stack's queues. Any waiting
+ * at all means the transmit thread isn't keeping up with the receive
+ * threads.
+ */
+struct stack_stats_t
+{
+    /** Times the thread refilled its cache from the shared pool */
+    uint64_t refills;
+
+    /** Times the shared pool was empty, so the thread had to wait for
+     * the transmit thread to send some packets and free their buffers */
+    uint64_t buffer_waits;
+
+    /** Times the transmit queue was full */
+    uint64_t transmit_waits;
+};
+
+/**
+ * The free buffers and transmit queue are shared by all the threads
+ * of an adapter. Each receive thread has its own clone, with its own
+ * cache of free buffers, so that it only touches the shared pool once
+ * every STACK_CACHE_SIZE packets.
+ */
 struct stack_t
 {
     PACKET_QUEUE* packet_buffers;
     PACKET_QUEUE* transmit_queue;
     macaddress_t source_mac;
     struct stack_src_t* src;
+
+    struct PacketBuffer* cache[STACK_CACHE_SIZE];
+    unsigned cache_count;
+
+    struct stack_stats_t stats;
 };
 
 /**
@@ -36,9 +73,37 @@ struct PacketBuffer* stack_get_packetbuffer(struct stack_t* stack);
  */
 void stack_transmit_packetbuffer(struct stack_t* stack, struct PacketBuffer* response);
 
-void stack_flush_packets(struct stack_t* stack, struct Adapter* adapter, uint64_t* packets_sent,
-                         uint64_t* batchsize);
+/**
+ * Transmit packets queued by the receive thread, up to 'batchsize' of them.
+ * @return
+ *      the number of packets still waiting in the queue, out of a
+ *      possible STACK_BUFFER_COUNT
+ */
+unsigned stack_flush_packets(struct stack_t* stack, struct Adapter* adapter,
+                             uint64_t* packets_sent, uint64_t* batchsize);
+
+/**
+ * Create the queues for packets that receive threads want transmitted.
+ * @param is_multithreaded
+ *      Whether more than one thread will be queueing packets (--rx-threads).
+ *      Otherwise, the faster single-producer queues are used.
+ */
+struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src,
+                             unsigned is_multithreaded);
+
+/**
+ * Create a stack for another thread to queue packets on, sharing the
+ * queues with the original, but with its own cache of free buffers.
+ */
+struct stack_t* stack_clone(const struct stack_t* stack);
+
+/**
+ * Destroy a clone, returning its cached buffers to the shared pool.
+ */
+void stack_destroy_clone(struct stack_t* stack);
+
+int stack_queue_selftest(void);
 
-struct stack_t* stack_create(macaddress_t source_mac, struct stack_src_t* src);
+void stack_queue_benchmark(void);
 
 #endif
@@ -72,6 +72,7 @@
 #include "util-logger.h"
 #include "util-malloc.h"
 #include "util-safefunc.h"
+#include "util-slab.h"
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
@@ -88,29 +89,72 @@
 #pragma warning(disable : 4996)
 #endif
 
+/**
+ * The most payload a segment can hold, which is also the size of the
+ * buffers we copy payloads into.
+ */
+#define TCP_SEGMENT_PAYLOAD 1460
+
+/**
+ * Payloads we send are split into segments of this size.
+ */
+#define TCP_SEGMENT_MSS 1400
+
 struct TCP_Segment
 {
     unsigned seqno;
     unsigned char* buf;
     size_t length;
     enum TCP__flags flags;
-    bool is_fin; /* was fin sent */
+    bool is_fin;      /* was fin sent */
+    bool is_embedded; /* part of the cold block, not from the slab */
     struct TCP_Segment* next;
 };
 
+/***************************************************************************
+ * The parts of a connection that are only needed once there is payload
+ * to send or receive: the segments waiting to be acknowledged, the banner
+ * parser's state, and the banners themselves. Most TCBs in a scan only
+ * ever see a SYN-ACK or RST, so this is allocated from a slab the first
+ * time it's needed, rather than being part of every TCB.
+ ***************************************************************************/
+struct TCP_Cold_Block
+{
+    struct TCP_Segment* segments;
+
+    /** Most connections only send a hello that fits in one segment, so
+     * the first segment doesn't need to come from the slab */
+    struct TCP_Segment first_segment;
+
+    /*
+     * If Running a script, the thread object
+     */
+    struct ScriptingThread* scripting_thread;
+    const struct ProtocolParserStream* stream;
+
+    struct BannerOutput banout;
+
+    struct StreamState banner1_state;
+};
+
 /***************************************************************************
  * A "TCP control block" is what most operating-systems/network-stack
  * calls the structure that corresponds to a TCP connection. It contains
  * things like the IP addresses, port numbers, sequence numbers, timers,
  * and other things.
+ *
+ * This is touched by every packet and timeout, so it's kept to two
+ * cache-lines on 64-bit systems: anything else goes in 'cold'.
  ***************************************************************************/
 struct TCP_Control_Block
 {
     ipaddress ip_me;
     ipaddress ip_them;
 
-    unsigned short port_me;
-    unsigned short port_them;
+    struct TimeoutEntry timeout[1];
+
+    /** NULL until there's payload, see 'tcb_cold()' */
+    struct TCP_Cold_Block* cold;
 
     uint32_t seqno_me;   /* next seqno I will use for transmit */
     uint32_t seqno_them; /* the next seqno I expect to receive */
@@ -120,12 +164,13 @@ struct TCP_Control_Block
     uint32_t seqno_me_first;
     uint32_t seqno_them_first;
 
-    struct TCP_Control_Block* next;
-    struct TimeoutEntry timeout[1];
+    unsigned short port_me;
+    unsigned short port_them;
+
+    /** In seconds, like 'global_now' */
+    uint32_t when_created;
 
-    unsigned char ttl;
-    unsigned char syns_sent; /* reconnect */
-    unsigned short mss;      /* maximum segment size 1460 */
+    unsigned ttl : 8;
     unsigned tcpstate : 4;
     unsigned is_ipv6 : 1;
     unsigned is_small_window : 1; /* send with smaller window */
@@ -141,34 +186,50 @@ struct TCP_Control_Block
     unsigned is_payload_dynamic : 1;
 
     unsigned app_state;
+};
 
-    struct TCP_Segment* segments;
-
-    /*
-    unsigned short payload_length;
-    const unsigned char *payload;
-    */
-    time_t when_created;
-
-    /*
-     * If Running a script, the thread object
-     */
-    struct ScriptingThread* scripting_thread;
-    const struct ProtocolParserStream* stream;
-
-    struct BannerOutput banout;
+/***************************************************************************
+ * The TCB table is open-addressed, using Robin Hood linear probing. Each
+ * slot holds a 32-bit fingerprint of the connection's 4-tuple, so a probe
+ * walks a dense array of fingerprints, and only touches a TCB when one
+ * matches. An empty slot has a fingerprint of zero.
+ ***************************************************************************/
+struct TCB_Table
+{
+    uint32_t* fingerprints;
+    struct TCP_Control_Block** tcbs;
+    unsigned bits;
+    size_t mask;
+    size_t count;
+};
 
-    struct StreamState banner1_state;
+/*
+ * Static hellos are the same for every target, so their frames are built
+ * once, and only need the addresses, ports, sequence numbers and checksums
+ * filled in for each packet. Hellos that are different for every port
+ * (SF__hello_per_port) get a few slots of their own, so that a wide
+ * --hello-set can't crowd out the HTTP request or SSL hello.
+ */
+#define TCP_HELLO_FRAMES 8
+#define TCP_HELLO_PORT_FRAMES 4
 
-    unsigned packet_number;
+struct TCP_HelloFrame
+{
+    const unsigned char* payload;
+    size_t length;
+    struct TemplateHello* hello[2]; /* IPv4, IPv6 */
 };
 
 struct TCP_ConnectionTable
 {
-    struct TCP_Control_Block** entries;
-    struct TCP_Control_Block* freed_list;
-    unsigned count;
-    unsigned mask;
+    /** When the table grows, TCBs move from the old table to the new one
+     * a few at a time, starting from 'migrate_index', so that no single
+     * packet pays for rehashing the whole thing. Until then, lookups
+     * check both. */
+    struct TCB_Table table;
+    struct TCB_Table old_table;
+    size_t migrate_index;
+
     unsigned timeout_connection;
     unsigned timeout_hello;
 
@@ -176,7 +237,20 @@ struct TCP_ConnectionTable
     uint64_t entropy;
 
     struct Timeouts* timeouts;
+
+    /** Where TCBs, segments and their payloads, and banners come from,
+     * so that once they have grown to the number of connections, the
+     * banner path doesn't need the heap */
+    struct Slab* tcb_slab;
+    struct Slab* cold_slab;
+    struct Slab* segment_slab;
+    struct Slab* payload_slab;
+    struct BanoutPool* banout_pool;
+
     struct TemplatePacket* pkt_template;
+    struct TCP_HelloFrame hello_frames[TCP_HELLO_FRAMES + TCP_HELLO_PORT_FRAMES];
+    unsigned hello_frame_count;
+    unsigned hello_port_frame_count;
     struct stack_t* stack;
 
     struct Banner1* banner1;
@@ -285,23 +359,26 @@ static void LOGtcb(const struct TCP_Control_Block* tcb, int dir, const char* fmt
 void tcpcon_timeouts(struct TCP_ConnectionTable* tcpcon, unsigned secs, unsigned usecs)
 {
     uint64_t timestamp = TICKS_FROM_TV(secs, usecs);
+    struct TimeoutEntry* expired = NULL;
+    struct TimeoutEntry* entry;
 
-    for (;;)
+    /*
+     * Get all the events that are older than the current time at once.
+     * If everything up to the current time has already been processed,
+     * this returns right away.
+     */
+    if (timeouts_expire(tcpcon->timeouts, timestamp, &expired) == 0)
+        return;
+
+    /* Processing one TCB may unlink or reschedule others still on the
+     * list, so always take whatever is at the head */
+    while ((entry = expired) != NULL)
     {
         struct TCP_Control_Block* tcb;
         enum TCB_result x;
 
-        /*
-         * Get the next event that is older than the current time
-         */
-        tcb = (struct TCP_Control_Block*) timeouts_remove(tcpcon->timeouts, timestamp);
-
-        /*
-         * If everything up to the current time has already been processed,
-         * then exit this loop
-         */
-        if (tcb == NULL)
-            break;
+        timeout_unlink(entry);
+        tcb = (struct TCP_Control_Block*) timeout_object(entry);
 
         /*
          * Process this timeout
@@ -566,6 +643,21 @@ void tcpcon_set_parameter(struct TCP_ConnectionTable* tcpcon, const char* name,
         return;
     }
 
+    /*
+     * Send a probe's hello to more ports, like "minecraft:25500-25600"
+     */
+    if (name_equals(name, "hello-set"))
+    {
+        char* str = MALLOC(value_length + 1);
+
+        memcpy(str, value, value_length);
+        str[value_length] = '\0';
+        if (!banner1_hello_set(banner1, str))
+            ERRMSG("tcpcon: parameter: bad hello-set: %s\n", str);
+        free(str);
+        return;
+    }
+
     /*
      * You can reconfigure the "hello" message to be anything
      * you want.
@@ -636,45 +728,16 @@ struct TCP_ConnectionTable* tcpcon_create_table(size_t entry_count, struct stack
     tcpcon->timeout_hello = 2;
     tcpcon->entropy = entropy;
 
-    /* Find nearest power of 2 to the tcb count, but don't go
-     * over the number 16-million */
-    {
-        size_t new_entry_count;
-        new_entry_count = 1;
-        while (new_entry_count < entry_count)
-        {
-            new_entry_count *= 2;
-            if (new_entry_count == 0)
-            {
-                new_entry_count = (1 << 24);
-                break;
-            }
-        }
-        if (new_entry_count > (1 << 24))
-            new_entry_count = (1 << 24);
-        if (new_entry_count < (1 << 10))
-            new_entry_count = (1 << 10);
-        entry_count = new_entry_count;
-    }
-
-    /* Create the table. If we can't allocate enough memory, then shrink
-     * the desired size of the table */
-    while (tcpcon->entries == 0)
-    {
-        tcpcon->entries = malloc(entry_count * sizeof(*tcpcon->entries));
-        if (tcpcon->entries == NULL)
-        {
-            entry_count >>= 1;
-        }
-    }
-    memset(tcpcon->entries, 0, entry_count * sizeof(*tcpcon->entries));
-
-    /* fill in the table structure */
-    tcpcon->count = (unsigned) entry_count;
-    tcpcon->mask = (unsigned) (entry_count - 1);
-
+    /* The TCB table itself starts out empty, and grows as connections
+     * are made. The count is only a hint for sizing the timeouts */
     /* create an event/timeouts structure */
-    tcpcon->timeouts = timeouts_create(TICKS_FROM_SECS(time(0)));
+    tcpcon->timeouts = timeouts_create(TICKS_FROM_SECS(time(0)), entry_count);
+
+    tcpcon->tcb_slab = slab_create(sizeof(struct TCP_Control_Block));
+    tcpcon->cold_slab = slab_create(sizeof(struct TCP_Cold_Block));
+    tcpcon->segment_slab = slab_create(sizeof(struct TCP_Segment));
+    tcpcon->payload_slab = slab_create(TCP_SEGMENT_PAYLOAD);
+    tcpcon->banout_pool = banout_pool_create();
 
     tcpcon->pkt_template = pkt_template;
 
@@ -711,6 +774,221 @@ static int TCB_EQUALS(const struct TCP_Control_Block* lhs, const struct TCP_Cont
     return 1;
 }
 
+/*
+ * The table starts at 1024 slots, and doubles when it's three-quarters
+ * full. Each insert takes this many steps through the old table, which
+ * empties it long before the new one fills up.
+ */
+#define TCB_TABLE_BITS_MIN 10
+#define TCB_TABLE_BITS_MAX 31
+#define TCB_TABLE_MIGRATE 8
+
+/***************************************************************************
+ * The fingerprint is the TCB hash, but never zero, which marks an empty
+ * slot. The hash also picks the receive thread, so all the TCBs in one
+ * table share its low bits. The home slot is therefore taken from the
+ * high bits of a multiplicative hash instead.
+ ***************************************************************************/
+static uint32_t tcb_fingerprint(unsigned hash)
+{
+    return hash ? (uint32_t) hash : 1;
+}
+
+static size_t tcbtable_home(const struct TCB_Table* table, uint32_t fingerprint)
+{
+    return (uint32_t) (fingerprint * 0x9E3779B1U) >> (32 - table->bits);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void tcbtable_alloc(struct TCB_Table* table, unsigned bits)
+{
+    table->bits = bits;
+    table->mask = ((size_t) 1 << bits) - 1;
+    table->count = 0;
+    table->fingerprints = CALLOC(table->mask + 1, sizeof(table->fingerprints[0]));
+    table->tcbs = CALLOC(table->mask + 1, sizeof(table->tcbs[0]));
+}
+
+static void tcbtable_free(struct TCB_Table* table)
+{
+    free(table->fingerprints);
+    free(table->tcbs);
+    memset(table, 0, sizeof(*table));
+}
+
+/***************************************************************************
+ * Find the TCB matching the 4-tuple in 'key'. Robin Hood probing keeps
+ * each run of slots sorted by home slot, so the search can stop as soon
+ * as it sees an entry closer to its home than we are to ours.
+ ***************************************************************************/
+static struct TCP_Control_Block* tcbtable_find(const struct TCB_Table* table,
+                                               uint32_t fingerprint,
+                                               const struct TCP_Control_Block* key)
+{
+    size_t i;
+    size_t distance;
+
+    if (table->fingerprints == NULL)
+        return NULL;
+
+    i = tcbtable_home(table, fingerprint);
+    for (distance = 0;; distance++)
+    {
+        uint32_t f = table->fingerprints[i];
+        if (f == 0)
+            return NULL;
+        if (((i - tcbtable_home(table, f)) & table->mask) < distance)
+            return NULL;
+        if (f == fingerprint && TCB_EQUALS(table->tcbs[i], key))
+            return table->tcbs[i];
+        i = (i + 1) & table->mask;
+    }
+}
+
+/***************************************************************************
+ * Find the slot holding this exact TCB, or return the table size if it
+ * isn't in this table.
+ ***************************************************************************/
+static size_t tcbtable_locate(const struct TCB_Table* table, uint32_t fingerprint,
+                              const struct TCP_Control_Block* tcb)
+{
+    size_t i;
+    size_t distance;
+
+    if (table->fingerprints == NULL)
+        return table->mask + 1;
+
+    i = tcbtable_home(table, fingerprint);
+    for (distance = 0;; distance++)
+    {
+        uint32_t f = table->fingerprints[i];
+        if (f == 0 || ((i - tcbtable_home(table, f)) & table->mask) < distance)
+            return table->mask + 1;
+        if (table->tcbs[i] == tcb)
+            return i;
+        i = (i + 1) & table->mask;
+    }
+}
+
+/***************************************************************************
+ * Insert, taking the slot from any entry that is closer to its home
+ * than we are, then carrying on with that entry instead.
+ ***************************************************************************/
+static void tcbtable_insert(struct TCB_Table* table, uint32_t fingerprint,
+                            struct TCP_Control_Block* tcb)
+{
+    size_t i;
+    size_t distance;
+
+    i = tcbtable_home(table, fingerprint);
+    for (distance = 0;; distance++)
+    {
+        uint32_t f = table->fingerprints[i];
+        size_t d;
+
+        if (f == 0)
+        {
+            table->fingerprints[i] = fingerprint;
+            table->tcbs[i] = tcb;
+            table->count++;
+            return;
+        }
+
+        d = (i - tcbtable_home(table, f)) & table->mask;
+        if (d < distance)
+        {
+            struct TCP_Control_Block* t = table->tcbs[i];
+            table->fingerprints[i] = fingerprint;
+            table->tcbs[i] = tcb;
+            fingerprint = f;
+            tcb = t;
+            distance = d;
+        }
+        i = (i + 1) & table->mask;
+    }
+}
+
+/***************************************************************************
+ * Remove the entry at this slot, shifting back the entries after it that
+ * aren't in their home slot, so no tombstones are needed.
+ ***************************************************************************/
+static void tcbtable_remove_at(struct TCB_Table* table, size_t i)
+{
+    for (;;)
+    {
+        size_t next = (i + 1) & table->mask;
+        uint32_t f = table->fingerprints[next];
+
+        if (f == 0 || tcbtable_home(table, f) == next)
+            break;
+        table->fingerprints[i] = f;
+        table->tcbs[i] = table->tcbs[next];
+        i = next;
+    }
+    table->fingerprints[i] = 0;
+    table->tcbs[i] = NULL;
+    table->count--;
+}
+
+/***************************************************************************
+ * Take up to 'steps' steps moving the old table into the new one, where a
+ * step either moves an entry or skips an empty slot. The slot at
+ * 'migrate_index' is emptied before moving on, and removing from it
+ * shifts back the rest of its run, so everything before the index stays
+ * empty, and lookups in the old table still work.
+ ***************************************************************************/
+static void tcpcon_migrate(struct TCP_ConnectionTable* tcpcon, size_t steps)
+{
+    struct TCB_Table* old = &tcpcon->old_table;
+
+    for (; old->fingerprints && steps; steps--)
+    {
+        size_t i = tcpcon->migrate_index;
+
+        if (old->fingerprints[i])
+        {
+            tcbtable_insert(&tcpcon->table, old->fingerprints[i], old->tcbs[i]);
+            tcbtable_remove_at(old, i);
+            continue;
+        }
+
+        if (old->count == 0 || i == old->mask)
+            tcbtable_free(old);
+        else
+            tcpcon->migrate_index++;
+    }
+}
+
+/***************************************************************************
+ * Called before inserting a TCB, to make room for it.
+ ***************************************************************************/
+static void tcpcon_reserve(struct TCP_ConnectionTable* tcpcon)
+{
+    struct TCB_Table* table = &tcpcon->table;
+    size_t count;
+
+    tcpcon_migrate(tcpcon, TCB_TABLE_MIGRATE);
+
+    if (table->fingerprints == NULL)
+    {
+        tcbtable_alloc(table, TCB_TABLE_BITS_MIN);
+        return;
+    }
+
+    count = table->count + tcpcon->old_table.count + 1;
+    if (count * 4 <= (table->mask + 1) * 3 || table->bits >= TCB_TABLE_BITS_MAX)
+        return;
+
+    /* Normally the previous migration is long finished by now */
+    tcpcon_migrate(tcpcon, ~(size_t) 0);
+
+    tcpcon->old_table = *table;
+    tcpcon->migrate_index = 0;
+    tcbtable_alloc(table, tcpcon->old_table.bits + 1);
+    LOG(2, "tcb: table grown to %u slots\n", (unsigned) (table->mask + 1));
+}
+
 /***************************************************************************
  ***************************************************************************/
 static void _tcb_change_state_to(struct TCP_Control_Block* tcb, unsigned new_state)
@@ -721,8 +999,8 @@ static void _tcb_change_state_to(struct TCP_Control_Block* tcb, unsigned new_sta
 
 /***************************************************************************
  ***************************************************************************/
-static unsigned tcb_hash(ipaddress ip_me, unsigned port_me, ipaddress ip_them, unsigned port_them,
-                         uint64_t entropy)
+unsigned tcb_hash(ipaddress ip_me, unsigned port_me, ipaddress ip_them, unsigned port_them,
+                  uint64_t entropy)
 {
     unsigned index;
 
@@ -755,6 +1033,36 @@ enum DestroyReason
 
 };
 
+/***************************************************************************
+ * Get the cold part of the TCB, allocating it the first time there's
+ * payload to send or receive.
+ ***************************************************************************/
+static struct TCP_Cold_Block* tcb_cold(struct TCP_ConnectionTable* tcpcon,
+                                       struct TCP_Control_Block* tcb)
+{
+    struct TCP_Cold_Block* cold = tcb->cold;
+
+    if (cold == NULL)
+    {
+        cold = slab_alloc(tcpcon->cold_slab);
+        memset(cold, 0, sizeof(*cold));
+        cold->stream = tcpcon->banner1->payloads.tcp[tcb->port_them];
+        cold->banner1_state.port = tcb->port_them;
+        banout_init_pool(&cold->banout, tcpcon->banout_pool);
+        tcb->cold = cold;
+    }
+    return cold;
+}
+
+/***************************************************************************
+ * The segments waiting to be acknowledged, without allocating the cold
+ * part just to find there aren't any.
+ ***************************************************************************/
+static struct TCP_Segment* tcb_segments(const struct TCP_Control_Block* tcb)
+{
+    return tcb->cold ? tcb->cold->segments : NULL;
+}
+
 /***************************************************************************
  * Flush all the banners associated with this TCP connection. This always
  * called when TCB is destroyed. This may also be called earlier, such
@@ -766,11 +1074,15 @@ void banner_flush(struct stack_handle_t* socket)
     struct TCP_Control_Block* tcb = socket->tcb;
     struct BannerOutput* banout;
 
+    /* No payload, no banners */
+    if (tcb->cold == NULL)
+        return;
+
     /* Go through and print all the banners. Some protocols have
      * multiple banners. For example, web servers have both
      * HTTP and HTML banners, and SSL also has several
      * X.509 certificate banners */
-    for (banout = &tcb->banout; banout != NULL; banout = banout->next)
+    for (banout = &tcb->cold->banout; banout != NULL; banout = banout->next)
     {
         if (banout->length && banout->protocol)
         {
@@ -783,7 +1095,94 @@ void banner_flush(struct stack_handle_t* socket)
     /*
      * Free up all the banners.
      */
-    banout_release(&tcb->banout);
+    banout_release(&tcb->cold->banout);
+}
+
+/***************************************************************************
+ * Free a segment, and its payload if we own it. Copies are in our own
+ * buffers, but adopted payloads came from the heap.
+ ***************************************************************************/
+static void _tcb_seg_free(struct TCP_ConnectionTable* tcpcon, struct TCP_Segment* seg)
+{
+    switch (seg->flags)
+    {
+        case TCP__copy:
+            slab_free(tcpcon->payload_slab, seg->buf);
+            break;
+        case TCP__adopt:
+            free(seg->buf);
+            break;
+        default:;
+    }
+    seg->buf = NULL;
+    if (!seg->is_embedded)
+        slab_free(tcpcon->segment_slab, seg);
+}
+
+/***************************************************************************
+ * Remember a static payload that fits in a single segment, so that when
+ * it's sent, it can use a pre-built frame.
+ * @param stream
+ *      The protocol the connection is sending its hello for, so that
+ *      per-port hellos are counted against their own slots.
+ ***************************************************************************/
+static void tcpcon_hello_register(struct TCP_ConnectionTable* tcpcon,
+                                  const struct ProtocolParserStream* stream, const void* payload,
+                                  size_t length)
+{
+    struct TCP_HelloFrame* frame;
+    bool is_per_port;
+    unsigned i;
+
+    for (i = 0; i < tcpcon->hello_frame_count; i++)
+    {
+        frame = &tcpcon->hello_frames[i];
+        if (frame->payload == payload && frame->length == length)
+            return;
+    }
+
+    is_per_port = stream && stream->hello == payload && (stream->flags & SF__hello_per_port);
+    if (is_per_port)
+    {
+        if (tcpcon->hello_port_frame_count >= TCP_HELLO_PORT_FRAMES)
+            return;
+        tcpcon->hello_port_frame_count++;
+    }
+    else if (tcpcon->hello_frame_count - tcpcon->hello_port_frame_count >= TCP_HELLO_FRAMES)
+        return;
+
+    frame = &tcpcon->hello_frames[tcpcon->hello_frame_count++];
+    frame->payload = payload;
+    frame->length = length;
+}
+
+/***************************************************************************
+ * Find the pre-built frame for this payload, building it the first time
+ * it's sent over this IP version.
+ ***************************************************************************/
+static const struct TemplateHello* tcpcon_hello_lookup(struct TCP_ConnectionTable* tcpcon,
+                                                       const unsigned char* payload,
+                                                       size_t length, unsigned ip_version)
+{
+    unsigned i;
+
+    if (length == 0)
+        return NULL;
+
+    for (i = 0; i < tcpcon->hello_frame_count; i++)
+    {
+        struct TCP_HelloFrame* frame = &tcpcon->hello_frames[i];
+        struct TemplateHello** hello;
+
+        if (frame->payload != payload || frame->length != length)
+            continue;
+
+        hello = &frame->hello[ip_version == 6];
+        if (*hello == NULL)
+            *hello = tcp_hello_create(tcpcon->pkt_template, ip_version, payload, length);
+        return *hello;
+    }
+    return NULL;
 }
 
 /***************************************************************************
@@ -794,25 +1193,27 @@ void banner_flush(struct stack_handle_t* socket)
 static void tcpcon_destroy_tcb(struct TCP_ConnectionTable* tcpcon, struct TCP_Control_Block* tcb,
                                enum DestroyReason reason)
 {
-    unsigned index;
-    struct TCP_Control_Block** r_entry;
+    uint32_t fingerprint;
+    struct TCB_Table* table;
+    size_t index;
 
     UNUSEDPARM(reason);
 
     /*
      * The TCB doesn't point to it's location in the table. Therefore, we
-     * have to do a lookup to find the head pointer in the table.
+     * have to do a lookup to find its slot, in whichever table it's in.
      */
-    index = tcb_hash(tcb->ip_me, tcb->port_me, tcb->ip_them, tcb->port_them, tcpcon->entropy);
-
-    /*
-     * At this point, we have the head of a linked list of TCBs. Now,
-     * traverse that linked list until we find our TCB
-     */
-    r_entry = &tcpcon->entries[index & tcpcon->mask];
-    while (*r_entry && *r_entry != tcb) r_entry = &(*r_entry)->next;
+    fingerprint = tcb_fingerprint(
+        tcb_hash(tcb->ip_me, tcb->port_me, tcb->ip_them, tcb->port_them, tcpcon->entropy));
+    table = &tcpcon->table;
+    index = tcbtable_locate(table, fingerprint, tcb);
+    if (index > table->mask)
+    {
+        table = &tcpcon->old_table;
+        index = tcbtable_locate(table, fingerprint, tcb);
+    }
 
-    if (*r_entry == NULL)
+    if (index > table->mask)
     {
         LOG(1, "tcb: double free\n");
         return;
@@ -830,32 +1231,35 @@ static void tcpcon_destroy_tcb(struct TCP_ConnectionTable* tcpcon, struct TCP_Co
 
     LOGtcb(tcb, 2, "--DESTROYED--\n");
 
-    /*
-     * If there are any queued segments to transmit, then free them
-     */
-    while (tcb->segments)
+    if (tcb->cold)
     {
-        struct TCP_Segment* seg;
-        seg = tcb->segments;
-        tcb->segments = seg->next;
-        if (seg->flags == TCP__copy || seg->flags == TCP__adopt)
+        struct TCP_Cold_Block* cold = tcb->cold;
+
+        /*
+         * If there are any queued segments to transmit, then free them
+         */
+        while (cold->segments)
         {
-            free(seg->buf);
-            seg->buf = 0;
+            struct TCP_Segment* seg;
+            seg = cold->segments;
+            cold->segments = seg->next;
+            _tcb_seg_free(tcpcon, seg);
         }
-        free(seg);
-    }
 
-    if (tcb->scripting_thread)
-        ;  // scripting_thread_close(tcb->scripting_thread);
-    tcb->scripting_thread = 0;
+        if (cold->scripting_thread)
+            ;  // scripting_thread_close(cold->scripting_thread);
+        cold->scripting_thread = 0;
 
-    /* KLUDGE: this needs to be made elegant */
-    switch (tcb->banner1_state.app_proto)
-    {
-        case PROTO_SMB:
-            banner_smb1.cleanup(&tcb->banner1_state);
-            break;
+        /* KLUDGE: this needs to be made elegant */
+        switch (cold->banner1_state.app_proto)
+        {
+            case PROTO_SMB:
+                banner_smb1.cleanup(&cold->banner1_state);
+                break;
+        }
+
+        slab_free(tcpcon->cold_slab, cold);
+        tcb->cold = NULL;
     }
 
     /*
@@ -870,9 +1274,8 @@ static void tcpcon_destroy_tcb(struct TCP_ConnectionTable* tcpcon, struct TCP_Co
 
     tcb->is_active = 0;
 
-    (*r_entry) = tcb->next;
-    tcb->next = tcpcon->freed_list;
-    tcpcon->freed_list = tcb;
+    tcbtable_remove_at(table, index);
+    slab_free(tcpcon->tcb_slab, tcb);
     tcpcon->active_count--;
 }
 
@@ -882,32 +1285,50 @@ static void tcpcon_destroy_tcb(struct TCP_ConnectionTable* tcpcon, struct TCP_Co
  ***************************************************************************/
 void tcpcon_destroy_table(struct TCP_ConnectionTable* tcpcon)
 {
-    unsigned i;
+    struct TCB_Table* tables[2];
+    size_t i;
+    unsigned t;
 
     if (tcpcon == NULL)
         return;
 
     /*
      * Do a graceful destruction of all the entires. If they have banners,
-     * they will be sent to the output
+     * they will be sent to the output. Destroying one shifts the next
+     * into its slot, so keep going until the slot is empty.
      */
-    for (i = 0; i <= tcpcon->mask; i++)
-    {
-        while (tcpcon->entries[i]) tcpcon_destroy_tcb(tcpcon, tcpcon->entries[i], Reason_Shutdown);
+    tables[0] = &tcpcon->table;
+    tables[1] = &tcpcon->old_table;
+    for (t = 0; t < 2; t++)
+    {
+        struct TCB_Table* table = tables[t];
+        if (table->fingerprints == NULL)
+            continue;
+        for (i = 0; i <= table->mask; i++)
+        {
+            while (table->fingerprints[i])
+                tcpcon_destroy_tcb(tcpcon, table->tcbs[i], Reason_Shutdown);
+        }
     }
 
     /*
      * Now free the memory
      */
-    while (tcpcon->freed_list)
+    slab_destroy(tcpcon->tcb_slab);
+    slab_destroy(tcpcon->cold_slab);
+    slab_destroy(tcpcon->segment_slab);
+    slab_destroy(tcpcon->payload_slab);
+    banout_pool_destroy(tcpcon->banout_pool);
+    timeouts_destroy(tcpcon->timeouts);
+    for (i = 0; i < tcpcon->hello_frame_count; i++)
     {
-        struct TCP_Control_Block* tcb = tcpcon->freed_list;
-        tcpcon->freed_list = tcb->next;
-        free(tcb);
+        tcp_hello_destroy(tcpcon->hello_frames[i].hello[0]);
+        tcp_hello_destroy(tcpcon->hello_frames[i].hello[1]);
     }
 
     banner1_destroy(tcpcon->banner1);
-    free(tcpcon->entries);
+    tcbtable_free(&tcpcon->table);
+    tcbtable_free(&tcpcon->old_table);
     free(tcpcon);
 }
 
@@ -922,7 +1343,7 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
                                             const struct ProtocolParserStream* stream,
                                             unsigned secs, unsigned usecs)
 {
-    unsigned index;
+    uint32_t fingerprint;
     struct TCP_Control_Block tmp;
     struct TCP_Control_Block* tcb;
 
@@ -933,14 +1354,11 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
     tmp.port_me = (unsigned short) port_me;
     tmp.port_them = (unsigned short) port_them;
 
-    /* Lookup the location in the hash table where this tcb should be
-     * placed */
-    index = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
-    tcb = tcpcon->entries[index & tcpcon->mask];
-    while (tcb && !TCB_EQUALS(tcb, &tmp))
-    {
-        tcb = tcb->next;
-    }
+    /* See if it's already in the table */
+    fingerprint = tcb_fingerprint(tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy));
+    tcb = tcbtable_find(&tcpcon->table, fingerprint, &tmp);
+    if (tcb == NULL)
+        tcb = tcbtable_find(&tcpcon->old_table, fingerprint, &tmp);
     if (tcb != NULL)
     {
         /* If it already exists, just return the existing one */
@@ -948,20 +1366,12 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
     }
 
     /* Allocate a new TCB, using a pool */
-    if (tcpcon->freed_list)
-    {
-        tcb = tcpcon->freed_list;
-        tcpcon->freed_list = tcb->next;
-    }
-    else
-    {
-        tcb = MALLOC(sizeof(*tcb));
-    }
+    tcb = slab_alloc(tcpcon->tcb_slab);
     memset(tcb, 0, sizeof(*tcb));
 
-    /* Add it to this spot in the hash table */
-    tcb->next = tcpcon->entries[index & tcpcon->mask];
-    tcpcon->entries[index & tcpcon->mask] = tcb;
+    /* Add it to the hash table, growing it if need be */
+    tcpcon_reserve(tcpcon);
+    tcbtable_insert(&tcpcon->table, fingerprint, tcb);
 
     /*
      * Initialize the entry
@@ -976,9 +1386,8 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
     tcb->seqno_them = seqno_them;
     tcb->ackno_me = seqno_them;
     tcb->ackno_them = seqno_me;
-    tcb->when_created = global_now;
+    tcb->when_created = (uint32_t) global_now;
     tcb->ttl = (unsigned char) ttl;
-    tcb->mss = 1400;
 
     /* Insert the TCB into the timeout. A TCB must always have a timeout
      * active. */
@@ -986,15 +1395,10 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
     timeouts_add(tcpcon->timeouts, tcb->timeout, offsetof(struct TCP_Control_Block, timeout),
                  TICKS_FROM_TV(secs + 1, usecs));
 
-    /* Get the protocol handler assigned to this port */
-    tcb->banner1_state.port = (unsigned short) port_them;
-    if (stream == NULL)
-    {
-        struct Banner1* banner1 = tcpcon->banner1;
-        stream = banner1->payloads.tcp[port_them];
-    }
-    tcb->stream = stream;
-    banout_init(&tcb->banout);
+    /* The protocol handler is normally the one assigned to this port,
+     * which doesn't need remembering until there's a payload */
+    if (stream != NULL)
+        tcb_cold(tcpcon, tcb)->stream = stream;
 
     /* The TCB is now allocated/in-use */
     assert(tcb->ip_me.version != 0 && tcb->ip_them.version != 0);
@@ -1002,8 +1406,6 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
 
     tcpcon->active_count++;
 
-    tcpcon_lookup_tcb(tcpcon, ip_me, ip_them, port_me, port_them);
-
     return tcb;
 }
 
@@ -1012,31 +1414,21 @@ struct TCP_Control_Block* tcpcon_create_tcb(struct TCP_ConnectionTable* tcpcon,
 struct TCP_Control_Block* tcpcon_lookup_tcb(struct TCP_ConnectionTable* tcpcon, ipaddress ip_me,
                                             ipaddress ip_them, unsigned port_me, unsigned port_them)
 {
-    unsigned index;
+    uint32_t fingerprint;
     struct TCP_Control_Block tmp;
     struct TCP_Control_Block* tcb;
-    ipaddress_formatted_t fmt1;
-    ipaddress_formatted_t fmt2;
 
     tmp.ip_me = ip_me;
     tmp.ip_them = ip_them;
     tmp.port_me = (unsigned short) port_me;
     tmp.port_them = (unsigned short) port_them;
 
-    index = tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy);
-
-    fmt1 = ipaddress_fmt(ip_me);
-    fmt2 = ipaddress_fmt(ip_them);
-    LOG(1, "tcb_hash(0x%08x) = %s %u %s %u\n", (unsigned) index, fmt1.string, port_me, fmt2.string,
-        port_them);
-
-    /* Hash to an entry in the table, then follow a linked list from
-     * that point forward. */
-    tcb = tcpcon->entries[index & tcpcon->mask];
-    while (tcb && !TCB_EQUALS(tcb, &tmp))
-    {
-        tcb = tcb->next;
-    }
+    /* A lookup never changes the table, not even to move entries
+     * along while it's growing */
+    fingerprint = tcb_fingerprint(tcb_hash(ip_me, port_me, ip_them, port_them, tcpcon->entropy));
+    tcb = tcbtable_find(&tcpcon->table, fingerprint, &tmp);
+    if (tcb == NULL)
+        tcb = tcbtable_find(&tcpcon->old_table, fingerprint, &tmp);
 
     return tcb;
 }
@@ -1048,6 +1440,7 @@ static void tcpcon_send_packet(struct TCP_ConnectionTable* tcpcon, struct TCP_Co
                                size_t payload_length)
 {
     struct PacketBuffer* response = 0;
+    const struct TemplateHello* hello;
     unsigned is_syn = (tcp_flags == 0x02);
 
     assert(tcb->ip_me.version != 0 && tcb->ip_them.version != 0);
@@ -1086,11 +1479,19 @@ static void tcpcon_send_packet(struct TCP_ConnectionTable* tcpcon, struct TCP_Co
      * 2. an ACK packet with no payload
      * 3. a RST packet with no payload
      * 4. a PSH-ACK packet WITH PAYLOAD
+     * Static hellos already have their frame built, and their payload
+     * checksummed.
      */
-    response->length =
-        tcp_create_packet(tcpcon->pkt_template, tcb->ip_them, tcb->port_them, tcb->ip_me,
-                          tcb->port_me, tcb->seqno_me - is_syn, tcb->seqno_them, tcp_flags, payload,
-                          payload_length, response->px, sizeof(response->px));
+    hello = tcpcon_hello_lookup(tcpcon, payload, payload_length, tcb->ip_them.version);
+    if (hello)
+        response->length = tcp_hello_packet(hello, tcb->ip_them, tcb->port_them, tcb->ip_me,
+                                            tcb->port_me, tcb->seqno_me, tcb->seqno_them,
+                                            tcp_flags, response->px, sizeof(response->px));
+    else
+        response->length = tcp_create_packet(
+            tcpcon->pkt_template, tcb->ip_them, tcb->port_them, tcb->ip_me, tcb->port_me,
+            tcb->seqno_me - is_syn, tcb->seqno_them, tcp_flags, payload, payload_length,
+            response->px, sizeof(response->px));
 
     /*
      * KLUDGE:
@@ -1208,7 +1609,7 @@ void tcpcon_send_RST(struct TCP_ConnectionTable* tcpcon, ipaddress ip_me, ipaddr
  ***************************************************************************/
 static void _tcb_seg_resend(struct TCP_ConnectionTable* tcpcon, struct TCP_Control_Block* tcb)
 {
-    struct TCP_Segment* seg = tcb->segments;
+    struct TCP_Segment* seg = tcb_segments(tcb);
 
     if (seg)
     {
@@ -1241,9 +1642,14 @@ static unsigned application_notify(struct TCP_ConnectionTable* tcpcon,
                                    unsigned usecs)
 {
     struct Banner1* banner1 = tcpcon->banner1;
-    const struct ProtocolParserStream* stream = tcb->stream;
+    const struct ProtocolParserStream* stream;
     struct stack_handle_t socket = {tcpcon, tcb, secs, usecs};
 
+    if (tcb->cold)
+        stream = tcb->cold->stream;
+    else
+        stream = banner1->payloads.tcp[tcb->port_them];
+
     return application_event(&socket, tcb->app_state, event, stream, banner1, payload,
                              payload_length);
 }
@@ -1255,23 +1661,25 @@ static void _tcb_seg_send(void* in_tcpcon, void* in_tcb, const void* buf, size_t
 {
     struct TCP_ConnectionTable* tcpcon = (struct TCP_ConnectionTable*) in_tcpcon;
     struct TCP_Control_Block* tcb = (struct TCP_Control_Block*) in_tcb;
+    struct TCP_Cold_Block* cold;
     struct TCP_Segment* seg;
     struct TCP_Segment** next;
     unsigned seqno = tcb->seqno_me;
     size_t length_more = 0;
     bool is_fin = (flags == TCP__close_fin);
 
-    if (length > tcb->mss)
+    if (length > TCP_SEGMENT_MSS)
     {
-        length_more = length - tcb->mss;
-        length = tcb->mss;
+        length_more = length - TCP_SEGMENT_MSS;
+        length = TCP_SEGMENT_MSS;
     }
 
     if (length == 0 && !is_fin)
         return;
 
     /* Go to the end of the segment list */
-    for (next = &tcb->segments; *next; next = &(*next)->next)
+    cold = tcb_cold(tcpcon, tcb);
+    for (next = &cold->segments; *next; next = &(*next)->next)
     {
         seqno = (unsigned) ((*next)->seqno + (*next)->length);
         if ((*next)->is_fin)
@@ -1287,8 +1695,19 @@ static void _tcb_seg_send(void* in_tcpcon, void* in_tcb, const void* buf, size_t
         }
     }
 
-    /* Append this segment to the list */
-    seg = calloc(1, sizeof(*seg));
+    /* Append this segment to the list. Segments are only ever removed
+     * from the head, so if the list is empty, the embedded one is free. */
+    if (cold->segments == NULL)
+    {
+        seg = &cold->first_segment;
+        memset(seg, 0, sizeof(*seg));
+        seg->is_embedded = true;
+    }
+    else
+    {
+        seg = slab_alloc(tcpcon->segment_slab);
+        memset(seg, 0, sizeof(*seg));
+    }
     *next = seg;
 
     /* Fill in this segment's members */
@@ -1298,11 +1717,16 @@ static void _tcb_seg_send(void* in_tcpcon, void* in_tcb, const void* buf, size_t
     switch (flags)
     {
         case TCP__static:
+            if (length_more == 0)
+                tcpcon_hello_register(tcpcon, cold->stream, buf, length);
+            seg->buf = (void*) buf;
+            break;
         case TCP__adopt:
             seg->buf = (void*) buf;
             break;
         case TCP__copy:
-            seg->buf = malloc(length);
+            assert(length <= TCP_SEGMENT_PAYLOAD);
+            seg->buf = slab_alloc(tcpcon->payload_slab);
             memcpy(seg->buf, buf, length);
             break;
         case TCP__close_fin:
@@ -1319,7 +1743,7 @@ static void _tcb_seg_send(void* in_tcpcon, void* in_tcb, const void* buf, size_t
            seg->seqno - tcb->seqno_me_first);
 
     /* If this is the head of the segment list, then transmit right away */
-    if (tcb->segments == seg)
+    if (cold->segments == seg)
     {
         LOGtcb(tcb, 0, "xmit = %u-bytes %s @ %u\n", length, is_fin ? "FIN" : "",
                seg->seqno - tcb->seqno_me_first);
@@ -1343,8 +1767,12 @@ static void _tcb_seg_send(void* in_tcpcon, void* in_tcb, const void* buf, size_t
 
 /***************************************************************************
  ***************************************************************************/
-static int _tcp_seg_acknowledge(struct TCP_Control_Block* tcb, uint32_t ackno)
+static int _tcp_seg_acknowledge(struct TCP_ConnectionTable* tcpcon, struct TCP_Control_Block* tcb,
+                                uint32_t ackno)
 {
+    struct TCP_Segment* none = NULL;
+    struct TCP_Segment** segments = tcb->cold ? &tcb->cold->segments : &none;
+
     /*LOG(4,  "%s - %u-sending, %u-reciving\n",
             fmt.string,
             tcb->seqno_me - ackno,
@@ -1384,9 +1812,9 @@ static int _tcp_seg_acknowledge(struct TCP_Control_Block* tcb, uint32_t ackno)
 
     /* Handle FIN specially */
 handle_fin:
-    if (tcb->segments && tcb->segments->is_fin)
+    if (*segments && (*segments)->is_fin)
     {
-        struct TCP_Segment* seg = tcb->segments;
+        struct TCP_Segment* seg = *segments;
 
         if (seg->seqno + 1 == ackno)
         {
@@ -1409,14 +1837,14 @@ handle_fin:
     /* Retire outstanding segments */
     {
         unsigned length = ackno - tcb->seqno_me;
-        while (tcb->segments && length >= tcb->segments->length)
+        while (*segments && length >= (*segments)->length)
         {
-            struct TCP_Segment* seg = tcb->segments;
+            struct TCP_Segment* seg = *segments;
 
             if (seg->is_fin)
                 goto handle_fin;
 
-            tcb->segments = seg->next;
+            *segments = seg->next;
 
             length -= seg->length;
             tcb->seqno_me += seg->length;
@@ -1425,42 +1853,33 @@ handle_fin:
             LOGtcb(tcb, 1, "ACKed %u-bytes\n", seg->length);
 
             /* free the old segment */
-            switch (seg->flags)
-            {
-                case TCP__static:
-                    break;
-                case TCP__adopt:
-                case TCP__copy:
-                    if (seg->buf)
-                    {
-                        free(seg->buf);
-                        seg->buf = NULL;
-                    }
-                    break;
-                default:;
-            }
-            free(seg);
+            _tcb_seg_free(tcpcon, seg);
             if (ackno == tcb->ackno_them)
                 return 1; /* good ACK */
         }
 
-        if (tcb->segments && length < tcb->segments->length)
+        if (*segments && length < (*segments)->length)
         {
-            struct TCP_Segment* seg = tcb->segments;
+            struct TCP_Segment* seg = *segments;
 
             tcb->seqno_me += length + seg->is_fin;
             tcb->ackno_them += length + seg->is_fin;
             LOGtcb(tcb, 1, "ACKed %u-bytes %s\n", length, seg->is_fin ? "FIN" : "");
 
-            /* This segment needs to be reduced */
-            if (seg->flags == TCP__adopt || seg->flags == TCP__copy)
+            /* This segment needs to be reduced. A buffer of our own can
+             * be shifted down, an adopted one gets replaced by our own. */
+            if (seg->flags == TCP__copy)
+            {
+                seg->length -= length;
+                memmove(seg->buf, seg->buf + length, seg->length);
+            }
+            else if (seg->flags == TCP__adopt)
             {
-                size_t new_length = seg->length - length;
-                unsigned char* buf = malloc(new_length);
-                memcpy(buf, seg->buf + length, new_length);
+                unsigned char* buf = slab_alloc(tcpcon->payload_slab);
+                seg->length -= length;
+                memcpy(buf, seg->buf + length, seg->length);
                 free(seg->buf);
                 seg->buf = buf;
-                seg->length -= length;
                 seg->flags = TCP__copy;
             }
             else
@@ -1476,8 +1895,8 @@ handle_fin:
 
 void banner_set_sslhello(struct stack_handle_t* socket, bool is_true)
 {
-    struct TCP_Control_Block* tcb = socket->tcb;
-    tcb->banner1_state.is_sent_sslhello = is_true;
+    struct TCP_Cold_Block* cold = tcb_cold(socket->tcpcon, socket->tcb);
+    cold->banner1_state.is_sent_sslhello = is_true;
 }
 
 void banner_set_small_window(struct stack_handle_t* socket, bool is_true)
@@ -1501,10 +1920,10 @@ size_t banner_parse(struct stack_handle_t* socket, const unsigned char* payload,
                     size_t payload_length)
 {
     struct TCP_ConnectionTable* tcpcon = socket->tcpcon;
-    struct TCP_Control_Block* tcb = socket->tcb;
-    assert(tcb->banout.max_length);
+    struct TCP_Cold_Block* cold = tcb_cold(tcpcon, socket->tcb);
+    assert(cold->banout.max_length);
 
-    banner1_parse(tcpcon->banner1, &tcb->banner1_state, payload, payload_length, &tcb->banout,
+    banner1_parse(tcpcon->banner1, &cold->banner1_state, payload, payload_length, &cold->banout,
                   socket);
     return payload_length;
 }
@@ -1703,9 +2122,11 @@ int tcpapi_close(struct stack_handle_t* socket)
 
 static bool _tcb_they_have_acked_my_fin(struct TCP_Control_Block* tcb)
 {
-    if (tcb->segments && tcb->segments->is_fin && tcb->segments->length == 0)
+    struct TCP_Segment* seg = tcb_segments(tcb);
+
+    if (seg && seg->is_fin && seg->length == 0)
     {
-        if (tcb->ackno_them >= tcb->segments->seqno + 1)
+        if (tcb->ackno_them >= seg->seqno + 1)
             return true;
         return false;
     }
@@ -1891,8 +2312,6 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                 case TCP_WHAT_TIMEOUT:
                     /* We've sent a SYN, but didn't get SYN-ACK, so
                      * send another */
-                    tcb->syns_sent++;
-
                     /* Send a SYN */
                     tcpcon_send_packet(tcpcon, tcb, 0x02 /*SYN*/, 0, 0);
                     break;
@@ -1939,9 +2358,9 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     }
                     break;
                 case TCP_WHAT_ACK:
-                    _tcp_seg_acknowledge(tcb, ackno_them);
+                    _tcp_seg_acknowledge(tcpcon, tcb, ackno_them);
 
-                    if (tcb->segments == NULL || tcb->segments->length == 0)
+                    if (tcb_segments(tcb) == NULL || tcb_segments(tcb)->length == 0)
                     {
                         /* We've finished sending everything, so switch our application state
                          * back to sending */
@@ -1994,7 +2413,7 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     }
                     break;
                 case TCP_WHAT_ACK:
-                    _tcp_seg_acknowledge(tcb, ackno_them);
+                    _tcp_seg_acknowledge(tcpcon, tcb, ackno_them);
                     break;
                 case TCP_WHAT_TIMEOUT:
                     application_notify(tcpcon, tcb, APP_RECV_TIMEOUT, 0, 0, secs, usecs);
@@ -2034,11 +2453,11 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     break;
                 case TCP_WHAT_ACK:
                     /* Apply the ack */
-                    if (_tcp_seg_acknowledge(tcb, ackno_them))
+                    if (_tcp_seg_acknowledge(tcpcon, tcb, ackno_them))
                     {
                         /* Same a in ESTABLISHED_SEND, once they've acknowledged
                          * all reception BEFORE THE FIN, then change the state */
-                        if (tcb->segments == NULL || tcb->segments->length == 0)
+                        if (tcb_segments(tcb) == NULL || tcb_segments(tcb)->length == 0)
                         {
                             /* All the payload has been sent. Notify the application of this, so
                              * that they can send more if the want, or switch to listening. */
@@ -2070,7 +2489,7 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     break;
                 case TCP_WHAT_ACK:
                     /* Apply the ack */
-                    if (_tcp_seg_acknowledge(tcb, ackno_them))
+                    if (_tcp_seg_acknowledge(tcpcon, tcb, ackno_them))
                     {
                         if (_tcb_they_have_acked_my_fin(tcb))
                         {
@@ -2100,7 +2519,7 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     tcpcon_destroy_tcb(tcpcon, tcb, Reason_Timeout);
                     return TCB__destroyed;
                 case TCP_WHAT_ACK:
-                    _tcp_seg_acknowledge(tcb, ackno_them);
+                    _tcp_seg_acknowledge(tcpcon, tcb, ackno_them);
                     if (_tcb_they_have_acked_my_fin(tcb))
                     {
                         tcpcon_destroy_tcb(tcpcon, tcb, Reason_FIN);
@@ -2190,7 +2609,7 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                     _tcb_seg_resend(tcpcon, tcb);
                     break;
                 case TCP_WHAT_ACK:
-                    if (_tcp_seg_acknowledge(tcb, ackno_them))
+                    if (_tcp_seg_acknowledge(tcpcon, tcb, ackno_them))
                     {
                         tcpcon_destroy_tcb(tcpcon, tcb, Reason_Shutdown);
                         return TCB__destroyed;
@@ -2210,3 +2629,112 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
     }
     return TCB__okay;
 }
+
+/***************************************************************************
+ * Create enough TCBs to grow the table several times, keeping only those
+ * that one of four receive threads would own, so they all share the low
+ * bits of their hash. Destroy some along the way, including while the
+ * table is growing, and check that lookups find exactly the rest.
+ ***************************************************************************/
+int tcpcon_selftest(void)
+{
+    struct TCP_ConnectionTable* tcpcon;
+    struct TCP_Control_Block** tcbs;
+    ipaddress ip_me = {0};
+    ipaddress ip_them = {0};
+    static const char hello_set[] = "minecraft:25500-25520,25565";
+    static const char* hello_strings[TCP_HELLO_FRAMES + 1] = {
+        "GET / HTTP/1.0\r\n\r\n", "HELP\r\n", "a", "b", "c", "d", "e", "f", "g",
+    };
+    unsigned count = 100000;
+    unsigned i;
+    int line = 0;
+
+    tcpcon = tcpcon_create_table(count, NULL, NULL, NULL, NULL, 30, 0x1234567890ULL);
+    tcbs = CALLOC(count, sizeof(tcbs[0]));
+    ip_me.version = 4;
+    ip_me.ipv4 = 0xC0000202;
+    ip_them.version = 4;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned port_me = 40000 + (i & 0x3FF);
+
+        ip_them.ipv4 = 0x0A000000 + i;
+        if (tcb_hash(ip_me, port_me, ip_them, 80, tcpcon->entropy) % 4 != 0)
+            continue;
+        tcbs[i] = tcpcon_create_tcb(tcpcon, ip_me, ip_them, port_me, 80, i, ~i, 64, NULL, 0, 0);
+
+        /* Creating it again returns the same one */
+        if (tcpcon_create_tcb(tcpcon, ip_me, ip_them, port_me, 80, i, ~i, 64, NULL, 0, 0) !=
+            tcbs[i])
+        {
+            line = __LINE__;
+            goto fail;
+        }
+
+        /* Destroy every third one we've got so far */
+        if (i % 3 == 0 && i > 0 && tcbs[i / 2])
+        {
+            tcpcon_destroy_tcb(tcpcon, tcbs[i / 2], Reason_Shutdown);
+            tcbs[i / 2] = NULL;
+        }
+    }
+
+    if (tcpcon->table.bits <= TCB_TABLE_BITS_MIN)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned port_me = 40000 + (i & 0x3FF);
+
+        ip_them.ipv4 = 0x0A000000 + i;
+        if (tcpcon_lookup_tcb(tcpcon, ip_me, ip_them, port_me, 80) != tcbs[i])
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        if (tcbs[i] && tcbs[i]->seqno_me != i)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+    }
+
+    /* A wide --hello-set only gets its own few pre-built frames, leaving
+     * the rest for the other hellos, like HTTP's */
+    tcpcon_set_parameter(tcpcon, "hello-set", strlen(hello_set), hello_set);
+    for (i = 25500; i <= 25520; i++)
+    {
+        const struct ProtocolParserStream* stream = tcpcon->banner1->payloads.tcp[i];
+
+        if (stream == NULL || (stream->flags & SF__hello_per_port) == 0)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        tcpcon_hello_register(tcpcon, stream, stream->hello, stream->hello_length);
+    }
+    for (i = 0; i < TCP_HELLO_FRAMES + 1; i++)
+        tcpcon_hello_register(tcpcon, NULL, hello_strings[i], strlen(hello_strings[i]));
+    if (tcpcon->hello_port_frame_count != TCP_HELLO_PORT_FRAMES ||
+        tcpcon->hello_frame_count != TCP_HELLO_FRAMES + TCP_HELLO_PORT_FRAMES ||
+        tcpcon->hello_frames[TCP_HELLO_PORT_FRAMES].payload !=
+            (const unsigned char*) hello_strings[0])
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    free(tcbs);
+    tcpcon_destroy_table(tcpcon);
+    return 0;
+fail:
+    fprintf(stderr, "[-] tcpcon: selftest failed, line=%d\n", line);
+    free(tcbs);
+    tcpcon_destroy_table(tcpcon);
+    return 1;
+}
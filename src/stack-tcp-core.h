@@ -43,16 +43,14 @@ void tcpcon_set_http_header(struct TCP_ConnectionTable* tcpcon, const char* name
 void scripting_init_tcp(struct TCP_ConnectionTable* tcpcon, struct lua_State* L);
 
 /**
- * Create a TCP connection table (to store TCP control blocks) with
- * the desired initial size.
+ * Create a TCP connection table (to store TCP control blocks).
  *
  * @param entry_count
- *      A hint about the desired initial size. This should be about twice
- *      the number of outstanding connections, so you should base this number
- *      on your transmit rate (the faster the transmit rate, the more
- *      outstanding connections you'll have). This function will automatically
- *      round this number up to the nearest power of 2, or round it down
- *      if it causes malloc() to not be able to allocate enough memory.
+ *      A hint about the number of outstanding connections, so you should
+ *      base this number on your transmit rate (the faster the transmit
+ *      rate, the more outstanding connections you'll have). It's used to
+ *      size the timeouts. The table itself starts small and grows as
+ *      needed, so this isn't a limit.
  * @param entropy
  *      Seed for syn-cookie randomization
  */
@@ -102,6 +100,14 @@ enum TCB_result stack_incoming_tcp(struct TCP_ConnectionTable* tcpcon,
                                    unsigned secs, unsigned usecs, unsigned seqno_them,
                                    unsigned ackno_them);
 
+/**
+ * The hash of a connection used to index the TCB table. It's symmetric,
+ * so packets in either direction get the same hash. With --rx-threads,
+ * this is also used to pick which worker owns a connection.
+ */
+unsigned tcb_hash(ipaddress ip_me, unsigned port_me, ipaddress ip_them, unsigned port_them,
+                  uint64_t entropy);
+
 /**
  * Lookup a connection record based on IP/ports.
  */
@@ -131,4 +137,6 @@ void tcp_send_RST(struct TemplatePacket* templ, struct stack_t* stack, ipaddress
                   ipaddress ip_me, unsigned port_them, unsigned port_me, unsigned seqno_them,
                   unsigned seqno_me);
 
+int tcpcon_selftest(void);
+
 #endif
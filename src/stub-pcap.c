@@ -290,6 +290,15 @@ static const char* null_PCAP_GETERR(pcap_t* p)
     UNUSEDPARM(p);
     return "(unknown)";
 }
+static int null_PCAP_STATS(pcap_t* p, struct pcap_stat* ps)
+{
+#ifdef STATICPCAP
+    return pcap_stats(p, ps);
+#endif
+    UNUSEDPARM(p);
+    UNUSEDPARM(ps);
+    return -1;
+}
 static const char* null_PCAP_DEV_NAME(const pcap_if_t* dev)
 {
     return dev->name;
@@ -444,6 +453,7 @@ int pcap_init(void)
     DOLINK(PCAP_DATALINK_VAL_TO_NAME, datalink_val_to_name);
     DOLINK(PCAP_PERROR, perror);
     DOLINK(PCAP_GETERR, geterr);
+    DOLINK(PCAP_STATS, stats);
 
     /* pseudo functions that don't exist in the libpcap interface */
     pl->dev_name = null_PCAP_DEV_NAME;
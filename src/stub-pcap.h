@@ -136,6 +136,14 @@ typedef int (*PCAP_SET_RFMON)(pcap_t* p, int rfmon);
 typedef int (*PCAP_CAN_SET_RFMON)(pcap_t* p);
 typedef int (*PCAP_ACTIVATE)(pcap_t* p);
 
+struct pcap_stat
+{
+    unsigned ps_recv;   /* packets received */
+    unsigned ps_drop;   /* packets dropped because the buffer was full */
+    unsigned ps_ifdrop; /* packets dropped by the interface */
+};
+typedef int (*PCAP_STATS)(pcap_t* p, struct pcap_stat* ps);
+
 /*
  * PORTABILITY: Windows supports the "sendq" feature, and is really slow
  * without this feature. It's not needed on Linux, so we just create
@@ -176,6 +184,7 @@ struct PcapFunctions
     PCAP_DATALINK_VAL_TO_NAME datalink_val_to_name;
     PCAP_PERROR perror;
     PCAP_GETERR geterr;
+    PCAP_STATS stats;
 
     /* Accessor functions for opaque data structure, don't really
      * exist in libpcap */
@@ -596,6 +596,203 @@ size_t tcp_create_packet(struct TemplatePacket* tmpl, ipaddress ip_them, unsigne
     }
 }
 
+/***************************************************************************
+ ***************************************************************************/
+struct TemplateHello
+{
+    unsigned version;
+    unsigned offset_ip;
+    unsigned offset_tcp;
+    unsigned offset_app;
+
+    /** From the template, for patching the IPv4 header checksum the same
+     * way 'tcp_create_packet()' does */
+    unsigned checksum_ip;
+    unsigned old_len;
+
+    /** The sum of the payload as big-endian 16-bit words, unfolded */
+    uint64_t payload_sum;
+    size_t payload_length;
+
+    /** The headers followed by the payload, padded to the minimum frame */
+    size_t length;
+    unsigned char* packet;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct TemplateHello* tcp_hello_create(const struct TemplatePacket* tmpl, unsigned ip_version,
+                                       const unsigned char* payload, size_t payload_length)
+{
+    struct TemplateHello* hello;
+    const unsigned char* templ_px;
+    size_t frame_length;
+    size_t i;
+
+    hello = CALLOC(1, sizeof(*hello));
+    hello->version = ip_version;
+    hello->payload_length = payload_length;
+
+    if (ip_version == 4)
+    {
+        size_t ip_len;
+
+        templ_px = tmpl->ipv4.packet;
+        hello->offset_ip = tmpl->ipv4.offset_ip;
+        hello->offset_tcp = tmpl->ipv4.offset_tcp;
+        hello->offset_app = hello->offset_tcp + ((templ_px[hello->offset_tcp + 12] & 0xF0) >> 2);
+        hello->checksum_ip = tmpl->ipv4.checksum_ip;
+        hello->old_len = templ_px[hello->offset_ip + 2] << 8 | templ_px[hello->offset_ip + 3];
+
+        frame_length = hello->offset_app + payload_length;
+        hello->length = frame_length < 60 ? 60 : frame_length;
+        hello->packet = CALLOC(1, hello->length);
+        memcpy(hello->packet, templ_px, hello->offset_app);
+
+        ip_len = (hello->offset_app - hello->offset_ip) + payload_length;
+        hello->packet[hello->offset_ip + 2] = (unsigned char) (ip_len >> 8);
+        hello->packet[hello->offset_ip + 3] = (unsigned char) (ip_len & 0xFF);
+    }
+    else
+    {
+        size_t len;
+
+        templ_px = tmpl->ipv6.packet;
+        hello->offset_ip = tmpl->ipv6.offset_ip;
+        hello->offset_tcp = tmpl->ipv6.offset_tcp;
+        hello->offset_app = tmpl->ipv6.offset_app;
+
+        hello->length = hello->offset_app + payload_length;
+        hello->packet = CALLOC(1, hello->length);
+        memcpy(hello->packet, templ_px, hello->offset_app);
+
+        len = hello->offset_app + payload_length - hello->offset_ip - 40;
+        hello->packet[hello->offset_ip + 4] = (unsigned char) (len >> 8) & 0xFF;
+        hello->packet[hello->offset_ip + 5] = (unsigned char) (len >> 0) & 0xFF;
+    }
+
+    memcpy(hello->packet + hello->offset_app, payload, payload_length);
+
+    /* The payload starts on a 4-byte boundary within the TCP header, so
+     * its words line up with the checksum's */
+    for (i = 0; i + 1 < payload_length; i += 2)
+        hello->payload_sum += payload[i] << 8 | payload[i + 1];
+    if (payload_length & 1)
+        hello->payload_sum += payload[payload_length - 1] << 8;
+
+    return hello;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void tcp_hello_destroy(struct TemplateHello* hello)
+{
+    if (hello == NULL)
+        return;
+    free(hello->packet);
+    free(hello);
+}
+
+/***************************************************************************
+ * Same as 'tcp_create_packet()', except that the payload is already in
+ * place, and the checksum only needs to cover the headers.
+ ***************************************************************************/
+size_t tcp_hello_packet(const struct TemplateHello* hello, ipaddress ip_them, unsigned port_them,
+                        ipaddress ip_me, unsigned port_me, unsigned seqno, unsigned ackno,
+                        unsigned flags, unsigned char* px, size_t px_length)
+{
+    unsigned offset_ip = hello->offset_ip;
+    unsigned offset_tcp = hello->offset_tcp;
+    unsigned offset_app = hello->offset_app;
+    size_t tcp_length = (offset_app - offset_tcp) + hello->payload_length;
+    uint64_t xsum;
+    unsigned i;
+
+    if (hello->length > px_length || ip_them.version != hello->version)
+        return 0;
+    memcpy(px, hello->packet, hello->length);
+
+    if (hello->version == 4)
+    {
+        unsigned ip_id = ip_them.ipv4 ^ port_them ^ seqno;
+        size_t ip_len = (offset_app - offset_ip) + hello->payload_length;
+
+        px[offset_ip + 4] = (unsigned char) (ip_id >> 8);
+        px[offset_ip + 5] = (unsigned char) (ip_id & 0xFF);
+        px[offset_ip + 12] = (unsigned char) ((ip_me.ipv4 >> 24) & 0xFF);
+        px[offset_ip + 13] = (unsigned char) ((ip_me.ipv4 >> 16) & 0xFF);
+        px[offset_ip + 14] = (unsigned char) ((ip_me.ipv4 >> 8) & 0xFF);
+        px[offset_ip + 15] = (unsigned char) ((ip_me.ipv4 >> 0) & 0xFF);
+        px[offset_ip + 16] = (unsigned char) ((ip_them.ipv4 >> 24) & 0xFF);
+        px[offset_ip + 17] = (unsigned char) ((ip_them.ipv4 >> 16) & 0xFF);
+        px[offset_ip + 18] = (unsigned char) ((ip_them.ipv4 >> 8) & 0xFF);
+        px[offset_ip + 19] = (unsigned char) ((ip_them.ipv4 >> 0) & 0xFF);
+
+        xsum = hello->checksum_ip;
+        xsum += (ip_id & 0xFFFF);
+        xsum += ip_me.ipv4;
+        xsum += ip_them.ipv4;
+        xsum += ip_len - hello->old_len;
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = ~xsum;
+
+        px[offset_ip + 10] = (unsigned char) (xsum >> 8);
+        px[offset_ip + 11] = (unsigned char) (xsum & 0xFF);
+    }
+    else
+    {
+        for (i = 0; i < 8; i++)
+        {
+            px[offset_ip + 8 + i] = (unsigned char) (ip_me.ipv6.hi >> (56 - 8 * i));
+            px[offset_ip + 16 + i] = (unsigned char) (ip_me.ipv6.lo >> (56 - 8 * i));
+            px[offset_ip + 24 + i] = (unsigned char) (ip_them.ipv6.hi >> (56 - 8 * i));
+            px[offset_ip + 32 + i] = (unsigned char) (ip_them.ipv6.lo >> (56 - 8 * i));
+        }
+    }
+
+    px[offset_tcp + 0] = (unsigned char) (port_me >> 8);
+    px[offset_tcp + 1] = (unsigned char) (port_me & 0xFF);
+    px[offset_tcp + 2] = (unsigned char) (port_them >> 8);
+    px[offset_tcp + 3] = (unsigned char) (port_them & 0xFF);
+    px[offset_tcp + 4] = (unsigned char) (seqno >> 24);
+    px[offset_tcp + 5] = (unsigned char) (seqno >> 16);
+    px[offset_tcp + 6] = (unsigned char) (seqno >> 8);
+    px[offset_tcp + 7] = (unsigned char) (seqno >> 0);
+    px[offset_tcp + 8] = (unsigned char) (ackno >> 24);
+    px[offset_tcp + 9] = (unsigned char) (ackno >> 16);
+    px[offset_tcp + 10] = (unsigned char) (ackno >> 8);
+    px[offset_tcp + 11] = (unsigned char) (ackno >> 0);
+    px[offset_tcp + 13] = (unsigned char) flags;
+    px[offset_tcp + 14] = (unsigned char) (1200 >> 8);
+    px[offset_tcp + 15] = (unsigned char) (1200 & 0xFF);
+    px[offset_tcp + 16] = 0;
+    px[offset_tcp + 17] = 0;
+
+    /* Pseudo-header, then the TCP header, then the payload we summed
+     * up front */
+    xsum = 6 + tcp_length;
+    if (hello->version == 4)
+    {
+        for (i = 12; i < 20; i += 2) xsum += px[offset_ip + i] << 8 | px[offset_ip + i + 1];
+    }
+    else
+    {
+        for (i = 8; i < 40; i += 2) xsum += px[offset_ip + i] << 8 | px[offset_ip + i + 1];
+    }
+    for (i = offset_tcp; i < offset_app; i += 2) xsum += px[i] << 8 | px[i + 1];
+    xsum += hello->payload_sum;
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = ~xsum;
+
+    px[offset_tcp + 16] = (unsigned char) (xsum >> 8);
+    px[offset_tcp + 17] = (unsigned char) (xsum >> 0);
+
+    return hello->length;
+}
+
 /***************************************************************************
  ***************************************************************************/
 static void udp_payload_fixup(struct TemplatePacket* tmpl, unsigned port, unsigned seqno)
@@ -1078,6 +1275,95 @@ void template_set_target_ipv4(struct TemplateSet* tmplset, ipv4address ip_them,
     }
 }
 
+/***************************************************************************
+ * Format a batch of probes. The common case, a TCP SYN, is done here with
+ * the template lookup and everything that doesn't vary per-packet hoisted
+ * out of the loop: the IP header checksum is computed incrementally from
+ * the template's partial checksum instead of being summed over the header
+ * again. Everything else falls back to template_set_target_ipv4(). Either
+ * way, the packets are identical.
+ ***************************************************************************/
+void template_set_target_ipv4_batch(struct TemplateSet* tmplset,
+                                    const struct TemplateTargetIPv4* targets, size_t count,
+                                    unsigned char* const* px, size_t sizeof_px, size_t* r_length)
+{
+    const struct TemplatePacket* tmpl = &tmplset->pkts[Proto_TCP];
+    const unsigned char* packet = tmpl->ipv4.packet;
+    unsigned length = tmpl->ipv4.length;
+    unsigned offset_ip = tmpl->ipv4.offset_ip;
+    unsigned offset_tcp = tmpl->ipv4.offset_tcp;
+    unsigned total_length = length - offset_ip;
+    uint64_t checksum_ip;
+    uint64_t checksum_tcp = tmpl->ipv4.checksum_tcp;
+    size_t n;
+
+    /* The template's partial IP checksum includes whatever is in its
+     * total-length field, so adjust for the length we'll write */
+    checksum_ip = (uint64_t) tmpl->ipv4.checksum_ip + total_length +
+                  (0xFFFF ^ (packet[offset_ip + 2] << 8 | packet[offset_ip + 3]));
+
+    for (n = 0; n < count; n++)
+    {
+        const struct TemplateTargetIPv4* t = &targets[n];
+        unsigned char* p = px[n];
+        unsigned ip_id;
+        uint64_t xsum;
+
+        if (t->port_them > Templ_TCP_last || tmpl->proto != Proto_TCP ||
+            sizeof_px < length)
+        {
+            template_set_target_ipv4(tmplset, t->ip_them, t->port_them, t->ip_me, t->port_me,
+                                     t->seqno, p, sizeof_px, &r_length[n]);
+            continue;
+        }
+
+        memcpy(p, packet, length);
+        r_length[n] = length;
+        ip_id = (t->ip_them ^ t->port_them ^ t->seqno) & 0xFFFF;
+
+        /* IP header */
+        p[offset_ip + 2] = (unsigned char) (total_length >> 8);
+        p[offset_ip + 3] = (unsigned char) (total_length >> 0);
+        p[offset_ip + 4] = (unsigned char) (ip_id >> 8);
+        p[offset_ip + 5] = (unsigned char) (ip_id >> 0);
+        p[offset_ip + 12] = (unsigned char) (t->ip_me >> 24);
+        p[offset_ip + 13] = (unsigned char) (t->ip_me >> 16);
+        p[offset_ip + 14] = (unsigned char) (t->ip_me >> 8);
+        p[offset_ip + 15] = (unsigned char) (t->ip_me >> 0);
+        p[offset_ip + 16] = (unsigned char) (t->ip_them >> 24);
+        p[offset_ip + 17] = (unsigned char) (t->ip_them >> 16);
+        p[offset_ip + 18] = (unsigned char) (t->ip_them >> 8);
+        p[offset_ip + 19] = (unsigned char) (t->ip_them >> 0);
+
+        xsum = checksum_ip + ip_id + (uint64_t) t->ip_me + (uint64_t) t->ip_them;
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = ~xsum;
+        p[offset_ip + 10] = (unsigned char) (xsum >> 8);
+        p[offset_ip + 11] = (unsigned char) (xsum >> 0);
+
+        /* TCP header */
+        p[offset_tcp + 0] = (unsigned char) (t->port_me >> 8);
+        p[offset_tcp + 1] = (unsigned char) (t->port_me >> 0);
+        p[offset_tcp + 2] = (unsigned char) (t->port_them >> 8);
+        p[offset_tcp + 3] = (unsigned char) (t->port_them >> 0);
+        p[offset_tcp + 4] = (unsigned char) (t->seqno >> 24);
+        p[offset_tcp + 5] = (unsigned char) (t->seqno >> 16);
+        p[offset_tcp + 6] = (unsigned char) (t->seqno >> 8);
+        p[offset_tcp + 7] = (unsigned char) (t->seqno >> 0);
+
+        xsum = checksum_tcp + (uint64_t) t->ip_me + (uint64_t) t->ip_them +
+               (uint64_t) t->port_me + (uint64_t) t->port_them + (uint64_t) t->seqno;
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = (xsum >> 16) + (xsum & 0xFFFF);
+        xsum = ~xsum;
+        p[offset_tcp + 16] = (unsigned char) (xsum >> 8);
+        p[offset_tcp + 17] = (unsigned char) (xsum >> 0);
+    }
+}
+
 #if defined(WIN32) || defined(_WIN32)
 #define AF_INET6 23
 #else
@@ -1466,6 +1752,203 @@ void template_set_vlan(struct TemplateSet* tmplset, unsigned vlan)
     }
 }
 
+/***************************************************************************
+ * Pick a probe for testing/benchmarking. Every 16th one isn't TCP, to
+ * exercise the fallback path of the batch formatter.
+ ***************************************************************************/
+static void template_test_target(struct TemplateTargetIPv4* t, unsigned i, unsigned with_other)
+{
+    t->ip_them = 0x0A000000 + i * 0x9E37;
+    t->port_them = 1 + (i * 7919) % 65535;
+    t->ip_me = 0xC0000202 + (i & 0x3);
+    t->port_me = 40000 + (i & 0xFF);
+    t->seqno = (unsigned) syn_cookie_ipv4(t->ip_them, t->port_them, t->ip_me, t->port_me, i);
+
+    if (with_other && (i & 0xF) == 0xF)
+    {
+        if (i & 0x10)
+            t->port_them = Templ_UDP + 53;
+        else
+            t->port_them = Templ_ICMP_echo;
+    }
+}
+
+/***************************************************************************
+ * The batch formatter must produce the same packets, byte for byte, as
+ * formatting each probe on its own.
+ ***************************************************************************/
+static int template_batch_selftest(struct TemplateSet* tmplset)
+{
+    struct TemplateTargetIPv4 targets[64];
+    unsigned char buf[64][256];
+    unsigned char* px[64];
+    size_t lengths[64];
+    unsigned pass;
+    unsigned i;
+
+    for (i = 0; i < 64; i++)
+        px[i] = buf[i];
+
+    for (pass = 0; pass < 16; pass++)
+    {
+        for (i = 0; i < 64; i++)
+            template_test_target(&targets[i], pass * 64 + i, 1);
+
+        template_set_target_ipv4_batch(tmplset, targets, 64, px, sizeof(buf[0]), lengths);
+
+        for (i = 0; i < 64; i++)
+        {
+            const struct TemplateTargetIPv4* t = &targets[i];
+            unsigned char expected[256];
+            size_t expected_length;
+
+            template_set_target_ipv4(tmplset, t->ip_them, t->port_them, t->ip_me, t->port_me,
+                                     t->seqno, expected, sizeof(expected), &expected_length);
+            if (lengths[i] != expected_length ||
+                memcmp(px[i], expected, expected_length) != 0)
+            {
+                fprintf(stderr, "[-] template: batch probe %u differs\n", pass * 64 + i);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Pre-built hello packets must be the same, byte for byte, as formatting
+ * the payload from scratch, for both IPv4 and IPv6, and for odd lengths.
+ ***************************************************************************/
+static int template_hello_selftest(struct TemplateSet* tmplset)
+{
+    struct TemplatePacket* tmpl = &tmplset->pkts[Proto_TCP];
+    unsigned char payload[1400];
+    unsigned char px[2048];
+    unsigned char expected[2048];
+    static const size_t lengths[] = {0, 1, 2, 5, 18, 517, 1400};
+    unsigned i;
+    unsigned j;
+
+    for (i = 0; i < sizeof(payload); i++)
+        payload[i] = (unsigned char) (i * 7 + 3);
+
+    for (i = 0; i < 2 * sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        unsigned version = (i & 1) ? 6 : 4;
+        size_t payload_length = lengths[i / 2];
+        struct TemplateHello* hello;
+
+        hello = tcp_hello_create(tmpl, version, payload, payload_length);
+
+        for (j = 0; j < 64; j++)
+        {
+            struct TemplateTargetIPv4 t;
+            ipaddress ip_them = {0};
+            ipaddress ip_me = {0};
+            size_t length;
+            size_t expected_length;
+
+            template_test_target(&t, i * 64 + j, 0);
+            ip_them.version = ip_me.version = (unsigned char) version;
+            if (version == 4)
+            {
+                ip_them.ipv4 = t.ip_them;
+                ip_me.ipv4 = t.ip_me;
+            }
+            else
+            {
+                ip_them.ipv6.hi = 0x20010db800000000ULL | t.ip_them;
+                ip_them.ipv6.lo = (uint64_t) t.seqno << 32 | t.ip_them;
+                ip_me.ipv6.hi = 0x20010db8ffff0000ULL;
+                ip_me.ipv6.lo = t.ip_me;
+            }
+
+            length = tcp_hello_packet(hello, ip_them, t.port_them, ip_me, t.port_me, t.seqno,
+                                      ~t.seqno, 0x18 | (j & 1), px, sizeof(px));
+            expected_length =
+                tcp_create_packet(tmpl, ip_them, t.port_them, ip_me, t.port_me, t.seqno,
+                                  ~t.seqno, 0x18 | (j & 1), payload, payload_length, expected,
+                                  sizeof(expected));
+            if (length != expected_length || memcmp(px, expected, length) != 0)
+            {
+                fprintf(stderr, "[-] template: hello IPv%u %u-bytes differs\n", version,
+                        (unsigned) payload_length);
+                tcp_hello_destroy(hello);
+                return 1;
+            }
+        }
+        tcp_hello_destroy(hello);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Measure how fast we can format probes, without sending them, both one
+ * at a time and in batches. The targets and their SYN-cookies are picked
+ * beforehand, so that this measures just the packet formatting.
+ ***************************************************************************/
+void template_benchmark(void)
+{
+    struct TemplateSet tmplset[1];
+    struct TemplateOptions templ_opts = {{0}};
+    struct TemplateTargetIPv4* targets;
+    unsigned char buf[64][128];
+    unsigned char* px[64];
+    size_t lengths[64];
+    uint64_t start, stop;
+    uint64_t result = 0;
+    unsigned i, j;
+    static const unsigned TARGET_COUNT = 4096;
+    static const unsigned ITERATIONS = 20000000;
+
+    printf("-- probe templates --\n");
+
+    memset(tmplset, 0, sizeof(tmplset[0]));
+    template_packet_init(tmplset, macaddress_from_bytes("\x00\x11\x22\x33\x44\x55"),
+                         macaddress_from_bytes("\x66\x55\x44\x33\x22\x11"),
+                         macaddress_from_bytes("\x66\x55\x44\x33\x22\x11"), 0, 0, 1, 0,
+                         &templ_opts);
+    targets = CALLOC(TARGET_COUNT, sizeof(targets[0]));
+    for (i = 0; i < TARGET_COUNT; i++)
+        template_test_target(&targets[i], i, 0);
+    for (i = 0; i < 64; i++)
+        px[i] = buf[i];
+
+    start = pixie_nanotime();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        const struct TemplateTargetIPv4* t = &targets[i % TARGET_COUNT];
+
+        template_set_target_ipv4(tmplset, t->ip_them, t->port_them, t->ip_me, t->port_me,
+                                 t->seqno, buf[i % 64], sizeof(buf[0]), &lengths[i % 64]);
+        result += buf[i % 64][24];
+    }
+    stop = pixie_nanotime();
+    if (result)
+    {
+        double elapsed = ((double) (stop - start)) / (1000000000.0);
+        printf("single: probes/second = %5.3f-million\n", ITERATIONS / elapsed / 1000000.0);
+    }
+
+    result = 0;
+    start = pixie_nanotime();
+    for (i = 0; i < ITERATIONS; i += 64)
+    {
+        j = i % TARGET_COUNT;
+        template_set_target_ipv4_batch(tmplset, &targets[j], 64, px, sizeof(buf[0]), lengths);
+        result += buf[0][24];
+    }
+    stop = pixie_nanotime();
+    if (result)
+    {
+        double elapsed = ((double) (stop - start)) / (1000000000.0);
+        printf("batch:  probes/second = %5.3f-million\n", i / elapsed / 1000000.0);
+    }
+
+    free(targets);
+    printf("\n");
+}
+
 /***************************************************************************
  ***************************************************************************/
 int template_selftest(void)
@@ -1498,6 +1981,9 @@ int template_selftest(void)
     // Proto_ICMP_timestamp; failures += tmplset->pkts[Proto_ARP].proto  !=
     // Proto_ARP;
 
+    failures += template_batch_selftest(tmplset);
+    failures += template_hello_selftest(tmplset);
+
     if (failures)
         fprintf(stderr, "template: failed\n");
     return failures;
@@ -16,6 +16,11 @@ struct TemplateOptions;
  */
 int template_selftest(void);
 
+/**
+ * Report how many probes per second we can format, with no I/O.
+ */
+void template_benchmark(void);
+
 enum TemplateProtocol
 {
     Proto_TCP,
@@ -151,6 +156,31 @@ void template_set_target_ipv4(struct TemplateSet* templset, ipv4address ip_them,
                               ipv4address ip_me, unsigned port_me, unsigned seqno,
                               unsigned char* px, size_t sizeof_px, size_t* r_length);
 
+/**
+ * One probe in a batch passed to template_set_target_ipv4_batch(). The
+ * fields are the same as the parameters of template_set_target_ipv4().
+ */
+struct TemplateTargetIPv4
+{
+    ipv4address ip_them;
+    unsigned port_them;
+    ipv4address ip_me;
+    unsigned port_me;
+    unsigned seqno;
+};
+
+/**
+ * Format a batch of probes, producing exactly the same packets as calling
+ * template_set_target_ipv4() on each one, but faster for TCP SYNs.
+ * @param px
+ *      an array of "count" buffers, each at least "sizeof_px" bytes
+ * @param r_length
+ *      an array of "count" lengths, returning each packet's size
+ */
+void template_set_target_ipv4_batch(struct TemplateSet* tmplset,
+                                    const struct TemplateTargetIPv4* targets, size_t count,
+                                    unsigned char* const* px, size_t sizeof_px, size_t* r_length);
+
 void template_set_target_ipv6(struct TemplateSet* templset, ipv6address ip_them, unsigned port_them,
                               ipv6address ip_me, unsigned port_me, unsigned seqno,
                               unsigned char* px, size_t sizeof_px, size_t* r_length);
@@ -164,6 +194,28 @@ size_t tcp_create_packet(struct TemplatePacket* pkt, ipaddress ip_them, unsigned
                          unsigned flags, const unsigned char* payload, size_t payload_length,
                          unsigned char* px, size_t px_length);
 
+/**
+ * A TCP packet with a fixed payload, such as a protocol's hello, already
+ * copied in after the template's headers, with the payload's share of
+ * the checksum worked out. Creating a packet from this only patches the
+ * addresses, ports, sequence numbers, and checksums, and gives the same
+ * result as 'tcp_create_packet()' with the same payload.
+ */
+struct TemplateHello;
+
+/**
+ * Pre-build the packet for this payload, for either IPv4 or IPv6. The
+ * payload is copied, so it needn't outlive this.
+ */
+struct TemplateHello* tcp_hello_create(const struct TemplatePacket* pkt, unsigned ip_version,
+                                       const unsigned char* payload, size_t payload_length);
+
+void tcp_hello_destroy(struct TemplateHello* hello);
+
+size_t tcp_hello_packet(const struct TemplateHello* hello, ipaddress ip_them, unsigned port_them,
+                        ipaddress ip_me, unsigned port_me, unsigned seqno, unsigned ackno,
+                        unsigned flags, unsigned char* px, size_t px_length);
+
 /**
  * Set's the TCP "window" field. The purpose is to cause the recipient
  * to fragment data on the response, thus evading IDS that triggers on
@@ -0,0 +1,723 @@
+#include "util-json.h"
+#include "pixie-timer.h"
+#include "util-malloc.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Only for comparison in the benchmark */
+#define JSMN_STATIC
+#include "jsmn.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+struct JsonIndex
+{
+    const char* json;
+    size_t length;
+
+    /** Where every structural character, quote, and scalar starts */
+    uint32_t* tokens;
+    size_t count;
+    size_t max;
+};
+
+/**
+ * One bit for each of 64 bytes of JSON, for each kind of character we
+ * care about.
+ */
+struct JsonBlock
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op; /* { } [ ] : , */
+    uint64_t space;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void json_classify_scalar(const unsigned char* px, struct JsonBlock* block)
+{
+    unsigned i;
+
+    memset(block, 0, sizeof(*block));
+    for (i = 0; i < 64; i++)
+    {
+        uint64_t bit = 1ULL << i;
+
+        switch (px[i])
+        {
+            case '"':
+                block->quote |= bit;
+                break;
+            case '\\':
+                block->backslash |= bit;
+                break;
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ':':
+            case ',':
+                block->op |= bit;
+                break;
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+                block->space |= bit;
+                break;
+        }
+    }
+}
+
+/***************************************************************************
+ * The same, a vector at a time. Setting the 0x20 bit turns '[' and ']'
+ * into '{' and '}', so the six operators take four compares.
+ ***************************************************************************/
+#if defined(__AVX2__)
+#include <immintrin.h>
+static void json_classify(const unsigned char* px, struct JsonBlock* block)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i brace_open = _mm256_set1_epi8('{');
+    const __m256i brace_close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    unsigned i;
+
+    memset(block, 0, sizeof(*block));
+    for (i = 0; i < 64; i += 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i*) (px + i));
+        __m256i lower = _mm256_or_si256(c, case_bit);
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(lower, brace_open),
+                            _mm256_cmpeq_epi8(lower, brace_close)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, colon), _mm256_cmpeq_epi8(c, comma)));
+        __m256i space = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r'))));
+
+        block->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, quote))
+                        << i;
+        block->backslash |=
+            (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, backslash)) << i;
+        block->op |= (uint64_t) (uint32_t) _mm256_movemask_epi8(op) << i;
+        block->space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+    }
+}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+static void json_classify(const unsigned char* px, struct JsonBlock* block)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i brace_open = _mm_set1_epi8('{');
+    const __m128i brace_close = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    unsigned i;
+
+    memset(block, 0, sizeof(*block));
+    for (i = 0; i < 64; i += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*) (px + i));
+        __m128i lower = _mm_or_si128(c, case_bit);
+        __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lower, brace_open), _mm_cmpeq_epi8(lower, brace_close)),
+            _mm_or_si128(_mm_cmpeq_epi8(c, colon), _mm_cmpeq_epi8(c, comma)));
+        __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')),
+                                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('\r'))));
+
+        block->quote |= (uint64_t) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(c, quote)) << i;
+        block->backslash |= (uint64_t) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(c, backslash))
+                            << i;
+        block->op |= (uint64_t) (unsigned) _mm_movemask_epi8(op) << i;
+        block->space |= (uint64_t) (unsigned) _mm_movemask_epi8(space) << i;
+    }
+}
+#else
+#define json_classify json_classify_scalar
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+static inline unsigned json_ctz(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (unsigned) i;
+#elif defined(__GNUC__)
+    return (unsigned) __builtin_ctzll(x);
+#else
+    unsigned i;
+    for (i = 0; (x & 1) == 0; i++) x >>= 1;
+    return i;
+#endif
+}
+
+/***************************************************************************
+ * Which characters are escaped by a backslash that isn't itself escaped.
+ * 'carry' is whether the last block ended with such a backslash. There are
+ * rarely more than a few backslashes, so we go through them one at a time.
+ ***************************************************************************/
+static uint64_t json_escaped(uint64_t backslash, uint64_t* carry)
+{
+    uint64_t escaped = *carry;
+
+    backslash &= ~escaped;
+    *carry = 0;
+    while (backslash)
+    {
+        uint64_t bit = backslash & (0 - backslash);
+
+        if (bit == 1ULL << 63)
+            *carry = 1;
+        escaped |= bit << 1;
+        backslash &= ~(bit | bit << 1);
+    }
+    return escaped;
+}
+
+/***************************************************************************
+ * Each bit becomes the XOR of itself and all the bits below it, so that
+ * between an opening quote and a closing quote, the bits are set.
+ ***************************************************************************/
+static uint64_t json_prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct JsonIndex* json_index_create(const char* json, size_t length)
+{
+    struct JsonIndex* index;
+    uint64_t escape_carry = 0;
+    uint64_t string_carry = 0; /* all ones if the last block ended in a string */
+    uint64_t scalar_carry = 0;
+    size_t offset;
+
+    if (length > UINT32_MAX)
+        return NULL;
+
+    index = CALLOC(1, sizeof(*index));
+    index->json = json;
+    index->length = length;
+    index->max = length / 8 + 64;
+    index->tokens = REALLOCARRAY(NULL, index->max, sizeof(index->tokens[0]));
+
+    for (offset = 0; offset < length; offset += 64)
+    {
+        const unsigned char* px = (const unsigned char*) json + offset;
+        unsigned char tail[64];
+        struct JsonBlock block;
+        uint64_t quote;
+        uint64_t in_string;
+        uint64_t scalar;
+        uint64_t bits;
+
+        /* The last block is padded with spaces, which aren't tokens */
+        if (length - offset < 64)
+        {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, px, length - offset);
+            px = tail;
+        }
+        json_classify(px, &block);
+
+        quote = block.quote & ~json_escaped(block.backslash, &escape_carry);
+        in_string = json_prefix_xor(quote) ^ string_carry;
+        string_carry = 0 - (in_string >> 63);
+
+        /* Scalars are anything else outside strings, and only the first
+         * character of each is a token */
+        scalar = ~(block.op | block.space | quote | in_string);
+        bits = (block.op & ~in_string) | quote | (scalar & ~(scalar << 1 | scalar_carry));
+        scalar_carry = scalar >> 63;
+
+        if (index->count + 64 > index->max)
+        {
+            index->max *= 2;
+            index->tokens = REALLOCARRAY(index->tokens, index->max, sizeof(index->tokens[0]));
+        }
+        while (bits)
+        {
+            index->tokens[index->count++] = (uint32_t) (offset + json_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    if (string_carry)
+    {
+        json_index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void json_index_destroy(struct JsonIndex* index)
+{
+    if (index == NULL)
+        return;
+    free(index->tokens);
+    free(index);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+char json_peek(const struct JsonIndex* index, size_t value)
+{
+    if (value >= index->count)
+        return 0;
+    return index->json[index->tokens[value]];
+}
+
+/***************************************************************************
+ * Find the token after a value, without looking at what's in it. Every
+ * opening quote is followed by its closing quote, since nothing in a
+ * string is a token.
+ ***************************************************************************/
+static size_t json_skip(const struct JsonIndex* index, size_t value)
+{
+    size_t depth = 0;
+    size_t i;
+
+    for (i = value; i < index->count; i++)
+    {
+        switch (index->json[index->tokens[i]])
+        {
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0)
+                    return JSON_NONE;
+                depth--;
+                break;
+            case '"':
+                i++;
+                break;
+        }
+        if (depth == 0)
+            return i + 1;
+    }
+    return JSON_NONE;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+size_t json_object_get(const struct JsonIndex* index, size_t object, const char* key)
+{
+    size_t key_length = strlen(key);
+    size_t i;
+
+    if (json_peek(index, object) != '{')
+        return JSON_NONE;
+
+    for (i = object + 1; json_peek(index, i) == '"'; i++)
+    {
+        const char* s;
+        size_t length;
+
+        if (!json_string(index, i, &s, &length) || json_peek(index, i + 2) != ':')
+            return JSON_NONE;
+        if (length == key_length && memcmp(s, key, length) == 0)
+            return i + 3 < index->count ? i + 3 : JSON_NONE;
+
+        i = json_skip(index, i + 3);
+        if (json_peek(index, i) != ',')
+            return JSON_NONE;
+    }
+    return JSON_NONE;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+size_t json_array_get(const struct JsonIndex* index, size_t array, size_t n)
+{
+    size_t i;
+
+    if (json_peek(index, array) != '[')
+        return JSON_NONE;
+
+    for (i = array + 1; n; n--)
+    {
+        i = json_skip(index, i);
+        if (json_peek(index, i) != ',')
+            return JSON_NONE;
+        i++;
+    }
+
+    switch (json_peek(index, i))
+    {
+        case 0:
+        case ']':
+        case '}':
+        case ',':
+        case ':':
+            return JSON_NONE;
+        default:
+            return i;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+bool json_string(const struct JsonIndex* index, size_t value, const char** s, size_t* length)
+{
+    if (json_peek(index, value) != '"' || value + 1 >= index->count)
+        return false;
+    *s = index->json + index->tokens[value] + 1;
+    *length = index->tokens[value + 1] - index->tokens[value] - 1;
+    return true;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+bool json_int(const struct JsonIndex* index, size_t value, int* result)
+{
+    const char* p;
+    const char* end;
+    bool is_negative = false;
+    long long n = 0;
+
+    if (value >= index->count)
+        return false;
+    p = index->json + index->tokens[value];
+    end = index->json + index->length;
+
+    if (*p == '-')
+    {
+        is_negative = true;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        n = n * 10 + (*p - '0');
+        if (n > (long long) INT_MAX + 1)
+            return false;
+    }
+    if ((!is_negative && n > INT_MAX) || (p < end && (*p == '.' || *p == 'e' || *p == 'E')))
+        return false;
+
+    *result = (int) (is_negative ? -n : n);
+    return true;
+}
+
+/***************************************************************************
+ * My own deterministic rand() function for testing this module
+ ***************************************************************************/
+static unsigned _rand(unsigned* seed)
+{
+    static const unsigned a = 214013;
+    static const unsigned c = 2531011;
+
+    *seed = (*seed) * a + c;
+    return (*seed) >> 16 & 0x7fff;
+}
+
+/***************************************************************************
+ * Index the JSON a byte at a time, the obvious way, to check the blocks
+ * against. Like the blocks, backslashes escape things even outside
+ * strings, which only matters if it isn't JSON.
+ * @return
+ *      the number of tokens, or -1 for an unterminated string
+ ***************************************************************************/
+static int json_selftest_reference(const char* json, size_t length, uint32_t* tokens)
+{
+    bool in_string = false;
+    bool is_escaped = false;
+    bool in_scalar = false;
+    int count = 0;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        char c = json[i];
+        bool was_escaped = is_escaped;
+
+        is_escaped = !was_escaped && c == '\\';
+        if (c == '"' && !was_escaped)
+        {
+            tokens[count++] = (uint32_t) i;
+            in_string = !in_string;
+            in_scalar = false;
+        }
+        else if (in_string)
+            continue;
+        else if (strchr("{}[]:,", c) && c)
+        {
+            tokens[count++] = (uint32_t) i;
+            in_scalar = false;
+        }
+        else if (strchr(" \t\n\r", c) && c)
+            in_scalar = false;
+        else
+        {
+            if (!in_scalar)
+                tokens[count++] = (uint32_t) i;
+            in_scalar = true;
+        }
+    }
+    return in_string ? -1 : count;
+}
+
+/***************************************************************************
+ * Build a status response like a modded Minecraft server's, with
+ * 'players' sample players and 'mods' mods before the fields we want.
+ ***************************************************************************/
+static size_t json_selftest_status(char* buf, size_t max, unsigned players, unsigned mods)
+{
+    size_t n;
+    unsigned i;
+
+    n = (size_t) snprintf(buf, max, "{\"players\":{\"max\":200,\"online\":%u,\"sample\":[",
+                          players);
+    for (i = 0; i < players; i++)
+        n += (size_t) snprintf(buf + n, max - n,
+                               "%s{\"name\":\"Player_%u\",\"id\":"
+                               "\"4566e69f-c907-48ee-8d71-d7ba5aa00d%02u\"}",
+                               i ? "," : "", i, i % 100);
+    n += (size_t) snprintf(buf + n, max - n, "]},\"forgeData\":{\"mods\":[");
+    for (i = 0; i < mods; i++)
+        n += (size_t) snprintf(buf + n, max - n,
+                               "%s{\"modId\":\"mod\\u005f%u\",\"modmarker\":\"1.%u.0\"}",
+                               i ? "," : "", i, i);
+    n += (size_t) snprintf(buf + n, max - n,
+                           "],\"fmlNetworkVersion\":3,\"truncated\":false},"
+                           "\"version\":{\"name\":\"1.20.1\",\"protocol\":763},"
+                           "\"description\":{\"text\":\"A \\\"modded\\\" server\"}}");
+    return n;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int json_selftest(void)
+{
+    /* Escaped quotes and backslashes across the block boundary, nested
+     * values to skip, and scalars of every kind */
+    static const char json[] = "{\"skip\":[{\"a\":[1,2,{}]},\"x\\\\\",null],                    "
+                               "\"k\\\"ey\\\\\":\"v\\\"\",\"list\":[true, -12.5e3 ,\"s\",{}],"
+                               "\"int\":-2147483648,\"big\":2147483648,\"obj\":{\"inner\":7}}";
+    unsigned char px[64];
+    struct JsonBlock block_simd;
+    struct JsonBlock block_scalar;
+    uint32_t expected[400];
+    struct JsonIndex* index;
+    char* status = NULL;
+    const char* s;
+    size_t length;
+    size_t value;
+    unsigned seed = 0;
+    unsigned i;
+    int n;
+    int line = 0;
+
+    /* The vectors find the same characters as the scalar code */
+    for (i = 0; i < 10000; i++)
+    {
+        unsigned j;
+
+        for (j = 0; j < sizeof(px); j++)
+            px[j] = (unsigned char) (i < 256 ? i + j : _rand(&seed));
+        json_classify(px, &block_simd);
+        json_classify_scalar(px, &block_scalar);
+        if (memcmp(&block_simd, &block_scalar, sizeof(block_simd)) != 0)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+    }
+
+    /* Random strings of JSON characters give the same tokens as a byte at
+     * a time, whatever the runs of backslashes and where the blocks split
+     * them */
+    for (i = 0; i < 20000; i++)
+    {
+        static const char chars[] = "\"\"\\\\\\{}[]:, \ta1";
+        char buf[300];
+        size_t buf_length = _rand(&seed) % sizeof(buf);
+        size_t j;
+
+        for (j = 0; j < buf_length; j++) buf[j] = chars[_rand(&seed) % (sizeof(chars) - 1)];
+        n = json_selftest_reference(buf, buf_length, expected);
+        index = json_index_create(buf, buf_length);
+        if ((n < 0) != (index == NULL) ||
+            (index && (index->count != (size_t) n ||
+                       memcmp(index->tokens, expected, n * sizeof(expected[0])) != 0)))
+        {
+            json_index_destroy(index);
+            line = __LINE__;
+            goto fail;
+        }
+        json_index_destroy(index);
+    }
+
+    /* Looking things up */
+    index = json_index_create(json, sizeof(json) - 1);
+    if (index == NULL || json_peek(index, 0) != '{' ||
+        !json_string(index, json_object_get(index, 0, "k\\\"ey\\\\"), &s, &length) ||
+        length != 3 || memcmp(s, "v\\\"", 3) != 0 ||
+        json_peek(index, json_object_get(index, 0, "list")) != '[' ||
+        json_peek(index, json_array_get(index, json_object_get(index, 0, "list"), 0)) != 't' ||
+        json_peek(index, json_array_get(index, json_object_get(index, 0, "list"), 3)) != '{' ||
+        json_array_get(index, json_object_get(index, 0, "list"), 4) != JSON_NONE ||
+        json_object_get(index, 0, "a") != JSON_NONE ||
+        json_object_get(index, 0, "missing") != JSON_NONE)
+    {
+        json_index_destroy(index);
+        line = __LINE__;
+        goto fail;
+    }
+    if (json_int(index, json_array_get(index, json_object_get(index, 0, "list"), 1), &n) ||
+        !json_int(index, json_object_get(index, 0, "int"), &n) || n != INT_MIN ||
+        json_int(index, json_object_get(index, 0, "big"), &n) ||
+        json_int(index, json_array_get(index, json_object_get(index, 0, "list"), 2), &n) ||
+        !json_int(index, json_object_get(index, json_object_get(index, 0, "obj"), "inner"), &n) ||
+        n != 7)
+    {
+        json_index_destroy(index);
+        line = __LINE__;
+        goto fail;
+    }
+    json_index_destroy(index);
+
+    /* Far more tokens than would fit in a fixed array */
+    status = MALLOC(1024 * 1024);
+    length = json_selftest_status(status, 1024 * 1024, 500, 300);
+    index = json_index_create(status, length);
+    if (index == NULL)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    value = json_object_get(index, json_object_get(index, 0, "players"), "sample");
+    value = json_object_get(index, json_array_get(index, value, 499), "name");
+    if (!json_string(index, value, &s, &length) || length != 10 ||
+        memcmp(s, "Player_499", 10) != 0)
+    {
+        json_index_destroy(index);
+        line = __LINE__;
+        goto fail;
+    }
+    value = json_object_get(index, json_object_get(index, 0, "description"), "text");
+    if (!json_string(index, value, &s, &length) || length != 19 ||
+        memcmp(s, "A \\\"modded\\\" server", 19) != 0 ||
+        !json_int(index, json_object_get(index, json_object_get(index, 0, "version"), "protocol"),
+                  &n) ||
+        n != 763)
+    {
+        json_index_destroy(index);
+        line = __LINE__;
+        goto fail;
+    }
+    json_index_destroy(index);
+    free(status);
+    status = NULL;
+
+    /* Truncated or malformed JSON doesn't read past the end */
+    if (json_index_create("{\"a\":\"b", 7) != NULL)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    index = json_index_create("{\"a\":[1,{\"b\":", 13);
+    if (index == NULL ||
+        json_object_get(index, json_array_get(index, json_object_get(index, 0, "a"), 1), "b") !=
+            JSON_NONE ||
+        json_array_get(index, json_object_get(index, 0, "a"), 2) != JSON_NONE ||
+        json_object_get(index, 0, "c") != JSON_NONE)
+    {
+        json_index_destroy(index);
+        line = __LINE__;
+        goto fail;
+    }
+    json_index_destroy(index);
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] json: selftest failed, line=%d\n", line);
+    free(status);
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void json_benchmark(void)
+{
+    static const size_t BYTES = 256 * 1024 * 1024;
+    static const unsigned sizes[][2] = {{0, 0}, {12, 10}, {1000, 500}};
+    char* status;
+    unsigned s;
+
+    printf("-- json --\n");
+    status = MALLOC(1024 * 1024);
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t length = json_selftest_status(status, 1024 * 1024, sizes[s][0], sizes[s][1]);
+        size_t count = BYTES / length;
+        jsmntok_t* tokens = MALLOC(length * sizeof(tokens[0]));
+        uint64_t start, stop;
+        double index_rate;
+        double tokenize_rate;
+        size_t found = 0;
+        size_t i;
+
+        start = pixie_nanotime();
+        for (i = 0; i < count; i++)
+        {
+            struct JsonIndex* index = json_index_create(status, length);
+            int protocol;
+
+            found += json_int(index,
+                              json_object_get(index, json_object_get(index, 0, "version"),
+                                              "protocol"),
+                              &protocol);
+            json_index_destroy(index);
+        }
+        stop = pixie_nanotime();
+        index_rate = (double) length * count / ((stop - start) / 1000.0);
+
+        start = pixie_nanotime();
+        for (i = 0; i < count; i++)
+        {
+            jsmn_parser parser;
+
+            jsmn_init(&parser);
+            found += jsmn_parse(&parser, status, length, tokens, (unsigned) length) > 0;
+        }
+        stop = pixie_nanotime();
+        tokenize_rate = (double) length * count / ((stop - start) / 1000.0);
+
+        printf("%7u bytes: index = %6.1f-MB/s, tokenize = %6.1f-MB/s (%llu)\n", (unsigned) length,
+               index_rate, tokenize_rate, (unsigned long long) found);
+        free(tokens);
+    }
+    free(status);
+    printf("\n");
+}
@@ -0,0 +1,73 @@
+/*
+    JSON structural index
+
+    Banners like the Minecraft status, or Docker's and Elasticsearch's
+    version responses, are JSON, but we only want a few fields out of
+    them. Instead of building a tree, or a fixed-size array of tokens that
+    big responses overflow, we make one pass over the JSON finding where
+    every brace, bracket, colon, comma, quote, and number or other scalar
+    starts, 64 bytes at a time with SIMD where we have it. Looking up a
+    field then just walks this index, skipping over the values it doesn't
+    want without looking at their bytes.
+
+    This isn't a validating parser: it doesn't reject everything that
+    isn't JSON, but it never reads outside the JSON, however malformed.
+*/
+#ifndef UTIL_JSON_H
+#define UTIL_JSON_H
+#include "util-bool.h"
+#include <stddef.h>
+
+struct JsonIndex;
+
+/** Returned instead of a value that isn't there */
+#define JSON_NONE ((size_t) -1)
+
+/**
+ * Index the JSON, which must stay around as long as the index.
+ * @return
+ *      the index, with the whole document as value 0, or NULL if there's
+ *      an unterminated string, which is also what a truncated banner
+ *      usually looks like.
+ */
+struct JsonIndex* json_index_create(const char* json, size_t length);
+
+void json_index_destroy(struct JsonIndex* index);
+
+/**
+ * The first character of a value: '{', '[', '"', or the first character
+ * of a number or literal. Returns 0 for JSON_NONE.
+ */
+char json_peek(const struct JsonIndex* index, size_t value);
+
+/**
+ * Find a member of an object. Keys are compared as they are in the JSON,
+ * without decoding escapes.
+ */
+size_t json_object_get(const struct JsonIndex* index, size_t object, const char* key);
+
+/**
+ * Find the n'th element of an array, counting from 0.
+ */
+size_t json_array_get(const struct JsonIndex* index, size_t array, size_t n);
+
+/**
+ * Get a string, still escaped, pointing into the JSON.
+ */
+bool json_string(const struct JsonIndex* index, size_t value, const char** s, size_t* length);
+
+/**
+ * Get an integer, which must fit in an 'int', and have no fraction or
+ * exponent.
+ */
+bool json_int(const struct JsonIndex* index, size_t value, int* result);
+
+int json_selftest(void);
+
+/**
+ * Measure how fast we index status-sized and big JSON, against a
+ * tokenizer.
+ */
+void json_benchmark(void);
+
+#endif
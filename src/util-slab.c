@@ -0,0 +1,281 @@
+#include "util-slab.h"
+#include "util-malloc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <sys/mman.h>
+#endif
+
+/**
+ * Chunks this big are aligned to, and backed by, hugepages where we can.
+ */
+#define SLAB_HUGEPAGE (2 * 1024 * 1024)
+
+/**
+ * Chunks hold at least this many objects, but are at least SLAB_CHUNK_MIN
+ * and at most SLAB_HUGEPAGE bytes, unless a single object is bigger.
+ */
+#define SLAB_CHUNK_OBJECTS 1024
+#define SLAB_CHUNK_MIN (64 * 1024)
+
+struct SlabChunk
+{
+    void* p;
+    size_t size;
+    unsigned is_mapped : 1;
+};
+
+struct Slab
+{
+    size_t object_size;
+    size_t stride;
+    size_t chunk_size;
+
+    /** Objects that have been freed, linked through their first bytes */
+    void* free_list;
+
+    /** The unused remainder of the newest chunk */
+    unsigned char* next;
+    unsigned char* end;
+
+    struct SlabChunk* chunks;
+    size_t chunk_count;
+
+    size_t count;
+};
+
+/***************************************************************************
+ * Map a hugepage-aligned chunk. First try explicit hugepages, which only
+ * works if the administrator has reserved some, then ordinary pages that
+ * the kernel may merge into transparent hugepages.
+ ***************************************************************************/
+#if !defined(WIN32)
+static void* chunk_map(size_t size)
+{
+    unsigned char* p;
+    size_t lead;
+
+#if defined(MAP_HUGETLB)
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+        return p;
+#endif
+
+    /* Over-allocate, then trim so the chunk starts on a hugepage */
+    p = mmap(NULL, size + SLAB_HUGEPAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    lead = (SLAB_HUGEPAGE - ((size_t) p & (SLAB_HUGEPAGE - 1))) & (SLAB_HUGEPAGE - 1);
+    if (lead)
+        munmap(p, lead);
+    if (SLAB_HUGEPAGE - lead)
+        munmap(p + lead + size, SLAB_HUGEPAGE - lead);
+    p += lead;
+
+#if defined(MADV_HUGEPAGE)
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+static void slab_grow(struct Slab* slab)
+{
+    struct SlabChunk* chunk;
+
+    slab->chunks = REALLOCARRAY(slab->chunks, slab->chunk_count + 1, sizeof(slab->chunks[0]));
+    chunk = &slab->chunks[slab->chunk_count++];
+    chunk->size = slab->chunk_size;
+    chunk->is_mapped = 0;
+    chunk->p = NULL;
+
+#if !defined(WIN32)
+    if (chunk->size % SLAB_HUGEPAGE == 0)
+    {
+        chunk->p = chunk_map(chunk->size);
+        chunk->is_mapped = (chunk->p != NULL);
+    }
+#endif
+    if (chunk->p == NULL)
+        chunk->p = MALLOC(chunk->size);
+
+    slab->next = chunk->p;
+    slab->end = slab->next + chunk->size;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Slab* slab_create(size_t object_size)
+{
+    struct Slab* slab;
+    size_t chunk_size;
+
+    slab = CALLOC(1, sizeof(*slab));
+    slab->object_size = object_size;
+
+    /* Big enough to hold the free-list link, aligned for any type, and
+     * bigger objects don't share cache-lines */
+    slab->stride = object_size < sizeof(void*) ? sizeof(void*) : object_size;
+    if (slab->stride >= 64)
+        slab->stride = (slab->stride + 63) & ~(size_t) 63;
+    else
+        slab->stride = (slab->stride + 15) & ~(size_t) 15;
+
+    chunk_size = SLAB_CHUNK_MIN;
+    while (chunk_size < SLAB_HUGEPAGE && chunk_size < slab->stride * SLAB_CHUNK_OBJECTS)
+        chunk_size *= 2;
+    if (chunk_size < slab->stride)
+        chunk_size = (slab->stride + SLAB_HUGEPAGE - 1) & ~(size_t) (SLAB_HUGEPAGE - 1);
+    slab->chunk_size = chunk_size;
+
+    return slab;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void slab_destroy(struct Slab* slab)
+{
+    size_t i;
+
+    if (slab == NULL)
+        return;
+
+    for (i = 0; i < slab->chunk_count; i++)
+    {
+        struct SlabChunk* chunk = &slab->chunks[i];
+#if !defined(WIN32)
+        if (chunk->is_mapped)
+        {
+            munmap(chunk->p, chunk->size);
+            continue;
+        }
+#endif
+        free(chunk->p);
+    }
+    free(slab->chunks);
+    free(slab);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void* slab_alloc(struct Slab* slab)
+{
+    void* object;
+
+    if (slab->free_list)
+    {
+        object = slab->free_list;
+        slab->free_list = *(void**) object;
+    }
+    else
+    {
+        if (slab->next + slab->stride > slab->end)
+            slab_grow(slab);
+        object = slab->next;
+        slab->next += slab->stride;
+    }
+
+    slab->count++;
+    return object;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void slab_free(struct Slab* slab, void* object)
+{
+    if (object == NULL)
+        return;
+    *(void**) object = slab->free_list;
+    slab->free_list = object;
+    slab->count--;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+size_t slab_object_size(const struct Slab* slab)
+{
+    return slab->object_size;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+size_t slab_count(const struct Slab* slab)
+{
+    return slab->count;
+}
+
+/***************************************************************************
+ * Fill objects with a pattern, making sure none overlap, then check that
+ * freed objects get reused rather than growing the slab.
+ ***************************************************************************/
+static int slab_selftest_size(size_t object_size, size_t count)
+{
+    struct Slab* slab = slab_create(object_size);
+    unsigned char** objects = CALLOC(count, sizeof(objects[0]));
+    size_t chunk_count;
+    size_t i;
+    int line = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        objects[i] = slab_alloc(slab);
+        if (((size_t) objects[i] & 7) != 0)
+        {
+            line = __LINE__;
+            goto fail;
+        }
+        memset(objects[i], (int) (i & 0xFF), object_size);
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (objects[i][0] != (i & 0xFF) || objects[i][object_size - 1] != (i & 0xFF))
+        {
+            line = __LINE__;
+            goto fail;
+        }
+    }
+
+    /* Free every other one, then allocate them again */
+    for (i = 0; i < count; i += 2) slab_free(slab, objects[i]);
+    if (slab_count(slab) != count / 2)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+    chunk_count = slab->chunk_count;
+    for (i = 0; i < count; i += 2) objects[i] = slab_alloc(slab);
+    if (slab->chunk_count != chunk_count || slab_count(slab) != count)
+    {
+        line = __LINE__;
+        goto fail;
+    }
+
+    free(objects);
+    slab_destroy(slab);
+    return 0;
+fail:
+    fprintf(stderr, "[-] slab: selftest failed, size=%u, line=%d\n", (unsigned) object_size,
+            line);
+    free(objects);
+    slab_destroy(slab);
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int slab_selftest(void)
+{
+    int err = 0;
+
+    /* Pointer-sized, segment-sized, buffer-sized, and bigger than a chunk */
+    err += slab_selftest_size(8, 100000);
+    err += slab_selftest_size(40, 100000);
+    err += slab_selftest_size(1460, 4000);
+    err += slab_selftest_size(3 * 1024 * 1024, 3);
+
+    return err;
+}
@@ -0,0 +1,57 @@
+/*
+    Slab allocator for fixed-size objects
+
+    The TCP stack allocates and frees a TCB, a few segments, and a few
+    banner buffers for every connection. With hundreds of thousands of
+    connections a second, going to malloc() for each of these means lock
+    contention between receive threads and a fragmented heap.
+
+    Instead, each kind of object gets a slab: big chunks of memory carved
+    into equal pieces, with freed pieces kept on a list for reuse. Once
+    the slab has grown to the number of objects a scan needs at once, it
+    never allocates again. Large chunks are backed by hugepages when the
+    system has them, so the objects spread over fewer TLB entries.
+
+    A slab isn't thread-safe: each receive thread has its own.
+*/
+#ifndef UTIL_SLAB_H
+#define UTIL_SLAB_H
+#include <stddef.h>
+
+struct Slab;
+
+/**
+ * Create a slab of objects of the given size. Memory is only allocated
+ * as objects are.
+ */
+struct Slab* slab_create(size_t object_size);
+
+/**
+ * Free all the chunks, including any objects still in use.
+ */
+void slab_destroy(struct Slab* slab);
+
+/**
+ * Allocate an object, whose contents are undefined. Like MALLOC(), this
+ * aborts the program rather than return NULL.
+ */
+void* slab_alloc(struct Slab* slab);
+
+/**
+ * Return the object to the slab for reuse.
+ */
+void slab_free(struct Slab* slab, void* object);
+
+/**
+ * The size given to 'slab_create()'.
+ */
+size_t slab_object_size(const struct Slab* slab);
+
+/**
+ * The number of objects allocated and not yet freed.
+ */
+size_t slab_count(const struct Slab* slab);
+
+int slab_selftest(void);
+
+#endif